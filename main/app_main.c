@@ -6,12 +6,15 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "boot_time.h"
 #include "button_longpress.h"
 #include "cli.h"
 #include "led_status.h"
 #include "msc.h"
 #include "setup_mode.h"
+#include "trace.h"
 #include "wimill_pins.h"
+#include "xfer_buf.h"
 
 #define TAG "APP"
 
@@ -22,8 +25,33 @@ static void setup_button_cb(void *ctx)
     setup_mode_start();
 }
 
+// Wi-Fi, then the web server (and mDNS once the station has an IP), off the
+// main task so they come up while USB enumerates and the CLI starts.
+static void net_start(void)
+{
+    boot_time_mark(BOOT_PHASE_NET);
+    esp_err_t err = setup_mode_autostart();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Setup mode autostart failed: %s", esp_err_to_name(err));
+    }
+}
+
+static void net_start_task(void *arg)
+{
+    (void)arg;
+    net_start();
+    vTaskDelete(NULL);
+}
+
 void app_main(void)
 {
+    boot_time_mark(BOOT_PHASE_APP_MAIN);
+    trace_init();
+    // Carve the transfer pools before Wi-Fi and the card driver fragment the heap.
+    if (xfer_buf_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Transfer pools incomplete, buffers fall back to the heap");
+    }
+
     // Fix for slow USB init: silence the noisy drivers!
     esp_log_level_set("sdspi_transaction", ESP_LOG_ERROR);
     esp_log_level_set("sdspi_host", ESP_LOG_ERROR);
@@ -44,18 +72,27 @@ void app_main(void)
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "NVS init failed: %s", esp_err_to_name(err));
     }
+    boot_time_mark(BOOT_PHASE_NVS);
 
     led_status_init();
     led_status_set(LED_STATE_BOOT);
 
+    // USB first: the machine gets its drive without waiting for Wi-Fi.
+    err = msc_init();
+    bool msc_ok = (err == ESP_OK);
+    if (!msc_ok)
+    {
+        ESP_LOGE(TAG, "MSC init failed: %s", esp_err_to_name(err));
+    }
+
     err = setup_mode_init();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Setup mode init failed: %s", esp_err_to_name(err));
     }
 
-    err = setup_mode_autostart();
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Setup mode autostart failed: %s", esp_err_to_name(err));
+    if (xTaskCreate(net_start_task, "net_start", 6144, NULL, 5, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Network start task failed, starting inline");
+        net_start();
     }
 
     err = button_longpress_init(WIMILL_PIN_SETUP_BTN, 5000, 40, setup_button_cb, NULL);
@@ -63,10 +100,8 @@ void app_main(void)
         ESP_LOGE(TAG, "Button init failed: %s", esp_err_to_name(err));
     }
 
-    err = msc_init();
-    if (err != ESP_OK)
+    if (!msc_ok)
     {
-        ESP_LOGE(TAG, "MSC init failed: %s", esp_err_to_name(err));
         led_status_set(LED_STATE_ERROR);
         return;
     }
@@ -76,6 +111,10 @@ void app_main(void)
     {
         ESP_LOGE(TAG, "CLI start failed: %s", esp_err_to_name(err));
     }
+    else
+    {
+        boot_time_mark(BOOT_PHASE_CLI);
+    }
 
     while (true)
     {
@@ -0,0 +1,80 @@
+#include "boot_time.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *const s_names[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_APP_MAIN] = "app_main",
+    [BOOT_PHASE_NVS] = "nvs",
+    [BOOT_PHASE_CARD] = "card",
+    [BOOT_PHASE_USB] = "usb",
+    [BOOT_PHASE_USB_HOST] = "usb_host",
+    [BOOT_PHASE_CLI] = "cli",
+    [BOOT_PHASE_NET] = "net",
+    [BOOT_PHASE_WIFI] = "wifi",
+    [BOOT_PHASE_HTTP] = "http",
+    [BOOT_PHASE_MDNS] = "mdns",
+};
+
+static int64_t s_us[BOOT_PHASE_COUNT];
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void boot_time_mark(boot_phase_t phase)
+{
+    if (phase >= BOOT_PHASE_COUNT || s_us[phase] != 0) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_mux);
+    if (s_us[phase] == 0) {
+        s_us[phase] = now;
+    }
+    portEXIT_CRITICAL(&s_mux);
+}
+
+int64_t boot_time_get(boot_phase_t phase)
+{
+    if (phase >= BOOT_PHASE_COUNT) {
+        return 0;
+    }
+    portENTER_CRITICAL(&s_mux);
+    int64_t us = s_us[phase];
+    portEXIT_CRITICAL(&s_mux);
+    return us;
+}
+
+const char *boot_time_phase_name(boot_phase_t phase)
+{
+    return phase < BOOT_PHASE_COUNT ? s_names[phase] : "unknown";
+}
+
+size_t boot_time_json(char *buf, size_t len)
+{
+    if (!buf || len < 3) {
+        return 0;
+    }
+    size_t pos = 0;
+    buf[pos++] = '{';
+    for (int i = 0; i < BOOT_PHASE_COUNT; ++i) {
+        int64_t us = boot_time_get((boot_phase_t)i);
+        if (us == 0) {
+            continue;
+        }
+        int n = snprintf(buf + pos, len - pos, "%s\"%s\":%" PRId64, pos > 1 ? "," : "", s_names[i], us);
+        if (n < 0 || (size_t)n >= len - pos) {
+            buf[0] = '\0';
+            return 0;
+        }
+        pos += (size_t)n;
+    }
+    if (pos + 2 > len) {
+        buf[0] = '\0';
+        return 0;
+    }
+    buf[pos++] = '}';
+    buf[pos] = '\0';
+    return pos;
+}
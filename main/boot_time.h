@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Boot timeline: the first time each start-up phase is reached, in
+// microseconds of esp_timer (counted from early start-up, before app_main).
+// Shown by the `boot` CLI command, in /api/status ("boot_us") and as
+// wimill_boot_phase_us in /api/metrics.
+
+typedef enum {
+    BOOT_PHASE_APP_MAIN, // app_main entered
+    BOOT_PHASE_NVS,      // NVS ready
+    BOOT_PHASE_CARD,     // card initialised for USB (after any 40 -> 20 MHz retry)
+    BOOT_PHASE_USB,      // TinyUSB installed, device connected to the bus
+    BOOT_PHASE_USB_HOST, // host read the capacity: the drive is visible
+    BOOT_PHASE_CLI,
+    BOOT_PHASE_NET,      // network start task running
+    BOOT_PHASE_WIFI,     // AP up, or station got an IP
+    BOOT_PHASE_HTTP,     // web server listening
+    BOOT_PHASE_MDNS,     // mDNS service announced
+    BOOT_PHASE_COUNT,
+} boot_phase_t;
+
+// Records `phase` once; later calls are ignored, so marks on paths that run
+// again (USB re-attach, Wi-Fi reconnect) keep the boot value.
+void boot_time_mark(boot_phase_t phase);
+// Microseconds at which `phase` was reached, 0 if it has not been yet.
+int64_t boot_time_get(boot_phase_t phase);
+const char *boot_time_phase_name(boot_phase_t phase);
+// Writes the reached phases as a JSON object ({"app_main":123,...});
+// returns the length, or 0 if `len` is too small.
+size_t boot_time_json(char *buf, size_t len);
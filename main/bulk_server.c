@@ -0,0 +1,316 @@
+#include "bulk_server.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "web_fs.h"
+
+// Protocol, all integers little-endian:
+//
+//   request   u32 magic "WMB1" | u8 op | u8 flags | u16 path_len
+//             | u64 size | u64 mtime_ms | path bytes
+//   response  u32 magic "WMB1" | u16 status | u16 err_len | u64 size
+//             | u8 sha256[32] | err bytes
+//
+// PUT (op 1, flags bit 0 = overwrite): the server checks the target first and
+// answers 100 (send the payload) or an error. After `size` payload bytes it
+// answers 200 with the stored size and SHA-256, or an error.
+// GET (op 2): the server answers 200 with the file size, then the bytes.
+// Errors use the HTTP API's status numbers and error codes. A connection
+// carries any number of commands; one failing mid-payload is closed.
+
+#define TAG "BULK"
+#define BULK_MAGIC 0x31424D57u // "WMB1"
+#define BULK_OP_PUT 1
+#define BULK_OP_GET 2
+#define BULK_FLAG_OVERWRITE 0x01
+#define BULK_REQ_LEN 24
+#define BULK_RESP_LEN 48
+#define BULK_STATUS_CONTINUE 100
+#define BULK_PATH_MAX 255
+// Socket buffers sized for a full Wi-Fi TCP window. lwIP applies SO_RCVBUF
+// only with CONFIG_LWIP_SO_RCVBUF and has no SO_SNDBUF (the send side is
+// TCP_SND_BUF); both are set so a stack that honours them gets the room.
+#define BULK_SOCK_BUF (64 * 1024)
+#define BULK_IDLE_TIMEOUT_S 30
+// Transfers run web_fs_stream_put/get on this task, the same chain the
+// HTTP handlers run on a 16 KB stack (several path buffers and the upload
+// context, then hash index and journal lines further down), so it gets the
+// same.
+#define BULK_TASK_STACK 16384
+#define BULK_TASK_PRIO 5
+
+static uint16_t s_port;
+
+#if WIMILL_BULK_SERVER
+
+typedef struct {
+    int sock;
+    bool begun;
+} bulk_conn_t;
+
+static TaskHandle_t s_task;
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static bool send_all(int sock, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        int n = send(sock, data, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool recv_all(int sock, uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        int n = recv(sock, buf, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool send_response(int sock, uint16_t status, uint64_t size, const uint8_t *sha, const char *err)
+{
+    uint8_t hdr[BULK_RESP_LEN] = {0};
+    size_t err_len = err ? strlen(err) : 0;
+    put_u32(hdr, BULK_MAGIC);
+    put_u16(hdr + 4, status);
+    put_u16(hdr + 6, (uint16_t)err_len);
+    put_u64(hdr + 8, size);
+    if (sha) {
+        memcpy(hdr + 16, sha, 32);
+    }
+    return send_all(sock, hdr, sizeof(hdr)) && (err_len == 0 || send_all(sock, (const uint8_t *)err, err_len));
+}
+
+static int io_recv(void *ctx, uint8_t *buf, size_t len)
+{
+    bulk_conn_t *c = (bulk_conn_t *)ctx;
+    int n;
+    do {
+        n = recv(c->sock, buf, len, 0);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static bool io_send(void *ctx, const uint8_t *data, size_t len)
+{
+    return send_all(((bulk_conn_t *)ctx)->sock, data, len);
+}
+
+static bool io_begin_put(void *ctx, uint64_t size)
+{
+    bulk_conn_t *c = (bulk_conn_t *)ctx;
+    c->begun = true;
+    return send_response(c->sock, BULK_STATUS_CONTINUE, size, NULL, NULL);
+}
+
+static bool io_begin_get(void *ctx, uint64_t size)
+{
+    bulk_conn_t *c = (bulk_conn_t *)ctx;
+    c->begun = true;
+    return send_response(c->sock, 200, size, NULL, NULL);
+}
+
+// Runs one command; false when the connection has to be closed.
+static bool handle_command(bulk_conn_t *c)
+{
+    uint8_t req[BULK_REQ_LEN];
+    if (!recv_all(c->sock, req, sizeof(req))) {
+        return false;
+    }
+    if (get_u32(req) != BULK_MAGIC) {
+        send_response(c->sock, 400, 0, NULL, "BAD_FRAME");
+        return false;
+    }
+    uint8_t op = req[4];
+    uint8_t flags = req[5];
+    uint16_t path_len = get_u16(req + 6);
+    uint64_t size = get_u64(req + 8);
+    uint64_t mtime_ms = get_u64(req + 16);
+    char path[BULK_PATH_MAX + 1];
+    if (path_len == 0 || path_len > BULK_PATH_MAX) {
+        send_response(c->sock, 400, 0, NULL, "BAD_PATH");
+        return false;
+    }
+    if (!recv_all(c->sock, (uint8_t *)path, path_len)) {
+        return false;
+    }
+    path[path_len] = '\0';
+
+    web_fs_stream_t io = {.recv = io_recv, .send = io_send, .ctx = c};
+    const char *err = NULL;
+    int64_t t0 = esp_timer_get_time();
+    int status;
+    uint64_t bytes = 0;
+    uint8_t sha[32];
+    c->begun = false;
+    if (op == BULK_OP_PUT) {
+        io.begin = io_begin_put;
+        status = web_fs_stream_put(path, size, (flags & BULK_FLAG_OVERWRITE) != 0, mtime_ms, &io, sha, &err);
+        bytes = c->begun ? size : 0;
+        if (status == 200) {
+            send_response(c->sock, 200, size, sha, NULL);
+        }
+    } else if (op == BULK_OP_GET) {
+        io.begin = io_begin_get;
+        status = web_fs_stream_get(path, &io, &bytes, &err);
+    } else {
+        send_response(c->sock, 400, 0, NULL, "BAD_OP");
+        return false;
+    }
+    int64_t dur_us = esp_timer_get_time() - t0;
+    if (status != 200) {
+        ESP_LOGW(TAG, "%s %s: %d %s", op == BULK_OP_PUT ? "put" : "get", path, status, err ? err : "");
+        // A PUT that failed mid-payload still gets its verdict before the
+        // close; a GET cut short can only be closed.
+        if (!c->begun || op == BULK_OP_PUT) {
+            send_response(c->sock, (uint16_t)status, 0, NULL, err);
+        }
+        return !c->begun;
+    }
+    ESP_LOGI(TAG, "%s %s: %llu bytes in %lld ms (%.2f MB/s)", op == BULK_OP_PUT ? "put" : "get", path,
+             (unsigned long long)bytes, (long long)(dur_us / 1000),
+             dur_us > 0 ? (double)bytes / (double)dur_us : 0.0);
+    return true;
+}
+
+static void tune_socket(int sock)
+{
+    int buf = BULK_SOCK_BUF;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+    // Response frames are small and follow the payload: no Nagle wait.
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = {.tv_sec = BULK_IDLE_TIMEOUT_S};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// One client at a time: transfers serialise on the file-operation lock
+// anyway, and the next client simply waits in the listen backlog.
+static void bulk_task(void *arg)
+{
+    int listener = (int)(intptr_t)arg;
+    while (true) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        int sock = accept(listener, (struct sockaddr *)&peer, &peer_len);
+        if (sock < 0) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        tune_socket(sock);
+        bulk_conn_t conn = {.sock = sock};
+        while (handle_command(&conn)) {
+        }
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
+    }
+}
+
+#endif
+
+esp_err_t bulk_server_start(uint16_t port)
+{
+#if WIMILL_BULK_SERVER
+    if (s_task) {
+        if (port != s_port) {
+            ESP_LOGW(TAG, "staying on port %u until restart", (unsigned)s_port);
+        }
+        return ESP_OK;
+    }
+    int listener = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (listener < 0) {
+        return ESP_FAIL;
+    }
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // Accepted sockets inherit the receive buffer; the window is announced
+    // at SYN time, so it has to be set before listen().
+    int buf = BULK_SOCK_BUF;
+    setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 2) != 0) {
+        ESP_LOGE(TAG, "port %u: bind/listen failed (errno %d)", (unsigned)port, errno);
+        close(listener);
+        return ESP_FAIL;
+    }
+    if (xTaskCreate(bulk_task, "bulk_srv", BULK_TASK_STACK, (void *)(intptr_t)listener, BULK_TASK_PRIO, &s_task) !=
+        pdPASS) {
+        s_task = NULL;
+        close(listener);
+        return ESP_ERR_NO_MEM;
+    }
+    s_port = port;
+    ESP_LOGI(TAG, "listening on %u", (unsigned)port);
+    return ESP_OK;
+#else
+    (void)port;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+uint16_t bulk_server_port(void)
+{
+    return s_port;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Optional raw-TCP bulk transfer server next to the HTTP API: a fixed
+// little-endian command frame, then the raw payload, no header parsing or
+// chunked framing. Files go through web_fs_stream_put/get, i.e. the same
+// writer and reader pipelines as upload_raw/download. The frame layout is
+// documented in bulk_server.c; tools/wimill_bulk.c is the reference client.
+//
+// Build with -DWIMILL_BULK_SERVER=0 to leave it out.
+#ifndef WIMILL_BULK_SERVER
+#define WIMILL_BULK_SERVER 1
+#endif
+
+// Starts the listener task; a second call with another port keeps the first
+// listener (the port changes with web_port only after a restart).
+esp_err_t bulk_server_start(uint16_t port);
+// Port being listened on, 0 when the server is not running.
+uint16_t bulk_server_port(void);
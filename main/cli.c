@@ -13,6 +13,10 @@
 #include "freertos/queue.h"
 #include "freertos/task.h"
 
+#include "boot_time.h"
+#include "config_store.h"
+#include "dir_index.h"
+#include "fs_journal.h"
 #include "msc.h"
 #include "sdcard.h"
 #include "web_fs.h"
@@ -28,6 +32,7 @@
 #define CLI_DEFAULT_SDTEST_BUF WIMILL_SDTEST_BUF_SZ
 #define CLI_DEFAULT_SDBENCH_MB 1
 #define CLI_DEFAULT_SDBENCH_BUF 4096
+#define CLI_DEFAULT_LSBENCH_ENTRIES 1000
 
 #define FILEOP_QUEUE_LEN 4
 #define FILEOP_TASK_STACK 4096
@@ -37,6 +42,7 @@ typedef enum {
     FILEOP_TOUCH,
     FILEOP_SDTEST,
     FILEOP_SDBENCH,
+    FILEOP_LSBENCH,
 } fileop_type_t;
 
 typedef struct {
@@ -46,6 +52,7 @@ typedef struct {
     size_t size_mb;
     uint32_t freq_khz;
     size_t buf_bytes;
+    size_t entries;
 } fileop_t;
 
 static QueueHandle_t s_fileop_queue = NULL;
@@ -77,13 +84,15 @@ void cli_print_help(void)
     printf("  help                - this help\n");
     printf("  ls [path]           - list files in /sdcard\n");
     printf("  info                - show total/free space\n");
+    printf("  boot                - boot timeline (ms since start-up)\n");
     printf("  rm <name>           - remove file\n");
     printf("  mkdir <dir>         - create directory\n");
     printf("  cat <name>          - show first %d bytes (hex+ascii)\n", CLI_DEFAULT_CAT_BYTES);
     printf("  touch <name> <n>    - create file with n zero bytes (queued)\n");
     printf("  sdtest [mb] [kHz] [buf N] - write+verify file (queued)\n");
     printf("  sdbench [mb] [buf N] - write+read speed test (queued)\n");
-    printf("  sd freq [kHz]       - show/set SD SPI freq (20000..40000)\n");
+    printf("  lsbench [n]         - listing speed, n files (default %d, queued)\n", CLI_DEFAULT_LSBENCH_ENTRIES);
+    printf("  sd freq [kHz]       - show/set SD SPI freq (20000..40000, kept for next boot)\n");
     printf("  sd check [0|1]      - disk status check (remount)\n");
     printf("  usb status|attach|detach|stats  - manage MSC state\n");
 }
@@ -160,9 +169,18 @@ static void fileop_task(void *arg)
             ESP_LOGI(TAG, "sdbench done: %s", esp_err_to_name(err));
             break;
         }
+        case FILEOP_LSBENCH: {
+            ESP_LOGI(TAG, "lsbench start: %u entries", (unsigned)op.entries);
+            esp_err_t err = sdcard_list_bench(op.entries);
+            ESP_LOGI(TAG, "lsbench done: %s", esp_err_to_name(err));
+            break;
+        }
         default:
             break;
         }
+        // Every file op creates or removes files behind the web listings.
+        dir_index_invalidate_all();
+        fs_journal_new_epoch();
         s_fileop_busy = false;
     }
 }
@@ -265,6 +283,32 @@ static void handle_info(void)
             ESP_LOGI(TAG, "Card: %s", st.card_name);
         }
     }
+    for (int cls = 0; cls < SDCARD_IO_CLASS_COUNT; ++cls) {
+        sdcard_io_stats_t io;
+        sdcard_io_get_stats((sdcard_io_class_t)cls, &io);
+        ESP_LOGI(TAG, "IO %-11s grants=%u waits=%u queued=%u wait avg=%u us max=%u us busy avg=%u us max=%u us",
+                 sdcard_io_class_name((sdcard_io_class_t)cls), (unsigned)io.grants, (unsigned)io.waits,
+                 (unsigned)io.queued, (unsigned)(io.grants ? io.wait_us_total / io.grants : 0),
+                 (unsigned)io.wait_us_max, (unsigned)(io.grants ? io.busy_us_total / io.grants : 0),
+                 (unsigned)io.busy_us_max);
+    }
+}
+
+static void handle_boot(void)
+{
+    int64_t prev = 0;
+    for (int i = 0; i < BOOT_PHASE_COUNT; ++i) {
+        int64_t us = boot_time_get((boot_phase_t)i);
+        if (us == 0) {
+            ESP_LOGI(TAG, "Boot %-9s -", boot_time_phase_name((boot_phase_t)i));
+            continue;
+        }
+        // Phases after the network task starts run in parallel, so the delta
+        // is only to the previous line, not the cost of the phase.
+        ESP_LOGI(TAG, "Boot %-9s %7.1f ms (+%.1f)", boot_time_phase_name((boot_phase_t)i), us / 1000.0,
+                 prev ? (us - prev) / 1000.0 : 0.0);
+        prev = us;
+    }
 }
 
 static void handle_rm(const char *name)
@@ -277,6 +321,8 @@ static void handle_rm(const char *name)
         return;
     }
     esp_err_t err = sdcard_remove(name);
+    dir_index_invalidate_all();
+    fs_journal_new_epoch();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "rm failed: %s", esp_err_to_name(err));
     }
@@ -292,6 +338,8 @@ static void handle_mkdir(const char *name)
         return;
     }
     esp_err_t err = sdcard_mkdir(name);
+    dir_index_invalidate_all();
+    fs_journal_new_epoch();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "mkdir failed: %s", esp_err_to_name(err));
     }
@@ -361,6 +409,7 @@ static void handle_sd_freq(int argc, char *argv[])
         uint32_t freq = (uint32_t)strtoul(argv[2], NULL, 10);
         esp_err_t err = sdcard_set_frequency(freq, sdcard_is_mounted());
         if (err == ESP_OK) {
+            config_save_sd_khz(freq);
             ESP_LOGI(TAG, "SD freq set to %u kHz%s",
                      freq,
                      sdcard_is_mounted() ? " (remounted)" : " (applies on next mount)");
@@ -492,6 +541,36 @@ static void handle_sdbench(int argc, char *argv[])
     ESP_LOGI(TAG, "sdbench queued");
 }
 
+static void handle_lsbench(const char *entries_str)
+{
+    if (!ensure_vfs_ready()) {
+        return;
+    }
+    size_t entries = CLI_DEFAULT_LSBENCH_ENTRIES;
+    if (entries_str) {
+        long v = strtol(entries_str, NULL, 10);
+        if (v <= 0) {
+            ESP_LOGW(TAG, "Invalid entry count: %s", entries_str);
+            return;
+        }
+        entries = (size_t)v;
+    }
+
+    fileop_t op = {0};
+    op.type = FILEOP_LSBENCH;
+    op.entries = entries;
+
+    if (!s_fileop_queue) {
+        ESP_LOGW(TAG, "File-op queue not ready");
+        return;
+    }
+    if (xQueueSend(s_fileop_queue, &op, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "File-op queue full");
+        return;
+    }
+    ESP_LOGI(TAG, "lsbench queued");
+}
+
 static void handle_usb(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -528,6 +607,11 @@ static void handle_usb(int argc, char *argv[])
                  stats.write_fast_calls, stats.write_partial_calls,
                  write_avg, stats.write_buf_min, stats.write_buf_max);
         ESP_LOGI(TAG, "MSC cache: flushes=%u misses=%u", stats.cache_flushes, stats.cache_misses);
+        ESP_LOGI(TAG, "MSC card: reads=%u avg=%u us max=%u us, writes=%u avg=%u us max=%u us",
+                 stats.card_reads, stats.card_reads ? (uint32_t)(stats.card_read_us / stats.card_reads) : 0,
+                 stats.card_read_us_max, stats.card_writes,
+                 stats.card_writes ? (uint32_t)(stats.card_write_us / stats.card_writes) : 0,
+                 stats.card_write_us_max);
         return;
     }
 
@@ -575,6 +659,8 @@ static void execute_command(int argc, char *argv[])
         handle_ls(argc > 1 ? argv[1] : NULL);
     } else if (strcmp(cmd, "info") == 0) {
         handle_info();
+    } else if (strcmp(cmd, "boot") == 0) {
+        handle_boot();
     } else if (strcmp(cmd, "rm") == 0) {
         handle_rm(argc > 1 ? argv[1] : NULL);
     } else if (strcmp(cmd, "mkdir") == 0) {
@@ -589,6 +675,8 @@ static void execute_command(int argc, char *argv[])
         handle_sdtest(argc, argv);
     } else if (strcmp(cmd, "sdbench") == 0) {
         handle_sdbench(argc, argv);
+    } else if (strcmp(cmd, "lsbench") == 0) {
+        handle_lsbench(argc > 1 ? argv[1] : NULL);
     } else if (strcmp(cmd, "usb") == 0) {
         handle_usb(argc, argv);
     } else {
@@ -133,3 +133,31 @@ esp_err_t config_save(const wimill_config_t *cfg)
     nvs_close(nvs);
     return err;
 }
+
+esp_err_t config_load_sd_khz(uint32_t *khz)
+{
+    if (!khz) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    nvs_handle_t nvs = 0;
+    esp_err_t err = nvs_open(k_namespace, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+    }
+    err = nvs_get_u32(nvs, "sd_khz", khz);
+    nvs_close(nvs);
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+}
+
+esp_err_t config_save_sd_khz(uint32_t khz)
+{
+    nvs_handle_t nvs = 0;
+    esp_err_t err = nvs_open(k_namespace, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_u32(nvs, "sd_khz", khz);
+    if (err == ESP_OK) err = nvs_commit(nvs);
+    nvs_close(nvs);
+    return err;
+}
@@ -26,3 +26,9 @@ typedef struct {
 void config_load_defaults(wimill_config_t *cfg);
 esp_err_t config_load(wimill_config_t *cfg);
 esp_err_t config_save(const wimill_config_t *cfg);
+
+// SD clock that worked at the last boot, so a card that needs the 20 MHz
+// fallback does not pay for a failed 40 MHz init on every power-on.
+// ESP_ERR_NOT_FOUND if none was stored.
+esp_err_t config_load_sd_khz(uint32_t *khz);
+esp_err_t config_save_sd_khz(uint32_t khz);
@@ -0,0 +1,62 @@
+#include "delta_sync.h"
+
+#include <string.h>
+
+#include "mbedtls/sha256.h"
+
+uint32_t delta_block_size(uint64_t file_size, uint32_t requested)
+{
+    uint32_t block = requested ? requested : DELTA_BLOCK_DEFAULT;
+    if (block < DELTA_BLOCK_MIN) {
+        block = DELTA_BLOCK_MIN;
+    }
+    if (block > DELTA_BLOCK_MAX) {
+        block = DELTA_BLOCK_MAX;
+    }
+    while (block < DELTA_BLOCK_MAX && (file_size + block - 1) / block > DELTA_MAX_BLOCKS) {
+        block *= 2;
+    }
+    return block;
+}
+
+uint32_t delta_weak_checksum(const uint8_t *data, size_t len)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < len; ++i) {
+        a += data[i];
+        b += (uint32_t)(len - i) * data[i];
+    }
+    return (a & 0xffff) | ((b & 0xffff) << 16);
+}
+
+void delta_strong_hash(const uint8_t *data, size_t len, uint8_t out[DELTA_STRONG_LEN])
+{
+    uint8_t digest[32];
+    mbedtls_sha256(data, len, digest, 0);
+    memcpy(out, digest, DELTA_STRONG_LEN);
+}
+
+void delta_put_u32(uint8_t *dst, uint32_t v)
+{
+    dst[0] = (uint8_t)v;
+    dst[1] = (uint8_t)(v >> 8);
+    dst[2] = (uint8_t)(v >> 16);
+    dst[3] = (uint8_t)(v >> 24);
+}
+
+void delta_put_u64(uint8_t *dst, uint64_t v)
+{
+    delta_put_u32(dst, (uint32_t)v);
+    delta_put_u32(dst + 4, (uint32_t)(v >> 32));
+}
+
+uint32_t delta_get_u32(const uint8_t *src)
+{
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+uint64_t delta_get_u64(const uint8_t *src)
+{
+    return (uint64_t)delta_get_u32(src) | ((uint64_t)delta_get_u32(src + 4) << 32);
+}
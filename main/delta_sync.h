@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// rsync-style delta transfer. The device publishes per-block signatures of
+// an existing file; the client answers with a stream of copy/literal ops
+// that rebuild the new version from the old one.
+//
+// Signature stream (little-endian):
+//   "WSG2" u32 block_size u64 file_size u32 block_count u32 strong_len
+//   i64 file_mtime
+//   block_count x { u32 weak, strong_len bytes of SHA-256(block) }
+//
+// Delta stream (little-endian):
+//   "WDL2" u32 block_size u64 base_size i64 base_mtime
+//   'C' u32 first_block u32 block_count   copy blocks from the old file
+//   'L' u32 len, len bytes                literal data
+//   'E'                                   end of stream
+//
+// base_size and base_mtime (seconds, as in stat) are echoed from the
+// signature; the device refuses the delta if the file no longer has both,
+// since copy ops would then pull blocks of a different version.
+
+#define DELTA_SIG_MAGIC 0x32475357u  // "WSG2"
+#define DELTA_BODY_MAGIC 0x324c4457u // "WDL2"
+#define DELTA_SIG_HEADER_LEN 32
+#define DELTA_BODY_HEADER_LEN 24
+#define DELTA_STRONG_LEN 8
+#define DELTA_SIG_ENTRY_LEN (4 + DELTA_STRONG_LEN)
+#define DELTA_BLOCK_MIN 512
+#define DELTA_BLOCK_MAX (64 * 1024)
+#define DELTA_BLOCK_DEFAULT 2048
+#define DELTA_MAX_BLOCKS 16384
+
+#define DELTA_OP_COPY 'C'
+#define DELTA_OP_LITERAL 'L'
+#define DELTA_OP_END 'E'
+
+// Picks the block size for a file: the requested size (or the default),
+// doubled until the signature stays within DELTA_MAX_BLOCKS entries.
+uint32_t delta_block_size(uint64_t file_size, uint32_t requested);
+
+// rsync rolling checksum: a = sum(x), b = sum((len - i) * x), both mod 2^16.
+uint32_t delta_weak_checksum(const uint8_t *data, size_t len);
+void delta_strong_hash(const uint8_t *data, size_t len, uint8_t out[DELTA_STRONG_LEN]);
+
+void delta_put_u32(uint8_t *dst, uint32_t v);
+void delta_put_u64(uint8_t *dst, uint64_t v);
+uint32_t delta_get_u32(const uint8_t *src);
+uint64_t delta_get_u64(const uint8_t *src);
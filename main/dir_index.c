@@ -0,0 +1,459 @@
+#include "dir_index.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#include "sdcard.h"
+
+#define TAG "DIR_INDEX"
+#define DIR_INDEX_SLOTS 4
+#define DIR_INDEX_TTL_US (120LL * 1000 * 1000)
+#define DIR_INDEX_PATH_LEN 256
+#define ENTRY_GROW 256
+#define POOL_GROW 8192
+// Directories share a generation when their paths collide in this table;
+// that only costs an extra rescan, never a stale answer.
+#define GEN_BUCKETS 64
+#define BLOB_SLOTS 4
+#define INTERNAL_DIR "/.wimill"
+
+typedef struct {
+    const char *name;
+    uint32_t name_off; // into the pool; `name` is only set once the pool stops moving
+    bool is_dir;
+    uint64_t size;
+    int64_t mtime;
+} slot_entry_t;
+
+struct dir_index {
+    uint32_t id;
+    int64_t last_used_us;
+    uint64_t stamp;
+    dir_index_sort_t sort;
+    bool desc;
+    char glob[DIR_INDEX_GLOB_LEN];
+    char rel_path[DIR_INDEX_PATH_LEN];
+    slot_entry_t *entries;
+    size_t count;
+    size_t cap;
+    char *pool;
+    size_t pool_len;
+    size_t pool_cap;
+};
+
+typedef struct {
+    uint64_t stamp;
+    char rel_path[DIR_INDEX_PATH_LEN];
+    char *data;
+    size_t len;
+    int64_t last_used_us;
+} blob_t;
+
+static dir_index_t *s_slots[DIR_INDEX_SLOTS];
+static uint32_t s_next_id = 1;
+static blob_t s_blobs[BLOB_SLOTS];
+static volatile uint32_t s_gen[GEN_BUCKETS];
+static volatile uint32_t s_epoch;
+
+static uint32_t path_bucket(const char *rel_dir)
+{
+    uint32_t h = 2166136261u;
+    for (const char *p = rel_dir; *p; ++p) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    return h % GEN_BUCKETS;
+}
+
+void dir_index_changed(const char *rel_dir)
+{
+    if (rel_dir) {
+        s_gen[path_bucket(rel_dir)]++;
+    }
+}
+
+static uint32_t current_epoch(void)
+{
+    if (s_epoch == 0) {
+        // Random start so a stamp (and the ETag built from it) never repeats
+        // across reboots.
+        s_epoch = esp_random() | 1;
+    }
+    return s_epoch;
+}
+
+void dir_index_invalidate_all(void)
+{
+    s_epoch = current_epoch() + 1;
+}
+
+uint64_t dir_index_stamp(const char *rel_dir)
+{
+    uint64_t epoch = current_epoch();
+    return (epoch << 32) | s_gen[path_bucket(rel_dir ? rel_dir : "/")];
+}
+
+bool dir_index_cacheable(const char *rel_dir)
+{
+    size_t len = strlen(INTERNAL_DIR);
+    return rel_dir && !(strncmp(rel_dir, INTERNAL_DIR, len) == 0 && (rel_dir[len] == '/' || rel_dir[len] == '\0'));
+}
+
+static void *psram_realloc(void *ptr, size_t size)
+{
+    void *p = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!p) {
+        p = heap_caps_realloc(ptr, size, MALLOC_CAP_8BIT);
+    }
+    return p;
+}
+
+static void index_free(dir_index_t *index)
+{
+    if (!index) {
+        return;
+    }
+    heap_caps_free(index->entries);
+    heap_caps_free(index->pool);
+    heap_caps_free(index);
+}
+
+static bool index_add(dir_index_t *index, const sdcard_dirent_t *ent)
+{
+    if (index->count == index->cap) {
+        size_t cap = index->cap + ENTRY_GROW;
+        slot_entry_t *entries = psram_realloc(index->entries, cap * sizeof(*entries));
+        if (!entries) {
+            return false;
+        }
+        index->entries = entries;
+        index->cap = cap;
+    }
+    size_t len = strlen(ent->name) + 1;
+    if (index->pool_len + len > index->pool_cap) {
+        size_t cap = index->pool_cap + (len > POOL_GROW ? len : POOL_GROW);
+        char *pool = psram_realloc(index->pool, cap);
+        if (!pool) {
+            return false;
+        }
+        index->pool = pool;
+        index->pool_cap = cap;
+    }
+    memcpy(index->pool + index->pool_len, ent->name, len);
+    index->entries[index->count++] = (slot_entry_t){
+        .name_off = (uint32_t)index->pool_len,
+        .is_dir = ent->is_dir,
+        .size = ent->size,
+        .mtime = ent->mtime,
+    };
+    index->pool_len += len;
+    return true;
+}
+
+static int cmp_type_name(const slot_entry_t *a, const slot_entry_t *b)
+{
+    if (a->is_dir != b->is_dir) {
+        return a->is_dir ? -1 : 1;
+    }
+    return strcasecmp(a->name, b->name);
+}
+
+static int cmp_name(const void *pa, const void *pb)
+{
+    return cmp_type_name(pa, pb);
+}
+
+static int cmp_mtime(const void *pa, const void *pb)
+{
+    const slot_entry_t *a = pa;
+    const slot_entry_t *b = pb;
+    if (a->is_dir == b->is_dir && a->mtime != b->mtime) {
+        return a->mtime < b->mtime ? -1 : 1;
+    }
+    return cmp_type_name(a, b);
+}
+
+static int cmp_size(const void *pa, const void *pb)
+{
+    const slot_entry_t *a = pa;
+    const slot_entry_t *b = pb;
+    if (a->is_dir == b->is_dir && a->size != b->size) {
+        return a->size < b->size ? -1 : 1;
+    }
+    return cmp_type_name(a, b);
+}
+
+static void reverse(slot_entry_t *entries, size_t count)
+{
+    for (size_t i = 0; i < count / 2; ++i) {
+        slot_entry_t tmp = entries[i];
+        entries[i] = entries[count - 1 - i];
+        entries[count - 1 - i] = tmp;
+    }
+}
+
+static void index_sort(dir_index_t *index, dir_index_sort_t sort, bool desc)
+{
+    for (size_t i = 0; i < index->count; ++i) {
+        index->entries[i].name = index->pool + index->entries[i].name_off;
+    }
+    int (*cmp)(const void *, const void *) = cmp_name;
+    if (sort == DIR_INDEX_SORT_MTIME) {
+        cmp = cmp_mtime;
+    } else if (sort == DIR_INDEX_SORT_SIZE) {
+        cmp = cmp_size;
+    }
+    qsort(index->entries, index->count, sizeof(*index->entries), cmp);
+    if (desc) {
+        // Reverse each block on its own so directories stay on top.
+        size_t dirs = 0;
+        while (dirs < index->count && index->entries[dirs].is_dir) {
+            dirs++;
+        }
+        reverse(index->entries, dirs);
+        reverse(index->entries + dirs, index->count - dirs);
+    }
+}
+
+static void cache_put(dir_index_t *index)
+{
+    int64_t now = esp_timer_get_time();
+    size_t victim = 0;
+    for (size_t i = 0; i < DIR_INDEX_SLOTS; ++i) {
+        if (s_slots[i] && now - s_slots[i]->last_used_us > DIR_INDEX_TTL_US) {
+            index_free(s_slots[i]);
+            s_slots[i] = NULL;
+        }
+        if (!s_slots[i]) {
+            victim = i;
+        } else if (s_slots[victim] && s_slots[i]->last_used_us < s_slots[victim]->last_used_us) {
+            victim = i;
+        }
+    }
+    index_free(s_slots[victim]);
+    s_slots[victim] = index;
+}
+
+esp_err_t dir_index_create(const char *rel_path, dir_index_sort_t sort, bool desc, const char *glob,
+                           const dir_index_t **out)
+{
+    if (!rel_path || rel_path[0] != '/' || !out || strlen(rel_path) >= DIR_INDEX_PATH_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!glob) {
+        glob = "";
+    }
+    // Taken before the scan: a change that races with it bumps the
+    // generation and makes this snapshot stale rather than wrongly current.
+    uint64_t stamp = dir_index_stamp(rel_path);
+    bool cacheable = dir_index_cacheable(rel_path);
+    for (size_t i = 0; cacheable && i < DIR_INDEX_SLOTS; ++i) {
+        dir_index_t *index = s_slots[i];
+        if (index && index->stamp == stamp && index->sort == sort && index->desc == desc &&
+            strcmp(index->rel_path, rel_path) == 0 && strcmp(index->glob, glob) == 0) {
+            index->last_used_us = esp_timer_get_time();
+            *out = index;
+            return ESP_OK;
+        }
+    }
+
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    sdcard_dir_t *dir = sdcard_dir_open(rel_path);
+    if (!dir) {
+        sdcard_io_end();
+        return ESP_ERR_NOT_FOUND;
+    }
+    dir_index_t *index = heap_caps_calloc(1, sizeof(*index), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    sdcard_dirent_t *ent = malloc(sizeof(*ent));
+    if (!index || !ent) {
+        heap_caps_free(index);
+        free(ent);
+        sdcard_dir_close(dir);
+        sdcard_io_end();
+        return ESP_ERR_NO_MEM;
+    }
+    strcpy(index->rel_path, rel_path);
+    strncpy(index->glob, glob, sizeof(index->glob) - 1);
+    index->sort = sort;
+    index->desc = desc;
+    // Snapshots of uncacheable directories never match a later stamp.
+    index->stamp = cacheable ? stamp : 0;
+
+    esp_err_t err = ESP_OK;
+    int64_t start_us = esp_timer_get_time();
+    while (sdcard_dir_read(dir, ent)) {
+        if (!ent->is_dir && glob[0] && !dir_index_glob_match(glob, ent->name)) {
+            continue;
+        }
+        if (!index_add(index, ent)) {
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+    }
+    if (err == ESP_OK) {
+        // A read error or unmount cut the scan short: no partial snapshot.
+        err = sdcard_dir_error(dir);
+    }
+    sdcard_dir_close(dir);
+    sdcard_io_end();
+    free(ent);
+    if (err != ESP_OK) {
+        index_free(index);
+        return err;
+    }
+
+    index_sort(index, sort, desc);
+    index->id = s_next_id++;
+    if (s_next_id == 0) {
+        s_next_id = 1;
+    }
+    index->last_used_us = esp_timer_get_time();
+    ESP_LOGD(TAG, "%s: id=%u entries=%u pool=%u %lldms", rel_path, (unsigned)index->id, (unsigned)index->count,
+             (unsigned)index->pool_len, (long long)((index->last_used_us - start_us) / 1000));
+    cache_put(index);
+    *out = index;
+    return ESP_OK;
+}
+
+const dir_index_t *dir_index_lookup(uint32_t id, const char *rel_path)
+{
+    if (id == 0 || !rel_path) {
+        return NULL;
+    }
+    for (size_t i = 0; i < DIR_INDEX_SLOTS; ++i) {
+        dir_index_t *index = s_slots[i];
+        if (index && index->id == id && strcmp(index->rel_path, rel_path) == 0) {
+            index->last_used_us = esp_timer_get_time();
+            return index;
+        }
+    }
+    return NULL;
+}
+
+uint32_t dir_index_id(const dir_index_t *index)
+{
+    return index ? index->id : 0;
+}
+
+uint64_t dir_index_snapshot_stamp(const dir_index_t *index)
+{
+    return index ? index->stamp : 0;
+}
+
+size_t dir_index_count(const dir_index_t *index)
+{
+    return index ? index->count : 0;
+}
+
+bool dir_index_get(const dir_index_t *index, size_t pos, dir_index_entry_t *out)
+{
+    if (!index || !out || pos >= index->count) {
+        return false;
+    }
+    const slot_entry_t *e = &index->entries[pos];
+    out->name = e->name;
+    out->size = e->size;
+    out->mtime = e->mtime;
+    out->is_dir = e->is_dir;
+    return true;
+}
+
+bool dir_index_blob_get(const char *rel_dir, uint64_t stamp, const char **data, size_t *len)
+{
+    if (!rel_dir || !dir_index_cacheable(rel_dir)) {
+        return false;
+    }
+    for (size_t i = 0; i < BLOB_SLOTS; ++i) {
+        blob_t *b = &s_blobs[i];
+        if (b->data && b->stamp == stamp && strcmp(b->rel_path, rel_dir) == 0) {
+            b->last_used_us = esp_timer_get_time();
+            *data = b->data;
+            *len = b->len;
+            return true;
+        }
+    }
+    return false;
+}
+
+void dir_index_blob_put(const char *rel_dir, uint64_t stamp, char *data, size_t len)
+{
+    if (!rel_dir || !data || strlen(rel_dir) >= DIR_INDEX_PATH_LEN || !dir_index_cacheable(rel_dir)) {
+        heap_caps_free(data);
+        return;
+    }
+    blob_t *victim = &s_blobs[0];
+    for (size_t i = 0; i < BLOB_SLOTS; ++i) {
+        blob_t *b = &s_blobs[i];
+        if (b->data && strcmp(b->rel_path, rel_dir) == 0) {
+            victim = b;
+            break;
+        }
+        if (!b->data || (victim->data && b->last_used_us < victim->last_used_us)) {
+            victim = b;
+        }
+    }
+    heap_caps_free(victim->data);
+    victim->data = data;
+    victim->len = len;
+    victim->stamp = stamp;
+    victim->last_used_us = esp_timer_get_time();
+    strcpy(victim->rel_path, rel_dir);
+}
+
+static bool glob_one(const char *pat, size_t pat_len, const char *name)
+{
+    size_t pi = 0;
+    size_t star_pi = 0;
+    const char *star_name = NULL;
+    while (*name) {
+        if (pi < pat_len && pat[pi] == '*') {
+            star_pi = ++pi;
+            star_name = name;
+        } else if (pi < pat_len &&
+                   (pat[pi] == '?' || tolower((unsigned char)pat[pi]) == tolower((unsigned char)*name))) {
+            pi++;
+            name++;
+        } else if (star_name) {
+            pi = star_pi;
+            name = ++star_name;
+        } else {
+            return false;
+        }
+    }
+    while (pi < pat_len && pat[pi] == '*') {
+        pi++;
+    }
+    return pi == pat_len;
+}
+
+bool dir_index_glob_match(const char *patterns, const char *name)
+{
+    if (!patterns || !patterns[0]) {
+        return true;
+    }
+    const char *p = patterns;
+    bool any = false;
+    while (*p) {
+        while (*p == ',' || *p == ' ') {
+            p++;
+        }
+        size_t len = strcspn(p, ",");
+        while (len > 0 && p[len - 1] == ' ') {
+            len--;
+        }
+        if (len > 0) {
+            if (glob_one(p, len, name)) {
+                return true;
+            }
+            any = true;
+        }
+        p += strcspn(p, ",");
+    }
+    return !any;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Sorted, filtered snapshot of one directory, kept in PSRAM so a paged
+// listing can continue from a cursor without rescanning the card. The last
+// few snapshots are cached by id; all calls must come from the httpd task
+// except the change-tracking ones below, which any task may use.
+
+#define DIR_INDEX_GLOB_LEN 64
+
+typedef enum {
+    DIR_INDEX_SORT_NAME,
+    DIR_INDEX_SORT_MTIME,
+    DIR_INDEX_SORT_SIZE,
+} dir_index_sort_t;
+
+typedef struct {
+    const char *name;
+    uint64_t size;
+    int64_t mtime;
+    bool is_dir;
+} dir_index_entry_t;
+
+typedef struct dir_index dir_index_t;
+
+// Change tracking. Each directory has a generation that writers bump when an
+// entry in it appears, disappears or changes; invalidate_all covers changes
+// nobody can describe (USB host access, CLI). The stamp folds both with a
+// per-boot random value, so equal stamps mean equal contents.
+void dir_index_changed(const char *rel_dir);
+void dir_index_invalidate_all(void);
+uint64_t dir_index_stamp(const char *rel_dir);
+// False for the internal /.wimill tree, which is written behind the
+// generations' back (hash index, upload sessions).
+bool dir_index_cacheable(const char *rel_dir);
+
+// Directories come first, then entries by `sort` with ties broken by name
+// (case-insensitive, like FAT). `glob` is a comma-separated list of * and ?
+// patterns applied to files only, so subdirectories stay navigable. A cached
+// snapshot with the same parameters and a current stamp is reused as is.
+esp_err_t dir_index_create(const char *rel_path, dir_index_sort_t sort, bool desc, const char *glob,
+                           const dir_index_t **out);
+// Returns the cached snapshot with this id if it was built for rel_path.
+const dir_index_t *dir_index_lookup(uint32_t id, const char *rel_path);
+
+uint32_t dir_index_id(const dir_index_t *index);
+uint64_t dir_index_snapshot_stamp(const dir_index_t *index);
+size_t dir_index_count(const dir_index_t *index);
+bool dir_index_get(const dir_index_t *index, size_t pos, dir_index_entry_t *out);
+
+// Serialized full listings (/api/fs/list without paging). put takes
+// ownership of a heap_caps buffer; get only hits while `stamp` is current
+// and the data stays valid until the next put.
+bool dir_index_blob_get(const char *rel_dir, uint64_t stamp, const char **data, size_t *len);
+void dir_index_blob_put(const char *rel_dir, uint64_t stamp, char *data, size_t len);
+
+bool dir_index_glob_match(const char *patterns, const char *name);
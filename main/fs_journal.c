@@ -0,0 +1,402 @@
+#include "fs_journal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "sdcard.h"
+#include "wimill_pins.h"
+
+#define TAG "JOURNAL"
+#define JOURNAL_ROOT WIMILL_SD_MOUNT_POINT "/.wimill"
+#define JOURNAL_FILE JOURNAL_ROOT "/journal.log"
+#define JOURNAL_TMP JOURNAL_ROOT "/journal.tmp"
+#define JOURNAL_MAGIC "wimill-journal 1"
+#define JOURNAL_LINE_LEN (2 * FS_JOURNAL_PATH_LEN + 48)
+#define JOURNAL_PENDING_SIZE 4096
+// Appended lines after which the file is rewritten from the ring.
+#define JOURNAL_COMPACT_LINES (4 * FS_JOURNAL_RING)
+
+// File format, one record per line:
+//   E<TAB>epoch<TAB>seq             start of an epoch (ring emptied)
+//   seq<TAB>C|M|D|R<TAB>F|D<TAB>path[<TAB>to]
+
+static SemaphoreHandle_t s_mutex = NULL;
+static fs_journal_event_t *s_ring = NULL;
+static uint32_t s_epoch = 0;
+static uint32_t s_seq = 0;
+static uint32_t s_oldest = 1;
+static bool s_loaded = false;
+static int s_batch = 0;
+static char s_pending[JOURNAL_PENDING_SIZE];
+static size_t s_pending_len = 0;
+static uint32_t s_file_lines = 0;
+static fs_journal_listener_t s_listener = NULL;
+
+static const char k_op_chars[] = {'C', 'M', 'D', 'R'};
+
+static bool ensure_mutex(void)
+{
+    if (s_mutex) {
+        return true;
+    }
+    s_mutex = xSemaphoreCreateMutex();
+    return s_mutex != NULL;
+}
+
+static bool lock(void)
+{
+    if (!ensure_mutex()) {
+        return false;
+    }
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    return true;
+}
+
+static void unlock(void)
+{
+    xSemaphoreGive(s_mutex);
+}
+
+const char *fs_journal_op_name(fs_journal_op_t op)
+{
+    switch (op) {
+    case FS_JOURNAL_CREATE:
+        return "create";
+    case FS_JOURNAL_MODIFY:
+        return "modify";
+    case FS_JOURNAL_DELETE:
+        return "delete";
+    case FS_JOURNAL_RENAME:
+        return "rename";
+    default:
+        return "unknown";
+    }
+}
+
+static fs_journal_event_t *ring_slot(uint32_t seq)
+{
+    return &s_ring[seq % FS_JOURNAL_RING];
+}
+
+static void ring_advance(uint32_t seq)
+{
+    s_seq = seq;
+    if (s_seq - s_oldest + 1 > FS_JOURNAL_RING) {
+        s_oldest = s_seq - FS_JOURNAL_RING + 1;
+    }
+}
+
+static int format_event(const fs_journal_event_t *ev, char *out, size_t out_len)
+{
+    if (ev->op == FS_JOURNAL_RENAME) {
+        return snprintf(out, out_len, "%lu\t%c\t%c\t%s\t%s\n", (unsigned long)ev->seq, k_op_chars[ev->op],
+                        ev->is_dir ? 'D' : 'F', ev->path, ev->to);
+    }
+    return snprintf(out, out_len, "%lu\t%c\t%c\t%s\n", (unsigned long)ev->seq, k_op_chars[ev->op],
+                    ev->is_dir ? 'D' : 'F', ev->path);
+}
+
+static bool parse_event(char *line, fs_journal_event_t *ev)
+{
+    char *fields[5] = {0};
+    size_t n = 0;
+    char *p = line;
+    while (n < 5) {
+        fields[n++] = p;
+        p = strchr(p, '\t');
+        if (!p) {
+            break;
+        }
+        *p++ = '\0';
+    }
+    if (n < 4 || strlen(fields[1]) != 1 || strlen(fields[3]) >= sizeof(ev->path)) {
+        return false;
+    }
+    const char *op = memchr(k_op_chars, fields[1][0], sizeof(k_op_chars));
+    if (!op) {
+        return false;
+    }
+    ev->seq = (uint32_t)strtoul(fields[0], NULL, 10);
+    ev->op = (fs_journal_op_t)(op - k_op_chars);
+    ev->is_dir = fields[2][0] == 'D';
+    strcpy(ev->path, fields[3]);
+    ev->to[0] = '\0';
+    if (ev->op == FS_JOURNAL_RENAME) {
+        if (n < 5 || strlen(fields[4]) >= sizeof(ev->to)) {
+            return false;
+        }
+        strcpy(ev->to, fields[4]);
+    }
+    return true;
+}
+
+// Rewrites the file as the epoch line plus the events still in the ring.
+static void compact_locked(void)
+{
+    mkdir(JOURNAL_ROOT, 0775);
+    FILE *f = fopen(JOURNAL_TMP, "w");
+    if (!f) {
+        ESP_LOGW(TAG, "compact: cannot open %s", JOURNAL_TMP);
+        return;
+    }
+    char *line = malloc(JOURNAL_LINE_LEN);
+    bool ok = line != NULL;
+    ok = ok && fprintf(f, "%s\nE\t%lu\t%lu\n", JOURNAL_MAGIC, (unsigned long)s_epoch,
+                       (unsigned long)(s_oldest - 1)) > 0;
+    uint32_t lines = 1;
+    for (uint32_t seq = s_oldest; ok && seq <= s_seq && seq != 0; ++seq) {
+        int n = format_event(ring_slot(seq), line, JOURNAL_LINE_LEN);
+        ok = n > 0 && fwrite(line, 1, (size_t)n, f) == (size_t)n;
+        lines++;
+    }
+    free(line);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        unlink(JOURNAL_TMP);
+        return;
+    }
+    unlink(JOURNAL_FILE);
+    if (rename(JOURNAL_TMP, JOURNAL_FILE) == 0) {
+        s_file_lines = lines;
+    }
+}
+
+static void flush_locked(void)
+{
+    if (s_pending_len == 0 || !sdcard_is_mounted()) {
+        return;
+    }
+    FILE *f = fopen(JOURNAL_FILE, "a");
+    if (!f) {
+        ESP_LOGW(TAG, "append failed, %u bytes dropped", (unsigned)s_pending_len);
+        s_pending_len = 0;
+        return;
+    }
+    fwrite(s_pending, 1, s_pending_len, f);
+    fclose(f);
+    for (size_t i = 0; i < s_pending_len; ++i) {
+        s_file_lines += s_pending[i] == '\n';
+    }
+    s_pending_len = 0;
+    if (s_file_lines > JOURNAL_COMPACT_LINES) {
+        compact_locked();
+    }
+}
+
+static void pending_append_locked(const char *line, size_t len)
+{
+    if (s_pending_len + len > sizeof(s_pending)) {
+        flush_locked();
+    }
+    if (s_pending_len + len > sizeof(s_pending)) {
+        ESP_LOGW(TAG, "card unavailable, event not persisted");
+        return;
+    }
+    memcpy(s_pending + s_pending_len, line, len);
+    s_pending_len += len;
+}
+
+static void load_file_locked(FILE *f)
+{
+    char *line = malloc(JOURNAL_LINE_LEN);
+    if (!line) {
+        return;
+    }
+    if (!fgets(line, JOURNAL_LINE_LEN, f) || strncmp(line, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != 0) {
+        free(line);
+        return;
+    }
+    uint32_t lines = 1;
+    while (fgets(line, JOURNAL_LINE_LEN, f)) {
+        lines++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == 'E' && line[1] == '\t') {
+            char *end = NULL;
+            s_epoch = (uint32_t)strtoul(line + 2, &end, 10);
+            uint32_t seq = end && *end == '\t' ? (uint32_t)strtoul(end + 1, NULL, 10) : 0;
+            if (seq > s_seq) {
+                s_seq = seq;
+            }
+            s_oldest = s_seq + 1;
+            continue;
+        }
+        uint32_t seq = (uint32_t)strtoul(line, NULL, 10);
+        if (seq <= s_seq) {
+            continue;
+        }
+        fs_journal_event_t *slot = ring_slot(seq);
+        if (!parse_event(line, slot)) {
+            continue;
+        }
+        if (seq != s_seq + 1) {
+            // A gap (torn write) makes everything before it unusable.
+            s_oldest = seq;
+        }
+        ring_advance(seq);
+    }
+    s_file_lines = lines;
+    free(line);
+}
+
+// The journal lives on the card, so it is loaded on first use after a mount.
+static bool ensure_loaded_locked(void)
+{
+    if (s_loaded) {
+        return true;
+    }
+    if (!s_ring) {
+        s_ring = heap_caps_calloc(FS_JOURNAL_RING, sizeof(*s_ring), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!s_ring) {
+            return false;
+        }
+    }
+    if (!sdcard_is_mounted()) {
+        return false;
+    }
+    FILE *f = fopen(JOURNAL_FILE, "r");
+    if (f) {
+        load_file_locked(f);
+        fclose(f);
+    }
+    if (s_epoch == 0) {
+        // No usable journal: a random epoch keeps old client cursors from
+        // matching the restarted sequence.
+        s_epoch = esp_random() | 1;
+        s_oldest = s_seq + 1;
+        compact_locked();
+    }
+    s_loaded = true;
+    ESP_LOGI(TAG, "epoch=%lu seq=%lu ring=%lu", (unsigned long)s_epoch, (unsigned long)s_seq,
+             (unsigned long)(s_seq + 1 - s_oldest));
+    return true;
+}
+
+uint32_t fs_journal_record(fs_journal_op_t op, const char *path, const char *to, bool is_dir)
+{
+    if (!path || strlen(path) >= FS_JOURNAL_PATH_LEN || (to && strlen(to) >= FS_JOURNAL_PATH_LEN)) {
+        return 0;
+    }
+    if (!lock()) {
+        return 0;
+    }
+    if (!ensure_loaded_locked()) {
+        unlock();
+        return 0;
+    }
+    uint32_t seq = s_seq + 1;
+    fs_journal_event_t *ev = ring_slot(seq);
+    ev->seq = seq;
+    ev->op = op;
+    ev->is_dir = is_dir;
+    strcpy(ev->path, path);
+    strcpy(ev->to, (op == FS_JOURNAL_RENAME && to) ? to : "");
+    ring_advance(seq);
+
+    char line[JOURNAL_LINE_LEN];
+    int n = format_event(ev, line, sizeof(line));
+    if (n > 0 && (size_t)n < sizeof(line)) {
+        pending_append_locked(line, (size_t)n);
+    }
+    if (s_batch == 0) {
+        flush_locked();
+    }
+    if (s_listener) {
+        s_listener(s_epoch, ev);
+    }
+    unlock();
+    return seq;
+}
+
+void fs_journal_new_epoch(void)
+{
+    if (!lock()) {
+        return;
+    }
+    if (ensure_loaded_locked()) {
+        // Events still buffered by a batch belong to the old epoch; writing
+        // them first keeps their sequence numbers on the card even if the
+        // compaction below fails, so they are never handed out again.
+        flush_locked();
+        s_epoch++;
+        if (s_epoch == 0) {
+            s_epoch = 1;
+        }
+        s_oldest = s_seq + 1;
+        compact_locked();
+        ESP_LOGI(TAG, "new epoch %lu at seq %lu", (unsigned long)s_epoch, (unsigned long)s_seq);
+        if (s_listener) {
+            s_listener(s_epoch, NULL);
+        }
+    }
+    unlock();
+}
+
+void fs_journal_unload(void)
+{
+    if (!lock()) {
+        return;
+    }
+    if (s_loaded) {
+        flush_locked();
+        s_loaded = false;
+    }
+    unlock();
+}
+
+void fs_journal_state(fs_journal_state_t *out)
+{
+    if (!out || !lock()) {
+        return;
+    }
+    ensure_loaded_locked();
+    out->epoch = s_epoch;
+    out->seq = s_seq;
+    out->oldest = s_oldest;
+    unlock();
+}
+
+bool fs_journal_get(uint32_t seq, fs_journal_event_t *out)
+{
+    if (!out || !lock()) {
+        return false;
+    }
+    bool ok = s_loaded && seq >= s_oldest && seq <= s_seq && seq != 0;
+    if (ok) {
+        *out = *ring_slot(seq);
+    }
+    unlock();
+    return ok;
+}
+
+void fs_journal_batch_begin(void)
+{
+    if (lock()) {
+        s_batch++;
+        unlock();
+    }
+}
+
+void fs_journal_batch_end(void)
+{
+    if (!lock()) {
+        return;
+    }
+    if (s_batch > 0 && --s_batch == 0) {
+        flush_locked();
+    }
+    unlock();
+}
+
+void fs_journal_set_listener(fs_journal_listener_t listener)
+{
+    s_listener = listener;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Journal of changes made through the web file manager, so clients can
+// catch up with /api/fs/changes?since=N instead of re-listing. The last
+// FS_JOURNAL_RING events are kept in PSRAM and appended to
+// /sdcard/.wimill/journal.log; sequence numbers never repeat, also across
+// reboots. Changes the device cannot describe (USB host access, CLI) start
+// a new epoch, which drops the ring and tells clients to rescan.
+
+#define FS_JOURNAL_RING 256
+#define FS_JOURNAL_PATH_LEN 256
+
+typedef enum {
+    FS_JOURNAL_CREATE,
+    FS_JOURNAL_MODIFY,
+    FS_JOURNAL_DELETE,
+    FS_JOURNAL_RENAME,
+} fs_journal_op_t;
+
+typedef struct {
+    uint32_t seq;
+    fs_journal_op_t op;
+    bool is_dir;
+    char path[FS_JOURNAL_PATH_LEN];
+    char to[FS_JOURNAL_PATH_LEN]; // FS_JOURNAL_RENAME only
+} fs_journal_event_t;
+
+typedef struct {
+    uint32_t epoch;
+    uint32_t seq;    // last assigned sequence number
+    uint32_t oldest; // first seq still in the ring (seq + 1 when empty)
+} fs_journal_state_t;
+
+// `to` is only used for FS_JOURNAL_RENAME. Returns the new sequence number.
+uint32_t fs_journal_record(fs_journal_op_t op, const char *path, const char *to, bool is_dir);
+void fs_journal_new_epoch(void);
+// Before the card is unmounted: writes buffered events, and has the file read
+// again on next use, since whoever had the card meanwhile may have changed it.
+void fs_journal_unload(void);
+void fs_journal_state(fs_journal_state_t *out);
+// Copies the event with this sequence number; false once it left the ring.
+bool fs_journal_get(uint32_t seq, fs_journal_event_t *out);
+
+// Between begin and end, events are only appended to the card when the
+// write buffer fills up (used by the tar upload, which creates many files).
+void fs_journal_batch_begin(void);
+void fs_journal_batch_end(void);
+
+const char *fs_journal_op_name(fs_journal_op_t op);
+
+// Called for every recorded event, and with ev == NULL when a new epoch
+// starts. Runs with the journal locked, so it must not call back into it.
+typedef void (*fs_journal_listener_t)(uint32_t epoch, const fs_journal_event_t *ev);
+void fs_journal_set_listener(fs_journal_listener_t listener);
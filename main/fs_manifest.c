@@ -0,0 +1,391 @@
+#include "fs_manifest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "hash_index.h"
+#include "sdcard.h"
+
+#define TAG "MANIFEST"
+#define INTERNAL_DIR ".wimill"
+// FAT keeps mtime with 2 s resolution, so a round trip may shift it by one step.
+#define MTIME_SLACK_S 2
+
+typedef struct dir_node {
+    struct dir_node *next;
+    char rel[];
+} dir_node_t;
+
+static bool push_dir(dir_node_t **head, dir_node_t **tail, const char *rel)
+{
+    size_t len = strlen(rel);
+    dir_node_t *node = malloc(sizeof(*node) + len + 1);
+    if (!node) {
+        return false;
+    }
+    node->next = NULL;
+    memcpy(node->rel, rel, len + 1);
+    if (*tail) {
+        (*tail)->next = node;
+    } else {
+        *head = node;
+    }
+    *tail = node;
+    return true;
+}
+
+static bool has_dotdot_segment(const char *p)
+{
+    for (const char *seg = p; seg; seg = strchr(seg, '/')) {
+        if (*seg == '/') {
+            seg++;
+        }
+        if (seg[0] == '.' && seg[1] == '.' && (seg[2] == '/' || seg[2] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool join_rel(const char *dir, const char *name, char *out, size_t out_len)
+{
+    int n = strcmp(dir, "/") == 0 ? snprintf(out, out_len, "/%s", name)
+                                  : snprintf(out, out_len, "%s/%s", dir, name);
+    return n > 0 && (size_t)n < out_len;
+}
+
+esp_err_t fs_manifest_walk(const char *rel_root, bool with_hash, fs_manifest_cb_t cb, void *ctx)
+{
+    if (!rel_root || rel_root[0] != '/' || !cb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dir_node_t *head = NULL;
+    dir_node_t *tail = NULL;
+    // The entry is kept off the stack: callers run on the httpd task.
+    sdcard_dirent_t *ent = malloc(sizeof(*ent));
+    if (!ent || !push_dir(&head, &tail, rel_root)) {
+        free(ent);
+        return ESP_ERR_NO_MEM;
+    }
+    size_t root_len = strcmp(rel_root, "/") == 0 ? 0 : strlen(rel_root);
+    esp_err_t err = ESP_OK;
+    bool is_root = true;
+
+    while (head && err == ESP_OK) {
+        dir_node_t *node = head;
+        head = node->next;
+        if (!head) {
+            tail = NULL;
+        }
+        bool at_top = strcmp(node->rel, "/") == 0;
+        // A tree walk is bulk work: it takes the card one directory at a time.
+        sdcard_io_begin(SDCARD_IO_STREAM);
+        sdcard_dir_t *dir = sdcard_dir_open(node->rel);
+        if (!dir) {
+            sdcard_io_end();
+            if (is_root) {
+                err = ESP_ERR_NOT_FOUND;
+            }
+            is_root = false;
+            free(node);
+            continue;
+        }
+        is_root = false;
+
+        hash_index_dir_t *index = with_hash ? hash_index_dir_load(node->rel) : NULL;
+        while (err == ESP_OK && sdcard_dir_read(dir, ent)) {
+            if (at_top && strcmp(ent->name, INTERNAL_DIR) == 0) {
+                continue;
+            }
+            char child_rel[FS_MANIFEST_PATH_LEN];
+            if (!join_rel(node->rel, ent->name, child_rel, sizeof(child_rel))) {
+                continue;
+            }
+            char hex[HASH_INDEX_HEX_LEN];
+            fs_manifest_entry_t entry = {
+                .path = child_rel + root_len + 1,
+                .size = ent->size,
+                .mtime = ent->mtime,
+                .sha256 = NULL,
+                .is_dir = ent->is_dir,
+            };
+            if (entry.is_dir) {
+                if (!push_dir(&head, &tail, child_rel)) {
+                    err = ESP_ERR_NO_MEM;
+                    break;
+                }
+            } else if (index && hash_index_dir_find(index, ent->name, entry.size, entry.mtime, hex)) {
+                entry.sha256 = hex;
+            }
+            if (!cb(&entry, ctx)) {
+                err = ESP_ERR_INVALID_STATE;
+            }
+        }
+        if (err == ESP_OK) {
+            // A directory cut short would read as files missing on the card.
+            err = sdcard_dir_error(dir);
+        }
+        sdcard_dir_close(dir);
+        sdcard_io_end();
+        hash_index_dir_free(index);
+        free(node);
+    }
+    while (head) {
+        dir_node_t *next = head->next;
+        free(head);
+        head = next;
+    }
+    free(ent);
+    return err;
+}
+
+int fs_manifest_format(const fs_manifest_entry_t *entry, char *out, size_t out_len)
+{
+    return snprintf(out, out_len, "%c\t%llu\t%lld\t%s\t%s\n",
+                    entry->is_dir ? 'D' : 'F',
+                    (unsigned long long)entry->size,
+                    (long long)entry->mtime,
+                    (entry->sha256 && entry->sha256[0]) ? entry->sha256 : "-",
+                    entry->path);
+}
+
+bool fs_manifest_parse(char *line, fs_manifest_entry_t *out)
+{
+    char *fields[5];
+    char *p = line;
+    for (int i = 0; i < 4; ++i) {
+        fields[i] = p;
+        p = strchr(p, '\t');
+        if (!p) {
+            return false;
+        }
+        *p++ = '\0';
+    }
+    size_t len = strlen(p);
+    while (len > 0 && (p[len - 1] == '\r' || p[len - 1] == '\n')) {
+        p[--len] = '\0';
+    }
+    while (*p == '/') {
+        p++;
+    }
+    if ((fields[0][0] != 'F' && fields[0][0] != 'D') || fields[0][1] != '\0' || *p == '\0') {
+        return false;
+    }
+    // Paths only come back to the client in the plan, but keep them tidy.
+    // "v1..2.nc" is a fine name; only a whole ".." segment is refused.
+    if (has_dotdot_segment(p) || strstr(p, "//")) {
+        return false;
+    }
+    out->is_dir = (fields[0][0] == 'D');
+    out->size = strtoull(fields[1], NULL, 10);
+    out->mtime = strtoll(fields[2], NULL, 10);
+    out->sha256 = (strlen(fields[3]) == HASH_INDEX_HEX_LEN - 1) ? fields[3] : NULL;
+    out->path = p;
+    return true;
+}
+
+typedef struct {
+    fs_manifest_entry_t e;
+    bool seen;
+    bool upload;
+} client_entry_t;
+
+// Card files the client manifest does not mention: rename sources or deletes.
+typedef struct orphan {
+    struct orphan *next;
+    uint64_t size;
+    int64_t mtime;
+    char sha256[HASH_INDEX_HEX_LEN];
+    char path[];
+} orphan_t;
+
+typedef struct {
+    client_entry_t *entries;
+    uint32_t count;
+    orphan_t *orphans;
+    fs_plan_stats_t *stats;
+    bool no_mem;
+} plan_ctx_t;
+
+static int cmp_client(const void *a, const void *b)
+{
+    return strcmp(((const client_entry_t *)a)->e.path, ((const client_entry_t *)b)->e.path);
+}
+
+static client_entry_t *find_client(plan_ctx_t *p, const char *path)
+{
+    client_entry_t key = {.e = {.path = path}};
+    return bsearch(&key, p->entries, p->count, sizeof(client_entry_t), cmp_client);
+}
+
+static bool same_content(uint64_t size_a, int64_t mtime_a, const char *hash_a,
+                         uint64_t size_b, int64_t mtime_b, const char *hash_b)
+{
+    if (size_a != size_b) {
+        return false;
+    }
+    if (hash_a && hash_a[0] && hash_b && hash_b[0]) {
+        return strcasecmp(hash_a, hash_b) == 0;
+    }
+    int64_t diff = mtime_a - mtime_b;
+    return diff >= -MTIME_SLACK_S && diff <= MTIME_SLACK_S;
+}
+
+static bool same_parent(const char *a, const char *b)
+{
+    const char *sa = strrchr(a, '/');
+    const char *sb = strrchr(b, '/');
+    size_t la = sa ? (size_t)(sa - a) : 0;
+    size_t lb = sb ? (size_t)(sb - b) : 0;
+    return la == lb && strncmp(a, b, la) == 0;
+}
+
+static bool plan_walk_cb(const fs_manifest_entry_t *dev, void *ctx)
+{
+    plan_ctx_t *p = (plan_ctx_t *)ctx;
+    client_entry_t *c = find_client(p, dev->path);
+    if (c && c->e.is_dir == dev->is_dir) {
+        c->seen = true;
+        if (!dev->is_dir) {
+            if (same_content(dev->size, dev->mtime, dev->sha256, c->e.size, c->e.mtime, c->e.sha256)) {
+                p->stats->unchanged++;
+            } else {
+                c->upload = true;
+            }
+        }
+        return true;
+    }
+    if (dev->is_dir) {
+        return true;
+    }
+    size_t len = strlen(dev->path);
+    orphan_t *o = malloc(sizeof(*o) + len + 1);
+    if (!o) {
+        p->no_mem = true;
+        return false;
+    }
+    o->size = dev->size;
+    o->mtime = dev->mtime;
+    o->sha256[0] = '\0';
+    if (dev->sha256) {
+        memcpy(o->sha256, dev->sha256, HASH_INDEX_HEX_LEN);
+    }
+    memcpy(o->path, dev->path, len + 1);
+    o->next = p->orphans;
+    p->orphans = o;
+    return true;
+}
+
+static orphan_t *take_rename_source(plan_ctx_t *p, const client_entry_t *c)
+{
+    for (orphan_t **pp = &p->orphans; *pp; pp = &(*pp)->next) {
+        orphan_t *o = *pp;
+        if (o->size > 0 && same_parent(o->path, c->e.path) &&
+            same_content(o->size, o->mtime, o->sha256, c->e.size, c->e.mtime, c->e.sha256)) {
+            *pp = o->next;
+            return o;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t fs_manifest_plan(const char *rel_root, char *client, size_t client_len, bool mirror,
+                           fs_plan_cb_t cb, void *ctx, fs_plan_stats_t *stats)
+{
+    if (!rel_root || !client || !cb || !stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    uint32_t lines = 1;
+    for (size_t i = 0; i < client_len; ++i) {
+        if (client[i] == '\n') {
+            lines++;
+        }
+    }
+    plan_ctx_t p = {.stats = stats};
+    p.entries = heap_caps_calloc(lines, sizeof(client_entry_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!p.entries) {
+        p.entries = calloc(lines, sizeof(client_entry_t));
+    }
+    if (!p.entries) {
+        return ESP_ERR_NO_MEM;
+    }
+    char *line = client;
+    char *end = client + client_len;
+    while (line < end && p.count < lines) {
+        char *nl = memchr(line, '\n', (size_t)(end - line));
+        if (nl) {
+            *nl = '\0';
+        }
+        if (fs_manifest_parse(line, &p.entries[p.count].e)) {
+            p.count++;
+        }
+        line = nl ? nl + 1 : end;
+    }
+    qsort(p.entries, p.count, sizeof(client_entry_t), cmp_client);
+
+    esp_err_t err = fs_manifest_walk(rel_root, true, plan_walk_cb, &p);
+    if (err == ESP_ERR_INVALID_STATE && p.no_mem) {
+        err = ESP_ERR_NO_MEM;
+    }
+
+    // Sorted order puts every directory before its children.
+    for (uint32_t i = 0; err == ESP_OK && i < p.count; ++i) {
+        client_entry_t *c = &p.entries[i];
+        if (!c->seen && c->e.is_dir) {
+            stats->mkdirs++;
+            if (!cb(FS_PLAN_MKDIR, c->e.path, NULL, ctx)) {
+                err = ESP_ERR_INVALID_STATE;
+            }
+        }
+    }
+    for (uint32_t i = 0; err == ESP_OK && i < p.count; ++i) {
+        client_entry_t *c = &p.entries[i];
+        if (c->seen || c->e.is_dir) {
+            continue;
+        }
+        orphan_t *o = take_rename_source(&p, c);
+        if (!o) {
+            c->upload = true;
+            continue;
+        }
+        c->seen = true;
+        stats->renames++;
+        if (!cb(FS_PLAN_RENAME, o->path, c->e.path, ctx)) {
+            err = ESP_ERR_INVALID_STATE;
+        }
+        free(o);
+    }
+    for (uint32_t i = 0; err == ESP_OK && i < p.count; ++i) {
+        client_entry_t *c = &p.entries[i];
+        if (c->upload && !c->e.is_dir) {
+            stats->uploads++;
+            if (!cb(FS_PLAN_UPLOAD, c->e.path, NULL, ctx)) {
+                err = ESP_ERR_INVALID_STATE;
+            }
+        }
+    }
+    for (orphan_t *o = p.orphans; err == ESP_OK && mirror && o; o = o->next) {
+        stats->deletes++;
+        if (!cb(FS_PLAN_DELETE, o->path, NULL, ctx)) {
+            err = ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    while (p.orphans) {
+        orphan_t *next = p.orphans->next;
+        free(p.orphans);
+        p.orphans = next;
+    }
+    heap_caps_free(p.entries);
+    ESP_LOGI(TAG, "plan %s: client=%u unchanged=%u mkdir=%u rename=%u upload=%u delete=%u",
+             rel_root, (unsigned)p.count, (unsigned)stats->unchanged, (unsigned)stats->mkdirs,
+             (unsigned)stats->renames, (unsigned)stats->uploads, (unsigned)stats->deletes);
+    return err;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define FS_MANIFEST_PATH_LEN 256
+#define FS_MANIFEST_LINE_LEN (FS_MANIFEST_PATH_LEN + 112)
+
+// One record per file or directory, paths relative to the walked root and
+// without a leading slash. Serialized as a tab-separated line (FAT names
+// cannot contain control characters):
+//   F<TAB>size<TAB>mtime<TAB>sha256|-<TAB>path
+//   D<TAB>0<TAB>mtime<TAB>-<TAB>path
+typedef struct {
+    const char *path;
+    uint64_t size;
+    int64_t mtime;
+    const char *sha256;
+    bool is_dir;
+} fs_manifest_entry_t;
+
+// Return false from the callback to stop the walk (e.g. client went away).
+typedef bool (*fs_manifest_cb_t)(const fs_manifest_entry_t *entry, void *ctx);
+
+// Breadth-first walk below rel_root ("/" or "/dir"). Only one directory is
+// open at a time; the internal /.wimill tree is skipped. With with_hash the
+// cached hash-index entry is attached when it is still valid.
+esp_err_t fs_manifest_walk(const char *rel_root, bool with_hash, fs_manifest_cb_t cb, void *ctx);
+
+int fs_manifest_format(const fs_manifest_entry_t *entry, char *out, size_t out_len);
+// Parses one line in place (the line buffer backs the returned strings).
+bool fs_manifest_parse(char *line, fs_manifest_entry_t *out);
+
+typedef enum {
+    FS_PLAN_MKDIR,
+    FS_PLAN_RENAME,
+    FS_PLAN_UPLOAD,
+    FS_PLAN_DELETE,
+} fs_plan_op_t;
+
+typedef struct {
+    uint32_t unchanged;
+    uint32_t mkdirs;
+    uint32_t renames;
+    uint32_t uploads;
+    uint32_t deletes;
+} fs_plan_stats_t;
+
+// `to` is only set for FS_PLAN_RENAME. Ops are emitted grouped in the enum
+// order, so a client can execute them front to back.
+typedef bool (*fs_plan_cb_t)(fs_plan_op_t op, const char *path, const char *to, void *ctx);
+
+// Diffs the client manifest (lines as above, parsed in place) against the
+// card below rel_root. Renames are only proposed within one directory since
+// that is all /api/fs/rename can do; deletes only when mirror is set.
+esp_err_t fs_manifest_plan(const char *rel_root, char *client, size_t client_len, bool mirror,
+                           fs_plan_cb_t cb, void *ctx, fs_plan_stats_t *stats);
@@ -0,0 +1,463 @@
+#include "gcode_compact.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+
+#define OUT_BUF_SIZE (16 * 1024)
+// Longer lines (long comments, mostly) are passed through untouched.
+#define LINE_MAX_LEN 512
+#define MAX_WORDS 32
+#define VALUE_MAX_LEN 24
+
+enum {
+    GROUP_MOTION,
+    GROUP_DISTANCE,
+    GROUP_PLANE,
+    GROUP_UNITS,
+    GROUP_FEED_MODE,
+    GROUP_COUNT,
+    GROUP_OTHER = GROUP_COUNT,
+};
+
+typedef struct {
+    char letter;
+    char value[VALUE_MAX_LEN];
+    int code; // G/M: value * 10 (G38.2 -> 382), -1 if it has more decimals
+    int group;
+    bool drop;
+} word_t;
+
+struct gcode_compactor {
+    gcode_compact_sink_fn sink;
+    void *sink_ctx;
+    uint8_t *out;
+    size_t out_len;
+    char line[LINE_MAX_LEN];
+    size_t line_len;
+    bool overflow; // current line outgrew the buffer and is streamed as is
+    bool failed;
+    bool linear;              // file order is still execution order
+    int modal[GROUP_COUNT];   // current code per group, -1 unknown
+    char feed[VALUE_MAX_LEN]; // normalised F value, "" unknown
+    word_t words[MAX_WORDS];
+    uint64_t consumed;
+    uint64_t produced;
+};
+
+static void forget_state(gcode_compactor_t *c)
+{
+    for (int g = 0; g < GROUP_COUNT; ++g) {
+        c->modal[g] = -1;
+    }
+    c->feed[0] = '\0';
+}
+
+gcode_compactor_t *gcode_compactor_create(gcode_compact_sink_fn sink, void *sink_ctx)
+{
+    gcode_compactor_t *c = heap_caps_calloc(1, sizeof(*c), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!c) {
+        return NULL;
+    }
+    c->out = heap_caps_malloc(OUT_BUF_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!c->out) {
+        heap_caps_free(c);
+        return NULL;
+    }
+    c->sink = sink;
+    c->sink_ctx = sink_ctx;
+    c->linear = true;
+    forget_state(c);
+    return c;
+}
+
+void gcode_compactor_destroy(gcode_compactor_t *c)
+{
+    if (!c) {
+        return;
+    }
+    heap_caps_free(c->out);
+    heap_caps_free(c);
+}
+
+static bool flush_out(gcode_compactor_t *c)
+{
+    if (c->out_len > 0 && !c->failed) {
+        if (!c->sink(c->sink_ctx, c->out, c->out_len)) {
+            c->failed = true;
+        } else {
+            c->produced += c->out_len;
+        }
+    }
+    c->out_len = 0;
+    return !c->failed;
+}
+
+static void emit(gcode_compactor_t *c, const char *data, size_t len)
+{
+    while (len > 0 && !c->failed) {
+        size_t n = OUT_BUF_SIZE - c->out_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(c->out + c->out_len, data, n);
+        c->out_len += n;
+        data += n;
+        len -= n;
+        if (c->out_len == OUT_BUF_SIZE) {
+            flush_out(c);
+        }
+    }
+}
+
+// The line minus surrounding whitespace, as written.
+static void emit_verbatim(gcode_compactor_t *c, const char *s, size_t len)
+{
+    while (len > 0 && isspace((unsigned char)s[0])) {
+        s++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char)s[len - 1])) {
+        len--;
+    }
+    if (len > 0) {
+        emit(c, s, len);
+        emit(c, "\n", 1);
+    }
+    forget_state(c);
+}
+
+// "(MSG, ...)", "(PRINT, ...)", "(DEBUG, ...)": comments the controller acts on.
+static bool is_active_comment(const char *s, const char *end)
+{
+    while (s < end && (*s == ' ' || *s == '\t')) {
+        s++;
+    }
+    const char *word = s;
+    while (s < end && isalpha((unsigned char)*s)) {
+        s++;
+    }
+    return s > word && s < end && *s == ',';
+}
+
+// Parses [+-]digits[.digits] at *p into its shortest exact form; `code`
+// keeps the dot out of G/M numbers. Returns false on malformed numbers.
+static bool normalise_number(const char **p, bool code, char *out, size_t out_len)
+{
+    const char *s = *p;
+    bool neg = false;
+    if (*s == '+' || *s == '-') {
+        neg = *s == '-';
+        s++;
+    }
+    const char *int_start = s;
+    while (isdigit((unsigned char)*s)) {
+        s++;
+    }
+    const char *int_end = s;
+    bool dot = false;
+    const char *frac_start = s;
+    const char *frac_end = s;
+    if (*s == '.') {
+        dot = true;
+        frac_start = ++s;
+        while (isdigit((unsigned char)*s)) {
+            s++;
+        }
+        frac_end = s;
+    }
+    if (int_end == int_start && frac_end == frac_start) {
+        return false;
+    }
+    *p = s;
+    while (int_start < int_end && *int_start == '0') {
+        int_start++;
+    }
+    while (frac_end > frac_start && frac_end[-1] == '0') {
+        frac_end--;
+    }
+    size_t int_len = (size_t)(int_end - int_start);
+    size_t frac_len = (size_t)(frac_end - frac_start);
+    if (int_len == 0 && frac_len == 0) {
+        snprintf(out, out_len, "0");
+        return true;
+    }
+    // A trailing dot stays on axis and feed words: without it some
+    // controllers read the number in least increments, not mm.
+    // No leading zero either: ".5" is valid everywhere.
+    int n = snprintf(out, out_len, "%s%.*s%s%.*s", neg ? "-" : "", (int)int_len, int_start,
+                     (frac_len || (dot && !code)) ? "." : "", (int)frac_len, frac_start);
+    return n > 0 && (size_t)n < out_len;
+}
+
+// "300" and "300." are the same feed.
+static bool same_value(const char *a, const char *b)
+{
+    size_t la = strlen(a);
+    size_t lb = strlen(b);
+    la -= la > 0 && a[la - 1] == '.';
+    lb -= lb > 0 && b[lb - 1] == '.';
+    return la == lb && memcmp(a, b, la) == 0;
+}
+
+static int g_group(int code)
+{
+    switch (code) {
+    case 0:
+    case 10:
+    case 20:
+    case 30:
+    case 330:
+    case 382:
+    case 383:
+    case 384:
+    case 385:
+    case 730:
+    case 760:
+        return GROUP_MOTION;
+    case 900:
+    case 910:
+        return GROUP_DISTANCE;
+    case 170:
+    case 180:
+    case 190:
+        return GROUP_PLANE;
+    case 200:
+    case 210:
+        return GROUP_UNITS;
+    case 930:
+    case 940:
+    case 950:
+        return GROUP_FEED_MODE;
+    default:
+        return code >= 800 && code <= 890 && code % 10 == 0 ? GROUP_MOTION : GROUP_OTHER;
+    }
+}
+
+static int code_value(const char *v)
+{
+    int whole = 0;
+    const char *s = v;
+    while (isdigit((unsigned char)*s)) {
+        whole = whole * 10 + (*s++ - '0');
+        if (whole > 9999) {
+            return -1;
+        }
+    }
+    if (*s == '\0') {
+        return whole * 10;
+    }
+    if (s[0] == '.' && isdigit((unsigned char)s[1]) && s[2] == '\0') {
+        return whole * 10 + (s[1] - '0');
+    }
+    return -1;
+}
+
+static void process_line(gcode_compactor_t *c)
+{
+    const char *raw = c->line;
+    size_t raw_len = c->line_len;
+    char clean[LINE_MAX_LEN];
+    size_t clean_len = 0;
+    bool block_delete = false;
+    size_t i = 0;
+    while (i < raw_len && isspace((unsigned char)raw[i])) {
+        i++;
+    }
+    if (i < raw_len && raw[i] == '/') {
+        block_delete = true;
+        i++;
+    }
+    for (; i < raw_len; ++i) {
+        char ch = raw[i];
+        if (ch == ';') {
+            break;
+        }
+        if (ch == '(') {
+            const char *close = memchr(raw + i, ')', raw_len - i);
+            if (!close || is_active_comment(raw + i + 1, close)) {
+                emit_verbatim(c, raw, raw_len);
+                return;
+            }
+            i = (size_t)(close - raw);
+            continue;
+        }
+        if (isspace((unsigned char)ch)) {
+            continue;
+        }
+        clean[clean_len++] = (char)toupper((unsigned char)ch);
+    }
+    if (clean_len == 0) {
+        return;
+    }
+    clean[clean_len] = '\0';
+    // Program delimiters and controller commands ($H, $J=...) as written.
+    if (clean[0] == '%' || clean[0] == '$') {
+        emit_verbatim(c, raw, raw_len);
+        return;
+    }
+
+    size_t count = 0;
+    const char *p = clean;
+    while (*p) {
+        if (count == MAX_WORDS || !isalpha((unsigned char)*p)) {
+            break;
+        }
+        word_t *w = &c->words[count];
+        bool code = *p == 'G' || *p == 'M';
+        w->letter = *p++;
+        if (!normalise_number(&p, code, w->value, sizeof(w->value))) {
+            break;
+        }
+        w->code = code ? code_value(w->value) : -1;
+        w->group = w->letter == 'G' ? (w->code >= 0 ? g_group(w->code) : GROUP_OTHER) : GROUP_OTHER;
+        w->drop = false;
+        count++;
+    }
+    if (*p) {
+        // Parameters, expressions, GOTO/WHILE...: keep it and stop eliding.
+        c->linear = false;
+        emit_verbatim(c, raw, raw_len);
+        return;
+    }
+
+    bool other_g = false;
+    bool feed_basis_set = false; // units or feed mode given: F is restated
+    bool program_end = false;
+    for (size_t k = 0; k < count; ++k) {
+        const word_t *w = &c->words[k];
+        if (w->letter == 'O' || (w->letter == 'M' && (w->code == 970 || w->code == 980 || w->code == 990)) ||
+            (w->letter == 'G' && (w->code == 650 || w->code == 660 || w->code == 661))) {
+            c->linear = false;
+        }
+        if (w->letter == 'M' && (w->code == 20 || w->code == 300)) {
+            program_end = true;
+        }
+        if (w->letter == 'G' && w->group == GROUP_OTHER) {
+            other_g = true;
+        }
+        if (w->letter == 'G' && (w->group == GROUP_UNITS || w->group == GROUP_FEED_MODE)) {
+            feed_basis_set = true;
+        }
+    }
+
+    if (c->linear) {
+        for (size_t k = 0; k < count; ++k) {
+            word_t *w = &c->words[k];
+            if (w->letter == 'G' && w->group != GROUP_OTHER && !other_g && c->modal[w->group] == w->code &&
+                (w->group != GROUP_MOTION || w->code <= 30)) {
+                w->drop = true;
+            } else if (w->letter == 'F' && !feed_basis_set && c->feed[0] && c->modal[GROUP_FEED_MODE] != 930 &&
+                       same_value(c->feed, w->value)) {
+                // Inverse-time feed (G93) must be given on every move.
+                w->drop = true;
+            }
+        }
+    }
+
+    char out[LINE_MAX_LEN + 2];
+    size_t out_len = 0;
+    if (block_delete) {
+        out[out_len++] = '/';
+    }
+    bool any = false;
+    for (size_t k = 0; k < count; ++k) {
+        const word_t *w = &c->words[k];
+        if (w->drop) {
+            continue;
+        }
+        size_t vlen = strlen(w->value);
+        if (out_len + 1 + vlen >= sizeof(out) - 1) {
+            emit_verbatim(c, raw, raw_len);
+            return;
+        }
+        out[out_len++] = w->letter;
+        memcpy(out + out_len, w->value, vlen);
+        out_len += vlen;
+        any = true;
+    }
+    if (any) {
+        out[out_len++] = '\n';
+        emit(c, out, out_len);
+    }
+
+    // A block-delete line may or may not run: whatever it sets is unknown.
+    if (feed_basis_set) {
+        c->feed[0] = '\0';
+    }
+    for (size_t k = 0; k < count; ++k) {
+        const word_t *w = &c->words[k];
+        if (w->letter == 'G' && w->group != GROUP_OTHER) {
+            c->modal[w->group] = block_delete ? -1 : w->code;
+        } else if (w->letter == 'F') {
+            if (block_delete) {
+                c->feed[0] = '\0';
+            } else {
+                memcpy(c->feed, w->value, sizeof(c->feed));
+            }
+        }
+    }
+    if (program_end) {
+        forget_state(c);
+    }
+}
+
+bool gcode_compactor_feed(gcode_compactor_t *c, const uint8_t *data, size_t len)
+{
+    if (!c || c->failed) {
+        return false;
+    }
+    c->consumed += len;
+    for (size_t i = 0; i < len; ++i) {
+        char ch = (char)data[i];
+        if (c->overflow) {
+            if (ch == '\n') {
+                emit(c, "\n", 1);
+                c->overflow = false;
+                forget_state(c);
+            } else {
+                emit(c, &ch, 1);
+            }
+            continue;
+        }
+        if (ch == '\n') {
+            process_line(c);
+            c->line_len = 0;
+        } else if (c->line_len < LINE_MAX_LEN - 1) {
+            c->line[c->line_len++] = ch;
+        } else {
+            emit(c, c->line, c->line_len);
+            emit(c, &ch, 1);
+            c->line_len = 0;
+            c->overflow = true;
+        }
+    }
+    return !c->failed;
+}
+
+bool gcode_compactor_finish(gcode_compactor_t *c)
+{
+    if (!c || c->failed) {
+        return false;
+    }
+    if (c->overflow) {
+        emit(c, "\n", 1);
+        c->overflow = false;
+    } else if (c->line_len > 0) {
+        process_line(c);
+        c->line_len = 0;
+    }
+    return flush_out(c);
+}
+
+uint64_t gcode_compactor_consumed(const gcode_compactor_t *c)
+{
+    return c ? c->consumed : 0;
+}
+
+uint64_t gcode_compactor_produced(const gcode_compactor_t *c)
+{
+    return c ? c->produced : 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming G-code compactor, an optional upload transform: strips comments
+// and whitespace, drops G/F words that only repeat the current modal state
+// (motion G0-G3, G90/G91, G17-G19, G20/G21, G93-G95, feed) and normalises
+// numbers (X+010.500 -> X10.5, G01 -> G1). Output goes to `sink` in blocks.
+//
+// Conservative by design. Lines it does not fully understand (parameters,
+// expressions, GOTO/WHILE, active comments such as "(MSG, ...)") pass through
+// unchanged and make it forget the modal state. From the first O-word,
+// M98/M99 or macro line on, nothing is dropped any more: execution order is
+// no longer file order.
+
+// Returns false to abort (write error).
+typedef bool (*gcode_compact_sink_fn)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct gcode_compactor gcode_compactor_t;
+
+gcode_compactor_t *gcode_compactor_create(gcode_compact_sink_fn sink, void *sink_ctx);
+bool gcode_compactor_feed(gcode_compactor_t *c, const uint8_t *data, size_t len);
+// Emits a last unterminated line and flushes the output block.
+bool gcode_compactor_finish(gcode_compactor_t *c);
+// Bytes fed in / handed to the sink so far.
+uint64_t gcode_compactor_consumed(const gcode_compactor_t *c);
+uint64_t gcode_compactor_produced(const gcode_compactor_t *c);
+void gcode_compactor_destroy(gcode_compactor_t *c);
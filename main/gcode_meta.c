@@ -0,0 +1,844 @@
+#include "gcode_meta.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "fs_manifest.h"
+#include "gz_cache.h"
+#include "wimill_pins.h"
+
+#define TAG "GCODE"
+#define META_ROOT WIMILL_SD_MOUNT_POINT "/.wimill"
+#define META_DIR META_ROOT "/meta"
+#define META_MAGIC "wimill-meta 1 "
+#define META_FILE_PATH_LEN 64
+#define META_HEADER_LEN (FS_MANIFEST_PATH_LEN + 64)
+#define META_READ_BUF_SIZE (16 * 1024)
+// Longer lines are cut; G-code lines are short and words past 255 chars
+// are almost certainly comment text.
+#define LINE_MAX_LEN 256
+// No machine profile on the device: rapids are costed at a typical hobby
+// machine speed and accelerations are ignored.
+#define RAPID_MM_PER_MIN 3000.0f
+#define MM_PER_INCH 25.4f
+#define SCAN_QUEUE_LEN 8
+#define SCAN_MAX_FILES 1024
+#define SCAN_SETTLE_MS 3000
+#define SCAN_TASK_STACK 6144
+#define SCAN_TASK_PRIO 2
+#define MAX_G_WORDS 8
+#define MAX_M_WORDS 4
+#define LINES_MAGIC "WMLX"
+#define LINES_VERSION 1
+#define LINES_INDEX_CHUNK 256
+
+static const char *const k_gcode_ext[] = {"gcode", "gco", "g", "nc", "ngc", "tap", "cnc"};
+
+struct gcode_analyzer {
+    gcode_meta_t m;
+    char line[LINE_MAX_LEN];
+    size_t line_len;
+    bool line_pending;
+    int motion; // 0-3, -1 after G80 or before the first motion word
+    int plane;  // 17/18/19
+    bool relative;
+    float scale; // to mm
+    float pos[3];
+    float feed; // mm/min
+    int pending_tool;
+    double cut_min;
+    double dwell_s;
+    uint64_t offset; // bytes fed so far
+    uint32_t *index; // start offset of every GCODE_LINES_STRIDE-th line
+    uint32_t index_count;
+    uint32_t index_cap;
+    bool index_failed;
+};
+
+static uint32_t fnv1a32(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+bool gcode_meta_is_gcode(const char *name)
+{
+    const char *slash = name ? strrchr(name, '/') : NULL;
+    const char *dot = name ? strrchr(slash ? slash : name, '.') : NULL;
+    if (!dot) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(k_gcode_ext) / sizeof(k_gcode_ext[0]); ++i) {
+        if (strcasecmp(dot + 1, k_gcode_ext[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+gcode_analyzer_t *gcode_analyzer_create(void)
+{
+    gcode_analyzer_t *a = heap_caps_calloc(1, sizeof(*a), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!a) {
+        a = calloc(1, sizeof(*a));
+    }
+    if (!a) {
+        return NULL;
+    }
+    a->motion = -1;
+    a->plane = 17;
+    a->scale = 1.0f;
+    a->pending_tool = -1;
+    return a;
+}
+
+void gcode_analyzer_destroy(gcode_analyzer_t *a)
+{
+    if (a) {
+        heap_caps_free(a->index);
+    }
+    heap_caps_free(a);
+}
+
+// Offsets fit in 32 bits: FAT32 files stop at 4 GB.
+static void index_line_start(gcode_analyzer_t *a, uint64_t offset)
+{
+    if (a->index_failed) {
+        return;
+    }
+    if (a->index_count == a->index_cap) {
+        uint32_t cap = a->index_cap + LINES_INDEX_CHUNK;
+        uint32_t *grown = heap_caps_realloc(a->index, cap * sizeof(uint32_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!grown) {
+            a->index_failed = true;
+            return;
+        }
+        a->index = grown;
+        a->index_cap = cap;
+    }
+    a->index[a->index_count++] = (uint32_t)offset;
+}
+
+static void include_point(gcode_meta_t *m, const float p[3])
+{
+    if (!m->has_bounds) {
+        memcpy(m->min, p, sizeof(m->min));
+        memcpy(m->max, p, sizeof(m->max));
+        m->has_bounds = true;
+        return;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (p[i] < m->min[i]) {
+            m->min[i] = p[i];
+        }
+        if (p[i] > m->max[i]) {
+            m->max[i] = p[i];
+        }
+    }
+}
+
+static void note_tool(gcode_meta_t *m, int tool)
+{
+    if (tool < 0) {
+        return;
+    }
+    for (uint8_t i = 0; i < m->tool_count; ++i) {
+        if (m->tools[i] == tool) {
+            return;
+        }
+    }
+    if (m->tool_count < GCODE_META_MAX_TOOLS) {
+        m->tools[m->tool_count++] = (uint16_t)tool;
+    }
+}
+
+// XY-plane arc (G17) from a->pos to `to`, centre given by I/J or radius R.
+// The bounding box also takes the quadrant points the arc passes through.
+static float arc_length(gcode_analyzer_t *a, const float to[3], bool cw, const bool *has, const float *val)
+{
+    const float two_pi = 6.2831853f;
+    float x0 = a->pos[0];
+    float y0 = a->pos[1];
+    float dz = to[2] - a->pos[2];
+    if (!has['I' - 'A'] && !has['J' - 'A']) {
+        float r = fabsf(val['R' - 'A'] * a->scale);
+        float chord = hypotf(to[0] - x0, to[1] - y0);
+        if (!has['R' - 'A'] || r <= 0.0f || chord > 2.0f * r + 1e-3f) {
+            return hypotf(chord, dz);
+        }
+        float half = chord / (2.0f * r);
+        float sweep = 2.0f * asinf(half > 1.0f ? 1.0f : half);
+        if (val['R' - 'A'] < 0.0f) {
+            sweep = two_pi - sweep;
+        }
+        return hypotf(r * sweep, dz);
+    }
+    float cx = x0 + (has['I' - 'A'] ? val['I' - 'A'] * a->scale : 0.0f);
+    float cy = y0 + (has['J' - 'A'] ? val['J' - 'A'] * a->scale : 0.0f);
+    float r = hypotf(x0 - cx, y0 - cy);
+    float a0 = atan2f(y0 - cy, x0 - cx);
+    float a1 = atan2f(to[1] - cy, to[0] - cx);
+    float sweep = cw ? a0 - a1 : a1 - a0;
+    if (sweep <= 1e-6f) {
+        sweep += two_pi;
+    }
+    for (int k = 0; k < 4; ++k) {
+        float q = (float)k * (two_pi / 4.0f);
+        float d = fmodf((cw ? a0 - q : q - a0) + 2.0f * two_pi, two_pi);
+        if (d <= sweep) {
+            float p[3] = {cx + r * cosf(q), cy + r * sinf(q), a->pos[2] + dz * (d / sweep)};
+            include_point(&a->m, p);
+        }
+    }
+    return hypotf(r * sweep, dz);
+}
+
+static void process_line(gcode_analyzer_t *a)
+{
+    float val[26] = {0};
+    bool has[26] = {0};
+    int g_words[MAX_G_WORDS];
+    int m_words[MAX_M_WORDS];
+    int g_count = 0;
+    int m_count = 0;
+
+    a->line[a->line_len] = '\0';
+    char *p = a->line;
+    while (*p) {
+        char c = *p;
+        if (c == ';') {
+            break;
+        }
+        if (c == '(') {
+            char *close = strchr(p, ')');
+            if (!close) {
+                break;
+            }
+            p = close + 1;
+            continue;
+        }
+        if (!isalpha((unsigned char)c)) {
+            p++;
+            continue;
+        }
+        int letter = toupper((unsigned char)c) - 'A';
+        char *end = NULL;
+        float v = strtof(p + 1, &end);
+        if (end == p + 1) {
+            p++;
+            continue;
+        }
+        p = end;
+        if (letter == 'G' - 'A') {
+            if (g_count < MAX_G_WORDS) {
+                g_words[g_count++] = (int)lroundf(v * 10.0f);
+            }
+        } else if (letter == 'M' - 'A') {
+            if (m_count < MAX_M_WORDS) {
+                m_words[m_count++] = (int)lroundf(v);
+            }
+        } else {
+            val[letter] = v;
+            has[letter] = true;
+        }
+    }
+
+    bool skip_move = false;
+    bool set_origin = false;
+    bool dwell = false;
+    for (int i = 0; i < g_count; ++i) {
+        switch (g_words[i]) {
+        case 0:
+        case 10:
+        case 20:
+        case 30:
+            a->motion = g_words[i] / 10;
+            break;
+        case 40:
+            dwell = true;
+            break;
+        case 170:
+        case 180:
+        case 190:
+            a->plane = g_words[i] / 10;
+            break;
+        case 200:
+            a->scale = MM_PER_INCH;
+            break;
+        case 210:
+            a->scale = 1.0f;
+            break;
+        case 280:
+        case 300:
+            // Homing goes through machine positions we do not track.
+            skip_move = true;
+            break;
+        case 800:
+            a->motion = -1;
+            break;
+        case 900:
+            a->relative = false;
+            break;
+        case 910:
+            a->relative = true;
+            break;
+        case 920:
+            set_origin = true;
+            break;
+        default:
+            // Canned cycles and the like: axis words are not a plain move.
+            if (g_words[i] >= 810 && g_words[i] <= 890) {
+                skip_move = true;
+            }
+            break;
+        }
+    }
+    if (has['F' - 'A'] && val['F' - 'A'] > 0.0f) {
+        a->feed = val['F' - 'A'] * a->scale;
+    }
+    if (has['T' - 'A']) {
+        a->pending_tool = (int)val['T' - 'A'];
+    }
+    for (int i = 0; i < m_count; ++i) {
+        if (m_words[i] == 6) {
+            a->m.tool_changes++;
+            note_tool(&a->m, a->pending_tool);
+        }
+    }
+    if (dwell) {
+        // P in seconds, as Grbl and LinuxCNC read it.
+        if (has['P' - 'A'] && val['P' - 'A'] > 0.0f) {
+            a->dwell_s += val['P' - 'A'];
+        }
+        return;
+    }
+
+    bool axis = has['X' - 'A'] || has['Y' - 'A'] || has['Z' - 'A'];
+    if (!axis) {
+        return;
+    }
+    if (set_origin) {
+        // G92 only renames the current position; nothing moves.
+        for (int i = 0; i < 3; ++i) {
+            if (has['X' - 'A' + i]) {
+                a->pos[i] = val['X' - 'A' + i] * a->scale;
+            }
+        }
+        return;
+    }
+    if (skip_move || a->motion < 0) {
+        return;
+    }
+
+    float to[3];
+    for (int i = 0; i < 3; ++i) {
+        to[i] = a->pos[i];
+        if (has['X' - 'A' + i]) {
+            float v = val['X' - 'A' + i] * a->scale;
+            to[i] = a->relative ? a->pos[i] + v : v;
+        }
+    }
+    float len;
+    if (a->motion >= 2 && a->plane == 17) {
+        len = arc_length(a, to, a->motion == 2, has, val);
+    } else {
+        len = sqrtf((to[0] - a->pos[0]) * (to[0] - a->pos[0]) + (to[1] - a->pos[1]) * (to[1] - a->pos[1]) +
+                    (to[2] - a->pos[2]) * (to[2] - a->pos[2]));
+    }
+    if (a->motion == 0) {
+        a->m.rapid_mm += len;
+    } else {
+        a->m.cut_mm += len;
+        if (a->feed > 0.0f) {
+            a->cut_min += len / a->feed;
+            if (a->m.feed_min == 0.0f || a->feed < a->m.feed_min) {
+                a->m.feed_min = a->feed;
+            }
+            if (a->feed > a->m.feed_max) {
+                a->m.feed_max = a->feed;
+            }
+        }
+    }
+    a->m.moves++;
+    include_point(&a->m, to);
+    memcpy(a->pos, to, sizeof(a->pos));
+}
+
+void gcode_analyzer_feed(gcode_analyzer_t *a, const uint8_t *data, size_t len)
+{
+    if (!a) {
+        return;
+    }
+    if (a->offset == 0 && len > 0) {
+        index_line_start(a, 0);
+    }
+    for (size_t i = 0; i < len; ++i) {
+        char c = (char)data[i];
+        if (c == '\n') {
+            process_line(a);
+            a->m.lines++;
+            a->line_len = 0;
+            a->line_pending = false;
+            if (a->m.lines % GCODE_LINES_STRIDE == 0) {
+                index_line_start(a, a->offset + i + 1);
+            }
+        } else if (c != '\r') {
+            if (a->line_len < LINE_MAX_LEN - 1) {
+                a->line[a->line_len++] = c;
+            }
+            a->line_pending = true;
+        }
+    }
+    a->offset += len;
+}
+
+void gcode_analyzer_finish(gcode_analyzer_t *a, gcode_meta_t *out)
+{
+    if (!a) {
+        return;
+    }
+    if (a->line_pending) {
+        process_line(a);
+        a->m.lines++;
+        a->line_len = 0;
+        a->line_pending = false;
+    }
+    double seconds = a->cut_min * 60.0 + (double)a->m.rapid_mm / RAPID_MM_PER_MIN * 60.0 + a->dwell_s;
+    a->m.est_s = (uint32_t)(seconds + 0.5);
+    if (out) {
+        *out = a->m;
+    }
+}
+
+int gcode_meta_to_json(const gcode_meta_t *m, char *out, size_t out_len)
+{
+    int n = snprintf(out, out_len, "{\"lines\":%lu,\"moves\":%lu,\"bounds\":", (unsigned long)m->lines,
+                     (unsigned long)m->moves);
+    if (m->has_bounds) {
+        n += snprintf(out + n, n < (int)out_len ? out_len - n : 0,
+                      "{\"min\":[%.3f,%.3f,%.3f],\"max\":[%.3f,%.3f,%.3f]}", m->min[0], m->min[1], m->min[2],
+                      m->max[0], m->max[1], m->max[2]);
+    } else {
+        n += snprintf(out + n, n < (int)out_len ? out_len - n : 0, "null");
+    }
+    if (m->feed_max > 0.0f) {
+        n += snprintf(out + n, n < (int)out_len ? out_len - n : 0, ",\"feed\":{\"min\":%.1f,\"max\":%.1f}",
+                      m->feed_min, m->feed_max);
+    } else {
+        n += snprintf(out + n, n < (int)out_len ? out_len - n : 0, ",\"feed\":null");
+    }
+    n += snprintf(out + n, n < (int)out_len ? out_len - n : 0, ",\"tool_changes\":%lu,\"tools\":[",
+                  (unsigned long)m->tool_changes);
+    for (uint8_t i = 0; i < m->tool_count; ++i) {
+        n += snprintf(out + n, n < (int)out_len ? out_len - n : 0, "%s%u", i ? "," : "", (unsigned)m->tools[i]);
+    }
+    n += snprintf(out + n, n < (int)out_len ? out_len - n : 0,
+                  "],\"cut_mm\":%.1f,\"rapid_mm\":%.1f,\"est_s\":%lu", m->cut_mm, m->rapid_mm,
+                  (unsigned long)m->est_s);
+    if (m->original_bytes > 0) {
+        n += snprintf(out + n, n < (int)out_len ? out_len - n : 0, ",\"original_bytes\":%llu",
+                      (unsigned long long)m->original_bytes);
+    }
+    n += snprintf(out + n, n < (int)out_len ? out_len - n : 0, "}");
+    return n < (int)out_len ? n : -1;
+}
+
+static void sidecar_path(const char *rel_path, char *out, size_t out_len, const char *ext)
+{
+    snprintf(out, out_len, "%s/%08lx.%s", META_DIR, (unsigned long)fnv1a32(rel_path), ext);
+}
+
+static bool ensure_meta_dir(void)
+{
+    if (mkdir(META_ROOT, 0775) != 0 && errno != EEXIST) {
+        return false;
+    }
+    if (mkdir(META_DIR, 0775) != 0 && errno != EEXIST) {
+        return false;
+    }
+    return true;
+}
+
+// Sidecar: "wimill-meta 1 <size> <mtime> <path>" then the JSON object on
+// the second line. The path in the header guards against FNV clashes.
+esp_err_t gcode_meta_store(const char *rel_path, uint64_t size, int64_t mtime, const gcode_meta_t *m)
+{
+    if (!rel_path || !m) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char json[GCODE_META_JSON_LEN];
+    if (gcode_meta_to_json(m, json, sizeof(json)) < 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    char path[META_FILE_PATH_LEN];
+    char tmp[META_FILE_PATH_LEN];
+    sidecar_path(rel_path, path, sizeof(path), "json");
+    sidecar_path(rel_path, tmp, sizeof(tmp), "new");
+    if (!ensure_meta_dir()) {
+        return ESP_FAIL;
+    }
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        return ESP_FAIL;
+    }
+    fprintf(f, "%s%llu %lld %s\n%s\n", META_MAGIC, (unsigned long long)size, (long long)mtime, rel_path, json);
+    bool ok = fflush(f) == 0;
+    fclose(f);
+    if (ok) {
+        unlink(path);
+        ok = rename(tmp, path) == 0;
+    }
+    if (!ok) {
+        unlink(tmp);
+        ESP_LOGW(TAG, "meta store failed for %s", rel_path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gcode_meta_load_json(const char *rel_path, uint64_t size, int64_t mtime, char *out, size_t out_len)
+{
+    if (!rel_path || !out || out_len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char path[META_FILE_PATH_LEN];
+    sidecar_path(rel_path, path, sizeof(path), "json");
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    char header[META_HEADER_LEN];
+    unsigned long long sz = 0;
+    long long mt = 0;
+    int consumed = 0;
+    if (fgets(header, sizeof(header), f) && strncmp(header, META_MAGIC, strlen(META_MAGIC)) == 0 &&
+        sscanf(header + strlen(META_MAGIC), "%llu %lld %n", &sz, &mt, &consumed) == 2 && consumed > 0) {
+        char *name = header + strlen(META_MAGIC) + consumed;
+        name[strcspn(name, "\r\n")] = '\0';
+        if (strcmp(name, rel_path) != 0) {
+            err = ESP_ERR_NOT_FOUND;
+        } else if (sz == size && mt == mtime && fgets(out, (int)out_len, f) && out[0] == '{') {
+            out[strcspn(out, "\r\n")] = '\0';
+            err = ESP_OK;
+        }
+    }
+    fclose(f);
+    return err;
+}
+
+// Line index sidecar (.lix next to the .json): this header, the path, then
+// `count` little-endian u32 offsets; entry k is where line k * stride starts.
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t path_len;
+    uint32_t stride;
+    uint32_t lines;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t size;
+    int64_t mtime;
+} lines_header_t;
+
+esp_err_t gcode_lines_store(const char *rel_path, uint64_t size, int64_t mtime, const gcode_analyzer_t *a)
+{
+    if (!rel_path || !a || a->index_failed || a->index_count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    lines_header_t h = {
+        .version = LINES_VERSION,
+        .path_len = (uint16_t)strlen(rel_path),
+        .stride = GCODE_LINES_STRIDE,
+        .lines = a->m.lines,
+        .count = a->index_count,
+        .size = size,
+        .mtime = mtime,
+    };
+    memcpy(h.magic, LINES_MAGIC, sizeof(h.magic));
+    char path[META_FILE_PATH_LEN];
+    char tmp[META_FILE_PATH_LEN];
+    sidecar_path(rel_path, path, sizeof(path), "lix");
+    sidecar_path(rel_path, tmp, sizeof(tmp), "lnew");
+    if (!ensure_meta_dir()) {
+        return ESP_FAIL;
+    }
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(rel_path, 1, h.path_len, f) == h.path_len &&
+              fwrite(a->index, sizeof(uint32_t), a->index_count, f) == a->index_count;
+    ok = fclose(f) == 0 && ok;
+    if (ok) {
+        unlink(path);
+        ok = rename(tmp, path) == 0;
+    }
+    if (!ok) {
+        unlink(tmp);
+        ESP_LOGW(TAG, "line index store failed for %s", rel_path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gcode_lines_seek(const char *rel_path, uint64_t size, int64_t mtime, uint32_t line,
+                           gcode_lines_pos_t *out)
+{
+    if (!rel_path || !out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char path[META_FILE_PATH_LEN];
+    sidecar_path(rel_path, path, sizeof(path), "lix");
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    lines_header_t h;
+    char name[FS_MANIFEST_PATH_LEN];
+    size_t path_len = strlen(rel_path);
+    if (fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, LINES_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == LINES_VERSION && h.stride > 0 && h.count > 0 && h.path_len == path_len &&
+        path_len < sizeof(name) && fread(name, 1, path_len, f) == path_len && memcmp(name, rel_path, path_len) == 0) {
+        if (h.size == size && h.mtime == mtime) {
+            uint32_t k = line / h.stride;
+            if (k >= h.count) {
+                k = h.count - 1;
+            }
+            uint32_t offset = 0;
+            if (fseek(f, (long)(sizeof(h) + path_len + k * sizeof(uint32_t)), SEEK_SET) == 0 &&
+                fread(&offset, sizeof(offset), 1, f) == 1) {
+                out->line = k * h.stride;
+                out->offset = offset;
+                out->total_lines = h.lines;
+                err = ESP_OK;
+            }
+        }
+    } else {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    fclose(f);
+    return err;
+}
+
+esp_err_t gcode_meta_analyze_file(const char *rel_path, sdcard_io_class_t cls, gcode_meta_t *out)
+{
+    char full[FS_MANIFEST_PATH_LEN + sizeof(WIMILL_SD_MOUNT_POINT)];
+    snprintf(full, sizeof(full), "%s%s", WIMILL_SD_MOUNT_POINT, rel_path);
+    uint8_t *buf = heap_caps_malloc(META_READ_BUF_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    gcode_analyzer_t *a = gcode_analyzer_create();
+    if (!buf || !a) {
+        heap_caps_free(buf);
+        gcode_analyzer_destroy(a);
+        return ESP_ERR_NO_MEM;
+    }
+    if (!sdcard_job_begin()) {
+        heap_caps_free(buf);
+        gcode_analyzer_destroy(a);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = ESP_OK;
+    FILE *f = NULL;
+    struct stat st;
+    if (sdcard_job_should_stop() || !sdcard_is_vfs_allowed() || !sdcard_is_mounted()) {
+        err = ESP_ERR_INVALID_STATE;
+    } else if (stat(full, &st) != 0 || S_ISDIR(st.st_mode) || !(f = fopen(full, "rb"))) {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    while (err == ESP_OK) {
+        if (sdcard_job_should_stop()) {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        sdcard_io_begin(cls);
+        size_t n = fread(buf, 1, META_READ_BUF_SIZE, f);
+        sdcard_io_end();
+        if (n == 0) {
+            break;
+        }
+        gcode_analyzer_feed(a, buf, n);
+    }
+    if (f) {
+        fclose(f);
+    }
+    gcode_meta_t m;
+    if (err == ESP_OK) {
+        gcode_analyzer_finish(a, &m);
+        sdcard_io_begin(cls);
+        err = gcode_meta_store(rel_path, (uint64_t)st.st_size, (int64_t)st.st_mtime, &m);
+        gcode_lines_store(rel_path, (uint64_t)st.st_size, (int64_t)st.st_mtime, a);
+        sdcard_io_end();
+        if (out) {
+            *out = m;
+        }
+    }
+    sdcard_job_end();
+    heap_caps_free(buf);
+    gcode_analyzer_destroy(a);
+    return err;
+}
+
+// Background queue: a path to analyse, or "" for a full card scan.
+static QueueHandle_t s_queue;
+static volatile bool s_scan_queued;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime;
+    char path[FS_MANIFEST_PATH_LEN];
+} scan_item_t;
+
+typedef struct {
+    scan_item_t *items;
+    size_t count;
+} scan_list_t;
+
+static bool scan_collect(const fs_manifest_entry_t *entry, void *arg)
+{
+    scan_list_t *list = (scan_list_t *)arg;
+    if (sdcard_job_should_stop()) {
+        return false;
+    }
+    if (entry->is_dir || !gcode_meta_is_gcode(entry->path) || list->count >= SCAN_MAX_FILES) {
+        return true;
+    }
+    scan_item_t *it = &list->items[list->count];
+    // Manifest paths are relative to the walked root and have no leading slash.
+    if (snprintf(it->path, sizeof(it->path), "/%s", entry->path) >= (int)sizeof(it->path)) {
+        return true;
+    }
+    it->size = entry->size;
+    it->mtime = entry->mtime;
+    list->count++;
+    return true;
+}
+
+static bool is_current(const char *rel_path, uint64_t size, int64_t mtime)
+{
+    char json[GCODE_META_JSON_LEN];
+    sdcard_io_begin(SDCARD_IO_BACKGROUND);
+    bool ok = gcode_meta_load_json(rel_path, size, mtime, json, sizeof(json)) == ESP_OK;
+    sdcard_io_end();
+    return ok;
+}
+
+static void run_scan(void)
+{
+    scan_list_t list = {
+        .items = heap_caps_malloc(SCAN_MAX_FILES * sizeof(scan_item_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT),
+    };
+    if (!list.items) {
+        ESP_LOGW(TAG, "scan: no memory");
+        return;
+    }
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (sdcard_job_begin()) {
+        if (!sdcard_job_should_stop() && sdcard_is_vfs_allowed() && sdcard_is_mounted()) {
+            err = fs_manifest_walk("/", false, scan_collect, &list);
+        }
+        sdcard_job_end();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "scan stopped: %s", esp_err_to_name(err));
+        heap_caps_free(list.items);
+        return;
+    }
+    uint32_t analysed = 0;
+    for (size_t i = 0; i < list.count; ++i) {
+        scan_item_t *it = &list.items[i];
+        if (is_current(it->path, it->size, it->mtime)) {
+            continue;
+        }
+        err = gcode_meta_analyze_file(it->path, SDCARD_IO_BACKGROUND, NULL);
+        if (err == ESP_ERR_INVALID_STATE) {
+            break;
+        }
+        if (err == ESP_OK) {
+            analysed++;
+        }
+    }
+    ESP_LOGI(TAG, "scan: %u G-code files, %lu analysed%s", (unsigned)list.count, (unsigned long)analysed,
+             list.count >= SCAN_MAX_FILES ? " (list truncated)" : "");
+    heap_caps_free(list.items);
+    // The scan follows USB host access, which started a new journal epoch
+    // and so left every compressed sidecar stale.
+    gz_cache_prune(false);
+}
+
+static void scan_task(void *arg)
+{
+    char path[FS_MANIFEST_PATH_LEN];
+    while (true) {
+        if (xQueueReceive(s_queue, path, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (path[0] == '\0') {
+            // Let the UI's first listings after a detach go first.
+            vTaskDelay(pdMS_TO_TICKS(SCAN_SETTLE_MS));
+            s_scan_queued = false;
+            run_scan();
+            continue;
+        }
+        esp_err_t err = gcode_meta_analyze_file(path, SDCARD_IO_BACKGROUND, NULL);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "analyse %s: %s", path, esp_err_to_name(err));
+        }
+    }
+}
+
+static bool ensure_task(void)
+{
+    if (s_queue) {
+        return true;
+    }
+    QueueHandle_t q = xQueueCreate(SCAN_QUEUE_LEN, FS_MANIFEST_PATH_LEN);
+    if (!q) {
+        return false;
+    }
+    s_queue = q;
+    if (xTaskCreate(scan_task, "gcode_meta", SCAN_TASK_STACK, NULL, SCAN_TASK_PRIO, NULL) != pdPASS) {
+        s_queue = NULL;
+        vQueueDelete(q);
+        return false;
+    }
+    return true;
+}
+
+void gcode_meta_schedule(const char *rel_path)
+{
+    char path[FS_MANIFEST_PATH_LEN];
+    if (!rel_path || !gcode_meta_is_gcode(rel_path) || strlen(rel_path) >= sizeof(path) || !ensure_task()) {
+        return;
+    }
+    strncpy(path, rel_path, sizeof(path));
+    if (xQueueSend(s_queue, path, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "queue full, %s left for the next scan", rel_path);
+    }
+}
+
+void gcode_meta_schedule_scan(void)
+{
+    char path[FS_MANIFEST_PATH_LEN] = {0};
+    if (s_scan_queued || !ensure_task()) {
+        return;
+    }
+    s_scan_queued = xQueueSend(s_queue, path, 0) == pdTRUE;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "sdcard.h"
+
+// Job summary of a G-code program: line count, bounding box, feed range,
+// tool changes and a run-time estimate. The analyser is fed the file bytes
+// as they stream past (upload writer, background scan) and keeps only the
+// current line and the modal state.
+//
+// Results are stored as one small JSON sidecar per file under
+// /sdcard/.wimill/meta, trusted only while the file's size and mtime still
+// match. Web uploads (multipart, raw, tar, delta, bulk) feed the analyser
+// as they are written; upload sessions, whose chunks may arrive out of
+// order, and USB host copies are picked up by a background task.
+
+#define GCODE_META_MAX_TOOLS 16
+#define GCODE_META_JSON_LEN 512
+
+typedef struct {
+    uint32_t lines;
+    uint32_t moves;
+    bool has_bounds;
+    float min[3]; // mm, X/Y/Z
+    float max[3];
+    float feed_min; // mm/min over cutting moves, 0 when none
+    float feed_max;
+    uint32_t tool_changes;
+    uint8_t tool_count;
+    uint16_t tools[GCODE_META_MAX_TOOLS]; // in order of first use
+    float cut_mm;
+    float rapid_mm;
+    uint32_t est_s;
+    uint64_t original_bytes; // size as uploaded before compaction, 0 if not compacted
+} gcode_meta_t;
+
+typedef struct gcode_analyzer gcode_analyzer_t;
+
+gcode_analyzer_t *gcode_analyzer_create(void);
+void gcode_analyzer_feed(gcode_analyzer_t *a, const uint8_t *data, size_t len);
+void gcode_analyzer_finish(gcode_analyzer_t *a, gcode_meta_t *out);
+void gcode_analyzer_destroy(gcode_analyzer_t *a);
+
+// G-code by extension (.gcode/.gco/.g/.nc/.ngc/.tap/.cnc).
+bool gcode_meta_is_gcode(const char *name);
+int gcode_meta_to_json(const gcode_meta_t *m, char *out, size_t out_len);
+
+// Sidecar for rel_path; size and mtime are those of the file it describes.
+esp_err_t gcode_meta_store(const char *rel_path, uint64_t size, int64_t mtime, const gcode_meta_t *m);
+// Copies the stored JSON object if the sidecar is current.
+esp_err_t gcode_meta_load_json(const char *rel_path, uint64_t size, int64_t mtime, char *out, size_t out_len);
+// Sparse line index: the analyser also records where every
+// GCODE_LINES_STRIDE-th line starts, so line N is one fseek plus at most
+// STRIDE - 1 skipped lines away. Stored next to the summary, same checks.
+#define GCODE_LINES_STRIDE 1024
+
+typedef struct {
+    uint32_t line; // 0-based number of the indexed line at or before the target
+    uint64_t offset;
+    uint32_t total_lines;
+} gcode_lines_pos_t;
+
+esp_err_t gcode_lines_store(const char *rel_path, uint64_t size, int64_t mtime, const gcode_analyzer_t *a);
+esp_err_t gcode_lines_seek(const char *rel_path, uint64_t size, int64_t mtime, uint32_t line,
+                           gcode_lines_pos_t *out);
+
+// Reads and analyses the whole file as one card job, then stores the
+// summary and the line index. Stops early (ESP_ERR_INVALID_STATE) if the card is about to be
+// unmounted.
+esp_err_t gcode_meta_analyze_file(const char *rel_path, sdcard_io_class_t cls, gcode_meta_t *out);
+
+// Background analysis: one file, or every G-code file on the card without a
+// current sidecar (after USB host access). Never blocks the caller.
+void gcode_meta_schedule(const char *rel_path);
+void gcode_meta_schedule_scan(void);
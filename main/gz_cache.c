@@ -0,0 +1,409 @@
+#include "gz_cache.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+#include "fs_journal.h"
+#include "sdcard.h"
+#include "wimill_pins.h"
+
+#define TAG "GZCACHE"
+#define CACHE_ROOT WIMILL_SD_MOUNT_POINT "/.wimill"
+#define CACHE_DIR_REL "/.wimill/gz"
+#define CACHE_DIR WIMILL_SD_MOUNT_POINT CACHE_DIR_REL
+#define CACHE_FILE_PATH_LEN 64
+#define CACHE_MIN_SIZE 1024
+// Smaller files compress on the fly faster than a sidecar can be looked up.
+#define CACHE_SIDECAR_MIN_SIZE (64 * 1024)
+#define GZIP_HEADER_LEN 10
+#define GZIP_FLAG_EXTRA 0x04
+// Subfield: 'W' 'M', len, then epoch (u32), size (u64), mtime (i64), path.
+#define EXTRA_FIXED_LEN (4 + 4 + 8 + 8)
+// Sidecars are cheap to rebuild (one compressed download), so the cache is
+// kept small next to the card; a prune cuts it back to the low mark so the
+// next few commits do not each walk the directory again.
+#define CACHE_MAX_BYTES (64ull * 1024 * 1024)
+#define CACHE_LOW_BYTES (CACHE_MAX_BYTES / 4 * 3)
+// Entries considered per prune; beyond that the rest waits for the next one.
+#define CACHE_PRUNE_MAX_FILES 1024
+
+typedef struct {
+    char name[16]; // 8 hex digits + ".part"
+    uint64_t size;
+    int64_t mtime;
+} prune_entry_t;
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static gz_cache_stats_t s_stats;
+static bool s_stats_known; // s_stats.files/bytes come from a full listing
+static bool s_pruning;
+
+static const char *const k_text_ext[] = {
+    "gcode", "gco", "g", "nc", "ngc", "tap", "cnc", "txt", "log", "csv",
+    "json", "html", "htm", "css", "js", "svg", "xml", "md", "ini", "cfg",
+};
+
+static uint32_t fnv1a32(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void sidecar_path(const char *rel_path, const char *ext, char *out, size_t out_len)
+{
+    snprintf(out, out_len, "%s/%08lx.%s", CACHE_DIR, (unsigned long)fnv1a32(rel_path), ext);
+}
+
+static bool ensure_cache_dir(void)
+{
+    if (mkdir(CACHE_ROOT, 0775) != 0 && errno != EEXIST) {
+        return false;
+    }
+    if (mkdir(CACHE_DIR, 0775) != 0 && errno != EEXIST) {
+        return false;
+    }
+    return true;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+bool gz_cache_compressible(const char *rel_path, uint64_t size)
+{
+    if (!rel_path || size < CACHE_MIN_SIZE) {
+        return false;
+    }
+    const char *slash = strrchr(rel_path, '/');
+    const char *dot = strrchr(slash ? slash : rel_path, '.');
+    if (!dot) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(k_text_ext) / sizeof(k_text_ext[0]); ++i) {
+        if (strcasecmp(dot + 1, k_text_ext[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t gz_cache_extra(const char *rel_path, uint64_t size, int64_t mtime, uint8_t *out, size_t out_len)
+{
+    size_t path_len = strlen(rel_path);
+    size_t total = EXTRA_FIXED_LEN + path_len;
+    if (total > out_len) {
+        return 0;
+    }
+    fs_journal_state_t js;
+    fs_journal_state(&js);
+    out[0] = 'W';
+    out[1] = 'M';
+    put_le(out + 2, total - 4, 2);
+    put_le(out + 4, js.epoch, 4);
+    put_le(out + 8, size, 8);
+    put_le(out + 16, (uint64_t)mtime, 8);
+    memcpy(out + EXTRA_FIXED_LEN, rel_path, path_len);
+    return total;
+}
+
+// A sidecar is current when its header carries exactly the extra field we
+// would write for the source today.
+static bool header_matches(FILE *f, const uint8_t *want, size_t want_len)
+{
+    uint8_t h[GZIP_HEADER_LEN + 2];
+    if (fread(h, 1, sizeof(h), f) != sizeof(h)) {
+        return false;
+    }
+    if (h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || !(h[3] & GZIP_FLAG_EXTRA)) {
+        return false;
+    }
+    if (((size_t)h[10] | ((size_t)h[11] << 8)) != want_len) {
+        return false;
+    }
+    uint8_t got[GZ_CACHE_EXTRA_MAX];
+    return fread(got, 1, want_len, f) == want_len && memcmp(got, want, want_len) == 0;
+}
+
+FILE *gz_cache_open(const char *rel_path, uint64_t size, int64_t mtime, uint64_t *gz_size)
+{
+    uint8_t want[GZ_CACHE_EXTRA_MAX];
+    size_t want_len = gz_cache_extra(rel_path, size, mtime, want, sizeof(want));
+    if (want_len == 0) {
+        return NULL;
+    }
+    char path[CACHE_FILE_PATH_LEN];
+    sidecar_path(rel_path, "gz", path, sizeof(path));
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    FILE *f = fopen(path, "rb");
+    struct stat st;
+    bool ok = f && fstat(fileno(f), &st) == 0 && header_matches(f, want, want_len) &&
+              fseek(f, 0, SEEK_SET) == 0;
+    sdcard_io_end();
+    if (!ok) {
+        if (f) {
+            ESP_LOGI(TAG, "stale sidecar for %s", rel_path);
+            fclose(f);
+        }
+        return NULL;
+    }
+    if (gz_size) {
+        *gz_size = (uint64_t)st.st_size;
+    }
+    return f;
+}
+
+FILE *gz_cache_create(const char *rel_path, uint64_t size)
+{
+    if (size < CACHE_SIDECAR_MIN_SIZE || !ensure_cache_dir()) {
+        return NULL;
+    }
+    char path[CACHE_FILE_PATH_LEN];
+    sidecar_path(rel_path, "part", path, sizeof(path));
+    sdcard_io_begin(SDCARD_IO_STREAM);
+    FILE *f = fopen(path, "wb");
+    sdcard_io_end();
+    if (!f) {
+        ESP_LOGW(TAG, "create %s failed: %d", path, errno);
+    }
+    return f;
+}
+
+void gz_cache_commit(const char *rel_path, FILE *f, bool ok)
+{
+    if (!f) {
+        return;
+    }
+    char part[CACHE_FILE_PATH_LEN];
+    char path[CACHE_FILE_PATH_LEN];
+    sidecar_path(rel_path, "part", part, sizeof(part));
+    sidecar_path(rel_path, "gz", path, sizeof(path));
+    struct stat st;
+    uint64_t new_size = 0;
+    uint64_t old_size = 0;
+    bool replaced = false;
+    sdcard_io_begin(SDCARD_IO_STREAM);
+    ok = fclose(f) == 0 && ok;
+    if (ok && stat(part, &st) == 0) {
+        new_size = (uint64_t)st.st_size;
+    }
+    if (ok) {
+        replaced = stat(path, &st) == 0;
+        old_size = replaced ? (uint64_t)st.st_size : 0;
+        unlink(path);
+        ok = rename(part, path) == 0;
+    }
+    if (!ok) {
+        unlink(part);
+    }
+    sdcard_io_end();
+
+    portENTER_CRITICAL(&s_mux);
+    if (replaced) {
+        s_stats.files -= s_stats.files > 0 ? 1 : 0;
+        s_stats.bytes -= old_size <= s_stats.bytes ? old_size : s_stats.bytes;
+    }
+    if (ok) {
+        s_stats.files++;
+        s_stats.bytes += new_size;
+    }
+    bool prune = ok && (!s_stats_known || s_stats.bytes > CACHE_MAX_BYTES);
+    portEXIT_CRITICAL(&s_mux);
+    // Downloads hold the file-operation lock, so no other .part is open.
+    if (prune) {
+        gz_cache_prune(true);
+    }
+}
+
+void gz_cache_drop(const char *rel_path)
+{
+    char path[CACHE_FILE_PATH_LEN];
+    sidecar_path(rel_path, "gz", path, sizeof(path));
+    struct stat st;
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    bool removed = stat(path, &st) == 0 && unlink(path) == 0;
+    sdcard_io_end();
+    if (removed) {
+        portENTER_CRITICAL(&s_mux);
+        s_stats.files -= s_stats.files > 0 ? 1 : 0;
+        s_stats.bytes -= (uint64_t)st.st_size <= s_stats.bytes ? (uint64_t)st.st_size : s_stats.bytes;
+        portEXIT_CRITICAL(&s_mux);
+    }
+}
+
+// Epoch in the sidecar's extra field, false if the header is not ours.
+static bool read_epoch(const char *path, uint32_t *epoch)
+{
+    uint8_t h[GZIP_HEADER_LEN + 2 + 8];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fread(h, 1, sizeof(h), f) == sizeof(h);
+    fclose(f);
+    if (!ok || h[0] != 0x1f || h[1] != 0x8b || !(h[3] & GZIP_FLAG_EXTRA) || h[12] != 'W' || h[13] != 'M') {
+        return false;
+    }
+    *epoch = (uint32_t)h[16] | ((uint32_t)h[17] << 8) | ((uint32_t)h[18] << 16) | ((uint32_t)h[19] << 24);
+    return true;
+}
+
+static bool remove_entry(const prune_entry_t *e)
+{
+    char path[CACHE_FILE_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", CACHE_DIR, e->name);
+    sdcard_io_begin(SDCARD_IO_BACKGROUND);
+    bool ok = unlink(path) == 0;
+    sdcard_io_end();
+    return ok;
+}
+
+static int cmp_mtime(const void *a, const void *b)
+{
+    const prune_entry_t *x = a;
+    const prune_entry_t *y = b;
+    return x->mtime < y->mtime ? -1 : x->mtime > y->mtime ? 1 : 0;
+}
+
+static size_t list_cache(prune_entry_t *entries, bool drop_parts, uint32_t *skipped_files, uint64_t *skipped_bytes,
+                         esp_err_t *err)
+{
+    sdcard_dirent_t *ent = malloc(sizeof(*ent));
+    sdcard_dir_t *dir = ent ? sdcard_dir_open(CACHE_DIR_REL) : NULL;
+    size_t count = 0;
+    while (dir && !sdcard_job_should_stop()) {
+        sdcard_io_begin(SDCARD_IO_BACKGROUND);
+        bool more = sdcard_dir_read(dir, ent);
+        sdcard_io_end();
+        if (!more) {
+            *err = sdcard_dir_error(dir);
+            break;
+        }
+        size_t len = strlen(ent->name);
+        bool part = len > 5 && strcasecmp(ent->name + len - 5, ".part") == 0;
+        if (ent->is_dir || (part && !drop_parts) || len >= sizeof(entries[0].name) ||
+            count >= CACHE_PRUNE_MAX_FILES) {
+            if (!ent->is_dir && !part) {
+                (*skipped_files)++;
+                *skipped_bytes += ent->size;
+            }
+            continue;
+        }
+        prune_entry_t *e = &entries[count++];
+        memcpy(e->name, ent->name, len + 1);
+        e->size = ent->size;
+        // A leftover .part sorts first, ahead of every sidecar.
+        e->mtime = part ? INT64_MIN : ent->mtime;
+    }
+    sdcard_dir_close(dir);
+    free(ent);
+    return count;
+}
+
+void gz_cache_prune(bool drop_parts)
+{
+    portENTER_CRITICAL(&s_mux);
+    bool busy = s_pruning;
+    s_pruning = true;
+    portEXIT_CRITICAL(&s_mux);
+    if (busy) {
+        return;
+    }
+    prune_entry_t *entries =
+        heap_caps_malloc(CACHE_PRUNE_MAX_FILES * sizeof(prune_entry_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!entries || !sdcard_job_begin()) {
+        heap_caps_free(entries);
+        portENTER_CRITICAL(&s_mux);
+        s_pruning = false;
+        portEXIT_CRITICAL(&s_mux);
+        return;
+    }
+
+    uint32_t files = 0;
+    uint64_t bytes = 0;
+    esp_err_t list_err = ESP_OK;
+    size_t count = list_cache(entries, drop_parts, &files, &bytes, &list_err);
+    fs_journal_state_t js;
+    fs_journal_state(&js);
+    uint32_t stale = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < count && !sdcard_job_should_stop(); ++i) {
+        prune_entry_t *e = &entries[i];
+        bool is_part = e->mtime == INT64_MIN;
+        uint32_t epoch = 0;
+        if (!is_part) {
+            char path[CACHE_FILE_PATH_LEN];
+            snprintf(path, sizeof(path), "%s/%s", CACHE_DIR, e->name);
+            sdcard_io_begin(SDCARD_IO_BACKGROUND);
+            bool ours = read_epoch(path, &epoch);
+            sdcard_io_end();
+            if (ours && epoch == js.epoch) {
+                entries[kept++] = *e;
+                continue;
+            }
+        }
+        if (remove_entry(e)) {
+            stale += is_part ? 0 : 1;
+        } else {
+            entries[kept++] = *e;
+        }
+    }
+    for (size_t i = 0; i < kept; ++i) {
+        files++;
+        bytes += entries[i].size;
+    }
+
+    uint32_t evicted = 0;
+    uint64_t evicted_bytes = 0;
+    if (bytes > CACHE_MAX_BYTES) {
+        qsort(entries, kept, sizeof(entries[0]), cmp_mtime);
+        for (size_t i = 0; i < kept && bytes > CACHE_LOW_BYTES && !sdcard_job_should_stop(); ++i) {
+            if (remove_entry(&entries[i])) {
+                files--;
+                bytes -= entries[i].size;
+                evicted++;
+                evicted_bytes += entries[i].size;
+            }
+        }
+    }
+    // After a read error the totals miss files; the next commit lists again.
+    bool complete = !sdcard_job_should_stop() && list_err == ESP_OK;
+    sdcard_job_end();
+    heap_caps_free(entries);
+
+    portENTER_CRITICAL(&s_mux);
+    s_stats.files = files;
+    s_stats.bytes = bytes;
+    s_stats.stale_removed += stale;
+    s_stats.evicted += evicted;
+    s_stats.evicted_bytes += evicted_bytes;
+    s_stats_known = complete;
+    s_pruning = false;
+    portEXIT_CRITICAL(&s_mux);
+    if (stale || evicted) {
+        ESP_LOGI(TAG, "prune: %lu stale, %lu evicted (%llu bytes), %lu left (%llu bytes)", (unsigned long)stale,
+                 (unsigned long)evicted, (unsigned long long)evicted_bytes, (unsigned long)files,
+                 (unsigned long long)bytes);
+    }
+}
+
+void gz_cache_get_stats(gz_cache_stats_t *out)
+{
+    portENTER_CRITICAL(&s_mux);
+    *out = s_stats;
+    portEXIT_CRITICAL(&s_mux);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Gzip copies of text files for downloads with Accept-Encoding: gzip. One
+// sidecar per file lives under /sdcard/.wimill/gz, written while the first
+// compressed download streams and served as-is afterwards. The gzip header's
+// extra field records the source path, size, mtime and journal epoch; any
+// mismatch makes the sidecar stale, so USB host edits (new epoch) and
+// rewrites outside the web API never serve old content.
+
+#define GZ_CACHE_EXTRA_MAX 300
+
+// Text-like extension and big enough for compression to pay off.
+bool gz_cache_compressible(const char *rel_path, uint64_t size);
+
+// Builds the FEXTRA payload tying a gzip stream to this version of the
+// source. Returns its length, 0 if the path does not fit.
+size_t gz_cache_extra(const char *rel_path, uint64_t size, int64_t mtime, uint8_t *out, size_t out_len);
+
+// Opens the sidecar if it is current, positioned at offset 0.
+FILE *gz_cache_open(const char *rel_path, uint64_t size, int64_t mtime, uint64_t *gz_size);
+
+// Starts a new sidecar (written to .part); NULL when the file is too small
+// to be worth caching or the cache directory is unavailable.
+FILE *gz_cache_create(const char *rel_path, uint64_t size);
+// Closes the .part file and renames it into place, or discards it.
+void gz_cache_commit(const char *rel_path, FILE *f, bool ok);
+
+void gz_cache_drop(const char *rel_path);
+
+// Removes sidecars of an older journal epoch (stale for good: the epoch only
+// grows) and then the oldest ones until the cache is back under its size
+// cap. A card job of its own; run by the G-code background scan after USB
+// host access, and by gz_cache_commit() once the cache outgrows the cap.
+// Leftover .part files are only removed when drop_parts is set, i.e. when
+// the caller knows no download is writing one.
+void gz_cache_prune(bool drop_parts);
+
+typedef struct {
+    uint32_t files; // sidecars on the card as of the last prune, plus commits since
+    uint64_t bytes;
+    uint32_t stale_removed;   // old epoch or unreadable header
+    uint32_t evicted;         // removed to stay under the cap
+    uint64_t evicted_bytes;
+} gz_cache_stats_t;
+
+void gz_cache_get_stats(gz_cache_stats_t *out);
@@ -0,0 +1,379 @@
+#include "gzip_stream.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "rom/miniz.h"
+
+#define GZIP_IN_BUF_SIZE 4096
+#define GZIP_FLAG_HCRC 0x02
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+#define GZIP_FLAG_COMMENT 0x10
+
+typedef enum {
+    GZIP_STATE_HEADER,
+    GZIP_STATE_BODY,
+    GZIP_STATE_DONE,
+    GZIP_STATE_ERROR,
+} gzip_state_t;
+
+struct gzip_reader {
+    tinfl_decompressor inflator;
+    gzip_src_fn src;
+    void *src_ctx;
+    gzip_state_t state;
+    bool src_eof;
+    size_t in_pos;
+    size_t in_len;
+    size_t dict_pos;
+    size_t out_pos;
+    size_t out_len;
+    uint32_t crc;
+    uint32_t total;
+    uint64_t consumed;
+    // Trailer bytes the inflater had already pulled into its bit buffer.
+    uint8_t back[8];
+    size_t back_pos;
+    size_t back_len;
+    uint8_t in[GZIP_IN_BUF_SIZE];
+    // tinfl needs the output buffer to be the whole (power of two) window.
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+};
+
+gzip_reader_t *gzip_reader_create(gzip_src_fn src, void *src_ctx)
+{
+    if (!src) {
+        return NULL;
+    }
+    gzip_reader_t *gz = heap_caps_calloc(1, sizeof(*gz), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!gz) {
+        return NULL;
+    }
+    gz->src = src;
+    gz->src_ctx = src_ctx;
+    gz->state = GZIP_STATE_HEADER;
+    return gz;
+}
+
+void gzip_reader_destroy(gzip_reader_t *gz)
+{
+    heap_caps_free(gz);
+}
+
+uint64_t gzip_reader_consumed(const gzip_reader_t *gz)
+{
+    return gz ? gz->consumed : 0;
+}
+
+static bool refill(gzip_reader_t *gz)
+{
+    if (gz->in_pos < gz->in_len) {
+        return true;
+    }
+    if (gz->src_eof) {
+        return false;
+    }
+    int n = gz->src(gz->src_ctx, gz->in, sizeof(gz->in));
+    if (n <= 0) {
+        gz->src_eof = true;
+        return false;
+    }
+    gz->in_pos = 0;
+    gz->in_len = (size_t)n;
+    return true;
+}
+
+static int next_byte(gzip_reader_t *gz)
+{
+    if (gz->back_pos < gz->back_len) {
+        gz->consumed++;
+        return gz->back[gz->back_pos++];
+    }
+    if (!refill(gz)) {
+        return -1;
+    }
+    gz->consumed++;
+    return gz->in[gz->in_pos++];
+}
+
+static bool skip_bytes(gzip_reader_t *gz, size_t n)
+{
+    while (n-- > 0) {
+        if (next_byte(gz) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool skip_cstring(gzip_reader_t *gz)
+{
+    int c;
+    while ((c = next_byte(gz)) > 0) {
+    }
+    return c == 0;
+}
+
+static bool read_le32(gzip_reader_t *gz, uint32_t *out)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+        int c = next_byte(gz);
+        if (c < 0) {
+            return false;
+        }
+        v |= (uint32_t)c << (8 * i);
+    }
+    *out = v;
+    return true;
+}
+
+static bool parse_header(gzip_reader_t *gz)
+{
+    uint8_t h[10];
+    for (size_t i = 0; i < sizeof(h); ++i) {
+        int c = next_byte(gz);
+        if (c < 0) {
+            return false;
+        }
+        h[i] = (uint8_t)c;
+    }
+    if (h[0] != 0x1f || h[1] != 0x8b || h[2] != 8) {
+        return false;
+    }
+    uint8_t flags = h[3];
+    if (flags & GZIP_FLAG_EXTRA) {
+        int lo = next_byte(gz);
+        int hi = next_byte(gz);
+        if (lo < 0 || hi < 0 || !skip_bytes(gz, (size_t)lo | ((size_t)hi << 8))) {
+            return false;
+        }
+    }
+    if ((flags & GZIP_FLAG_NAME) && !skip_cstring(gz)) {
+        return false;
+    }
+    if ((flags & GZIP_FLAG_COMMENT) && !skip_cstring(gz)) {
+        return false;
+    }
+    if ((flags & GZIP_FLAG_HCRC) && !skip_bytes(gz, 2)) {
+        return false;
+    }
+    tinfl_init(&gz->inflator);
+    return true;
+}
+
+// The ROM tinfl (miniz 1.15) has no put-back: its Huffman fast path reads
+// two bytes at a time, so when the last block ends up to m_num_bits / 8
+// bytes past the deflate stream sit in m_bit_buf, already counted as
+// consumed. They may come from an earlier input buffer, so they are taken
+// from the bit buffer (low byte first, after the partial byte's bits) rather
+// than by rewinding in_pos.
+static void put_back_lookahead(gzip_reader_t *gz)
+{
+    uint32_t bits = gz->inflator.m_num_bits;
+    uint64_t buf = (uint64_t)gz->inflator.m_bit_buf >> (bits & 7);
+    size_t n = bits >> 3;
+    if (n > sizeof(gz->back)) {
+        n = sizeof(gz->back);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        gz->back[i] = (uint8_t)(buf >> (8 * i));
+    }
+    gz->back_pos = 0;
+    gz->back_len = n;
+    gz->consumed -= n;
+}
+
+static bool check_trailer(gzip_reader_t *gz)
+{
+    put_back_lookahead(gz);
+    uint32_t crc = 0;
+    uint32_t size = 0;
+    return read_le32(gz, &crc) && read_le32(gz, &size) && crc == gz->crc && size == gz->total;
+}
+
+int gzip_reader_read(gzip_reader_t *gz, uint8_t *dst, size_t len)
+{
+    if (!gz || !dst) {
+        return -1;
+    }
+    while (true) {
+        if (gz->out_len > 0) {
+            size_t n = gz->out_len < len ? gz->out_len : len;
+            memcpy(dst, gz->dict + gz->out_pos, n);
+            gz->out_pos += n;
+            gz->out_len -= n;
+            return (int)n;
+        }
+        if (gz->state == GZIP_STATE_DONE) {
+            return 0;
+        }
+        if (gz->state == GZIP_STATE_ERROR) {
+            return -1;
+        }
+        if (gz->state == GZIP_STATE_HEADER) {
+            gz->state = parse_header(gz) ? GZIP_STATE_BODY : GZIP_STATE_ERROR;
+            continue;
+        }
+
+        bool more = refill(gz);
+        size_t in_avail = gz->in_len - gz->in_pos;
+        size_t out_avail = TINFL_LZ_DICT_SIZE - gz->dict_pos;
+        tinfl_status status = tinfl_decompress(&gz->inflator, gz->in + gz->in_pos, &in_avail,
+                                               gz->dict, gz->dict + gz->dict_pos, &out_avail,
+                                               more ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+        gz->in_pos += in_avail;
+        gz->consumed += in_avail;
+        if (out_avail > 0) {
+            gz->crc = esp_rom_crc32_le(gz->crc, gz->dict + gz->dict_pos, (uint32_t)out_avail);
+            gz->total += (uint32_t)out_avail;
+            gz->out_pos = gz->dict_pos;
+            gz->out_len = out_avail;
+            gz->dict_pos = (gz->dict_pos + out_avail) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+        // Pending output is still handed out; the error surfaces on the next call.
+        if (status < 0 || (status == TINFL_STATUS_NEEDS_MORE_INPUT && !more)) {
+            gz->state = GZIP_STATE_ERROR;
+        } else if (status == TINFL_STATUS_DONE) {
+            gz->state = check_trailer(gz) ? GZIP_STATE_DONE : GZIP_STATE_ERROR;
+        }
+    }
+}
+
+// miniz level 2: greedy parsing, few hash probes. Text still shrinks 3-5x
+// while the core stays free enough to keep the socket busy.
+#define GZIP_DEFLATE_FLAGS (6 | TDEFL_GREEDY_PARSING_FLAG)
+#define GZIP_OS_UNKNOWN 255
+
+struct gzip_writer {
+    tdefl_compressor deflator;
+    gzip_sink_fn sink;
+    void *sink_ctx;
+    bool failed;
+    bool finished;
+    bool header_sent;
+    uint32_t crc;
+    uint32_t total;
+    uint64_t produced;
+    size_t header_len;
+    // Emitted with the first output, so nothing reaches the sink (and the
+    // caller can still change its mind) until data actually flows.
+    uint8_t header[];
+};
+
+static bool emit(gzip_writer_t *gz, const uint8_t *data, size_t len)
+{
+    if (gz->failed) {
+        return false;
+    }
+    if (len > 0 && !gz->sink(gz->sink_ctx, data, len)) {
+        gz->failed = true;
+        return false;
+    }
+    gz->produced += len;
+    return true;
+}
+
+static bool emit_header(gzip_writer_t *gz)
+{
+    if (gz->header_sent) {
+        return true;
+    }
+    gz->header_sent = true;
+    return emit(gz, gz->header, gz->header_len);
+}
+
+static mz_bool deflate_put(const void *buf, int len, void *user)
+{
+    gzip_writer_t *gz = (gzip_writer_t *)user;
+    return emit_header(gz) && emit(gz, buf, (size_t)len);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+gzip_writer_t *gzip_writer_create(gzip_sink_fn sink, void *sink_ctx,
+                                  const uint8_t *extra, size_t extra_len)
+{
+    if (!sink || extra_len > 0xffff || (extra_len > 0 && !extra)) {
+        return NULL;
+    }
+    size_t header_len = extra_len > 0 ? 12 + extra_len : 10;
+    // ~320 KB of hash chains and output buffer: PSRAM only.
+    gzip_writer_t *gz = heap_caps_calloc(1, sizeof(*gz) + header_len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!gz) {
+        return NULL;
+    }
+    gz->sink = sink;
+    gz->sink_ctx = sink_ctx;
+    if (tdefl_init(&gz->deflator, deflate_put, gz, GZIP_DEFLATE_FLAGS) != TDEFL_STATUS_OKAY) {
+        heap_caps_free(gz);
+        return NULL;
+    }
+
+    uint8_t *h = gz->header;
+    h[0] = 0x1f;
+    h[1] = 0x8b;
+    h[2] = 8;
+    h[3] = extra_len > 0 ? GZIP_FLAG_EXTRA : 0;
+    h[9] = GZIP_OS_UNKNOWN;
+    if (extra_len > 0) {
+        h[10] = (uint8_t)extra_len;
+        h[11] = (uint8_t)(extra_len >> 8);
+        memcpy(h + 12, extra, extra_len);
+    }
+    gz->header_len = header_len;
+    return gz;
+}
+
+bool gzip_writer_write(gzip_writer_t *gz, const uint8_t *data, size_t len)
+{
+    if (!gz || gz->failed || gz->finished) {
+        return false;
+    }
+    if (len == 0) {
+        return true;
+    }
+    gz->crc = esp_rom_crc32_le(gz->crc, data, (uint32_t)len);
+    gz->total += (uint32_t)len;
+    if (tdefl_compress_buffer(&gz->deflator, data, len, TDEFL_NO_FLUSH) != TDEFL_STATUS_OKAY) {
+        gz->failed = true;
+    }
+    return !gz->failed;
+}
+
+bool gzip_writer_finish(gzip_writer_t *gz)
+{
+    if (!gz || gz->failed || gz->finished) {
+        return false;
+    }
+    gz->finished = true;
+    if (tdefl_compress_buffer(&gz->deflator, NULL, 0, TDEFL_FINISH) != TDEFL_STATUS_DONE) {
+        gz->failed = true;
+        return false;
+    }
+    uint8_t trailer[8];
+    if (!emit_header(gz)) {
+        return false;
+    }
+    put_le32(trailer, gz->crc);
+    put_le32(trailer + 4, gz->total);
+    return emit(gz, trailer, sizeof(trailer));
+}
+
+uint64_t gzip_writer_produced(const gzip_writer_t *gz)
+{
+    return gz ? gz->produced : 0;
+}
+
+void gzip_writer_destroy(gzip_writer_t *gz)
+{
+    heap_caps_free(gz);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming gzip (RFC 1952) decoder on top of the ROM inflater. Input is
+// pulled from `src` on demand; output is handed out of the 32 KB history
+// window, so no buffer proportional to the file size is ever needed.
+
+// Returns bytes placed in dst, 0 at end of input, < 0 on error.
+typedef int (*gzip_src_fn)(void *ctx, uint8_t *dst, size_t len);
+
+typedef struct gzip_reader gzip_reader_t;
+
+gzip_reader_t *gzip_reader_create(gzip_src_fn src, void *src_ctx);
+// Returns bytes produced, 0 once the trailer (CRC32 + size) checked out,
+// < 0 on corrupt or truncated input.
+int gzip_reader_read(gzip_reader_t *gz, uint8_t *dst, size_t len);
+// Compressed bytes consumed so far, header and trailer included.
+uint64_t gzip_reader_consumed(const gzip_reader_t *gz);
+void gzip_reader_destroy(gzip_reader_t *gz);
+
+// Streaming gzip encoder on top of the ROM deflater. Compressed output is
+// pushed to `sink` as the deflater's output buffer fills; the header (with
+// an optional caller-supplied FEXTRA field) goes out with the first block,
+// so creating a writer never touches the sink.
+
+// Returns false to abort the stream (e.g. the client went away).
+typedef bool (*gzip_sink_fn)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct gzip_writer gzip_writer_t;
+
+// `extra` is the raw FEXTRA payload (subfields included) or NULL.
+gzip_writer_t *gzip_writer_create(gzip_sink_fn sink, void *sink_ctx,
+                                  const uint8_t *extra, size_t extra_len);
+bool gzip_writer_write(gzip_writer_t *gz, const uint8_t *data, size_t len);
+// Flushes the deflater and emits the trailer (CRC32 + size).
+bool gzip_writer_finish(gzip_writer_t *gz);
+// Compressed bytes handed to the sink so far, header and trailer included.
+uint64_t gzip_writer_produced(const gzip_writer_t *gz);
+void gzip_writer_destroy(gzip_writer_t *gz);
@@ -0,0 +1,438 @@
+#include "hash_index.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "sdcard.h"
+#include "wimill_pins.h"
+
+#define TAG "HASHIDX"
+#define INDEX_ROOT WIMILL_SD_MOUNT_POINT "/.wimill"
+#define INDEX_DIR INDEX_ROOT "/hash"
+#define INDEX_MAGIC "wimill-hash 1 "
+#define INDEX_FILE_PATH_LEN 64
+#define INDEX_LINE_LEN 400
+#define INDEX_HASH_BUF_SIZE (16 * 1024)
+
+static uint32_t fnv1a32(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void index_file_path(const char *rel_dir, const char *ext, char *out, size_t out_len)
+{
+    snprintf(out, out_len, "%s/%08lx.%s", INDEX_DIR, (unsigned long)fnv1a32(rel_dir), ext);
+}
+
+static bool ensure_index_dir(void)
+{
+    if (mkdir(INDEX_ROOT, 0775) != 0 && errno != EEXIST) {
+        return false;
+    }
+    if (mkdir(INDEX_DIR, 0775) != 0 && errno != EEXIST) {
+        return false;
+    }
+    return true;
+}
+
+static void strip_eol(char *line)
+{
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        line[--len] = '\0';
+    }
+}
+
+// Opens the index for rel_dir and checks the header, so an FNV clash between
+// two directories reads as "no index" instead of returning foreign entries.
+static FILE *open_index(const char *rel_dir)
+{
+    char path[INDEX_FILE_PATH_LEN];
+    index_file_path(rel_dir, "idx", path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+    char line[INDEX_LINE_LEN];
+    if (!fgets(line, sizeof(line), f)) {
+        fclose(f);
+        return NULL;
+    }
+    strip_eol(line);
+    if (strncmp(line, INDEX_MAGIC, strlen(INDEX_MAGIC)) != 0 ||
+        strcmp(line + strlen(INDEX_MAGIC), rel_dir) != 0) {
+        ESP_LOGW(TAG, "index %s belongs to another dir", path);
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+// Entry line: "<sha256 hex> <size> <mtime> <name>"; the name goes last so it
+// may contain spaces.
+static bool parse_entry(char *line, char *hex, uint64_t *size, int64_t *mtime, char **name)
+{
+    unsigned long long sz = 0;
+    long long mt = 0;
+    int consumed = 0;
+    strip_eol(line);
+    if (sscanf(line, "%64s %llu %lld %n", hex, &sz, &mt, &consumed) != 3 || consumed == 0 ||
+        strlen(hex) != HASH_INDEX_HEX_LEN - 1) {
+        return false;
+    }
+    *size = (uint64_t)sz;
+    *mtime = (int64_t)mt;
+    *name = line + consumed;
+    return (*name)[0] != '\0';
+}
+
+// Rewrites the index, dropping (or renaming) the entry for `name` and
+// appending `add_*` if given. Written to .new and renamed like the upload
+// session files.
+static bool is_added(const hash_index_item_t *adds, size_t add_count, const char *name)
+{
+    for (size_t i = 0; i < add_count; ++i) {
+        if (strcmp(adds[i].name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drops `name` (or renames it to new_name) and appends `adds`, replacing any
+// older entries of the same names, in one pass over the index file.
+static esp_err_t rewrite_index(const char *rel_dir, const char *name, const char *new_name,
+                               const hash_index_item_t *adds, size_t add_count)
+{
+    if (!ensure_index_dir()) {
+        return ESP_FAIL;
+    }
+    char path[INDEX_FILE_PATH_LEN];
+    char tmp[INDEX_FILE_PATH_LEN];
+    index_file_path(rel_dir, "idx", path, sizeof(path));
+    index_file_path(rel_dir, "new", tmp, sizeof(tmp));
+
+    FILE *in = open_index(rel_dir);
+    FILE *out = fopen(tmp, "w");
+    if (!out) {
+        if (in) {
+            fclose(in);
+        }
+        return ESP_FAIL;
+    }
+    fprintf(out, "%s%s\n", INDEX_MAGIC, rel_dir);
+
+    uint32_t entries = 0;
+    char line[INDEX_LINE_LEN];
+    char hex[HASH_INDEX_HEX_LEN];
+    while (in && fgets(line, sizeof(line), in)) {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        char *entry_name = NULL;
+        if (!parse_entry(line, hex, &size, &mtime, &entry_name)) {
+            continue;
+        }
+        bool is_target = name && strcmp(entry_name, name) == 0;
+        if (new_name && strcmp(entry_name, new_name) == 0) {
+            continue;
+        }
+        if ((is_target && !new_name) || is_added(adds, add_count, entry_name)) {
+            continue;
+        }
+        fprintf(out, "%s %llu %lld %s\n", hex, (unsigned long long)size, (long long)mtime,
+                is_target ? new_name : entry_name);
+        entries++;
+    }
+    if (in) {
+        fclose(in);
+    }
+    for (size_t i = 0; i < add_count; ++i) {
+        fprintf(out, "%s %llu %lld %s\n", adds[i].hex, (unsigned long long)adds[i].size,
+                (long long)adds[i].mtime, adds[i].name);
+        entries++;
+    }
+    bool ok = (fflush(out) == 0);
+    fsync(fileno(out));
+    fclose(out);
+    if (!ok) {
+        unlink(tmp);
+        return ESP_FAIL;
+    }
+    unlink(path);
+    if (entries == 0) {
+        unlink(tmp);
+        return ESP_OK;
+    }
+    return rename(tmp, path) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static void hex_lower(const char *hex, char *out)
+{
+    for (size_t i = 0; i < HASH_INDEX_HEX_LEN; ++i) {
+        out[i] = (hex[i] >= 'A' && hex[i] <= 'F') ? (char)(hex[i] - 'A' + 'a') : hex[i];
+    }
+}
+
+esp_err_t hash_index_lookup(const char *rel_dir, const char *name, uint64_t size, int64_t mtime,
+                            char *hex_out)
+{
+    if (!rel_dir || !name || !hex_out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    FILE *f = open_index(rel_dir);
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    char line[INDEX_LINE_LEN];
+    char hex[HASH_INDEX_HEX_LEN];
+    while (fgets(line, sizeof(line), f)) {
+        uint64_t entry_size = 0;
+        int64_t entry_mtime = 0;
+        char *entry_name = NULL;
+        if (!parse_entry(line, hex, &entry_size, &entry_mtime, &entry_name) ||
+            strcmp(entry_name, name) != 0) {
+            continue;
+        }
+        // Same name but edited behind our back (e.g. over USB): stale.
+        if (entry_size == size && entry_mtime == mtime) {
+            memcpy(hex_out, hex, HASH_INDEX_HEX_LEN);
+            err = ESP_OK;
+        } else {
+            err = ESP_ERR_INVALID_STATE;
+        }
+        break;
+    }
+    fclose(f);
+    return err;
+}
+
+esp_err_t hash_index_put(const char *rel_dir, const char *name, uint64_t size, int64_t mtime,
+                         const char *hex)
+{
+    if (!rel_dir || !name || !hex || strlen(hex) != HASH_INDEX_HEX_LEN - 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    hash_index_item_t item = {
+        .name = name,
+        .size = size,
+        .mtime = mtime,
+    };
+    hex_lower(hex, item.hex);
+    esp_err_t err = rewrite_index(rel_dir, NULL, NULL, &item, 1);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "index update failed for %s/%s", rel_dir, name);
+    }
+    return err;
+}
+
+esp_err_t hash_index_put_batch(const char *rel_dir, const hash_index_item_t *items, size_t count)
+{
+    if (!rel_dir || (!items && count > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (count == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = rewrite_index(rel_dir, NULL, NULL, items, count);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "index update failed for %s (%u entries)", rel_dir, (unsigned)count);
+    }
+    return err;
+}
+
+esp_err_t hash_index_remove(const char *rel_dir, const char *name)
+{
+    if (!rel_dir || !name) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    FILE *f = open_index(rel_dir);
+    if (!f) {
+        return ESP_OK;
+    }
+    fclose(f);
+    return rewrite_index(rel_dir, name, NULL, NULL, 0);
+}
+
+esp_err_t hash_index_rename(const char *rel_dir, const char *old_name, const char *new_name)
+{
+    if (!rel_dir || !old_name || !new_name) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    FILE *f = open_index(rel_dir);
+    if (!f) {
+        return ESP_OK;
+    }
+    fclose(f);
+    return rewrite_index(rel_dir, old_name, new_name, NULL, 0);
+}
+
+esp_err_t hash_index_drop_dir(const char *rel_dir)
+{
+    if (!rel_dir) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    FILE *f = open_index(rel_dir);
+    if (!f) {
+        return ESP_OK;
+    }
+    fclose(f);
+    char path[INDEX_FILE_PATH_LEN];
+    index_file_path(rel_dir, "idx", path, sizeof(path));
+    unlink(path);
+    return ESP_OK;
+}
+
+typedef struct {
+    char *name;
+    uint64_t size;
+    int64_t mtime;
+    char hex[HASH_INDEX_HEX_LEN];
+} dir_entry_t;
+
+struct hash_index_dir {
+    dir_entry_t *entries;
+    uint32_t count;
+    uint32_t cap;
+};
+
+hash_index_dir_t *hash_index_dir_load(const char *rel_dir)
+{
+    if (!rel_dir) {
+        return NULL;
+    }
+    FILE *f = open_index(rel_dir);
+    if (!f) {
+        return NULL;
+    }
+    hash_index_dir_t *dir = calloc(1, sizeof(*dir));
+    char line[INDEX_LINE_LEN];
+    char hex[HASH_INDEX_HEX_LEN];
+    while (dir && fgets(line, sizeof(line), f)) {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        char *name = NULL;
+        if (!parse_entry(line, hex, &size, &mtime, &name)) {
+            continue;
+        }
+        if (dir->count == dir->cap) {
+            uint32_t cap = dir->cap ? dir->cap * 2 : 32;
+            dir_entry_t *grown = heap_caps_realloc(dir->entries, cap * sizeof(dir_entry_t),
+                                                   MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (!grown) {
+                break;
+            }
+            dir->entries = grown;
+            dir->cap = cap;
+        }
+        dir_entry_t *e = &dir->entries[dir->count];
+        e->name = strdup(name);
+        if (!e->name) {
+            break;
+        }
+        e->size = size;
+        e->mtime = mtime;
+        memcpy(e->hex, hex, sizeof(e->hex));
+        dir->count++;
+    }
+    fclose(f);
+    return dir;
+}
+
+bool hash_index_dir_find(const hash_index_dir_t *dir, const char *name, uint64_t size, int64_t mtime,
+                         char *hex_out)
+{
+    for (uint32_t i = 0; dir && i < dir->count; ++i) {
+        const dir_entry_t *e = &dir->entries[i];
+        if (strcmp(e->name, name) == 0) {
+            if (e->size != size || e->mtime != mtime) {
+                return false;
+            }
+            memcpy(hex_out, e->hex, HASH_INDEX_HEX_LEN);
+            return true;
+        }
+    }
+    return false;
+}
+
+void hash_index_dir_free(hash_index_dir_t *dir)
+{
+    if (!dir) {
+        return;
+    }
+    for (uint32_t i = 0; i < dir->count; ++i) {
+        free(dir->entries[i].name);
+    }
+    heap_caps_free(dir->entries);
+    free(dir);
+}
+
+void hash_index_to_hex(const uint8_t digest[32], char *hex_out)
+{
+    for (size_t i = 0; i < 32; ++i) {
+        snprintf(hex_out + i * 2, 3, "%02x", digest[i]);
+    }
+}
+
+esp_err_t hash_index_file_sha256(const char *full_path, uint64_t limit, char *hex_out)
+{
+    if (!full_path || !hex_out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    FILE *f = fopen(full_path, "rb");
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t *buf = heap_caps_malloc(INDEX_HASH_BUF_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf) {
+        buf = heap_caps_malloc(INDEX_HASH_BUF_SIZE, MALLOC_CAP_8BIT);
+    }
+    if (!buf) {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    size_t n = 0;
+    uint64_t total = 0;
+    while (limit == 0 || total < limit) {
+        sdcard_io_begin(SDCARD_IO_STREAM);
+        n = fread(buf, 1, INDEX_HASH_BUF_SIZE, f);
+        sdcard_io_end();
+        if (n == 0) {
+            break;
+        }
+        if (limit && total + n > limit) {
+            n = (size_t)(limit - total);
+        }
+        mbedtls_sha256_update(&sha, buf, n);
+        total += n;
+    }
+    bool read_err = ferror(f) != 0;
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    heap_caps_free(buf);
+    fclose(f);
+    if (read_err || (limit && total != limit)) {
+        return ESP_FAIL;
+    }
+    hash_index_to_hex(digest, hex_out);
+    return ESP_OK;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define HASH_INDEX_HEX_LEN 65
+
+// Per-directory SHA-256 index of uploaded files. One index file per directory
+// lives under /sdcard/.wimill/hash, so job folders seen by the machine over
+// USB stay free of sidecars. An entry is only trusted while the file's size
+// and mtime still match what was recorded.
+esp_err_t hash_index_lookup(const char *rel_dir, const char *name, uint64_t size, int64_t mtime,
+                            char *hex_out);
+esp_err_t hash_index_put(const char *rel_dir, const char *name, uint64_t size, int64_t mtime,
+                         const char *hex);
+
+// Adds or replaces several entries of one directory with a single index
+// rewrite; hex must already be lowercase (hash_index_to_hex output).
+typedef struct {
+    const char *name;
+    uint64_t size;
+    int64_t mtime;
+    char hex[HASH_INDEX_HEX_LEN];
+} hash_index_item_t;
+esp_err_t hash_index_put_batch(const char *rel_dir, const hash_index_item_t *items, size_t count);
+
+esp_err_t hash_index_remove(const char *rel_dir, const char *name);
+esp_err_t hash_index_rename(const char *rel_dir, const char *old_name, const char *new_name);
+esp_err_t hash_index_drop_dir(const char *rel_dir);
+
+// Whole-directory view for walkers that look up many names in a row.
+typedef struct hash_index_dir hash_index_dir_t;
+hash_index_dir_t *hash_index_dir_load(const char *rel_dir);
+bool hash_index_dir_find(const hash_index_dir_t *dir, const char *name, uint64_t size, int64_t mtime,
+                         char *hex_out);
+void hash_index_dir_free(hash_index_dir_t *dir);
+
+// Hashes up to `limit` bytes of the file (0 = whole file).
+esp_err_t hash_index_file_sha256(const char *full_path, uint64_t limit, char *hex_out);
+void hash_index_to_hex(const uint8_t digest[32], char *hex_out);
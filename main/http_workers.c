@@ -0,0 +1,163 @@
+#include "http_workers.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#define TAG "HTTPW"
+// Same stack as the httpd task the handlers were written for; one step
+// below its priority so the server keeps accepting and answering.
+#define HTTP_WORKER_STACK 16384
+#define HTTP_WORKER_PRIO 4
+
+typedef struct {
+    httpd_req_t *req;
+    esp_err_t (*handler)(httpd_req_t *req);
+} http_job_t;
+
+typedef struct {
+    const char *name;
+    uint8_t workers;
+    uint8_t queue_len;
+    QueueHandle_t queue;
+    volatile uint32_t active;
+    volatile uint32_t done;
+    volatile uint32_t rejected;
+} http_class_t;
+
+#define BULK_WORKERS 1
+#define BULK_QUEUE_LEN 3
+#define SCAN_WORKERS 1
+#define SCAN_QUEUE_LEN 2
+_Static_assert(BULK_WORKERS + BULK_QUEUE_LEN + SCAN_WORKERS + SCAN_QUEUE_LEN <= HTTP_WORKERS_MAX_SOCKETS,
+               "HTTP_WORKERS_MAX_SOCKETS is what setup_mode sizes the server by");
+
+static http_class_t s_classes[HTTP_WORK_CLASS_COUNT] = {
+    [HTTP_WORK_BULK] = {.name = "bulk", .workers = BULK_WORKERS, .queue_len = BULK_QUEUE_LEN},
+    [HTTP_WORK_SCAN] = {.name = "scan", .workers = SCAN_WORKERS, .queue_len = SCAN_QUEUE_LEN},
+};
+static bool s_started = false;
+
+static void worker_task(void *arg)
+{
+    http_class_t *c = (http_class_t *)arg;
+    while (true) {
+        http_job_t job;
+        if (xQueueReceive(c->queue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        c->active++;
+        // As on the httpd task: a failed handler (e.g. an aborted send) may
+        // have left the exchange half done, so the keep-alive socket goes.
+        if (job.handler(job.req) != ESP_OK) {
+            httpd_sess_trigger_close(job.req->handle, httpd_req_to_sockfd(job.req));
+        }
+        httpd_req_async_handler_complete(job.req);
+        c->active--;
+        c->done++;
+    }
+}
+
+// Called from the httpd task only.
+static bool ensure_started(void)
+{
+    if (s_started) {
+        return true;
+    }
+    for (int i = 0; i < HTTP_WORK_CLASS_COUNT; ++i) {
+        http_class_t *c = &s_classes[i];
+        if (!c->queue) {
+            c->queue = xQueueCreate(c->queue_len, sizeof(http_job_t));
+            if (!c->queue) {
+                return false;
+            }
+            for (int w = 0; w < c->workers; ++w) {
+                char name[16];
+                snprintf(name, sizeof(name), "httpw_%s%d", c->name, w);
+                if (xTaskCreate(worker_task, name, HTTP_WORKER_STACK, c, HTTP_WORKER_PRIO, NULL) != pdPASS) {
+                    ESP_LOGE(TAG, "%s worker %d: no memory", c->name, w);
+                    return false;
+                }
+            }
+        }
+    }
+    s_started = true;
+    return true;
+}
+
+void http_drain_body(httpd_req_t *req)
+{
+    char buf[256];
+    size_t remaining = req->content_len;
+    while (remaining > 0) {
+        int r = httpd_req_recv(req, buf, remaining > sizeof(buf) ? sizeof(buf) : remaining);
+        if (r == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        remaining -= (size_t)r;
+    }
+}
+
+// Runs on the httpd task, so the body of a rejected upload is not read
+// here (that would stall every other URI for as long as it takes): the
+// reply says the connection closes, and the socket goes with the rest.
+static esp_err_t reject_busy(httpd_req_t *req, http_class_t *c)
+{
+    c->rejected++;
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    httpd_resp_set_hdr(req, "Connection", "close");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"error\":\"BUSY\"}", HTTPD_RESP_USE_STRLEN);
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    return ESP_OK;
+}
+
+esp_err_t http_workers_dispatch(httpd_req_t *req)
+{
+    const http_work_t *work = (const http_work_t *)req->user_ctx;
+    if (!work || work->cls >= HTTP_WORK_CLASS_COUNT) {
+        return ESP_FAIL;
+    }
+    http_class_t *c = &s_classes[work->cls];
+    if (!ensure_started()) {
+        return work->handler(req);
+    }
+    if (uxQueueSpacesAvailable(c->queue) == 0) {
+        return reject_busy(req, c);
+    }
+    httpd_req_t *async_req = NULL;
+    if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK) {
+        return work->handler(req);
+    }
+    http_job_t job = {.req = async_req, .handler = work->handler};
+    if (xQueueSend(c->queue, &job, 0) != pdTRUE) {
+        reject_busy(async_req, c);
+        httpd_req_async_handler_complete(async_req);
+    }
+    return ESP_OK;
+}
+
+void http_workers_stats(http_work_class_t cls, http_workers_stats_t *out)
+{
+    if (!out || cls >= HTTP_WORK_CLASS_COUNT) {
+        return;
+    }
+    const http_class_t *c = &s_classes[cls];
+    out->queued = c->queue ? (uint32_t)uxQueueMessagesWaiting(c->queue) : 0;
+    out->active = c->active;
+    out->done = c->done;
+    out->rejected = c->rejected;
+}
+
+const char *http_workers_class_name(http_work_class_t cls)
+{
+    return cls < HTTP_WORK_CLASS_COUNT ? s_classes[cls].name : "unknown";
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Moves long-running handlers off the single esp_http_server task so status
+// and UI requests are answered while a transfer is in progress. Each class
+// has its own worker task(s) and a small queue: requests beyond the running
+// ones wait their turn, and once the queue is full they get 503 with
+// Retry-After. Handlers run unchanged on the async copy of the request.
+
+typedef enum {
+    HTTP_WORK_BULK, // uploads, downloads, archives: one at a time
+    HTTP_WORK_SCAN, // whole-file hashing, manifests, plans
+    HTTP_WORK_CLASS_COUNT,
+} http_work_class_t;
+
+// Sockets the workers can hold at once: every worker busy and every queue
+// full. The server needs more than this open, or status and the UI page
+// have no socket left while transfers wait.
+#define HTTP_WORKERS_MAX_SOCKETS 7
+
+typedef struct {
+    esp_err_t (*handler)(httpd_req_t *req);
+    http_work_class_t cls;
+} http_work_t;
+
+typedef struct {
+    uint32_t queued;   // waiting right now
+    uint32_t active;   // running right now
+    uint32_t done;
+    uint32_t rejected; // answered 503
+} http_workers_stats_t;
+
+// URI handler for offloaded endpoints: register it with .user_ctx pointing
+// to a static http_work_t. Falls back to running the handler inline when
+// the workers cannot be started.
+esp_err_t http_workers_dispatch(httpd_req_t *req);
+// Reads and discards the rest of the request body, so an early error reply
+// leaves the keep-alive connection in step.
+void http_drain_body(httpd_req_t *req);
+void http_workers_stats(http_work_class_t cls, http_workers_stats_t *out);
+const char *http_workers_class_name(http_work_class_t cls);
@@ -0,0 +1,471 @@
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "boot_time.h"
+#include "gz_cache.h"
+#include "http_workers.h"
+#include "msc.h"
+#include "sdcard.h"
+#include "setup_mode.h"
+#include "web_fs.h"
+#include "xfer_buf.h"
+
+// Output is streamed as chunked text from one small buffer, so the response
+// size does not depend on the number of tasks. Both formats come from the
+// same family()/sample() calls; JSON is
+//   {"uptime_us":N,"metrics":[{"name","type","help","samples":[{"labels":{..},"value":N}]}]}
+// Times are integer microseconds (the _us suffix), as everywhere else in the
+// firmware, rather than Prometheus' float seconds.
+
+#define TAG "METRICS"
+#define METRICS_CHUNK 1024
+#define METRICS_LABEL_MAX 32
+#define METRICS_TASKS_EXTRA 4
+
+typedef struct {
+    httpd_req_t *req;
+    bool json;
+    bool failed;
+    bool in_family;
+    bool first_family;
+    bool first_sample;
+    const char *name;
+    size_t len;
+    char buf[METRICS_CHUNK];
+} metrics_out_t;
+
+static void out_flush(metrics_out_t *o)
+{
+    if (o->len == 0 || o->failed) {
+        o->len = 0;
+        return;
+    }
+    if (httpd_resp_send_chunk(o->req, o->buf, o->len) != ESP_OK) {
+        o->failed = true;
+    }
+    o->len = 0;
+}
+
+static void out_printf(metrics_out_t *o, const char *fmt, ...)
+{
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(o->buf + o->len, sizeof(o->buf) - o->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return;
+        }
+        if (o->len + (size_t)n < sizeof(o->buf)) {
+            o->len += (size_t)n;
+            return;
+        }
+        // Did not fit: send what is there and format again into the empty
+        // buffer. Lines are far shorter than a chunk.
+        out_flush(o);
+    }
+}
+
+// Label values are task names and fixed words; '"' and '\' are escaped the
+// same way in both formats.
+static void escape_label(char *dst, size_t dst_len, const char *src)
+{
+    size_t di = 0;
+    for (; src && *src && di + 2 < dst_len; ++src) {
+        char c = *src;
+        if (c == '"' || c == '\\') {
+            dst[di++] = '\\';
+        } else if ((unsigned char)c < 0x20) {
+            c = '_';
+        }
+        dst[di++] = c;
+    }
+    dst[di] = '\0';
+}
+
+static void family(metrics_out_t *o, const char *name, const char *type, const char *help)
+{
+    o->name = name;
+    if (!o->json) {
+        out_printf(o, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+        return;
+    }
+    out_printf(o, "%s{\"name\":\"%s\",\"type\":\"%s\",\"help\":\"%s\",\"samples\":[", o->in_family ? "]}," : "",
+               name, type, help);
+    o->in_family = true;
+    o->first_sample = true;
+}
+
+// One sample of the current family with up to three labels; the list ends at
+// the first NULL key.
+static void sample3(metrics_out_t *o, const char *k1, const char *v1, const char *k2, const char *v2,
+                    const char *k3, const char *v3, int64_t value)
+{
+    const char *keys[3] = {k1, k1 ? k2 : NULL, k1 && k2 ? k3 : NULL};
+    const char *vals[3] = {v1, v2, v3};
+    char labels[3 * (METRICS_LABEL_MAX + 32)];
+    size_t len = 0;
+    labels[0] = '\0';
+    for (int i = 0; i < 3 && keys[i]; ++i) {
+        char e[METRICS_LABEL_MAX];
+        escape_label(e, sizeof(e), vals[i]);
+        int n = snprintf(labels + len, sizeof(labels) - len, o->json ? "%s\"%s\":\"%s\"" : "%s%s=\"%s\"",
+                         i ? "," : "", keys[i], e);
+        if (n < 0 || (size_t)n >= sizeof(labels) - len) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    if (!o->json) {
+        if (len == 0) {
+            out_printf(o, "%s %" PRId64 "\n", o->name, value);
+        } else {
+            out_printf(o, "%s{%s} %" PRId64 "\n", o->name, labels, value);
+        }
+        return;
+    }
+    const char *sep = o->first_sample ? "" : ",";
+    o->first_sample = false;
+    if (len == 0) {
+        out_printf(o, "%s{\"value\":%" PRId64 "}", sep, value);
+    } else {
+        out_printf(o, "%s{\"labels\":{%s},\"value\":%" PRId64 "}", sep, labels, value);
+    }
+}
+
+static void sample2(metrics_out_t *o, const char *k1, const char *v1, const char *k2, const char *v2, int64_t value)
+{
+    sample3(o, k1, v1, k2, v2, NULL, NULL, value);
+}
+
+static void sample(metrics_out_t *o, const char *k, const char *v, int64_t value)
+{
+    sample2(o, k, v, NULL, NULL, value);
+}
+
+// Family with a single unlabelled sample.
+static void metric(metrics_out_t *o, const char *name, const char *type, const char *help, int64_t value)
+{
+    family(o, name, type, help);
+    sample(o, NULL, NULL, value);
+}
+
+static void emit_boot(metrics_out_t *o)
+{
+    family(o, "wimill_boot_phase_us", "gauge", "When the start-up phase was first reached");
+    for (int i = 0; i < BOOT_PHASE_COUNT; ++i) {
+        int64_t us = boot_time_get((boot_phase_t)i);
+        if (us != 0) {
+            sample(o, "phase", boot_time_phase_name((boot_phase_t)i), us);
+        }
+    }
+}
+
+static void emit_transfers(metrics_out_t *o)
+{
+    web_fs_stats_t st;
+    web_fs_get_stats(&st);
+    metric(o, "wimill_uploads_total", "counter", "Uploads through the writer pipeline", st.uploads);
+    metric(o, "wimill_upload_write_errors_total", "counter", "Uploads that failed writing to the card",
+           st.upload_write_errors);
+    metric(o, "wimill_upload_bytes_total", "counter", "Bytes written to the card by uploads", (int64_t)st.upload_bytes);
+    family(o, "wimill_upload_stage_us_total", "counter", "Upload time per stage, summed over transfers");
+    sample(o, "stage", "recv", (int64_t)st.upload_recv_us);
+    sample(o, "stage", "write", (int64_t)st.upload_write_us);
+    sample(o, "stage", "wall", (int64_t)st.upload_wall_us);
+    metric(o, "wimill_upload_last_kbps", "gauge", "Average rate of the last upload, KiB/s", st.upload_last_kbps);
+
+    metric(o, "wimill_downloads_total", "counter", "File downloads", st.downloads);
+    metric(o, "wimill_download_send_errors_total", "counter", "Downloads cut short", st.download_send_errors);
+    metric(o, "wimill_download_bytes_total", "counter", "Bytes read from the card by downloads",
+           (int64_t)st.download_bytes);
+    family(o, "wimill_download_stage_us_total", "counter", "Download time per stage, summed over transfers");
+    sample(o, "stage", "read", (int64_t)st.download_read_us);
+    sample(o, "stage", "send", (int64_t)st.download_send_us);
+    sample(o, "stage", "wall", (int64_t)st.download_wall_us);
+    metric(o, "wimill_download_last_kbps", "gauge", "Average rate of the last download, KiB/s",
+           st.download_last_kbps);
+
+    family(o, "wimill_download_gzip_total", "counter", "Gzip-encoded downloads by source");
+    sample(o, "source", "sidecar", st.gzip_sidecar);
+    sample(o, "source", "live", st.gzip_live);
+    family(o, "wimill_download_gzip_bytes_total", "counter", "Gzip downloads: plain file and wire bytes");
+    sample(o, "side", "plain", (int64_t)st.gzip_plain_bytes);
+    sample(o, "side", "wire", (int64_t)st.gzip_wire_bytes);
+    metric(o, "wimill_download_gzip_deflate_us_total", "counter", "Time spent compressing live gzip downloads",
+           (int64_t)st.gzip_deflate_us);
+
+    gz_cache_stats_t gz;
+    gz_cache_get_stats(&gz);
+    metric(o, "wimill_gz_cache_files", "gauge", "Compressed sidecars on the card", gz.files);
+    metric(o, "wimill_gz_cache_bytes", "gauge", "Size of the compressed sidecars", (int64_t)gz.bytes);
+    family(o, "wimill_gz_cache_removed_total", "counter", "Sidecars removed by the prune pass");
+    sample(o, "reason", "stale", gz.stale_removed);
+    sample(o, "reason", "cap", gz.evicted);
+    metric(o, "wimill_gz_cache_evicted_bytes_total", "counter", "Bytes freed to keep the cache under its cap",
+           (int64_t)gz.evicted_bytes);
+}
+
+static void emit_msc(metrics_out_t *o)
+{
+    msc_stats_t st;
+    msc_stats_get(&st);
+    family(o, "wimill_msc_bytes_total", "counter", "Bytes moved for the USB host");
+    sample(o, "op", "read", (int64_t)st.read_bytes);
+    sample(o, "op", "write", (int64_t)st.write_bytes);
+    family(o, "wimill_msc_calls_total", "counter", "USB MSC callbacks; fast = whole sectors, card direct");
+    sample2(o, "op", "read", "path", "fast", st.read_fast_calls);
+    sample2(o, "op", "read", "path", "partial", st.read_partial_calls);
+    sample2(o, "op", "write", "path", "fast", st.write_fast_calls);
+    sample2(o, "op", "write", "path", "partial", st.write_partial_calls);
+    family(o, "wimill_msc_buf_max_bytes", "gauge", "Largest USB MSC transfer");
+    sample(o, "op", "read", st.read_buf_max);
+    sample(o, "op", "write", st.write_buf_max);
+    metric(o, "wimill_msc_cache_flushes_total", "counter", "Sector cache write-backs", st.cache_flushes);
+    metric(o, "wimill_msc_cache_misses_total", "counter", "Sector cache misses", st.cache_misses);
+    family(o, "wimill_sd_card_ops_total", "counter", "Card sector commands issued for USB MSC");
+    sample(o, "op", "read", st.card_reads);
+    sample(o, "op", "write", st.card_writes);
+    family(o, "wimill_sd_card_op_us_total", "counter", "Time in card sector commands for USB MSC");
+    sample(o, "op", "read", (int64_t)st.card_read_us);
+    sample(o, "op", "write", (int64_t)st.card_write_us);
+    family(o, "wimill_sd_card_op_us_max", "gauge", "Slowest card sector command for USB MSC");
+    sample(o, "op", "read", st.card_read_us_max);
+    sample(o, "op", "write", st.card_write_us_max);
+}
+
+static void emit_sd_io(metrics_out_t *o)
+{
+    sdcard_io_stats_t st[SDCARD_IO_CLASS_COUNT];
+    for (int cls = 0; cls < SDCARD_IO_CLASS_COUNT; ++cls) {
+        sdcard_io_get_stats((sdcard_io_class_t)cls, &st[cls]);
+    }
+#define SD_IO_FAMILY(name, type, help, field)                                                                         \
+    family(o, name, type, help);                                                                                      \
+    for (int cls = 0; cls < SDCARD_IO_CLASS_COUNT; ++cls) {                                                           \
+        sample(o, "class", sdcard_io_class_name((sdcard_io_class_t)cls), (int64_t)st[cls].field);                     \
+    }
+    SD_IO_FAMILY("wimill_sd_io_grants_total", "counter", "Units of card I/O granted", grants)
+    SD_IO_FAMILY("wimill_sd_io_waits_total", "counter", "Grants that had to queue", waits)
+    SD_IO_FAMILY("wimill_sd_io_queued", "gauge", "Units waiting for the card now", queued)
+    SD_IO_FAMILY("wimill_sd_io_wait_us_total", "counter", "Time queued for the card", wait_us_total)
+    SD_IO_FAMILY("wimill_sd_io_wait_us_max", "gauge", "Longest wait for the card", wait_us_max)
+    SD_IO_FAMILY("wimill_sd_io_busy_us_total", "counter", "Time holding the card (SD op latency)", busy_us_total)
+    SD_IO_FAMILY("wimill_sd_io_busy_us_max", "gauge", "Slowest unit of card I/O", busy_us_max)
+#undef SD_IO_FAMILY
+    metric(o, "wimill_sd_mounted", "gauge", "1 while the card is mounted for the firmware", sdcard_is_mounted());
+}
+
+static void emit_http_workers(metrics_out_t *o)
+{
+    http_workers_stats_t st[HTTP_WORK_CLASS_COUNT];
+    for (int cls = 0; cls < HTTP_WORK_CLASS_COUNT; ++cls) {
+        http_workers_stats((http_work_class_t)cls, &st[cls]);
+    }
+#define WORK_FAMILY(name, type, help, field)                                                                          \
+    family(o, name, type, help);                                                                                      \
+    for (int cls = 0; cls < HTTP_WORK_CLASS_COUNT; ++cls) {                                                           \
+        sample(o, "class", http_workers_class_name((http_work_class_t)cls), st[cls].field);                           \
+    }
+    WORK_FAMILY("wimill_http_work_queued", "gauge", "Offloaded requests waiting", queued)
+    WORK_FAMILY("wimill_http_work_active", "gauge", "Offloaded requests running", active)
+    WORK_FAMILY("wimill_http_work_done_total", "counter", "Offloaded requests finished", done)
+    WORK_FAMILY("wimill_http_work_rejected_total", "counter", "Offloaded requests answered 503", rejected)
+#undef WORK_FAMILY
+}
+
+static void emit_heap(metrics_out_t *o)
+{
+    static const struct {
+        const char *name;
+        uint32_t caps;
+    } regions[] = {
+        {"internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+        {"dma", MALLOC_CAP_DMA},
+        {"psram", MALLOC_CAP_SPIRAM},
+    };
+    const size_t count = sizeof(regions) / sizeof(regions[0]);
+    family(o, "wimill_heap_total_bytes", "gauge", "Heap size");
+    for (size_t i = 0; i < count; ++i) {
+        sample(o, "region", regions[i].name, (int64_t)heap_caps_get_total_size(regions[i].caps));
+    }
+    family(o, "wimill_heap_free_bytes", "gauge", "Free heap");
+    for (size_t i = 0; i < count; ++i) {
+        sample(o, "region", regions[i].name, (int64_t)heap_caps_get_free_size(regions[i].caps));
+    }
+    family(o, "wimill_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+    for (size_t i = 0; i < count; ++i) {
+        sample(o, "region", regions[i].name, (int64_t)heap_caps_get_minimum_free_size(regions[i].caps));
+    }
+    family(o, "wimill_heap_largest_free_block_bytes", "gauge", "Largest allocatable block");
+    for (size_t i = 0; i < count; ++i) {
+        sample(o, "region", regions[i].name, (int64_t)heap_caps_get_largest_free_block(regions[i].caps));
+    }
+}
+
+static void emit_xfer_buf(metrics_out_t *o)
+{
+    xfer_buf_stats_t st[XFER_BUF_POOL_COUNT];
+    for (int pool = 0; pool < XFER_BUF_POOL_COUNT; ++pool) {
+        xfer_buf_get_stats((xfer_buf_pool_t)pool, &st[pool]);
+    }
+#define XFER_FAMILY(name, type, help, field)                                                                          \
+    family(o, name, type, help);                                                                                      \
+    for (int pool = 0; pool < XFER_BUF_POOL_COUNT; ++pool) {                                                          \
+        sample(o, "pool", xfer_buf_pool_name((xfer_buf_pool_t)pool), st[pool].field);                                 \
+    }
+    XFER_FAMILY("wimill_xfer_buf_size_bytes", "gauge", "Transfer buffer pool size", size)
+    XFER_FAMILY("wimill_xfer_buf_in_use_bytes", "gauge", "Transfer buffer bytes leased now", in_use)
+    XFER_FAMILY("wimill_xfer_buf_peak_bytes", "gauge", "Most transfer buffer bytes leased at once", peak)
+    XFER_FAMILY("wimill_xfer_buf_leases_total", "counter", "Leases served from the pool", leases)
+    XFER_FAMILY("wimill_xfer_buf_fallbacks_total", "counter", "Leases served from the heap instead", fallbacks)
+    XFER_FAMILY("wimill_xfer_buf_failures_total", "counter", "Leases that found no memory", failures)
+#undef XFER_FAMILY
+}
+
+#if configUSE_TRACE_FACILITY
+static const char *task_core(TaskHandle_t task, char *buf, size_t len)
+{
+    BaseType_t core = xTaskGetCoreID(task);
+    if (core == tskNO_AFFINITY) {
+        return "any";
+    }
+    snprintf(buf, len, "%d", (int)core);
+    return buf;
+}
+#endif
+
+static void emit_tasks(metrics_out_t *o)
+{
+#if configUSE_TRACE_FACILITY
+    UBaseType_t cap = uxTaskGetNumberOfTasks() + METRICS_TASKS_EXTRA;
+    TaskStatus_t *tasks = heap_caps_malloc(cap * sizeof(TaskStatus_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!tasks) {
+        tasks = malloc(cap * sizeof(TaskStatus_t));
+    }
+    if (!tasks) {
+        ESP_LOGW(TAG, "no memory for the task list");
+        return;
+    }
+    configRUN_TIME_COUNTER_TYPE total_runtime = 0;
+    UBaseType_t n = uxTaskGetSystemState(tasks, cap, &total_runtime);
+    char core[8];
+    // Names repeat (one stripe_rx per stripe, the upload writers), so the
+    // FreeRTOS task number keeps each task its own series.
+    char num[12];
+    metric(o, "wimill_tasks", "gauge", "FreeRTOS tasks", (int64_t)n);
+    family(o, "wimill_task_stack_free_min_bytes", "gauge", "Stack high-water mark: least free stack seen");
+    for (UBaseType_t i = 0; i < n; ++i) {
+        snprintf(num, sizeof(num), "%u", (unsigned)tasks[i].xTaskNumber);
+        sample3(o, "task", tasks[i].pcTaskName, "core", task_core(tasks[i].xHandle, core, sizeof(core)), "id", num,
+                (int64_t)tasks[i].usStackHighWaterMark);
+    }
+#if configGENERATE_RUN_TIME_STATS
+    // Per-task CPU is rate(task runtime) / rate(cpu runtime); the total counts
+    // wall time, so with two cores all tasks add up to twice the total.
+    metric(o, "wimill_cpu_runtime_us_total", "counter", "Run-time clock", (int64_t)total_runtime);
+    family(o, "wimill_task_runtime_us_total", "counter", "CPU time used by the task");
+    for (UBaseType_t i = 0; i < n; ++i) {
+        snprintf(num, sizeof(num), "%u", (unsigned)tasks[i].xTaskNumber);
+        sample3(o, "task", tasks[i].pcTaskName, "core", task_core(tasks[i].xHandle, core, sizeof(core)), "id", num,
+                (int64_t)tasks[i].ulRunTimeCounter);
+    }
+#endif
+    heap_caps_free(tasks);
+#else
+    (void)o;
+#endif
+}
+
+static void emit_wifi(metrics_out_t *o)
+{
+    setup_wifi_stats_t st;
+    setup_mode_wifi_stats(&st);
+    metric(o, "wimill_wifi_connected", "gauge", "1 while the station has an IP", st.connected);
+    metric(o, "wimill_wifi_rssi_dbm", "gauge", "Signal of the joined AP, 0 when not connected", st.rssi);
+    metric(o, "wimill_wifi_connect_attempts_total", "counter", "Station connects started by the firmware",
+           st.connect_attempts);
+    metric(o, "wimill_wifi_connects_total", "counter", "Station connects that got an IP", st.connects);
+    metric(o, "wimill_wifi_disconnects_total", "counter", "Station disconnect events", st.disconnects);
+    metric(o, "wimill_wifi_connect_timeouts_total", "counter", "Station connects that timed out", st.timeouts);
+    metric(o, "wimill_wifi_last_disconnect_reason", "gauge", "wifi_err_reason_t of the last disconnect",
+           st.last_reason);
+}
+
+static bool want_json(httpd_req_t *req)
+{
+    char query[64];
+    char format[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "format", format, sizeof(format)) == ESP_OK) {
+        return strcmp(format, "json") == 0;
+    }
+    char accept[128];
+    return httpd_req_get_hdr_value_str(req, "Accept", accept, sizeof(accept)) == ESP_OK &&
+           strstr(accept, "application/json") != NULL;
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    metrics_out_t *o = calloc(1, sizeof(*o));
+    if (!o) {
+        httpd_resp_set_status(req, "500 Internal Server Error");
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_send(req, "{\"error\":\"NO_MEM\"}", HTTPD_RESP_USE_STRLEN);
+    }
+    o->req = req;
+    o->json = want_json(req);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_type(req, o->json ? "application/json" : "text/plain; version=0.0.4; charset=utf-8");
+
+    int64_t uptime_us = esp_timer_get_time();
+    if (o->json) {
+        out_printf(o, "{\"uptime_us\":%" PRId64 ",\"metrics\":[", uptime_us);
+    }
+    metric(o, "wimill_uptime_us", "counter", "Time since boot", uptime_us);
+    emit_boot(o);
+    emit_transfers(o);
+    emit_msc(o);
+    emit_sd_io(o);
+    emit_http_workers(o);
+    emit_heap(o);
+    emit_xfer_buf(o);
+    emit_tasks(o);
+    emit_wifi(o);
+    if (o->json) {
+        out_printf(o, "]}]}");
+    }
+    out_flush(o);
+    bool failed = o->failed;
+    free(o);
+    if (failed) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t metrics_register(httpd_handle_t server)
+{
+    if (!server) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    httpd_uri_t uri = {
+        .uri = "/api/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_handler,
+        .user_ctx = NULL,
+    };
+    return httpd_register_uri_handler(server, &uri);
+}
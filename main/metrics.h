@@ -0,0 +1,12 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// GET /api/metrics: transfer, card, heap, task and Wi-Fi counters in the
+// Prometheus text format (scrape it directly), or the same samples as JSON
+// with ?format=json or "Accept: application/json". Everything is read from
+// in-memory counters; a scrape never touches the card.
+
+// Registers /api/metrics on `server`; call again after the server was restarted.
+esp_err_t metrics_register(httpd_handle_t server);
@@ -13,9 +13,17 @@
 #include "tinyusb.h"
 #include "tusb.h"             // Main TinyUSB header
 
+#include "boot_time.h"
+#include "config_store.h"
+#include "dir_index.h"
+#include "fs_journal.h"
+#include "gcode_meta.h"
 #include "led_status.h"
 #include "sdcard.h"
+#include "trace.h"
+#include "xfer_buf.h"
 #include "wimill_pins.h" // Убедитесь, что этот файл существует и доступен
+#include "ws_events.h"
 
 #define TAG "MSC"
 #define MSC_SECTOR_SIZE 512
@@ -72,7 +80,7 @@ typedef struct
     bool valid;
     bool dirty;
     uint32_t base_lba;
-    uint8_t data[MSC_CACHE_SIZE] __attribute__((aligned(4)));
+    uint8_t *data; // MSC_CACHE_SIZE из DMA-пула xfer_buf, только пока USB подключён
     uint8_t mask[MSC_CACHE_SECTORS];
 } sector_cache_t;
 
@@ -137,6 +145,46 @@ static void stats_record_miss(void)
     portEXIT_CRITICAL(&s_stats_mux);
 }
 
+// Время команд карты (sdmmc_*_sectors): и прямых, и загрузки/сброса кэша.
+static void stats_record_card(bool write, uint32_t us)
+{
+    portENTER_CRITICAL(&s_stats_mux);
+    if (write) {
+        s_stats.card_writes++;
+        s_stats.card_write_us += us;
+        if (us > s_stats.card_write_us_max) {
+            s_stats.card_write_us_max = us;
+        }
+    } else {
+        s_stats.card_reads++;
+        s_stats.card_read_us += us;
+        if (us > s_stats.card_read_us_max) {
+            s_stats.card_read_us_max = us;
+        }
+    }
+    portEXIT_CRITICAL(&s_stats_mux);
+}
+
+static esp_err_t card_read(void *dst, uint32_t lba, uint32_t count)
+{
+    int64_t t0 = esp_timer_get_time();
+    TRACE_BEGIN(TRACE_SD_READ, lba);
+    esp_err_t ret = sdmmc_read_sectors(s_card, dst, lba, count);
+    TRACE_END(TRACE_SD_READ, count);
+    stats_record_card(false, (uint32_t)(esp_timer_get_time() - t0));
+    return ret;
+}
+
+static esp_err_t card_write(const void *src, uint32_t lba, uint32_t count)
+{
+    int64_t t0 = esp_timer_get_time();
+    TRACE_BEGIN(TRACE_SD_WRITE, lba);
+    esp_err_t ret = sdmmc_write_sectors(s_card, src, lba, count);
+    TRACE_END(TRACE_SD_WRITE, count);
+    stats_record_card(true, (uint32_t)(esp_timer_get_time() - t0));
+    return ret;
+}
+
 static inline void lock_io(void)
 {
     sdcard_lock();
@@ -152,18 +200,24 @@ static void set_state(msc_state_t st)
     if (s_state == st)
         return;
     s_state = st;
+    const char *msg;
     switch (s_state)
     {
     case MSC_STATE_USB_ATTACHED:
         led_status_set(LED_STATE_USB_ATTACHED);
+        msg = "{\"type\":\"usb\",\"mode\":\"ATTACHED\"}";
         break;
     case MSC_STATE_USB_DETACHED:
         led_status_set(LED_STATE_USB_DETACHED);
+        msg = "{\"type\":\"usb\",\"mode\":\"DETACHED\"}";
         break;
     default:
         led_status_set(LED_STATE_ERROR);
+        msg = "{\"type\":\"usb\",\"mode\":\"ERROR\"}";
         break;
     }
+    // Web UI узнаёт о смене режима без опроса /api/status
+    ws_events_publish(msg);
 }
 
 static inline bool cache_contains_lba(uint32_t lba)
@@ -238,7 +292,7 @@ static esp_err_t cache_load_full(uint32_t lba)
         return ESP_OK;
     }
     ESP_RETURN_ON_ERROR(flush_cache_locked(), TAG, "flush failed");
-    esp_err_t ret = sdmmc_read_sectors(s_card, s_cache.data, base, MSC_CACHE_SECTORS);
+    esp_err_t ret = card_read(s_cache.data, base, MSC_CACHE_SECTORS);
     if (ret != ESP_OK) {
         return ret;
     }
@@ -259,7 +313,7 @@ static esp_err_t cache_ensure_sector_full(uint32_t lba)
         return ESP_OK;
     }
     uint8_t temp[MSC_SECTOR_SIZE];
-    esp_err_t ret = sdmmc_read_sectors(s_card, temp, lba, 1);
+    esp_err_t ret = card_read(temp, lba, 1);
     if (ret != ESP_OK) {
         return ret;
     }
@@ -277,10 +331,8 @@ static esp_err_t cache_ensure_sector_full(uint32_t lba)
     return ESP_OK;
 }
 
-static esp_err_t flush_cache_locked(void)
+static esp_err_t cache_write_back_locked(void)
 {
-    if (!s_cache.valid || !s_cache.dirty)
-        return ESP_OK;
     stats_record_flush();
     bool any_dirty = false;
     bool all_full = true;
@@ -300,7 +352,7 @@ static esp_err_t flush_cache_locked(void)
     }
 
     if (all_full) {
-        esp_err_t ret = sdmmc_write_sectors(s_card, s_cache.data, s_cache.base_lba, MSC_CACHE_SECTORS);
+        esp_err_t ret = card_write(s_cache.data, s_cache.base_lba, MSC_CACHE_SECTORS);
         if (ret == ESP_OK) {
             s_cache.dirty = false;
         }
@@ -314,7 +366,7 @@ static esp_err_t flush_cache_locked(void)
         }
         uint8_t *sector_ptr = s_cache.data + i * MSC_SECTOR_SIZE;
         if (mask == MSC_SUBSECTOR_MASK_FULL) {
-            esp_err_t ret = sdmmc_write_sectors(s_card, sector_ptr, s_cache.base_lba + i, 1);
+            esp_err_t ret = card_write(sector_ptr, s_cache.base_lba + i, 1);
             if (ret != ESP_OK) {
                 return ret;
             }
@@ -322,7 +374,7 @@ static esp_err_t flush_cache_locked(void)
         }
 
         uint8_t temp[MSC_SECTOR_SIZE];
-        esp_err_t ret = sdmmc_read_sectors(s_card, temp, s_cache.base_lba + i, 1);
+        esp_err_t ret = card_read(temp, s_cache.base_lba + i, 1);
         if (ret != ESP_OK) {
             return ret;
         }
@@ -333,7 +385,7 @@ static esp_err_t flush_cache_locked(void)
                        MSC_SUBSECTOR_SIZE);
             }
         }
-        ret = sdmmc_write_sectors(s_card, temp, s_cache.base_lba + i, 1);
+        ret = card_write(temp, s_cache.base_lba + i, 1);
         if (ret != ESP_OK) {
             return ret;
         }
@@ -344,6 +396,16 @@ static esp_err_t flush_cache_locked(void)
     return ESP_OK;
 }
 
+static esp_err_t flush_cache_locked(void)
+{
+    if (!s_cache.valid || !s_cache.dirty)
+        return ESP_OK;
+    TRACE_BEGIN(TRACE_MSC_FLUSH, s_cache.base_lba);
+    esp_err_t ret = cache_write_back_locked();
+    TRACE_END(TRACE_MSC_FLUSH, ret);
+    return ret;
+}
+
 static esp_err_t msc_read_partial(uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
 {
     if (!s_card)
@@ -391,12 +453,20 @@ static esp_err_t msc_enable(void)
 
     // Инициализация карты
     ESP_RETURN_ON_ERROR(sdcard_init_raw(&s_card), TAG, "sd init failed");
+    boot_time_mark(BOOT_PHASE_CARD);
 
     // !!! ИСПРАВЛЕНИЕ 1: Корректный расчет размера !!!
     s_block_size = s_card->csd.sector_size;
     s_block_count = s_card->csd.capacity; // Без умножения!
 
     memset(&s_cache, 0, sizeof(s_cache));
+    // Кэш секторов берём из DMA-пула только на время USB-режима: в режиме
+    // приложения та же память служит буфером записи upload.
+    s_cache.data = xfer_buf_lease(XFER_BUF_DMA, MSC_CACHE_SIZE);
+    if (!s_cache.data) {
+        ESP_LOGE(TAG, "no memory for the sector cache");
+        return ESP_ERR_NO_MEM;
+    }
 
     // !!! ИСПРАВЛЕНИЕ 2: Ручные дескрипторы !!!
     tinyusb_config_t tusb_cfg = {
@@ -427,10 +497,17 @@ static esp_err_t msc_enable(void)
         .event_arg = NULL,
     };
 
-    ESP_RETURN_ON_ERROR(tinyusb_driver_install(&tusb_cfg), TAG, "tinyusb init failed");
+    esp_err_t ret = tinyusb_driver_install(&tusb_cfg);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "tinyusb init failed");
+        xfer_buf_release(s_cache.data);
+        s_cache.data = NULL;
+        return ret;
+    }
 
     tud_connect();
     s_usb_enabled = true;
+    boot_time_mark(BOOT_PHASE_USB);
     return ESP_OK;
 }
 
@@ -449,10 +526,20 @@ static void msc_disable(void)
     tinyusb_driver_uninstall();
     s_usb_enabled = false;
     s_card = NULL;
+    xfer_buf_release(s_cache.data);
+    s_cache.data = NULL;
 }
 
 esp_err_t msc_init(void)
 {
+    // Частота, с которой карта поднялась в прошлый раз: карта, которой нужен
+    // откат 40 -> 20 МГц, не ждёт неудачной попытки на 40 МГц при каждом старте
+    uint32_t saved_khz = 0;
+    if (config_load_sd_khz(&saved_khz) == ESP_OK && saved_khz != sdcard_get_current_freq_khz())
+    {
+        if (sdcard_set_frequency(saved_khz, false) == ESP_OK)
+            ESP_LOGI(TAG, "SD freq %u kHz (saved at last boot)", (unsigned)saved_khz);
+    }
     sdcard_set_mode(SDCARD_MODE_USB);
     esp_err_t ret = msc_enable();
     if (ret != ESP_OK)
@@ -460,6 +547,9 @@ esp_err_t msc_init(void)
         set_state(MSC_STATE_ERROR);
         return ret;
     }
+    uint32_t khz = sdcard_get_current_freq_khz();
+    if (khz != saved_khz)
+        config_save_sd_khz(khz);
     set_state(MSC_STATE_USB_ATTACHED);
     ESP_LOGI(TAG, "MSC initialized. Blocks: %lu", (unsigned long)s_block_count);
     return ESP_OK;
@@ -497,6 +587,8 @@ esp_err_t msc_attach(void)
     // Сначала отмонтируем VFS, если занято
     if (sdcard_is_mounted())
     {
+        // Дописываем журнал, пока карта ещё наша; после хоста он читается заново
+        fs_journal_unload();
         if (sdcard_unmount() != ESP_OK)
             return ESP_FAIL;
     }
@@ -506,6 +598,8 @@ esp_err_t msc_attach(void)
         return ESP_FAIL;
 
     set_state(MSC_STATE_USB_ATTACHED);
+    // Хост может менять что угодно: все кэшированные листинги устаревают
+    dir_index_invalidate_all();
     return ESP_OK;
 }
 
@@ -523,6 +617,10 @@ esp_err_t msc_detach(void)
         set_state(MSC_STATE_ERROR);
         return ESP_FAIL;
     }
+    // Журнал не знает, что делал хост: клиенты должны пересканировать
+    fs_journal_new_epoch();
+    // Файлы, скопированные хостом, анализируются в фоне
+    gcode_meta_schedule_scan();
     set_state(MSC_STATE_USB_DETACHED);
     return ESP_OK;
 }
@@ -548,6 +646,8 @@ bool tud_msc_test_unit_ready_cb(uint8_t lun)
 void tud_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_size)
 {
     (void)lun;
+    // Хост запросил ёмкость — диск появился у него
+    boot_time_mark(BOOT_PHASE_USB_HOST);
     *block_count = s_block_count; // Берем исправленное значение
     *block_size = (uint16_t)s_block_size;
 }
@@ -574,7 +674,7 @@ int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buff
             if (s_cache.dirty && cache_overlaps_range(lba, sectors)) {
                 ESP_RETURN_ON_ERROR(flush_cache_locked(), TAG, "flush failed");
             }
-            ret = sdmmc_read_sectors(s_card, buffer, lba, sectors);
+            ret = card_read(buffer, lba, sectors);
         }
     }
     else
@@ -623,7 +723,7 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *
                 s_cache.dirty = false;
                 cache_masks_set_all(0);
             }
-            ret = sdmmc_write_sectors(s_card, buffer, lba, sectors);
+            ret = card_write(buffer, lba, sectors);
         }
     }
     else
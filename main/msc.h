@@ -24,6 +24,12 @@ typedef struct {
     uint32_t write_buf_max;
     uint32_t cache_flushes;
     uint32_t cache_misses;
+    uint32_t card_reads;
+    uint32_t card_writes;
+    uint64_t card_read_us;
+    uint64_t card_write_us;
+    uint32_t card_read_us_max;
+    uint32_t card_write_us_max;
 } msc_stats_t;
 
 esp_err_t msc_init(void);
@@ -6,8 +6,10 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
+#include <time.h>
 
 #include "driver/gpio.h"
+#include "diskio/diskio_sdmmc.h"
 #include "driver/sdmmc_host.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
@@ -19,19 +21,30 @@
 #include "freertos/task.h"
 
 #include "wimill_pins.h"
+#include "xfer_buf.h"
 
 #define TAG "SDCARD"
 #define DEFAULT_ALLOC_UNIT (32 * 1024)
 #define SDTEST_FILE_PATH "/sdcard/.wimill_sdtest.bin"
 #define SDBENCH_FILE_PATH "/sdcard/.wimill_bench.bin"
+#define LSBENCH_ROOT "/.wimill/lsbench"
+#define FF_PATH_LEN 272
+#define SDCARD_IO_SLICE_US 50000
+#define SDCARD_IO_GRACE_US 5000
+#define SDCARD_IO_BG_AGE_US 500000
 #define SDTEST_BLOCK_MIN 4096
 static sdmmc_card_t *s_card = NULL;
 static bool s_card_raw_alloc = false;
 static bool s_mounted = false;
+// Bumped on every mount, so open directory handles can tell the volume they
+// were opened on is gone.
+static uint32_t s_mount_gen = 0;
 static bool s_host_inited = false;
 static uint32_t s_current_freq_khz = WIMILL_SD_FREQ_KHZ_DEFAULT;
 static bool s_disk_status_check = true;
 static SemaphoreHandle_t s_fs_mutex = NULL;
+static SemaphoreHandle_t s_job_mutex = NULL;
+static volatile bool s_unmount_pending;
 static size_t s_sdtest_buf_bytes = WIMILL_SDTEST_BUF_SZ;
 static sdcard_mode_t s_mode = SDCARD_MODE_USB;
 
@@ -42,11 +55,16 @@ static bool is_supported_freq(uint32_t khz)
 
 static bool ensure_mutex(void)
 {
-    if (s_fs_mutex) {
+    if (s_fs_mutex && s_job_mutex) {
         return true;
     }
-    s_fs_mutex = xSemaphoreCreateRecursiveMutex();
     if (!s_fs_mutex) {
+        s_fs_mutex = xSemaphoreCreateRecursiveMutex();
+    }
+    if (!s_job_mutex) {
+        s_job_mutex = xSemaphoreCreateMutex();
+    }
+    if (!s_fs_mutex || !s_job_mutex) {
         ESP_LOGE(TAG, "Failed to create SD mutex");
         return false;
     }
@@ -68,6 +86,246 @@ void sdcard_unlock(void)
     }
 }
 
+// Long CLI jobs (touch, sdtest, sdbench, lsbench) and background indexers
+// hold this instead of the state lock, so listings and status keep working;
+// unmount still waits for them to finish. Order: job mutex before
+// sdcard_lock().
+bool sdcard_job_begin(void)
+{
+    if (!ensure_mutex()) {
+        return false;
+    }
+    xSemaphoreTake(s_job_mutex, portMAX_DELAY);
+    return true;
+}
+
+void sdcard_job_end(void)
+{
+    xSemaphoreGive(s_job_mutex);
+}
+
+bool sdcard_job_should_stop(void)
+{
+    return s_unmount_pending;
+}
+
+// I/O scheduler. One task at a time owns the card; the owner's class picks
+// who goes next when it lets go. Bulk users take the card per chunk, so an
+// interactive request waits at most one chunk. A stream keeps the card for
+// up to SDCARD_IO_SLICE_US while it comes back within SDCARD_IO_GRACE_US,
+// then the next stream gets a turn. Background work runs when neither
+// interactive nor stream waiters are queued, or after SDCARD_IO_BG_AGE_US.
+typedef struct sdcard_io_waiter {
+    TaskHandle_t task;
+    sdcard_io_class_t cls;
+    int64_t since_us;
+    bool granted;
+    SemaphoreHandle_t sem;
+    struct sdcard_io_waiter *next;
+} sdcard_io_waiter_t;
+
+static SemaphoreHandle_t s_io_mutex = NULL;
+static sdcard_io_waiter_t *s_io_queue[SDCARD_IO_CLASS_COUNT];
+static TaskHandle_t volatile s_io_owner = NULL;
+static sdcard_io_class_t s_io_owner_cls = SDCARD_IO_INTERACTIVE;
+static uint32_t s_io_depth = 0;
+static TaskHandle_t s_io_slice_task = NULL;
+static int64_t s_io_slice_end_us = 0;
+static TaskHandle_t s_io_reserved = NULL;
+static int64_t s_io_reserved_until_us = 0;
+static int64_t s_io_grant_us = 0;
+static sdcard_io_stats_t s_io_stats[SDCARD_IO_CLASS_COUNT];
+
+static void io_enqueue_locked(sdcard_io_waiter_t *w)
+{
+    sdcard_io_waiter_t **pp = &s_io_queue[w->cls];
+    while (*pp) {
+        pp = &(*pp)->next;
+    }
+    w->next = NULL;
+    *pp = w;
+}
+
+static void io_unlink_locked(sdcard_io_waiter_t *w)
+{
+    for (sdcard_io_waiter_t **pp = &s_io_queue[w->cls]; *pp; pp = &(*pp)->next) {
+        if (*pp == w) {
+            *pp = w->next;
+            return;
+        }
+    }
+}
+
+static void io_grant_locked(sdcard_io_waiter_t *w, int64_t now)
+{
+    io_unlink_locked(w);
+    s_io_owner = w->task;
+    s_io_owner_cls = w->cls;
+    s_io_depth = 1;
+    s_io_grant_us = now;
+    s_io_reserved = NULL;
+    if (w->cls == SDCARD_IO_STREAM && s_io_slice_task != w->task) {
+        s_io_slice_task = w->task;
+        s_io_slice_end_us = now + SDCARD_IO_SLICE_US;
+    }
+    uint32_t waited = (uint32_t)(now - w->since_us);
+    sdcard_io_stats_t *st = &s_io_stats[w->cls];
+    st->grants++;
+    st->wait_us_total += waited;
+    if (waited > st->wait_us_max) {
+        st->wait_us_max = waited;
+    }
+    w->granted = true;
+    xSemaphoreGive(w->sem);
+}
+
+static void io_dispatch_locked(int64_t now)
+{
+    if (s_io_owner) {
+        return;
+    }
+    sdcard_io_waiter_t *next = s_io_queue[SDCARD_IO_INTERACTIVE];
+    bool reserved = s_io_reserved && now < s_io_reserved_until_us;
+    if (!next && reserved) {
+        // Only the stream holding the reservation may continue.
+        for (sdcard_io_waiter_t *w = s_io_queue[SDCARD_IO_STREAM]; w; w = w->next) {
+            if (w->task == s_io_reserved) {
+                next = w;
+                break;
+            }
+        }
+        if (!next) {
+            return;
+        }
+    }
+    sdcard_io_waiter_t *bg = s_io_queue[SDCARD_IO_BACKGROUND];
+    if (!next && bg && now - bg->since_us >= SDCARD_IO_BG_AGE_US) {
+        next = bg;
+    }
+    if (!next) {
+        next = s_io_queue[SDCARD_IO_STREAM] ? s_io_queue[SDCARD_IO_STREAM] : bg;
+    }
+    if (next) {
+        io_grant_locked(next, now);
+    }
+}
+
+static bool ensure_io_mutex(void)
+{
+    if (s_io_mutex) {
+        return true;
+    }
+    s_io_mutex = xSemaphoreCreateMutex();
+    return s_io_mutex != NULL;
+}
+
+void sdcard_io_begin(sdcard_io_class_t cls)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (s_io_owner == self) {
+        s_io_depth++;
+        return;
+    }
+    if (cls >= SDCARD_IO_CLASS_COUNT || !ensure_io_mutex()) {
+        return;
+    }
+    StaticSemaphore_t sem_buf;
+    sdcard_io_waiter_t w = {
+        .task = self,
+        .cls = cls,
+        .since_us = esp_timer_get_time(),
+        .sem = xSemaphoreCreateBinaryStatic(&sem_buf),
+    };
+    xSemaphoreTake(s_io_mutex, portMAX_DELAY);
+    io_enqueue_locked(&w);
+    io_dispatch_locked(w.since_us);
+    if (!w.granted) {
+        s_io_stats[cls].waits++;
+    }
+    while (!w.granted) {
+        // A reservation or background aging expires without anyone releasing,
+        // so waiters wake up to re-run the dispatch themselves.
+        int64_t now = esp_timer_get_time();
+        TickType_t ticks = portMAX_DELAY;
+        if (s_io_reserved && s_io_reserved_until_us > now) {
+            ticks = pdMS_TO_TICKS((s_io_reserved_until_us - now) / 1000) + 1;
+        } else if (s_io_queue[SDCARD_IO_BACKGROUND]) {
+            ticks = pdMS_TO_TICKS(SDCARD_IO_BG_AGE_US / 1000);
+        }
+        xSemaphoreGive(s_io_mutex);
+        xSemaphoreTake(w.sem, ticks);
+        xSemaphoreTake(s_io_mutex, portMAX_DELAY);
+        if (!w.granted) {
+            io_dispatch_locked(esp_timer_get_time());
+        }
+    }
+    xSemaphoreGive(s_io_mutex);
+    vSemaphoreDelete(w.sem);
+}
+
+void sdcard_io_end(void)
+{
+    if (!s_io_mutex || s_io_owner != xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+    if (--s_io_depth > 0) {
+        return;
+    }
+    xSemaphoreTake(s_io_mutex, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    // Latency of the unit of card I/O, queueing excluded.
+    uint32_t busy = (uint32_t)(now - s_io_grant_us);
+    sdcard_io_stats_t *st = &s_io_stats[s_io_owner_cls];
+    st->busy_us_total += busy;
+    if (busy > st->busy_us_max) {
+        st->busy_us_max = busy;
+    }
+    if (s_io_owner_cls == SDCARD_IO_STREAM && s_io_slice_task == s_io_owner && now < s_io_slice_end_us) {
+        s_io_reserved = s_io_owner;
+        s_io_reserved_until_us = now + SDCARD_IO_GRACE_US;
+        if (s_io_reserved_until_us > s_io_slice_end_us) {
+            s_io_reserved_until_us = s_io_slice_end_us;
+        }
+    } else if (s_io_slice_task == s_io_owner) {
+        s_io_slice_task = NULL;
+    }
+    s_io_owner = NULL;
+    io_dispatch_locked(now);
+    xSemaphoreGive(s_io_mutex);
+}
+
+void sdcard_io_get_stats(sdcard_io_class_t cls, sdcard_io_stats_t *out)
+{
+    if (!out || cls >= SDCARD_IO_CLASS_COUNT) {
+        return;
+    }
+    if (!ensure_io_mutex()) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(s_io_mutex, portMAX_DELAY);
+    *out = s_io_stats[cls];
+    out->queued = 0;
+    for (sdcard_io_waiter_t *w = s_io_queue[cls]; w; w = w->next) {
+        out->queued++;
+    }
+    xSemaphoreGive(s_io_mutex);
+}
+
+const char *sdcard_io_class_name(sdcard_io_class_t cls)
+{
+    switch (cls) {
+    case SDCARD_IO_INTERACTIVE:
+        return "interactive";
+    case SDCARD_IO_STREAM:
+        return "stream";
+    case SDCARD_IO_BACKGROUND:
+        return "background";
+    default:
+        return "unknown";
+    }
+}
+
 void sdcard_set_mode(sdcard_mode_t mode)
 {
     sdcard_lock();
@@ -326,6 +584,7 @@ esp_err_t sdcard_mount(void)
     }
     if (ret == ESP_OK) {
         s_mounted = true;
+        s_mount_gen++;
         s_card_raw_alloc = false;
     } else {
         s_card = NULL;
@@ -336,13 +595,23 @@ esp_err_t sdcard_mount(void)
 
 esp_err_t sdcard_unmount(void)
 {
+    // Waits for a running CLI job the same way it used to wait for the lock;
+    // background jobs see the flag and stop at their next check.
+    s_unmount_pending = true;
+    bool job = sdcard_job_begin();
+    s_unmount_pending = false;
+    if (!job) {
+        return ESP_ERR_NO_MEM;
+    }
     sdcard_lock();
     if (!vfs_allowed_locked()) {
         sdcard_unlock();
+        sdcard_job_end();
         return ESP_ERR_INVALID_STATE;
     }
     if (!s_mounted) {
         sdcard_unlock();
+        sdcard_job_end();
         return ESP_OK;
     }
     esp_err_t ret = esp_vfs_fat_sdcard_unmount(WIMILL_SD_MOUNT_POINT, s_card);
@@ -353,6 +622,7 @@ esp_err_t sdcard_unmount(void)
         s_host_inited = false;
     }
     sdcard_unlock();
+    sdcard_job_end();
     return ret;
 }
 
@@ -491,6 +761,112 @@ esp_err_t sdcard_list(const char *path)
     return ESP_OK;
 }
 
+struct sdcard_dir {
+    FF_DIR dir;
+    FILINFO info;
+    uint32_t mount_gen;
+    esp_err_t err; // why the last read returned false
+};
+
+// Mirrors the conversion vfs_fat does for st_mtime, so both listings agree.
+static int64_t fat_time_to_epoch(WORD fdate, WORD ftime)
+{
+    struct tm tm = {
+        .tm_mday = fdate & 0x1f,
+        .tm_mon = ((fdate >> 5) & 0x0f) - 1,
+        .tm_year = (fdate >> 9) + 80,
+        .tm_sec = (ftime & 0x1f) * 2,
+        .tm_min = (ftime >> 5) & 0x3f,
+        .tm_hour = (ftime >> 11) & 0x1f,
+    };
+    return (int64_t)mktime(&tm);
+}
+
+static bool build_ff_path_locked(const char *rel_path, char *out, size_t out_size)
+{
+    BYTE pdrv = s_card ? ff_diskio_get_pdrv_card(s_card) : 0xFF;
+    if (pdrv == 0xFF) {
+        return false;
+    }
+    int written = snprintf(out, out_size, "%u:%s", (unsigned)pdrv, rel_path);
+    return written > 0 && (size_t)written < out_size;
+}
+
+sdcard_dir_t *sdcard_dir_open(const char *rel_path)
+{
+    if (!rel_path || rel_path[0] != '/') {
+        return NULL;
+    }
+    sdcard_dir_t *dir = malloc(sizeof(*dir));
+    if (!dir) {
+        return NULL;
+    }
+    char ff_path[FF_PATH_LEN];
+    sdcard_lock();
+    bool ok = vfs_allowed_locked() && s_mounted && build_ff_path_locked(rel_path, ff_path, sizeof(ff_path)) &&
+              f_opendir(&dir->dir, ff_path) == FR_OK;
+    dir->mount_gen = s_mount_gen;
+    dir->err = ESP_OK;
+    sdcard_unlock();
+    if (!ok) {
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+bool sdcard_dir_read(sdcard_dir_t *dir, sdcard_dirent_t *out)
+{
+    if (!dir || !out) {
+        return false;
+    }
+    for (;;) {
+        // Under the lock per entry, as in sdcard_dir_open(): an unmount between
+        // two reads frees the volume the handle points into.
+        sdcard_lock();
+        bool mounted = s_mounted && dir->mount_gen == s_mount_gen;
+        FRESULT res = mounted ? f_readdir(&dir->dir, &dir->info) : FR_NOT_READY;
+        sdcard_unlock();
+        if (!mounted || res != FR_OK) {
+            ESP_LOGW(TAG, "readdir failed: %s", mounted ? "FATFS error" : "card unmounted");
+            dir->err = mounted ? ESP_FAIL : ESP_ERR_INVALID_STATE;
+            return false;
+        }
+        if (dir->info.fname[0] == '\0') {
+            return false;
+        }
+        const char *name = dir->info.fname;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        strncpy(out->name, name, sizeof(out->name));
+        out->name[sizeof(out->name) - 1] = '\0';
+        out->attr = dir->info.fattrib;
+        out->is_dir = (dir->info.fattrib & AM_DIR) != 0;
+        out->size = out->is_dir ? 0 : (uint64_t)dir->info.fsize;
+        out->mtime = fat_time_to_epoch(dir->info.fdate, dir->info.ftime);
+        return true;
+    }
+}
+
+esp_err_t sdcard_dir_error(const sdcard_dir_t *dir)
+{
+    return dir ? dir->err : ESP_ERR_INVALID_ARG;
+}
+
+void sdcard_dir_close(sdcard_dir_t *dir)
+{
+    if (!dir) {
+        return;
+    }
+    sdcard_lock();
+    if (s_mounted && dir->mount_gen == s_mount_gen) {
+        f_closedir(&dir->dir);
+    }
+    sdcard_unlock();
+    free(dir);
+}
+
 esp_err_t sdcard_remove(const char *path)
 {
     sdcard_lock();
@@ -582,19 +958,21 @@ esp_err_t sdcard_cat(const char *path, size_t max_bytes)
 
 esp_err_t sdcard_touch(const char *path, size_t size_bytes)
 {
-    sdcard_lock();
-    if (!vfs_allowed_locked() || !s_mounted) {
-        sdcard_unlock();
+    if (!sdcard_job_begin()) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!sdcard_is_vfs_allowed() || !s_mounted) {
+        sdcard_job_end();
         return ESP_ERR_INVALID_STATE;
     }
     char full_path[256];
     if (build_path(path, full_path, sizeof(full_path)) != ESP_OK) {
-        sdcard_unlock();
+        sdcard_job_end();
         return ESP_ERR_INVALID_ARG;
     }
     FILE *f = fopen(full_path, "wb");
     if (!f) {
-        sdcard_unlock();
+        sdcard_job_end();
         return ESP_FAIL;
     }
     const size_t chunk = 512;
@@ -603,17 +981,19 @@ esp_err_t sdcard_touch(const char *path, size_t size_bytes)
     size_t remaining = size_bytes;
     while (remaining > 0) {
         size_t to_write = remaining > chunk ? chunk : remaining;
+        sdcard_io_begin(SDCARD_IO_BACKGROUND);
         size_t written = fwrite(zeros, 1, to_write, f);
+        sdcard_io_end();
         if (written != to_write) {
             fclose(f);
-            sdcard_unlock();
+            sdcard_job_end();
             return ESP_FAIL;
         }
         remaining -= written;
         vTaskDelay(1);
     }
     fclose(f);
-    sdcard_unlock();
+    sdcard_job_end();
     return ESP_OK;
 }
 
@@ -631,9 +1011,11 @@ esp_err_t sdcard_self_test(size_t size_mb, uint32_t freq_khz, size_t buf_bytes)
     if (size_mb == 0) {
         size_mb = 10;
     }
-    sdcard_lock();
-    if (!vfs_allowed_locked() || !s_mounted) {
-        sdcard_unlock();
+    if (!sdcard_job_begin()) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!sdcard_is_vfs_allowed() || !s_mounted) {
+        sdcard_job_end();
         return ESP_ERR_INVALID_STATE;
     }
 
@@ -648,20 +1030,20 @@ esp_err_t sdcard_self_test(size_t size_mb, uint32_t freq_khz, size_t buf_bytes)
     const size_t total_bytes = size_mb * 1024 * 1024;
     const uint32_t seed = 0xA5A5F00Du;
 
-    uint8_t *io_buf = heap_caps_malloc(buf_bytes, MALLOC_CAP_8BIT | MALLOC_CAP_DMA);
-    uint8_t *exp_buf = heap_caps_malloc(buf_bytes, MALLOC_CAP_8BIT | MALLOC_CAP_DMA);
+    uint8_t *io_buf = xfer_buf_lease(XFER_BUF_DMA, buf_bytes);
+    uint8_t *exp_buf = xfer_buf_lease(XFER_BUF_DMA, buf_bytes);
     if (!io_buf || !exp_buf) {
-        if (io_buf) heap_caps_free(io_buf);
-        if (exp_buf) heap_caps_free(exp_buf);
-        sdcard_unlock();
+        xfer_buf_release(io_buf);
+        xfer_buf_release(exp_buf);
+        sdcard_job_end();
         return ESP_ERR_NO_MEM;
     }
 
     FILE *f = fopen(SDTEST_FILE_PATH, "wb");
     if (!f) {
-        heap_caps_free(io_buf);
-        heap_caps_free(exp_buf);
-        sdcard_unlock();
+        xfer_buf_release(io_buf);
+        xfer_buf_release(exp_buf);
+        sdcard_job_end();
         return ESP_FAIL;
     }
 
@@ -672,27 +1054,31 @@ esp_err_t sdcard_self_test(size_t size_mb, uint32_t freq_khz, size_t buf_bytes)
         size_t offset = written_total;
         size_t to_write = (total_bytes - written_total) > buf_bytes ? buf_bytes : (total_bytes - written_total);
         fill_pattern(io_buf, to_write, seed, offset);
+        sdcard_io_begin(SDCARD_IO_BACKGROUND);
         size_t wrote = fwrite(io_buf, 1, to_write, f);
+        sdcard_io_end();
         if (wrote != to_write || ferror(f)) {
             fclose(f);
-            heap_caps_free(io_buf);
-            heap_caps_free(exp_buf);
-            sdcard_unlock();
+            xfer_buf_release(io_buf);
+            xfer_buf_release(exp_buf);
+            sdcard_job_end();
             return ESP_FAIL;
         }
         written_total += wrote;
         vTaskDelay(1);
     }
+    sdcard_io_begin(SDCARD_IO_BACKGROUND);
     fflush(f);
     fsync(fd);
     fclose(f);
+    sdcard_io_end();
     int64_t write_end = esp_timer_get_time();
 
     f = fopen(SDTEST_FILE_PATH, "rb");
     if (!f) {
-        heap_caps_free(io_buf);
-        heap_caps_free(exp_buf);
-        sdcard_unlock();
+        xfer_buf_release(io_buf);
+        xfer_buf_release(exp_buf);
+        sdcard_job_end();
         return ESP_FAIL;
     }
 
@@ -701,20 +1087,22 @@ esp_err_t sdcard_self_test(size_t size_mb, uint32_t freq_khz, size_t buf_bytes)
     while (read_total < total_bytes) {
         size_t offset = read_total;
         size_t to_read = (total_bytes - read_total) > buf_bytes ? buf_bytes : (total_bytes - read_total);
+        sdcard_io_begin(SDCARD_IO_BACKGROUND);
         size_t got = fread(io_buf, 1, to_read, f);
+        sdcard_io_end();
         if (got != to_read || ferror(f)) {
             fclose(f);
-            heap_caps_free(io_buf);
-            heap_caps_free(exp_buf);
-            sdcard_unlock();
+            xfer_buf_release(io_buf);
+            xfer_buf_release(exp_buf);
+            sdcard_job_end();
             return ESP_FAIL;
         }
         fill_pattern(exp_buf, to_read, seed, offset);
         if (memcmp(io_buf, exp_buf, to_read) != 0) {
             fclose(f);
-            heap_caps_free(io_buf);
-            heap_caps_free(exp_buf);
-            sdcard_unlock();
+            xfer_buf_release(io_buf);
+            xfer_buf_release(exp_buf);
+            sdcard_job_end();
             return ESP_FAIL;
         }
         read_total += got;
@@ -730,9 +1118,9 @@ esp_err_t sdcard_self_test(size_t size_mb, uint32_t freq_khz, size_t buf_bytes)
              size_mb, kb_total / write_time_s, kb_total / read_time_s);
     unlink(SDTEST_FILE_PATH);
 
-    heap_caps_free(io_buf);
-    heap_caps_free(exp_buf);
-    sdcard_unlock();
+    xfer_buf_release(io_buf);
+    xfer_buf_release(exp_buf);
+    sdcard_job_end();
     return ESP_OK;
 }
 
@@ -741,9 +1129,11 @@ esp_err_t sdcard_bench(size_t size_mb, size_t buf_bytes)
     if (size_mb == 0) {
         size_mb = 1;
     }
-    sdcard_lock();
-    if (!vfs_allowed_locked() || !s_mounted) {
-        sdcard_unlock();
+    if (!sdcard_job_begin()) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!sdcard_is_vfs_allowed() || !s_mounted) {
+        sdcard_job_end();
         return ESP_ERR_INVALID_STATE;
     }
 
@@ -753,21 +1143,21 @@ esp_err_t sdcard_bench(size_t size_mb, size_t buf_bytes)
 
     size_t total_bytes = size_mb * 1024 * 1024;
     if (size_mb != 0 && total_bytes / (1024 * 1024) != size_mb) {
-        sdcard_unlock();
+        sdcard_job_end();
         return ESP_ERR_INVALID_SIZE;
     }
 
-    uint8_t *io_buf = heap_caps_malloc(buf_bytes, MALLOC_CAP_8BIT | MALLOC_CAP_DMA);
+    uint8_t *io_buf = xfer_buf_lease(XFER_BUF_DMA, buf_bytes);
     if (!io_buf) {
-        sdcard_unlock();
+        sdcard_job_end();
         return ESP_ERR_NO_MEM;
     }
     memset(io_buf, 'A', buf_bytes);
 
     FILE *f = fopen(SDBENCH_FILE_PATH, "wb");
     if (!f) {
-        heap_caps_free(io_buf);
-        sdcard_unlock();
+        xfer_buf_release(io_buf);
+        sdcard_job_end();
         return ESP_FAIL;
     }
 
@@ -778,11 +1168,13 @@ esp_err_t sdcard_bench(size_t size_mb, size_t buf_bytes)
     int64_t write_start = esp_timer_get_time();
     while (written_total < total_bytes) {
         size_t to_write = (total_bytes - written_total) > buf_bytes ? buf_bytes : (total_bytes - written_total);
+        sdcard_io_begin(SDCARD_IO_BACKGROUND);
         size_t wrote = fwrite(io_buf, 1, to_write, f);
+        sdcard_io_end();
         if (wrote != to_write || ferror(f)) {
             fclose(f);
-            heap_caps_free(io_buf);
-            sdcard_unlock();
+            xfer_buf_release(io_buf);
+            sdcard_job_end();
             return ESP_FAIL;
         }
         written_total += wrote;
@@ -793,15 +1185,17 @@ esp_err_t sdcard_bench(size_t size_mb, size_t buf_bytes)
             last_yield = esp_timer_get_time();
         }
     }
+    sdcard_io_begin(SDCARD_IO_BACKGROUND);
     fflush(f);
     fsync(fd);
     fclose(f);
+    sdcard_io_end();
     int64_t write_end = esp_timer_get_time();
 
     f = fopen(SDBENCH_FILE_PATH, "rb");
     if (!f) {
-        heap_caps_free(io_buf);
-        sdcard_unlock();
+        xfer_buf_release(io_buf);
+        sdcard_job_end();
         return ESP_FAIL;
     }
 
@@ -811,11 +1205,13 @@ esp_err_t sdcard_bench(size_t size_mb, size_t buf_bytes)
     int64_t read_start = esp_timer_get_time();
     while (read_total < total_bytes) {
         size_t to_read = (total_bytes - read_total) > buf_bytes ? buf_bytes : (total_bytes - read_total);
+        sdcard_io_begin(SDCARD_IO_BACKGROUND);
         size_t got = fread(io_buf, 1, to_read, f);
+        sdcard_io_end();
         if (got != to_read || ferror(f)) {
             fclose(f);
-            heap_caps_free(io_buf);
-            sdcard_unlock();
+            xfer_buf_release(io_buf);
+            sdcard_job_end();
             return ESP_FAIL;
         }
         read_total += got;
@@ -836,7 +1232,106 @@ esp_err_t sdcard_bench(size_t size_mb, size_t buf_bytes)
              size_mb, kb_total / write_time_s, kb_total / read_time_s);
     unlink(SDBENCH_FILE_PATH);
 
-    heap_caps_free(io_buf);
-    sdcard_unlock();
+    xfer_buf_release(io_buf);
+    sdcard_job_end();
+    return ESP_OK;
+}
+
+esp_err_t sdcard_list_bench(size_t entries)
+{
+    if (entries == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!sdcard_job_begin()) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!sdcard_is_vfs_allowed() || !s_mounted) {
+        sdcard_job_end();
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    char rel_dir[48];
+    char dir_path[64];
+    snprintf(rel_dir, sizeof(rel_dir), "%s/%u", LSBENCH_ROOT, (unsigned)entries);
+    snprintf(dir_path, sizeof(dir_path), "%s%s", WIMILL_SD_MOUNT_POINT, rel_dir);
+    mkdir(WIMILL_SD_MOUNT_POINT "/.wimill", 0775);
+    mkdir(WIMILL_SD_MOUNT_POINT LSBENCH_ROOT, 0775);
+    mkdir(dir_path, 0775);
+
+    size_t existing = 0;
+    sdcard_dirent_t *ent = malloc(sizeof(*ent));
+    sdcard_dir_t *dir = ent ? sdcard_dir_open(rel_dir) : NULL;
+    if (!dir) {
+        free(ent);
+        sdcard_job_end();
+        return ESP_FAIL;
+    }
+    while (sdcard_dir_read(dir, ent)) {
+        existing++;
+    }
+    sdcard_dir_close(dir);
+
+    // Creating is O(N^2) on FAT as well, so the set is kept for later runs.
+    if (existing < entries) {
+        ESP_LOGI(TAG, "LSBENCH creating %u files in %s", (unsigned)(entries - existing), dir_path);
+    }
+    for (size_t i = existing; i < entries; ++i) {
+        char file_path[96];
+        snprintf(file_path, sizeof(file_path), "%s/part_%05u.gcode", dir_path, (unsigned)i);
+        sdcard_io_begin(SDCARD_IO_BACKGROUND);
+        FILE *f = fopen(file_path, "wb");
+        if (f) {
+            fclose(f);
+        }
+        sdcard_io_end();
+        if (!f) {
+            ESP_LOGE(TAG, "LSBENCH create failed: %s", file_path);
+            free(ent);
+            sdcard_job_end();
+            return ESP_FAIL;
+        }
+        if ((i % 500) == 0) {
+            vTaskDelay(1);
+        }
+    }
+
+    // Each timed pass holds the card so other traffic does not skew it.
+    size_t stat_count = 0;
+    sdcard_io_begin(SDCARD_IO_BACKGROUND);
+    int64_t stat_start = esp_timer_get_time();
+    DIR *vfs_dir = opendir(dir_path);
+    if (vfs_dir) {
+        struct dirent *vfs_ent;
+        while ((vfs_ent = readdir(vfs_dir)) != NULL) {
+            char full_path[96 + 256];
+            snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, vfs_ent->d_name);
+            struct stat st;
+            if (stat(full_path, &st) == 0) {
+                stat_count++;
+            }
+        }
+        closedir(vfs_dir);
+    }
+    int64_t stat_end = esp_timer_get_time();
+    sdcard_io_end();
+
+    size_t single_count = 0;
+    sdcard_io_begin(SDCARD_IO_BACKGROUND);
+    int64_t single_start = esp_timer_get_time();
+    dir = sdcard_dir_open(rel_dir);
+    if (dir) {
+        while (sdcard_dir_read(dir, ent)) {
+            single_count++;
+        }
+        sdcard_dir_close(dir);
+    }
+    int64_t single_end = esp_timer_get_time();
+    sdcard_io_end();
+
+    ESP_LOGI(TAG, "LSBENCH entries=%u readdir+stat=%lld ms (%u) single-pass=%lld ms (%u)",
+             (unsigned)entries, (long long)((stat_end - stat_start) / 1000), (unsigned)stat_count,
+             (long long)((single_end - single_start) / 1000), (unsigned)single_count);
+    free(ent);
+    sdcard_job_end();
     return ESP_OK;
 }
@@ -23,6 +23,18 @@ typedef struct {
     uint64_t free_bytes;
 } sdcard_status_t;
 
+// One directory entry as FATFS reports it, so listings need no stat() per
+// entry (on FAT every stat re-scans the parent directory from the start).
+typedef struct {
+    char name[256];
+    uint64_t size;
+    int64_t mtime; // same local-time conversion as VFS stat()
+    bool is_dir;
+    uint8_t attr; // FATFS AM_* bits
+} sdcard_dirent_t;
+
+typedef struct sdcard_dir sdcard_dir_t;
+
 typedef enum {
     SDCARD_MODE_USB,
     SDCARD_MODE_APP,
@@ -35,6 +47,41 @@ bool sdcard_is_vfs_allowed(void);
 void sdcard_lock(void);
 void sdcard_unlock(void);
 
+// Long card jobs (CLI tests, background indexers) run between these;
+// unmount waits for the current job. Jobs that can stop early should poll
+// sdcard_job_should_stop() and return once it is set.
+bool sdcard_job_begin(void);
+void sdcard_job_end(void);
+bool sdcard_job_should_stop(void);
+
+// Priority classes for card I/O. Interactive requests (listings, metadata
+// changes) go first; streams share the card in time slices; background
+// jobs (benchmarks, CLI file ops) take what is left.
+typedef enum {
+    SDCARD_IO_INTERACTIVE,
+    SDCARD_IO_STREAM,
+    SDCARD_IO_BACKGROUND,
+    SDCARD_IO_CLASS_COUNT,
+} sdcard_io_class_t;
+
+typedef struct {
+    uint32_t grants;
+    uint32_t waits;  // grants that had to queue
+    uint32_t queued; // waiting right now
+    uint32_t wait_us_max;
+    uint64_t wait_us_total;
+    uint32_t busy_us_max; // card held per unit, grant to sdcard_io_end()
+    uint64_t busy_us_total;
+} sdcard_io_stats_t;
+
+// Brackets one unit of card I/O: a whole listing or metadata change, or one
+// chunk of a bulk transfer. Nests on the same task; keep network waits
+// outside the bracket where the code allows it.
+void sdcard_io_begin(sdcard_io_class_t cls);
+void sdcard_io_end(void);
+void sdcard_io_get_stats(sdcard_io_class_t cls, sdcard_io_stats_t *out);
+const char *sdcard_io_class_name(sdcard_io_class_t cls);
+
 esp_err_t sdcard_init_raw(sdmmc_card_t **out_card);
 esp_err_t sdcard_mount(void);
 esp_err_t sdcard_unmount(void);
@@ -50,9 +97,21 @@ esp_err_t sdcard_set_disk_status_check(bool enable, bool remount);
 esp_err_t sdcard_get_status(sdcard_status_t *out_status);
 esp_err_t sdcard_get_space(sd_space_info_t *info);
 esp_err_t sdcard_list(const char *path);
+// rel_path is relative to the mount point ("/" or "/dir"). read returns
+// false at the end of the directory or on error; "." and ".." are skipped.
+// After a false read, sdcard_dir_error() tells the two apart: ESP_OK at the
+// real end, ESP_ERR_INVALID_STATE if the card was unmounted meanwhile,
+// ESP_FAIL for a FATFS error. A listing that ended in error is incomplete.
+sdcard_dir_t *sdcard_dir_open(const char *rel_path);
+bool sdcard_dir_read(sdcard_dir_t *dir, sdcard_dirent_t *out);
+esp_err_t sdcard_dir_error(const sdcard_dir_t *dir);
+void sdcard_dir_close(sdcard_dir_t *dir);
 esp_err_t sdcard_remove(const char *path);
 esp_err_t sdcard_mkdir(const char *path);
 esp_err_t sdcard_cat(const char *path, size_t max_bytes);
 esp_err_t sdcard_touch(const char *path, size_t size_bytes);
 esp_err_t sdcard_self_test(size_t size_mb, uint32_t freq_khz, size_t buf_bytes);
 esp_err_t sdcard_bench(size_t size_mb, size_t buf_bytes);
+// Times readdir()+stat() against sdcard_dir_read() on a directory of
+// `entries` empty files (created once under /.wimill/lsbench and kept).
+esp_err_t sdcard_list_bench(size_t entries);
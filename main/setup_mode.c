@@ -16,18 +16,28 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "lwip/inet.h"
+#include "mbedtls/sha256.h"
 #include "mdns.h"
 
+#include "boot_time.h"
+#include "bulk_server.h"
 #include "config_store.h"
+#include "gzip_stream.h"
+#include "http_workers.h"
 #include "led_status.h"
+#include "metrics.h"
 #include "msc.h"
 #include "sdcard.h"
+#include "trace.h"
 #include "web_fs.h"
+#include "ws_events.h"
 
 #define TAG "SETUP"
 #define AP_PASS "wimill1234"
 #define STA_CONNECT_TIMEOUT_MS 30000
 #define MDNS_NAME_LIMIT 24
+#define WS_WIFI_INTERVAL_MS 5000
+#define UI_PLAIN_CHUNK 4096
 
 static bool s_active = false;
 static bool s_wifi_inited = false;
@@ -50,8 +60,10 @@ static char s_sta_ip[16] = "0.0.0.0";
 static char s_sta_error[32] = {0};
 static char s_mdns_name[32] = {0};
 static int s_sta_rssi = 0;
+static setup_wifi_stats_t s_wifi_stats = {0};
 static esp_timer_handle_t s_sta_timer = NULL;
 static esp_timer_handle_t s_apply_timer = NULL;
+static esp_timer_handle_t s_ws_wifi_timer = NULL;
 static wimill_config_t s_cfg;
 static SemaphoreHandle_t s_cfg_mutex = NULL;
 static SemaphoreHandle_t s_state_mutex = NULL;
@@ -188,6 +200,17 @@ static void update_mdns_name(void)
     state_unlock();
 }
 
+// Clients find the raw-TCP bulk port as TXT "bulk" on the _http service.
+static void setup_mdns_bulk_txt(void)
+{
+    uint16_t bulk_port = bulk_server_port();
+    if (!s_mdns_service_added || bulk_port == 0)
+        return;
+    char value[8];
+    snprintf(value, sizeof(value), "%u", (unsigned)bulk_port);
+    mdns_service_txt_item_set("_http", "_tcp", "bulk", value);
+}
+
 static esp_err_t setup_mdns_start(uint16_t port)
 {
     esp_err_t err = ESP_OK;
@@ -211,7 +234,11 @@ static esp_err_t setup_mdns_start(uint16_t port)
         mdns_service_remove("_http", "_tcp");
     err = mdns_service_add(NULL, "_http", "_tcp", port, NULL, 0);
     if (err == ESP_OK)
+    {
         s_mdns_service_added = true;
+        boot_time_mark(BOOT_PHASE_MDNS);
+        setup_mdns_bulk_txt();
+    }
     return err;
 }
 
@@ -228,6 +255,7 @@ static void sta_connect_timeout_cb(void *arg)
     set_sta_error("timeout");
     state_lock();
     s_sta_connecting = false;
+    s_wifi_stats.timeouts++;
     state_unlock();
     esp_wifi_disconnect();
     if (s_sta_only_mode)
@@ -256,6 +284,8 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
         s_sta_connected = false;
         s_sta_connecting = false;
         strncpy(s_sta_ip, "0.0.0.0", sizeof(s_sta_ip));
+        s_wifi_stats.disconnects++;
+        s_wifi_stats.last_reason = (int)disc->reason;
         state_unlock();
         if (s_sta_timer)
             esp_timer_stop(s_sta_timer);
@@ -283,7 +313,9 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
         s_sta_connected = true;
         s_sta_connecting = false;
         s_sta_error[0] = '\0';
+        s_wifi_stats.connects++;
         state_unlock();
+        boot_time_mark(BOOT_PHASE_WIFI);
         wifi_ap_record_t ap_info;
         if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK)
         {
@@ -393,6 +425,7 @@ static esp_err_t setup_wifi_start(void)
     uint16_t port = s_cfg.web_port ? s_cfg.web_port : 8080;
     cfg_unlock();
     ESP_LOGI(TAG, "AP started: SSID=%s PASS=%s IP=%s PORT=%u", s_ap_ssid, AP_PASS, s_ap_ip, port);
+    boot_time_mark(BOOT_PHASE_WIFI);
     s_sta_only_mode = false;
     led_status_set_wifi(true);
     return ESP_OK;
@@ -411,6 +444,11 @@ static esp_err_t setup_sta_only_start(void)
     }
     s_sta_only_mode = true;
     led_status_set_wifi(false);
+    // The server binds to any address, so it can listen while the station is
+    // still associating; got-IP then only restarts it if the port changed.
+    esp_err_t http_err = setup_http_start();
+    if (http_err != ESP_OK)
+        ESP_LOGW(TAG, "HTTP early start failed: %s", esp_err_to_name(http_err));
     if (!start_sta_connect_async())
         return ESP_ERR_INVALID_STATE;
     return ESP_OK;
@@ -458,6 +496,9 @@ static esp_err_t sta_connect_start(void)
     }
     esp_wifi_disconnect();
     err = esp_wifi_connect();
+    state_lock();
+    s_wifi_stats.connect_attempts++;
+    state_unlock();
     if (err != ESP_OK)
         return err;
     state_lock();
@@ -613,285 +654,97 @@ static bool apply_config_form(const char *body, char *err, size_t err_len)
 
 // --- HTML & RESOURCES (NEON CNC THEME) ---
 
-static const char k_index_html[] =
-    "<!DOCTYPE html><html lang=\"en\"><head><meta charset=\"UTF-8\">"
-    "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">"
-    "<title>NEON CNC CONTROL</title><style>"
-    ":root{--bg:#050510;--grid:rgba(0,255,255,0.1);--cyan:#00f3ff;--pink:#ff00ff;"
-    "--red:#ff3333;--green:#33ff33;--glass:rgba(0,20,40,0.7);}"
-    "body{margin:0;padding:20px;background-color:var(--bg);background-image:"
-    "linear-gradient(var(--grid) 1px,transparent 1px),linear-gradient(90deg,var(--grid) 1px,transparent 1px);"
-    "background-size:30px 30px;color:var(--cyan);font-family:'Courier New',monospace;font-weight:bold;"
-    "min-height:100vh;box-sizing:border-box;overflow-x:hidden;}"
-    "body::after{content:\"\";position:fixed;top:0;left:0;width:100vw;height:100vh;background:"
-    "repeating-linear-gradient(0deg,rgba(0,0,0,0.15),rgba(0,0,0,0.15) 1px,transparent 1px,transparent 2px);"
-    "pointer-events:none;z-index:999;}"
-    ".container{max-width:750px;margin:0 auto;border:2px solid var(--cyan);box-shadow:0 0 15px var(--cyan),"
-    "inset 0 0 20px rgba(0,243,255,0.2);background:var(--glass);backdrop-filter:blur(5px);padding:20px;"
-    "border-radius:4px;position:relative;}"
-    "header{display:flex;justify-content:space-between;align-items:center;border-bottom:2px solid var(--cyan);"
-    "padding-bottom:15px;margin-bottom:20px;}h1{margin:0;text-transform:uppercase;letter-spacing:4px;"
-    "text-shadow:2px 2px 0px var(--pink);font-size:1.5rem;}"
-    ".sys-status{font-size:0.9rem;text-align:right;}.status-badge{display:inline-block;padding:2px 8px;"
-    "background:#000;border:1px solid currentColor;}"
-    ".status-ok{color:var(--green);box-shadow:0 0 5px var(--green);}"
-    ".status-warn{color:var(--red);box-shadow:0 0 5px var(--red);animation:blink 1s infinite;}"
-    ".tabs{display:flex;gap:10px;margin-bottom:20px;}.tab-btn{flex:1;background:transparent;border:1px solid var(--cyan);"
-    "color:var(--cyan);padding:10px;cursor:pointer;text-transform:uppercase;font-family:inherit;font-weight:bold;"
-    "transition:0.2s;box-shadow:0 0 5px var(--cyan);}.tab-btn:hover{background:rgba(0,243,255,0.1);"
-    "transform:translateY(-2px);}.tab-btn.active{background:var(--cyan);color:#000;box-shadow:0 0 15px var(--cyan);}"
-    ".view{display:none;}.view.active{display:block;}"
-    ".diag-table{width:100%;border-collapse:collapse;margin-top:10px;}"
-    ".diag-table td,.diag-table th{border:1px solid var(--cyan);padding:8px;text-align:left;}"
-    ".diag-table th{background:rgba(0,243,255,0.2);text-transform:uppercase;}.val-ok{color:var(--green);}"
-    ".val-num{color:var(--pink);}.val-err{color:var(--red);}"
-    ".cfg-box{padding:15px;border:1px solid var(--grid);margin-top:15px;}"
-    ".cfg-input{background:black;border:1px solid var(--cyan);color:var(--cyan);font-family:inherit;"
-    "padding:5px;width:100%;box-sizing:border-box;margin-bottom:10px;}"
-    "/* NEW UI STYLES */"
-    ".toolbar{display:flex;flex-wrap:wrap;gap:10px;align-items:stretch;margin-bottom:15px;padding:10px;"
-    "border:1px dashed var(--cyan);background:rgba(0,0,0,0.3);width:100%;box-sizing:border-box;}"
-    ".toolbar button:disabled{opacity:0.3;pointer-events:none;border-color:#555;color:#555;}"
-    ".toolbar.disabled{opacity:0.3;pointer-events:none;}"
-    ".btn{background:#000;border:1px solid var(--pink);color:var(--pink);padding:8px 12px;cursor:pointer;"
-    "text-transform:uppercase;font-family:inherit;font-size:0.8rem;transition:0.2s;text-align:center;min-width:100px;}"
-    ".btn-tile{flex:1 1 0;min-width:140px;}"
-    ".btn:hover{background:var(--pink);color:#000;box-shadow:0 0 10px var(--pink);}"
-    ".btn-main{border-color:var(--cyan);color:var(--cyan);}"
-    ".btn-main:hover{background:var(--cyan);color:#000;box-shadow:0 0 10px var(--cyan);}"
-    ".btn-danger{border-color:var(--red);color:var(--red);min-width:100px;}"
-    ".btn-danger:hover{background:var(--red);color:#000;box-shadow:0 0 10px var(--red);}"
-    ".btn-danger:disabled{border-color:#555;color:#555;background:transparent;box-shadow:none;}"
-    "#dropZone{border:2px dashed var(--cyan);padding:30px;text-align:center;margin-bottom:20px;"
-    "color:rgba(0,243,255,0.5);transition:0.3s;cursor:pointer;}"
-    "#dropZone.hover{background:rgba(0,243,255,0.1);color:var(--cyan);border-style:solid;box-shadow:inset 0 0 20px var(--cyan);}"
-    /* Progress Bar styles update */
-    ".progress-container{display:none;flex-direction:row;align-items:center;gap:10px;margin-bottom:20px;"
-    "background:#000;padding:5px;border:1px solid var(--cyan);}"
-    ".progress-track{flex-grow:1;height:20px;background:#111;position:relative;}"
-    ".progress-bar{height:100%;width:0%;background:repeating-linear-gradient(45deg,var(--pink),var(--pink) 10px,"
-    "#d600d6 10px,#d600d6 20px);box-shadow:0 0 10px var(--pink);transition:width 0.2s linear;}"
-    ".progress-text{position:absolute;width:100%;text-align:center;top:0;line-height:20px;color:#fff;"
-    "text-shadow:1px 1px 0 #000;font-size:0.8rem;pointer-events:none;}"
-    ".btn-cancel{flex-shrink:0;border:1px solid var(--red);color:var(--red);background:transparent;"
-    "font-weight:bold;cursor:pointer;padding:0 15px;height:24px;font-size:0.8rem;font-family:inherit;}"
-    ".btn-cancel:hover{background:var(--red);color:#000;}"
-    /* File list updates */
-    ".file-list{width:100%;border-collapse:collapse;table-layout:fixed;}.file-list th{text-align:left;border-bottom:2px solid var(--cyan);"
-    "padding:8px 10px;}.file-list td{padding:8px 10px;border-bottom:1px solid rgba(0,243,255,0.3);cursor:pointer;"
-    "white-space:normal;word-break:break-word;}"
-    "#filesView{overflow-x:hidden;}"
-    ".file-list th:last-child,.file-list td:last-child{text-align:right;}"
-    ".file-list tr:hover{background:var(--cyan);color:#000;}.file-list tr.selected{background:var(--cyan);color:#000;text-shadow:none;font-weight:bold;}"
-    ".banner-warn{display:none;border:2px solid var(--red);padding:15px;background:rgba(50,0,0,0.5);color:var(--red);"
-    "text-align:center;box-shadow:0 0 15px var(--red);margin-bottom:15px;animation:blink 1s infinite alternate;}"
-    "@keyframes blink{from{opacity:1;}to{opacity:0.7;}}"
-    "</style></head><body>"
-    "<div class=\"container\">"
-    "<header><h1>WiMill <span style=\"color:var(--pink)\">//</span> CNC</h1>"
-    "<div class=\"sys-status\">SYSTEM: <span id=\"stSys\" class=\"status-badge\">...</span><br>"
-    "USB LINK: <span id=\"stUsb\" class=\"status-badge\">...</span></div></header>"
-    "<div class=\"tabs\"><button id=\"tabSetup\" class=\"tab-btn active\" onclick=\"setTab('setup')\">SYSTEM</button>"
-    "<button id=\"tabFiles\" class=\"tab-btn\" onclick=\"setTab('files')\">STORAGE</button></div>"
-    "<div id=\"setupView\" class=\"view active\">"
-    "<h3 style=\"border-bottom:1px solid var(--pink);display:inline-block;\">DIAGNOSTICS</h3>"
-    "<table class=\"diag-table\">"
-    "<tr><th>Parameter</th><th>Value</th></tr>"
-    "<tr><td>Device Name</td><td id=\"valDevName\" class=\"val-num\">-</td></tr>"
-    "<tr><td>Wi-Fi SSID</td><td id=\"valSsid\" class=\"val-ok\">-</td></tr>"
-    "<tr><td>IP Address</td><td id=\"valIp\" class=\"val-num\">-</td></tr>"
-    "<tr><td>Last Known IP</td><td id=\"valLastIp\" class=\"val-num\">-</td></tr>"
-    "<tr><td>Signal (RSSI)</td><td id=\"valRssi\" class=\"val-num\">-</td></tr>"
-    "<tr><td>Uptime</td><td id=\"valUptime\" class=\"val-num\">-</td></tr>"
-    "<tr><td>SD Card</td><td id=\"valSd\" class=\"val-ok\">-</td></tr>"
-    "</table><br>"
-    "<h3 style=\"border-bottom:1px solid var(--pink);display:inline-block;\">CONFIGURATION</h3>"
-    "<form id=\"cfgForm\" class=\"cfg-box\">"
-    "<label>DEVICE NAME</label><input id=\"device_name\" name=\"device_name\" class=\"cfg-input\">"
-    "<label>STA SSID</label><input id=\"sta_ssid\" name=\"sta_ssid\" class=\"cfg-input\">"
-    "<label>STA PASSWORD</label><input id=\"sta_psk\" name=\"sta_psk\" type=\"password\" class=\"cfg-input\">"
-    "<label>WEB PORT</label><input id=\"web_port\" name=\"web_port\" type=\"number\" class=\"cfg-input\">"
-    "<label>WIFI BOOT MODE</label><select id=\"wifi_boot\" name=\"wifi_boot\" class=\"cfg-input\" style=\"background:black;\">"
-    "<option value=\"sta\">STA (AUTO CONNECT)</option><option value=\"ap\">AP (SETUP MODE)</option></select>"
-    "<button type=\"submit\" class=\"btn btn-green\">APPLY SETTINGS</button><div id=\"saveMsg\"></div>"
-    "</form></div>"
-    "<div id=\"filesView\" class=\"view\">"
-    "<div id=\"usbWarning\" class=\"banner-warn\">⚠ USB CONTROLLED BY HOST ⚠<br>FILE OPERATIONS LOCKED</div>"
-    "<div style=\"display:flex;justify-content:space-between;margin-bottom:15px;background:rgba(255,0,255,0.1);padding:10px;border:1px solid var(--pink);\">"
-    "<span>USB INTERFACE CONTROL:</span><div><button id=\"btnAttach\" class=\"btn\" onclick=\"usbAction('attach')\">MOUNT (ATTACH)</button>"
-    "<button id=\"btnDetach\" class=\"btn btn-green\" onclick=\"usbAction('detach')\" style=\"display:none;\">EJECT (DETACH)</button></div></div>"
-    /* PROGRESS BAR WITH CANCEL */
-    "<div id=\"progressContainer\" class=\"progress-container\">"
-    "<div class=\"progress-track\"><div id=\"progressBar\" class=\"progress-bar\"></div><div id=\"progressText\" class=\"progress-text\"></div></div>"
-    "<button id=\"btnCancel\" class=\"btn-cancel\" onclick=\"cancelTransfer()\">[X] CANCEL</button>"
-    "</div>"
-    /* NEW TOOLBAR LAYOUT */
-    "<div id=\"toolbar\" class=\"toolbar\">"
-"<button class=\"btn btn-main btn-tile\" onclick=\"triggerUpload()\">[↑] UPLOAD</button>"
-"<button id=\"btnDown\" class=\"btn btn-tile\" onclick=\"fsDownload()\" disabled>[↓] DOWNLOAD</button>"
-"<button id=\"btnRen\" class=\"btn btn-tile\" onclick=\"fsRename()\" disabled>[R] RENAME</button>"
-"<button class=\"btn btn-main btn-tile\" onclick=\"fsMkdir()\">[+] NEW DIR</button>"
-"<input id=\"fileInput\" type=\"file\" style=\"display:none\"></div>"
-    /* PATH AND DELETE BUTTON ROW */
-    "<div style=\"display:flex;justify-content:space-between;align-items:center;margin-bottom:10px;border-bottom:1px solid var(--grid);padding-bottom:5px;\">"
-    "<div>PATH: <span id=\"fsPath\" style=\"color:var(--pink)\">/</span></div>"
-    "<button id=\"btnDel\" class=\"btn btn-danger\" onclick=\"fsDelete()\" disabled>[x] DELETE</button>"
-    "</div>"
-    "<div id=\"dropZone\">>> DRAG & DROP G-CODE FILES HERE <<</div>"
-    "<table class=\"file-list\"><thead><tr>"
-    "<th>TYPE</th>"
-    "<th id=\"thName\" onclick=\"setSort('name')\">NAME</th>"
-    "<th>SIZE</th>"
-    "<th id=\"thDate\" onclick=\"setSort('date')\">DATE</th>"
-    "</tr></thead><tbody id=\"fsBody\"></tbody></table>"
-    "</div></div><script>"
-    "let currentPath='/';let selected=null;let uploading=false;let downloading=false;let filled=false;"
-    "let pc=null;let pb=null;let pt=null;"
-    "let activeUploadXhr=null;let activeDownloadAbort=null;let activeDownloadXhr=null;"
-    "let lastUsbMode=null;let sortKey='name';let sortDir=1;"
-    "function fmt(b){if(b<1024)return b+' B';if(b<1048576)return(b/1024).toFixed(1)+' KB';return(b/1048576).toFixed(1)+' MB';}"
-    "function fmtSize(b){if(!b)return'';if(b<1048576)return (b/1024).toFixed(1)+' KB';return (b/1048576).toFixed(2)+' MB';}"
-    "function fmtDate(ts){if(!ts)return'';const d=new Date(ts*1000);return d.toLocaleString().replace(',', '');}"
-    "function sortLabel(k){return sortKey===k?(sortDir>0?' ▲':' ▼'):'';}"
-    "function updateSortHeaders(){document.getElementById('thName').textContent='NAME'+sortLabel('name');"
-    "document.getElementById('thDate').textContent='DATE'+sortLabel('date');}"
-    "function setSort(k){if(sortKey===k){sortDir*=-1;}else{sortKey=k;sortDir=1;}refreshFiles();}"
-    "function sortItems(items){items.sort((a,b)=>{if(a.type!==b.type)return a.type==='dir'?-1:1;"
-    "if(sortKey==='date'){const av=a.mtime||0;const bv=b.mtime||0;return (av-bv)*sortDir;}"
-    "const an=(a.name||'').toLowerCase();const bn=(b.name||'').toLowerCase();"
-    "if(an<bn)return -1*sortDir;if(an>bn)return 1*sortDir;return 0;});}"
-    "function setTab(t){document.querySelectorAll('.view').forEach(e=>e.classList.remove('active'));"
-    "document.querySelectorAll('.tab-btn').forEach(e=>e.classList.remove('active'));"
-    "document.getElementById(t+'View').classList.add('active');"
-    "document.getElementById('tab'+(t==='setup'?'Setup':'Files')).classList.add('active');"
-    "if(t==='files') refreshFiles();}"
-    "async function updateStatus(){try{const r=await fetch('/api/status');const j=await r.json();"
-    "const sSys=document.getElementById('stSys');const sUsb=document.getElementById('stUsb');"
-    "if(j.sta_connected){sSys.textContent='ONLINE ('+j.sta_ip+')';sSys.className='status-badge status-ok';}"
-    "else if(j.sta_connecting){sSys.textContent='CONNECTING...';sSys.className='status-badge status-warn';}"
-    "else{sSys.textContent='OFFLINE (AP)';sSys.className='status-badge';}"
-    "if(j.usb_mode==='ATTACHED'){sUsb.textContent='ATTACHED';sUsb.className='status-badge status-warn';"
-    "document.getElementById('usbWarning').style.display='block';document.getElementById('toolbar').classList.add('disabled');"
-    "document.getElementById('btnAttach').style.display='none';document.getElementById('btnDetach').style.display='inline-block';}"
-    "else{sUsb.textContent='DETACHED';sUsb.className='status-badge status-ok';"
-    "document.getElementById('usbWarning').style.display='none';document.getElementById('toolbar').classList.remove('disabled');"
-    "document.getElementById('btnAttach').style.display='inline-block';document.getElementById('btnDetach').style.display='none';}"
-    "if(lastUsbMode&&lastUsbMode!==j.usb_mode&&j.usb_mode==='DETACHED'){refreshFiles();}"
-    "lastUsbMode=j.usb_mode;"
-    "document.getElementById('valDevName').textContent=j.dev_name;"
-    "document.getElementById('valSsid').textContent=j.ssid||j.ap_ssid;"
-    "document.getElementById('valIp').textContent=j.sta_ip;"
-    "document.getElementById('valLastIp').textContent=j.last_sta_ip||'-';"
-    "document.getElementById('valRssi').textContent=j.rssi+' dBm';"
-    "document.getElementById('valUptime').textContent=Math.floor(j.uptime_s/60)+'m '+j.uptime_s%60+'s';"
-    "document.getElementById('valSd').textContent=j.sd_mounted?'MOUNTED':'UNMOUNTED';"
-    "if(!filled){document.getElementById('device_name').value=j.dev_name||'';document.getElementById('sta_ssid').value=j.ssid||'';"
-    "document.getElementById('sta_psk').value=j.sta_psk||'';document.getElementById('web_port').value=j.web_port||80;"
-    "document.getElementById('wifi_boot').value=(j.wifi_boot||'ap').toLowerCase();filled=true;}"
-    "}catch(e){console.error(e);}}setInterval(updateStatus,2000);updateStatus();"
-    "document.getElementById('cfgForm').onsubmit=async(e)=>{e.preventDefault();const msg=document.getElementById('saveMsg');"
-    "msg.textContent='SAVING...';const fd=new FormData(e.target);const r=await fetch('/api/config',{method:'POST',body:new URLSearchParams(fd)});"
-    "const j=await r.json();msg.textContent=j.ok?'SAVED. CONNECTING...':'ERROR: '+j.error;};"
-    "async function usbAction(act){await fetch('/api/usb/'+act,{method:'POST'});updateStatus();}"
-    "async function refreshFiles(){const r=await fetch('/api/fs/list?path='+encodeURIComponent(currentPath));"
-    "const j=await r.json();currentPath=j.path||'/';document.getElementById('fsPath').textContent=currentPath;"
-    "const tb=document.getElementById('fsBody');tb.innerHTML='';selected=null;updateFileButtons();"
-    "const items=(j.items||[]).slice();sortItems(items);updateSortHeaders();"
-    "if(currentPath!=='/'){addRow({type:'dir',name:'..',mtime:0});}"
-    "items.forEach(i=>addRow(i));}"
-    "function updateFileButtons(){const s=!!selected;const p=(selected&&selected.type==='dir'&&selected.name==='..');"
-    "const en=s&&!p;" /* Enable only if selected and not '..' */
-    "document.getElementById('btnDown').disabled=!en;"
-    "document.getElementById('btnRen').disabled=!en;"
-    "document.getElementById('btnDel').disabled=!en;}"
-    "function addRow(i){const tr=document.createElement('tr');"
-    "const dateStr=fmtDate(i.mtime);"
-    "const sizeStr=i.type==='file'?fmtSize(i.size||0):'';"
-    "tr.innerHTML='<td>'+(i.type==='dir'?'[DIR]':'[FILE]')+'</td><td>'+i.name+'</td><td>'+sizeStr+'</td><td>'+dateStr+'</td>';"
-    /* TOGGLE LOGIC */
-    "tr.onclick=()=>{if(selected===i){tr.classList.remove('selected');selected=null;}else{"
-    "Array.from(tr.parentNode.children).forEach(r=>r.classList.remove('selected'));tr.classList.add('selected');selected=i;}"
-    "updateFileButtons();};"
-    "tr.ondblclick=()=>{if(i.type==='dir'){currentPath=i.name==='..'?currentPath.split('/').slice(0,-1).join('/')||'/':(currentPath==='/'?'/':currentPath+'/')+i.name;refreshFiles();}};"
-    "document.getElementById('fsBody').appendChild(tr);}"
-    "function triggerUpload(){document.getElementById('fileInput').click();}"
-    "document.getElementById('fileInput').onchange=(e)=>{if(e.target.files[0]) uploadFile(e.target.files[0]);};"
-    "const dz=document.getElementById('dropZone');"
-    "dz.ondragover=e=>{e.preventDefault();dz.classList.add('hover');};dz.ondragleave=()=>{dz.classList.remove('hover');};"
-    "dz.ondrop=e=>{e.preventDefault();dz.classList.remove('hover');if(e.dataTransfer.files[0]) uploadFile(e.dataTransfer.files[0]);};"
-    "function uploadFile(file){if(uploading||downloading)return;uploading=true;"
-    "pc=document.getElementById('progressContainer');pb=document.getElementById('progressBar');pt=document.getElementById('progressText');"
-    "pc.style.display='flex';uploadRaw(file,true);}"
-    "function progressUpdate(loaded,total,start,label){const t=(performance.now()-start)/1000;const s=t>0?loaded/t:0;"
-    "if(total>0){const p=(loaded/total)*100;pb.style.width=p+'%';pt.textContent=label+': '+p.toFixed(0)+'% @ '+fmt(s)+'/s';}"
-    "else{pb.style.width='100%';pt.textContent=label+': '+fmt(loaded)+' @ '+fmt(s)+'/s';}}"
-    "function resetTransferUi(){if(pb){pb.style.width='0%';}if(pt){pt.textContent='';}"
-    "if(pc){pc.style.display='none';}}"
-    "function uploadRaw(file,allowFallback){const xhr=new XMLHttpRequest();activeUploadXhr=xhr;const start=performance.now();"
-    "xhr.upload.onprogress=e=>{progressUpdate(e.loaded,e.total,start,'UPLOADING');};"
-    "xhr.onload=()=>{activeUploadXhr=null;if(xhr.status===200){uploading=false;resetTransferUi();refreshFiles();}"
-    "else if(allowFallback){uploadMultipart(file);}else{uploading=false;alert('Upload failed');resetTransferUi();}};"
-    "xhr.onerror=()=>{activeUploadXhr=null;if(allowFallback){uploadMultipart(file);}else{uploading=false;alert('Upload failed');resetTransferUi();}};"
-    "xhr.onabort=()=>{activeUploadXhr=null;uploading=false;resetTransferUi();};"
-    "const mtime=(file.lastModified||Date.now());"
-    "const url='/api/fs/upload_raw?path='+encodeURIComponent(currentPath)+'&name='+encodeURIComponent(file.name)"
-    "+'&overwrite=1&mtime='+encodeURIComponent(mtime);"
-    "xhr.open('POST',url);xhr.setRequestHeader('Content-Type','application/octet-stream');xhr.send(file);}"
-    "function uploadMultipart(file){const fd=new FormData();fd.append('file',file);const xhr=new XMLHttpRequest();activeUploadXhr=xhr;"
-    "const start=performance.now();xhr.upload.onprogress=e=>{progressUpdate(e.loaded,e.total,start,'UPLOADING');};"
-    "xhr.onload=()=>{activeUploadXhr=null;uploading=false;resetTransferUi();refreshFiles();};"
-    "xhr.onerror=()=>{activeUploadXhr=null;uploading=false;alert('Upload failed');resetTransferUi();};"
-    "xhr.onabort=()=>{activeUploadXhr=null;uploading=false;resetTransferUi();};"
-    "const mtime=(file.lastModified||Date.now());"
-    "xhr.open('POST','/api/fs/upload?path='+encodeURIComponent(currentPath)"
-    "+'&overwrite=1&mtime='+encodeURIComponent(mtime));xhr.send(fd);}"
-    "async function fsDownload(){"
-    "if(downloading||uploading||!selected||selected.type!=='file')return;"
-    "downloading=true;pc=document.getElementById('progressContainer');pb=document.getElementById('progressBar');pt=document.getElementById('progressText');"
-    "pc.style.display='flex';const path=(currentPath==='/'?'/':currentPath+'/')+selected.name;"
-    "const url='/api/fs/download?path='+encodeURIComponent(path);const fname=selected.name;"
-    "const done=()=>{downloading=false;activeDownloadAbort=null;activeDownloadXhr=null;resetTransferUi();};"
-    "try{if(window.showSaveFilePicker){"
-    "const handle=await window.showSaveFilePicker({suggestedName:fname});"
-    "const writable=await handle.createWritable();const ctrl=new AbortController();activeDownloadAbort=ctrl;const res=await fetch(url,{signal:ctrl.signal});"
-    "if(!res.ok){let msg='Download failed';try{const j=await res.json();if(j.error)msg=j.error;}catch(e){}"
-    "await writable.abort();alert(msg);done();return;}"
-    "const total=parseInt(res.headers.get('X-Content-Length')||res.headers.get('Content-Length')||'0',10);"
-    "const reader=res.body.getReader();const start=performance.now();let received=0;"
-    "while(true){const {done:rdDone,value}=await reader.read();if(rdDone)break;"
-    "received+=value.length;await writable.write(value);progressUpdate(received,total,start,'DOWNLOADING');}"
-    "await writable.close();done();}else{"
-    "const xhr=new XMLHttpRequest();activeDownloadXhr=xhr;const start=performance.now();xhr.responseType='blob';"
-    "xhr.onprogress=e=>{let total=e.total;const h=xhr.getResponseHeader('X-Content-Length');"
-    "if(!total&&h)total=parseInt(h,10);progressUpdate(e.loaded,total||0,start,'DOWNLOADING');};"
-    "xhr.onload=()=>{if(xhr.status===200){const a=document.createElement('a');"
-    "a.href=URL.createObjectURL(xhr.response);a.download=fname;document.body.appendChild(a);a.click();"
-    "setTimeout(()=>{URL.revokeObjectURL(a.href);a.remove();},1000);done();}else{alert('Download failed');done();}};"
-    "xhr.onerror=()=>{alert('Download failed');done();};xhr.onabort=()=>{done();};xhr.open('GET',url);xhr.send();}}"
-    "catch(e){alert('Download failed');done();}}"
-    "function cancelTransfer(){"
-    "if(uploading&&activeUploadXhr){activeUploadXhr.abort();}"
-    "if(downloading){if(activeDownloadAbort){activeDownloadAbort.abort();}if(activeDownloadXhr){activeDownloadXhr.abort();}}"
-    "uploading=false;downloading=false;resetTransferUi();"
-    "}"
-    "async function fsMkdir(){const n=prompt('FOLDER NAME:');if(n) await apiCall('/api/fs/mkdir',{path:currentPath,name:n});}"
-    "async function fsRename(){if(!selected)return;const n=prompt('NEW NAME:',selected.name);"
-    "if(n) await apiCall('/api/fs/rename',{path:(currentPath==='/'?'/':currentPath+'/')+selected.name,new_name:n});}"
-    "async function fsDelete(){if(!selected||!confirm('DELETE '+selected.name+'?'))return;"
-    "await apiCall('/api/fs/delete',{path:(currentPath==='/'?'/':currentPath+'/')+selected.name});}"
-    "async function apiCall(u,d){await fetch(u,{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify(d)});refreshFiles();}"
-    "</script></body></html>";
+// The page lives in ui/index.html; the build minifies and gzips it
+// (tools/pack_ui.py) and links the result in as a binary blob.
+extern const uint8_t k_ui_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t k_ui_gz_end[] asm("_binary_index_html_gz_end");
+
+static char s_ui_etag[20];
+
+// Content hash of the blob: changes exactly when a new UI is flashed, so
+// browsers revalidate with a 304 instead of fetching the page again.
+static const char *ui_etag(void)
+{
+    if (!s_ui_etag[0])
+    {
+        uint8_t digest[32];
+        mbedtls_sha256(k_ui_gz_start, (size_t)(k_ui_gz_end - k_ui_gz_start), digest, 0);
+        snprintf(s_ui_etag, sizeof(s_ui_etag), "\"%02x%02x%02x%02x%02x%02x%02x%02x\"", digest[0], digest[1],
+                 digest[2], digest[3], digest[4], digest[5], digest[6], digest[7]);
+    }
+    return s_ui_etag;
+}
+
+typedef struct
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+} ui_src_t;
+
+static int ui_src_read(void *ctx, uint8_t *dst, size_t len)
+{
+    ui_src_t *src = (ui_src_t *)ctx;
+    size_t left = (size_t)(src->end - src->pos);
+    size_t n = len < left ? len : left;
+    memcpy(dst, src->pos, n);
+    src->pos += n;
+    return (int)n;
+}
+
+// Clients that do not take gzip (curl without --compressed) get the page
+// inflated on the fly; browsers never end up here.
+static esp_err_t ui_send_plain(httpd_req_t *req)
+{
+    ui_src_t src = {.pos = k_ui_gz_start, .end = k_ui_gz_end};
+    gzip_reader_t *gz = gzip_reader_create(ui_src_read, &src);
+    uint8_t *buf = malloc(UI_PLAIN_CHUNK);
+    if (!gz || !buf)
+    {
+        gzip_reader_destroy(gz);
+        free(buf);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+        return ESP_OK;
+    }
+    int n;
+    while ((n = gzip_reader_read(gz, buf, UI_PLAIN_CHUNK)) > 0)
+    {
+        if (httpd_resp_send_chunk(req, (const char *)buf, n) != ESP_OK)
+        {
+            break;
+        }
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    gzip_reader_destroy(gz);
+    free(buf);
+    return ESP_OK;
+}
 
 static esp_err_t http_root_get(httpd_req_t *req)
 {
+    const char *etag = ui_etag();
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    char hdr[128];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", hdr, sizeof(hdr)) == ESP_OK && strstr(hdr, etag))
+    {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
     httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, k_index_html, HTTPD_RESP_USE_STRLEN);
+    if (httpd_req_get_hdr_value_str(req, "Accept-Encoding", hdr, sizeof(hdr)) != ESP_OK || !strstr(hdr, "gzip"))
+    {
+        return ui_send_plain(req);
+    }
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_send(req, (const char *)k_ui_gz_start, (ssize_t)(k_ui_gz_end - k_ui_gz_start));
     return ESP_OK;
 }
 
 static esp_err_t http_status_get(httpd_req_t *req)
 {
-    char resp[768];
+    char resp[1280];
     uint32_t uptime_s = (uint32_t)(esp_timer_get_time() / 1000000ULL);
     bool mounted = sdcard_is_mounted();
 
@@ -940,13 +793,19 @@ static esp_err_t http_status_get(httpd_req_t *req)
     const char *mode = s_active ? "SETUP" : "NORMAL";
     const char *boot_str = (boot_mode == WIFI_BOOT_STA) ? "STA" : "AP";
     const char *usb_host = msc_is_host_connected() ? "connected" : "disconnected";
+    char boot_us[256];
+    if (boot_time_json(boot_us, sizeof(boot_us)) == 0)
+    {
+        // Printed unquoted, so it must stay a JSON object even when empty.
+        strcpy(boot_us, "{}");
+    }
     snprintf(resp, sizeof(resp),
              "{\"mode\":\"%s\",\"ap_ssid\":\"%s\",\"ap_ip\":\"%s\","
              "\"uptime_s\":%u,\"last_sta_ip\":\"%s\",\"usb_mode\":\"%s\",\"usb_host\":\"%s\","
              "\"sd_mounted\":%s,\"sta_connected\":%s,\"sta_connecting\":%s,"
              "\"sta_ip\":\"%s\",\"sta_error\":\"%s\",\"ssid\":\"%s\",\"sta_psk\":\"%s\","
-             "\"rssi\":%d,\"dev_name\":\"%s\",\"mdns_name\":\"%s\",\"web_port\":%u,"
-             "\"wifi_boot\":\"%s\"}",
+             "\"rssi\":%d,\"dev_name\":\"%s\",\"mdns_name\":\"%s\",\"web_port\":%u,\"bulk_port\":%u,"
+             "\"wifi_boot\":\"%s\",\"boot_us\":%s}",
              mode,
              s_active ? s_ap_ssid : "",
              s_active ? s_ap_ip : "",
@@ -965,7 +824,9 @@ static esp_err_t http_status_get(httpd_req_t *req)
              dev_name,
              mdns_name,
              (unsigned)web_port,
-             boot_str);
+             (unsigned)bulk_server_port(),
+             boot_str,
+             boot_us);
 
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
@@ -1019,6 +880,33 @@ static esp_err_t http_config_post(httpd_req_t *req)
     return ESP_OK;
 }
 
+// Pushes the STA signal to WebSocket clients so the UI does not have to poll
+// /api/status for it.
+static void ws_wifi_timer_cb(void *arg)
+{
+    if (!ws_events_has_clients())
+    {
+        return;
+    }
+    state_lock();
+    bool connected = s_sta_connected;
+    state_unlock();
+    wifi_ap_record_t ap_info;
+    if (connected && esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK)
+    {
+        state_lock();
+        s_sta_rssi = ap_info.rssi;
+        state_unlock();
+    }
+    state_lock();
+    int rssi = s_sta_rssi;
+    state_unlock();
+    char msg[64];
+    snprintf(msg, sizeof(msg), "{\"type\":\"wifi\",\"connected\":%s,\"rssi\":%d}", connected ? "true" : "false",
+             rssi);
+    ws_events_publish(msg);
+}
+
 static esp_err_t setup_http_start(void)
 {
     if (s_http)
@@ -1032,7 +920,14 @@ static esp_err_t setup_http_start(void)
 
     httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
     cfg.server_port = port;
-    cfg.max_uri_handlers = 16;
+    cfg.max_uri_handlers = 40;
+    // Queued and running offloaded requests keep their sockets; leave room
+    // next to them for status, the UI, the WebSocket and striped uploads.
+    // lwIP must have max_open_sockets + 3 for httpd plus the bulk server's
+    // two (CONFIG_LWIP_MAX_SOCKETS in sdkconfig.defaults).
+    cfg.max_open_sockets = HTTP_WORKERS_MAX_SOCKETS + 6;
+    // Striped uploads keep several sockets busy; let new ones evict idle keep-alives.
+    cfg.lru_purge_enable = true;
     cfg.stack_size = 16384;
     ESP_LOGI(TAG, "HTTPD stack_size=%u", cfg.stack_size);
 
@@ -1066,6 +961,23 @@ static esp_err_t setup_http_start(void)
     httpd_register_uri_handler(s_http, &status);
     httpd_register_uri_handler(s_http, &config);
     web_fs_register_handlers(s_http);
+    ws_events_register(s_http);
+    metrics_register(s_http);
+    trace_register(s_http);
+    // Only now does the server answer anything but 404.
+    boot_time_mark(BOOT_PHASE_HTTP);
+    if (port < UINT16_MAX && bulk_server_start(port + 1) == ESP_OK)
+    {
+        setup_mdns_bulk_txt();
+    }
+    if (!s_ws_wifi_timer)
+    {
+        const esp_timer_create_args_t args = {.callback = ws_wifi_timer_cb, .name = "ws_wifi"};
+        if (esp_timer_create(&args, &s_ws_wifi_timer) == ESP_OK)
+        {
+            esp_timer_start_periodic(s_ws_wifi_timer, (uint64_t)WS_WIFI_INTERVAL_MS * 1000ULL);
+        }
+    }
 
     return ESP_OK;
 }
@@ -1158,3 +1070,22 @@ bool setup_mode_is_active(void)
 {
     return s_active;
 }
+
+void setup_mode_wifi_stats(setup_wifi_stats_t *out)
+{
+    state_lock();
+    bool connected = s_sta_connected;
+    state_unlock();
+    wifi_ap_record_t ap_info;
+    if (connected && esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK)
+    {
+        state_lock();
+        s_sta_rssi = ap_info.rssi;
+        state_unlock();
+    }
+    state_lock();
+    *out = s_wifi_stats;
+    out->connected = s_sta_connected;
+    out->rssi = s_sta_connected ? s_sta_rssi : 0;
+    state_unlock();
+}
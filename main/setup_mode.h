@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "esp_err.h"
 
@@ -8,3 +9,18 @@ esp_err_t setup_mode_init(void);
 esp_err_t setup_mode_start(void);
 esp_err_t setup_mode_autostart(void);
 bool setup_mode_is_active(void);
+
+// Station link counters since boot. A connect attempt is one esp_wifi_connect()
+// by the firmware; the driver's own retries inside it are not visible.
+typedef struct
+{
+    bool connected;
+    int rssi; // refreshed from the driver while connected, 0 otherwise
+    uint32_t connect_attempts;
+    uint32_t connects; // got an IP
+    uint32_t disconnects;
+    uint32_t timeouts;
+    int last_reason; // last wifi_err_reason_t, 0 = none yet
+} setup_wifi_stats_t;
+
+void setup_mode_wifi_stats(setup_wifi_stats_t *out);
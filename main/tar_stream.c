@@ -0,0 +1,208 @@
+#include "tar_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAR_OFF_NAME 0
+#define TAR_OFF_SIZE 124
+#define TAR_OFF_MTIME 136
+#define TAR_OFF_CHKSUM 148
+#define TAR_OFF_TYPE 156
+#define TAR_OFF_MAGIC 257
+#define TAR_OFF_PREFIX 345
+
+static uint64_t parse_number(const uint8_t *field, size_t len)
+{
+    // GNU base-256 for values that do not fit the octal field.
+    if (field[0] & 0x80) {
+        uint64_t v = field[0] & 0x7f;
+        for (size_t i = 1; i < len; ++i) {
+            v = (v << 8) | field[i];
+        }
+        return v;
+    }
+    uint64_t v = 0;
+    size_t i = 0;
+    while (i < len && field[i] == ' ') {
+        i++;
+    }
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i) {
+        v = (v << 3) | (uint64_t)(field[i] - '0');
+    }
+    return v;
+}
+
+static bool checksum_ok(const uint8_t *block)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        bool in_field = i >= TAR_OFF_CHKSUM && i < TAR_OFF_CHKSUM + 8;
+        sum += in_field ? ' ' : block[i];
+    }
+    return sum == (uint32_t)parse_number(block + TAR_OFF_CHKSUM, 8);
+}
+
+static void copy_field(char *dst, const uint8_t *src, size_t len)
+{
+    size_t n = 0;
+    while (n < len && src[n]) {
+        n++;
+    }
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+uint64_t tar_padding(uint64_t size)
+{
+    return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+tar_entry_type_t tar_parse_header(const uint8_t block[TAR_BLOCK_SIZE], tar_entry_t *out)
+{
+    bool zero = true;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE && zero; ++i) {
+        zero = block[i] == 0;
+    }
+    if (zero) {
+        return out->type = TAR_ENTRY_END;
+    }
+    if (!checksum_ok(block)) {
+        return out->type = TAR_ENTRY_BAD;
+    }
+
+    char name[101];
+    char prefix[156] = {0};
+    copy_field(name, block + TAR_OFF_NAME, 100);
+    if (memcmp(block + TAR_OFF_MAGIC, "ustar", 5) == 0) {
+        copy_field(prefix, block + TAR_OFF_PREFIX, 155);
+    }
+    int n = prefix[0] ? snprintf(out->path, sizeof(out->path), "%s/%s", prefix, name)
+                      : snprintf(out->path, sizeof(out->path), "%s", name);
+    out->truncated = n < 0 || (size_t)n >= sizeof(out->path);
+    out->size = parse_number(block + TAR_OFF_SIZE, 12);
+    out->mtime = (int64_t)parse_number(block + TAR_OFF_MTIME, 12);
+
+    switch (block[TAR_OFF_TYPE]) {
+    case '0':
+    case '\0':
+    case '7':
+        // Old archivers mark directories with a trailing slash only.
+        out->type = (out->path[0] && out->path[strlen(out->path) - 1] == '/') ? TAR_ENTRY_DIR : TAR_ENTRY_FILE;
+        break;
+    case '5':
+        out->type = TAR_ENTRY_DIR;
+        break;
+    case 'L':
+        out->type = TAR_ENTRY_LONGNAME;
+        break;
+    case 'x':
+        out->type = TAR_ENTRY_PAX;
+        break;
+    default:
+        out->type = TAR_ENTRY_OTHER;
+        break;
+    }
+    if (out->type == TAR_ENTRY_DIR) {
+        out->size = 0;
+    }
+    return out->type;
+}
+
+void tar_apply_pax(const char *data, size_t len, tar_entry_t *out)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        // "<len> <key>=<value>\n", where <len> counts the whole record.
+        char *end = NULL;
+        unsigned long rec_len = strtoul(data + pos, &end, 10);
+        if (!end || *end != ' ' || rec_len == 0 || pos + rec_len > len) {
+            return;
+        }
+        const char *key = end + 1;
+        const char *rec_end = data + pos + rec_len - 1;
+        const char *eq = memchr(key, '=', (size_t)(rec_end - key));
+        if (eq && *rec_end == '\n') {
+            size_t key_len = (size_t)(eq - key);
+            size_t val_len = (size_t)(rec_end - eq - 1);
+            if (key_len == 4 && memcmp(key, "path", 4) == 0) {
+                out->truncated = val_len >= sizeof(out->path);
+                if (!out->truncated) {
+                    memcpy(out->path, eq + 1, val_len);
+                    out->path[val_len] = '\0';
+                }
+            } else if (key_len == 5 && memcmp(key, "mtime", 5) == 0) {
+                out->mtime = strtoll(eq + 1, NULL, 10);
+            }
+        }
+        pos += rec_len;
+    }
+}
+
+static void put_octal(uint8_t *field, size_t len, uint64_t v)
+{
+    // len - 1 digits plus the terminating NUL.
+    field[len - 1] = '\0';
+    for (size_t i = len - 1; i-- > 0;) {
+        field[i] = (uint8_t)('0' + (v & 7));
+        v >>= 3;
+    }
+}
+
+static void fill_header(uint8_t *block, const char *name, size_t name_len, const char *prefix, size_t prefix_len,
+                        uint64_t size, int64_t mtime, char type)
+{
+    memset(block, 0, TAR_BLOCK_SIZE);
+    memcpy(block + TAR_OFF_NAME, name, name_len);
+    put_octal(block + 100, 8, type == '5' ? 0755 : 0644);
+    put_octal(block + 108, 8, 0);
+    put_octal(block + 116, 8, 0);
+    put_octal(block + TAR_OFF_SIZE, 12, size);
+    put_octal(block + TAR_OFF_MTIME, 12, mtime > 0 ? (uint64_t)mtime : 0);
+    block[TAR_OFF_TYPE] = (uint8_t)type;
+    memcpy(block + TAR_OFF_MAGIC, "ustar\0" "00", 8);
+    if (prefix_len) {
+        memcpy(block + TAR_OFF_PREFIX, prefix, prefix_len);
+    }
+    memset(block + TAR_OFF_CHKSUM, ' ', 8);
+    uint32_t sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        sum += block[i];
+    }
+    put_octal(block + TAR_OFF_CHKSUM, 7, sum);
+}
+
+size_t tar_write_header(uint8_t *out, const char *path, uint64_t size, int64_t mtime, bool is_dir)
+{
+    char full[TAR_PATH_LEN + 1];
+    int n = snprintf(full, sizeof(full), "%s%s", path, is_dir ? "/" : "");
+    if (n <= 0 || (size_t)n >= sizeof(full)) {
+        return 0;
+    }
+    size_t len = (size_t)n;
+    char type = is_dir ? '5' : '0';
+    if (is_dir) {
+        size = 0;
+    }
+    if (len <= 100) {
+        fill_header(out, full, len, NULL, 0, size, mtime, type);
+        return TAR_BLOCK_SIZE;
+    }
+    // ustar split: prefix / name at a slash, name part at most 100 bytes.
+    for (size_t i = len - 1; i > 0; --i) {
+        if (full[i] != '/' || i > 155 || len - i - 1 > 100) {
+            continue;
+        }
+        if (len - i - 1 == 0) {
+            continue;
+        }
+        fill_header(out, full + i + 1, len - i - 1, full, i, size, mtime, type);
+        return TAR_BLOCK_SIZE;
+    }
+    // Otherwise a GNU long-name record carries the full path.
+    fill_header(out, "././@LongLink", 13, NULL, 0, len + 1, 0, 'L');
+    memset(out + TAR_BLOCK_SIZE, 0, TAR_BLOCK_SIZE);
+    memcpy(out + TAR_BLOCK_SIZE, full, len);
+    fill_header(out + 2 * TAR_BLOCK_SIZE, full, 100, NULL, 0, size, mtime, type);
+    return 3 * TAR_BLOCK_SIZE;
+}
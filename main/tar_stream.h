@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// POSIX ustar headers plus the two long-name extensions common archivers
+// emit (GNU 'L' records and pax 'x' headers). Archives are processed one
+// 512-byte block at a time so nothing proportional to the archive is kept.
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_PATH_LEN 256
+// GNU long-name header + name block + the entry header itself.
+#define TAR_HEADER_MAX (3 * TAR_BLOCK_SIZE)
+
+typedef enum {
+    TAR_ENTRY_FILE,
+    TAR_ENTRY_DIR,
+    TAR_ENTRY_LONGNAME, // data is the path of the next entry
+    TAR_ENTRY_PAX,      // data is "len key=value\n" records for the next entry
+    TAR_ENTRY_OTHER,    // links, devices, global pax: data is skipped
+    TAR_ENTRY_END,      // zero block
+    TAR_ENTRY_BAD,
+} tar_entry_type_t;
+
+typedef struct {
+    tar_entry_type_t type;
+    char path[TAR_PATH_LEN];
+    uint64_t size;
+    int64_t mtime;
+    bool truncated; // path did not fit TAR_PATH_LEN
+} tar_entry_t;
+
+tar_entry_type_t tar_parse_header(const uint8_t block[TAR_BLOCK_SIZE], tar_entry_t *out);
+// Copies path= and mtime= records of a pax header into `out`.
+void tar_apply_pax(const char *data, size_t len, tar_entry_t *out);
+// Zero bytes that follow `size` bytes of entry data.
+uint64_t tar_padding(uint64_t size);
+
+// Writes the header block(s) for one entry into `out` (TAR_HEADER_MAX bytes)
+// and returns their length; 0 when the path does not fit TAR_PATH_LEN.
+// Directory names get their trailing slash here.
+size_t tar_write_header(uint8_t *out, const char *path, uint64_t size, int64_t mtime, bool is_dir);
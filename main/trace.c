@@ -0,0 +1,296 @@
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "TRACE"
+
+#if WIMILL_TRACE
+
+// Events per core; a power of two. At upload rates this is tens of seconds
+// of pipeline history.
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 4096
+#endif
+#define TRACE_CORES portNUM_PROCESSORS
+#define TRACE_CHUNK 2048
+
+typedef struct {
+    int64_t ts;
+    TaskHandle_t task;
+    uint32_t arg;
+    uint32_t seq; // slot index + 1 once the record is complete, 0 while written
+    uint8_t id;
+    char phase;
+} trace_rec_t;
+
+typedef struct {
+    trace_rec_t rec;
+    uint32_t idx;
+    uint8_t core;
+} trace_snap_t;
+
+static const struct {
+    const char *name;
+    const char *cat;
+    const char *arg_begin; // NULL: arg not meaningful
+    const char *arg_end;
+} s_ids[TRACE_ID_COUNT] = {
+    [TRACE_HTTPD_RECV] = {"httpd_req_recv", "net", "want", "got"},
+    [TRACE_RB_SEND] = {"rb_send", "pipe", "bytes", NULL},
+    [TRACE_RB_RECV] = {"rb_receive", "pipe", NULL, "bytes"},
+    [TRACE_FWRITE] = {"fwrite", "card", "bytes", NULL},
+    [TRACE_FSYNC] = {"fsync", "card", NULL, NULL},
+    [TRACE_SD_READ] = {"sdmmc_read_sectors", "msc", "lba", "sectors"},
+    [TRACE_SD_WRITE] = {"sdmmc_write_sectors", "msc", "lba", "sectors"},
+    [TRACE_MSC_FLUSH] = {"cache_flush", "msc", "lba", "err"},
+};
+
+// Rings live in PSRAM; the heads stay in internal RAM because atomic
+// read-modify-write is not available on external memory.
+static trace_rec_t *s_ring[TRACE_CORES];
+static uint32_t s_head[TRACE_CORES];
+static uint32_t s_since[TRACE_CORES]; // first index after the last ?clear=1
+
+void trace_event(trace_id_t id, char phase, uint32_t arg)
+{
+    BaseType_t core = xPortGetCoreID();
+    trace_rec_t *ring = s_ring[core];
+    if (!ring) {
+        return;
+    }
+    // A task preempted here by another writer on this core just ends up one
+    // slot later; tasks that migrate meanwhile still get a unique slot.
+    uint32_t idx = __atomic_fetch_add(&s_head[core], 1, __ATOMIC_RELAXED);
+    trace_rec_t *r = &ring[idx & (TRACE_RING_EVENTS - 1)];
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    r->ts = esp_timer_get_time();
+    r->task = xTaskGetCurrentTaskHandle();
+    r->arg = arg;
+    r->id = (uint8_t)id;
+    r->phase = phase;
+    __atomic_store_n(&r->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+void trace_init(void)
+{
+    for (int core = 0; core < TRACE_CORES; ++core) {
+        if (s_ring[core]) {
+            continue;
+        }
+        trace_rec_t *ring = heap_caps_calloc(TRACE_RING_EVENTS, sizeof(trace_rec_t),
+                                             MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!ring) {
+            ESP_LOGW(TAG, "no memory for the core %d ring", core);
+            continue;
+        }
+        s_ring[core] = ring;
+    }
+    ESP_LOGI(TAG, "tracing on, %u events per core", (unsigned)TRACE_RING_EVENTS);
+}
+
+// Copies the completed records of one ring; slots rewritten while copying
+// are left out.
+static size_t snapshot_ring(int core, trace_snap_t *out, uint32_t *dropped)
+{
+    const trace_rec_t *ring = s_ring[core];
+    if (!ring) {
+        return 0;
+    }
+    uint32_t head = __atomic_load_n(&s_head[core], __ATOMIC_ACQUIRE);
+    uint32_t first = s_since[core];
+    if (head - first > TRACE_RING_EVENTS) {
+        *dropped += head - first - TRACE_RING_EVENTS;
+        first = head - TRACE_RING_EVENTS;
+    }
+    size_t n = 0;
+    for (uint32_t idx = first; idx != head; ++idx) {
+        const trace_rec_t *r = &ring[idx & (TRACE_RING_EVENTS - 1)];
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != idx + 1) {
+            continue;
+        }
+        out[n].rec = *r;
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != idx + 1) {
+            continue;
+        }
+        out[n].idx = idx;
+        out[n].core = (uint8_t)core;
+        n++;
+    }
+    return n;
+}
+
+static int snap_cmp(const void *a, const void *b)
+{
+    const trace_snap_t *x = a;
+    const trace_snap_t *y = b;
+    if (x->rec.ts != y->rec.ts) {
+        return x->rec.ts < y->rec.ts ? -1 : 1;
+    }
+    if (x->core != y->core) {
+        return x->core < y->core ? -1 : 1;
+    }
+    return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+typedef struct {
+    httpd_req_t *req;
+    bool failed;
+    size_t len;
+    char buf[TRACE_CHUNK];
+} trace_out_t;
+
+static void out_flush(trace_out_t *o)
+{
+    if (o->len > 0 && !o->failed && httpd_resp_send_chunk(o->req, o->buf, o->len) != ESP_OK) {
+        o->failed = true;
+    }
+    o->len = 0;
+}
+
+static void out_printf(trace_out_t *o, const char *fmt, ...)
+{
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(o->buf + o->len, sizeof(o->buf) - o->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return;
+        }
+        if (o->len + (size_t)n < sizeof(o->buf)) {
+            o->len += (size_t)n;
+            return;
+        }
+        out_flush(o);
+    }
+}
+
+// Thread names for the tasks that are still alive; events of deleted tasks
+// show up under their handle.
+static void emit_thread_names(trace_out_t *o)
+{
+#if configUSE_TRACE_FACILITY
+    UBaseType_t cap = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *tasks = heap_caps_malloc(cap * sizeof(TaskStatus_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!tasks) {
+        return;
+    }
+    UBaseType_t n = uxTaskGetSystemState(tasks, cap, NULL);
+    for (UBaseType_t i = 0; i < n; ++i) {
+        out_printf(o, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32 ",\"args\":{\"name\":\"%s\"}}",
+                   (uint32_t)(uintptr_t)tasks[i].xHandle, tasks[i].pcTaskName);
+    }
+    heap_caps_free(tasks);
+#else
+    (void)o;
+#endif
+}
+
+static bool query_flag(httpd_req_t *req, const char *key)
+{
+    char query[64];
+    char val[8];
+    return httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+           httpd_query_key_value(query, key, val, sizeof(val)) == ESP_OK && strcmp(val, "1") == 0;
+}
+
+static esp_err_t trace_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    if (!s_ring[0]) {
+        httpd_resp_set_status(req, "500 Internal Server Error");
+        return httpd_resp_send(req, "{\"error\":\"NO_MEM\"}", HTTPD_RESP_USE_STRLEN);
+    }
+    size_t cap = (size_t)TRACE_CORES * TRACE_RING_EVENTS;
+    trace_snap_t *snap = heap_caps_malloc(cap * sizeof(trace_snap_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    trace_out_t *o = calloc(1, sizeof(*o));
+    if (!snap || !o) {
+        heap_caps_free(snap);
+        free(o);
+        httpd_resp_set_status(req, "500 Internal Server Error");
+        return httpd_resp_send(req, "{\"error\":\"NO_MEM\"}", HTTPD_RESP_USE_STRLEN);
+    }
+    uint32_t dropped = 0;
+    size_t n = 0;
+    for (int core = 0; core < TRACE_CORES; ++core) {
+        n += snapshot_ring(core, snap + n, &dropped);
+    }
+    // Cores write their own rings, so the merged timeline needs a sort.
+    qsort(snap, n, sizeof(*snap), snap_cmp);
+    if (query_flag(req, "clear")) {
+        for (int core = 0; core < TRACE_CORES; ++core) {
+            s_since[core] = __atomic_load_n(&s_head[core], __ATOMIC_ACQUIRE);
+        }
+    }
+
+    o->req = req;
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    out_printf(o, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"events\":%u,\"dropped\":%" PRIu32 "},"
+                  "\"traceEvents\":[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"wimill\"}}",
+               (unsigned)n, dropped);
+    emit_thread_names(o);
+    for (size_t i = 0; i < n && !o->failed; ++i) {
+        const trace_rec_t *r = &snap[i].rec;
+        if (r->id >= TRACE_ID_COUNT) {
+            continue;
+        }
+        const char *key = r->phase == 'B' ? s_ids[r->id].arg_begin : s_ids[r->id].arg_end;
+        out_printf(o, ",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRId64 ",\"pid\":1,\"tid\":%" PRIu32
+                      ",\"args\":{\"core\":%u",
+                   s_ids[r->id].name, s_ids[r->id].cat, r->phase, r->ts, (uint32_t)(uintptr_t)r->task,
+                   (unsigned)snap[i].core);
+        if (key) {
+            out_printf(o, ",\"%s\":%" PRIu32, key, r->arg);
+        }
+        out_printf(o, "}}");
+    }
+    out_printf(o, "]}");
+    out_flush(o);
+    bool failed = o->failed;
+    free(o);
+    heap_caps_free(snap);
+    if (failed) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+#else
+
+void trace_init(void)
+{
+}
+
+static esp_err_t trace_handler(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, "404 Not Found");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, "{\"error\":\"TRACE_DISABLED\"}", HTTPD_RESP_USE_STRLEN);
+}
+
+#endif
+
+esp_err_t trace_register(httpd_handle_t server)
+{
+    if (!server) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    httpd_uri_t uri = {
+        .uri = "/api/trace",
+        .method = HTTP_GET,
+        .handler = trace_handler,
+        .user_ctx = NULL,
+    };
+    return httpd_register_uri_handler(server, &uri);
+}
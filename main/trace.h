@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Span tracing for the transfer pipelines: TRACE_BEGIN/TRACE_END store
+// timestamped events in a per-core ring in PSRAM (lock-free, a slot is
+// claimed with one atomic add, old events are overwritten), and
+// GET /api/trace returns the rings as Chrome trace-event JSON for
+// chrome://tracing or ui.perfetto.dev.
+//
+// Build with -DWIMILL_TRACE=1 to enable it; otherwise the macros compile to
+// nothing and /api/trace answers 404 TRACE_DISABLED.
+#ifndef WIMILL_TRACE
+#define WIMILL_TRACE 0
+#endif
+
+typedef enum {
+    TRACE_HTTPD_RECV, // arg: bytes asked for / received
+    TRACE_RB_SEND,    // arg: bytes
+    TRACE_RB_RECV,    // arg: - / bytes received
+    TRACE_FWRITE,     // arg: bytes
+    TRACE_FSYNC,
+    TRACE_SD_READ,    // arg: lba / sectors
+    TRACE_SD_WRITE,   // arg: lba / sectors
+    TRACE_MSC_FLUSH,  // arg: base lba / esp_err_t
+    TRACE_ID_COUNT,
+} trace_id_t;
+
+#if WIMILL_TRACE
+void trace_event(trace_id_t id, char phase, uint32_t arg);
+#define TRACE_BEGIN(id, arg) trace_event((id), 'B', (uint32_t)(arg))
+#define TRACE_END(id, arg) trace_event((id), 'E', (uint32_t)(arg))
+#else
+#define TRACE_BEGIN(id, arg) ((void)0)
+#define TRACE_END(id, arg) ((void)0)
+#endif
+
+// Allocates the rings; events before this are dropped. No-op when disabled.
+void trace_init(void);
+// Registers /api/trace on `server`; call again after the server was restarted.
+esp_err_t trace_register(httpd_handle_t server);
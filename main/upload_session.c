@@ -0,0 +1,336 @@
+#include "upload_session.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#include "hash_index.h"
+#include "wimill_pins.h"
+
+#define TAG "UPSESS"
+#define SESSION_ROOT WIMILL_SD_MOUNT_POINT "/.wimill"
+#define SESSION_DIR SESSION_ROOT "/sessions"
+#define SESSION_FILE_PATH_LEN 64
+#define SESSION_LINE_LEN 320
+
+static uint32_t fnv1a32(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void session_file_path(const char *id, const char *ext, char *out, size_t out_len)
+{
+    snprintf(out, out_len, "%s/%s.%s", SESSION_DIR, id, ext);
+}
+
+static bool valid_id(const char *id)
+{
+    if (!id || strlen(id) != UPLOAD_SESSION_ID_LEN - 1) {
+        return false;
+    }
+    for (size_t i = 0; id[i]; ++i) {
+        if (!isxdigit((unsigned char)id[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ensure_session_dir(void)
+{
+    if (mkdir(SESSION_ROOT, 0775) != 0 && errno != EEXIST) {
+        return false;
+    }
+    if (mkdir(SESSION_DIR, 0775) != 0 && errno != EEXIST) {
+        return false;
+    }
+    return true;
+}
+
+static esp_err_t load_file(const char *path, upload_session_t *out)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    upload_session_t s = {0};
+    char line[SESSION_LINE_LEN];
+    bool have_magic = false;
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (strcmp(line, "wimill-session 1") == 0) {
+            have_magic = true;
+        } else if (strncmp(line, "path=", 5) == 0) {
+            strncpy(s.rel_path, line + 5, sizeof(s.rel_path));
+            s.rel_path[sizeof(s.rel_path) - 1] = '\0';
+        } else if (strncmp(line, "size=", 5) == 0) {
+            s.size = strtoull(line + 5, NULL, 10);
+        } else if (strncmp(line, "mtime=", 6) == 0) {
+            s.mtime_ms = strtoull(line + 6, NULL, 10);
+        } else if (strncmp(line, "overwrite=", 10) == 0) {
+            s.overwrite = (line[10] == '1');
+        } else if (strncmp(line, "streams=", 8) == 0) {
+            s.streams = (uint8_t)atoi(line + 8);
+        } else if (strncmp(line, "sha256=", 7) == 0) {
+            strncpy(s.sha256, line + 7, sizeof(s.sha256));
+            s.sha256[sizeof(s.sha256) - 1] = '\0';
+        } else if (strncmp(line, "range=", 6) == 0 && s.range_count < UPLOAD_SESSION_MAX_RANGES) {
+            char *dash = NULL;
+            uint64_t start = strtoull(line + 6, &dash, 10);
+            if (dash && *dash == '-') {
+                uint64_t end = strtoull(dash + 1, NULL, 10);
+                if (end > start) {
+                    s.ranges[s.range_count].start = start;
+                    s.ranges[s.range_count].end = end;
+                    s.range_count++;
+                }
+            }
+        }
+    }
+    fclose(f);
+    if (!have_magic || s.rel_path[0] == '\0' || s.size == 0) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    *out = s;
+    return ESP_OK;
+}
+
+esp_err_t upload_session_load(const char *id, upload_session_t *out)
+{
+    if (!valid_id(id) || !out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char path[SESSION_FILE_PATH_LEN];
+    session_file_path(id, "ses", path, sizeof(path));
+    esp_err_t err = load_file(path, out);
+    if (err != ESP_OK) {
+        // A crash between writing .new and renaming it leaves only .new behind.
+        char alt[SESSION_FILE_PATH_LEN];
+        session_file_path(id, "new", alt, sizeof(alt));
+        err = load_file(alt, out);
+    }
+    if (err == ESP_OK) {
+        strncpy(out->id, id, sizeof(out->id));
+        out->id[sizeof(out->id) - 1] = '\0';
+    }
+    return err;
+}
+
+esp_err_t upload_session_save(const upload_session_t *s)
+{
+    if (!s || !valid_id(s->id)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!ensure_session_dir()) {
+        return ESP_FAIL;
+    }
+    char path[SESSION_FILE_PATH_LEN];
+    char tmp[SESSION_FILE_PATH_LEN];
+    session_file_path(s->id, "ses", path, sizeof(path));
+    session_file_path(s->id, "new", tmp, sizeof(tmp));
+
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        return ESP_FAIL;
+    }
+    fprintf(f, "wimill-session 1\n");
+    fprintf(f, "path=%s\n", s->rel_path);
+    fprintf(f, "size=%llu\n", (unsigned long long)s->size);
+    fprintf(f, "mtime=%llu\n", (unsigned long long)s->mtime_ms);
+    fprintf(f, "overwrite=%d\n", s->overwrite ? 1 : 0);
+    fprintf(f, "streams=%u\n", (unsigned)s->streams);
+    if (s->sha256[0]) {
+        fprintf(f, "sha256=%s\n", s->sha256);
+    }
+    for (uint32_t i = 0; i < s->range_count; ++i) {
+        fprintf(f, "range=%llu-%llu\n",
+                (unsigned long long)s->ranges[i].start,
+                (unsigned long long)s->ranges[i].end);
+    }
+    bool ok = (fflush(f) == 0);
+    fsync(fileno(f));
+    fclose(f);
+    if (!ok) {
+        unlink(tmp);
+        return ESP_FAIL;
+    }
+    unlink(path);
+    if (rename(tmp, path) != 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t upload_session_remove(const char *id)
+{
+    if (!valid_id(id)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char path[SESSION_FILE_PATH_LEN];
+    session_file_path(id, "ses", path, sizeof(path));
+    unlink(path);
+    session_file_path(id, "new", path, sizeof(path));
+    unlink(path);
+    return ESP_OK;
+}
+
+esp_err_t upload_session_open(const char *rel_path, uint64_t size, const char *sha256,
+                              uint64_t mtime_ms, bool overwrite,
+                              upload_session_t *out, bool *resumed)
+{
+    if (!rel_path || !out || size == 0 || strlen(rel_path) >= UPLOAD_SESSION_PATH_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (sha256 && sha256[0] && strlen(sha256) != UPLOAD_SESSION_HASH_LEN - 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (resumed) {
+        *resumed = false;
+    }
+
+    char id[UPLOAD_SESSION_ID_LEN];
+    snprintf(id, sizeof(id), "%08lx", (unsigned long)fnv1a32(rel_path));
+
+    upload_session_t s = {0};
+    if (upload_session_load(id, &s) == ESP_OK) {
+        if (strcmp(s.rel_path, rel_path) != 0) {
+            ESP_LOGW(TAG, "session id clash: %s vs %s", s.rel_path, rel_path);
+            return ESP_ERR_INVALID_STATE;
+        }
+        bool same_hash = (!sha256 || !sha256[0]) ? (s.sha256[0] == '\0') : (strcasecmp(s.sha256, sha256) == 0);
+        if (s.size == size && same_hash) {
+            s.mtime_ms = mtime_ms ? mtime_ms : s.mtime_ms;
+            s.overwrite = overwrite;
+            *out = s;
+            if (resumed) {
+                *resumed = true;
+            }
+            return ESP_OK;
+        }
+        ESP_LOGI(TAG, "session %s restarted (size/hash changed)", id);
+    }
+
+    memset(&s, 0, sizeof(s));
+    strncpy(s.id, id, sizeof(s.id));
+    strncpy(s.rel_path, rel_path, sizeof(s.rel_path));
+    s.rel_path[sizeof(s.rel_path) - 1] = '\0';
+    s.size = size;
+    s.mtime_ms = mtime_ms;
+    s.overwrite = overwrite;
+    if (sha256 && sha256[0]) {
+        for (size_t i = 0; i < UPLOAD_SESSION_HASH_LEN - 1; ++i) {
+            s.sha256[i] = (char)tolower((unsigned char)sha256[i]);
+        }
+        s.sha256[UPLOAD_SESSION_HASH_LEN - 1] = '\0';
+    }
+    esp_err_t err = upload_session_save(&s);
+    if (err != ESP_OK) {
+        return err;
+    }
+    *out = s;
+    return ESP_OK;
+}
+
+esp_err_t upload_session_add_range(upload_session_t *s, uint64_t start, uint64_t len)
+{
+    if (!s || len == 0) {
+        return ESP_OK;
+    }
+    uint64_t end = start + len;
+    if (end > s->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Insert keeping the list sorted, then coalesce overlapping/adjacent ranges.
+    upload_range_t merged[UPLOAD_SESSION_MAX_RANGES + 1];
+    uint32_t n = 0;
+    bool inserted = false;
+    for (uint32_t i = 0; i < s->range_count; ++i) {
+        if (!inserted && start < s->ranges[i].start) {
+            merged[n].start = start;
+            merged[n].end = end;
+            n++;
+            inserted = true;
+        }
+        merged[n++] = s->ranges[i];
+    }
+    if (!inserted) {
+        merged[n].start = start;
+        merged[n].end = end;
+        n++;
+    }
+
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (out > 0 && merged[i].start <= merged[out - 1].end) {
+            if (merged[i].end > merged[out - 1].end) {
+                merged[out - 1].end = merged[i].end;
+            }
+            continue;
+        }
+        merged[out++] = merged[i];
+    }
+    if (out > UPLOAD_SESSION_MAX_RANGES) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(s->ranges, merged, out * sizeof(merged[0]));
+    s->range_count = out;
+    return ESP_OK;
+}
+
+void upload_session_reset_ranges(upload_session_t *s)
+{
+    if (s) {
+        s->range_count = 0;
+    }
+}
+
+uint64_t upload_session_received(const upload_session_t *s)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; s && i < s->range_count; ++i) {
+        total += s->ranges[i].end - s->ranges[i].start;
+    }
+    return total;
+}
+
+bool upload_session_complete(const upload_session_t *s)
+{
+    return s && s->range_count == 1 && s->ranges[0].start == 0 && s->ranges[0].end == s->size;
+}
+
+esp_err_t upload_session_verify(const upload_session_t *s, const char *full_path)
+{
+    if (!s || !full_path) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s->sha256[0] == '\0') {
+        return ESP_OK;
+    }
+    char hex[UPLOAD_SESSION_HASH_LEN];
+    esp_err_t err = hash_index_file_sha256(full_path, s->size, hex);
+    if (err == ESP_ERR_NOT_FOUND || err == ESP_ERR_NO_MEM) {
+        return err == ESP_ERR_NO_MEM ? err : ESP_FAIL;
+    }
+    // A short file fails the same way as a bad digest: the data is not there.
+    if (err != ESP_OK || strcmp(hex, s->sha256) != 0) {
+        ESP_LOGW(TAG, "session %s hash mismatch: got %s", s->id, err == ESP_OK ? hex : "short read");
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
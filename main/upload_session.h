@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define UPLOAD_SESSION_ID_LEN 9
+#define UPLOAD_SESSION_PATH_LEN 256
+#define UPLOAD_SESSION_HASH_LEN 65
+#define UPLOAD_SESSION_MAX_RANGES 32
+
+// Received byte range [start, end) of a session's .part file.
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} upload_range_t;
+
+typedef struct {
+    char id[UPLOAD_SESSION_ID_LEN];
+    char rel_path[UPLOAD_SESSION_PATH_LEN];
+    uint64_t size;
+    uint64_t mtime_ms;
+    bool overwrite;
+    uint8_t streams;
+    char sha256[UPLOAD_SESSION_HASH_LEN];
+    uint32_t range_count;
+    upload_range_t ranges[UPLOAD_SESSION_MAX_RANGES];
+} upload_session_t;
+
+// Session state lives on the card (/sdcard/.wimill/sessions/<id>.ses), so an
+// interrupted transfer can be resumed after a reconnect or a reboot.
+esp_err_t upload_session_open(const char *rel_path, uint64_t size, const char *sha256,
+                              uint64_t mtime_ms, bool overwrite,
+                              upload_session_t *out, bool *resumed);
+esp_err_t upload_session_load(const char *id, upload_session_t *out);
+esp_err_t upload_session_save(const upload_session_t *s);
+esp_err_t upload_session_remove(const char *id);
+
+esp_err_t upload_session_add_range(upload_session_t *s, uint64_t start, uint64_t len);
+void upload_session_reset_ranges(upload_session_t *s);
+uint64_t upload_session_received(const upload_session_t *s);
+bool upload_session_complete(const upload_session_t *s);
+
+// Hashes the file and compares with the session's expected SHA-256 (hex).
+// Returns ESP_OK when no hash was given at create time.
+esp_err_t upload_session_verify(const upload_session_t *s, const char *full_path);
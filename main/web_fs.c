@@ -3,9 +3,12 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <utime.h>
@@ -13,13 +16,32 @@
 #include "esp_err.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/ringbuf.h"
 #include "freertos/semphr.h"
-
+#include "mbedtls/sha256.h"
+
+#include "delta_sync.h"
+#include "dir_index.h"
+#include "fs_journal.h"
+#include "fs_manifest.h"
+#include "gcode_meta.h"
+#include "gz_cache.h"
+#include "gcode_compact.h"
+#include "gzip_stream.h"
+#include "hash_index.h"
+#include "http_workers.h"
 #include "msc.h"
 #include "sdcard.h"
+#include "tar_stream.h"
+#include "trace.h"
+#include "upload_session.h"
+#include "ws_events.h"
+#include "xfer_buf.h"
+#include "zip_stream.h"
 
 #define TAG "WEBFS"
 #ifndef WEBFS_METRICS
@@ -27,8 +49,15 @@
 #endif
 #define DOWNLOAD_BUF_SIZE (32 * 1024)
 #define DOWNLOAD_BUF_FALLBACK (16 * 1024)
+#define ARCHIVE_SEND_WAIT_MS 200
+#define ARCHIVE_READER_STACK 8192
+#define ARCHIVE_READER_PRIO 5
 #define UPLOAD_RECV_BUF_SIZE (32 * 1024)
+#define LINES_DEFAULT_COUNT 100
+#define LINES_MAX_COUNT 5000
+#define LINES_BUF_SIZE 4096
 #define UPLOAD_HEADER_SIZE 16384
+#define UPLOAD_FILE_BUF_SIZE (32 * 1024)
 #define UPLOAD_TAIL_SIZE 128
 #define UPLOAD_WORK_SIZE (UPLOAD_RECV_BUF_SIZE + UPLOAD_TAIL_SIZE)
 #define UPLOAD_RINGBUF_SIZE_DEFAULT (512 * 1024)
@@ -36,17 +65,28 @@
 #define UPLOAD_LOG_INTERVAL_US 1000000
 #define UPLOAD_WRITER_STACK 8192
 #define UPLOAD_WRITER_PRIO 5
-#define MAX_QUERY_LEN 128
+#define STRIPE_MAX_STREAMS 4
+#define STRIPE_BLOCK_SIZE (32 * 1024)
+#define STRIPE_POOL_BLOCKS 24
+#define STRIPE_HIGH_WATER 16
+#define STRIPE_POOL_WAIT_MS 10000
+#define STRIPE_QUIESCE_MS 1000
+#define STRIPE_IDLE_US 2000000
+#define STRIPE_SYNC_INTERVAL_US 1000000
+#define STRIPE_WORKER_STACK 6144
+#define STRIPE_WORKER_PRIO 5
 #define MAX_PATH_LEN 256
 #define MAX_NAME_LEN 96
 #define MAX_BODY_LEN 512
+#define CHUNK_SEND_BUF 4096
+#define LIST_PAGE_MAX 1000
+#define LIST_CACHE_MAX (256 * 1024)
+#define ETAG_LEN 48
+#define PLAN_MAX_BODY (1024 * 1024)
+#define CHANGES_PAGE_MAX 200
 
 static SemaphoreHandle_t s_fileop_mutex = NULL;
-static char s_upload_header[UPLOAD_HEADER_SIZE];
-static uint8_t s_upload_recv_fallback[UPLOAD_RECV_BUF_SIZE];
-static uint8_t s_upload_work_fallback[UPLOAD_WORK_SIZE];
-static char s_upload_tail[UPLOAD_TAIL_SIZE];
-static char s_upload_file_buf[32 * 1024];
+static char *s_upload_file_buf = NULL;
 
 typedef struct
 {
@@ -64,33 +104,74 @@ typedef struct
     uint32_t max_recv_chunk;
     int64_t start_us;
     int64_t last_log_us;
+    const char *label; // path shown in WebSocket progress, NULL/"" for none
+    uint64_t total;
+    bool hash;
+    bool hash_started;
+    mbedtls_sha256_context sha;
+    uint8_t digest[32];
+    bool analyse; // G-code: summarise and line-index in the writer as well
+    gcode_analyzer_t *gcode; // kept past finish until index_file_meta stores it
+    bool compact; // G-code: run the compactor in front of the card write
+    gcode_compactor_t *compactor;
+    uint64_t compact_in; // set by finish when the compactor ran
+    uint64_t compact_out;
 } upload_ctx_t;
 
-static uint8_t *upload_alloc_buf(size_t size, uint8_t *fallback, bool *used_fallback)
+// Striped sessions (streams > 1): the client sends several chunk PUTs at once
+// over separate connections. Each request is handed off the httpd task to a
+// receiver task; receivers cut the body into blocks and a single writer task
+// reorders them so the card still sees (mostly) sequential writes.
+typedef struct stripe_block
 {
-    uint8_t *buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    if (!buf)
-    {
-        buf = fallback;
-        if (used_fallback)
-        {
-            *used_fallback = true;
-        }
-        return buf;
-    }
-    if (used_fallback)
-    {
-        *used_fallback = false;
-    }
-    return buf;
+    struct stripe_block *next;
+    uint64_t offset;
+    size_t len;
+    uint8_t data[];
+} stripe_block_t;
+
+typedef struct
+{
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t pool;
+    QueueHandle_t blocks;
+    upload_session_t session;
+    FILE *fp;
+    volatile bool active;
+    volatile bool closing;
+    volatile bool close_requested;
+    volatile int inflight;
+    volatile esp_err_t result;
+    uint64_t rx_pos[STRIPE_MAX_STREAMS];
+    stripe_block_t *pending;
+    uint32_t pending_count;
+    uint64_t file_pos;
+    uint64_t bytes_received;
+    uint64_t bytes_written;
+    uint32_t seek_writes;
+    uint32_t max_streams;
+    int64_t start_us;
+    int64_t last_rx_us;
+} stripe_ctx_t;
+
+static stripe_ctx_t s_stripe;
+static QueueHandle_t s_stripe_req_queue = NULL;
+static web_fs_stats_t s_xfer_stats;
+static portMUX_TYPE s_xfer_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool stripe_quiesce(uint32_t timeout_ms);
+static void json_escape(char *dst, size_t dst_len, const char *src);
+
+// Network-side work buffers come from the PSRAM transfer arena (heap
+// fallback inside xfer_buf), so nothing here is reserved in internal RAM.
+static uint8_t *upload_alloc_buf(size_t size)
+{
+    return (uint8_t *)xfer_buf_lease(XFER_BUF_PSRAM, size);
 }
 
-static void upload_free_buf(uint8_t *buf, bool used_fallback)
+static void upload_free_buf(void *buf)
 {
-    if (buf && !used_fallback)
-    {
-        heap_caps_free(buf);
-    }
+    xfer_buf_release(buf);
 }
 
 static RingbufHandle_t upload_ringbuf_create(size_t *out_size)
@@ -149,6 +230,26 @@ static void upload_stats_add_write(upload_ctx_t *ctx, uint32_t bytes, uint64_t d
     portEXIT_CRITICAL(&ctx->mux);
 }
 
+// Transfer progress for WebSocket clients; called at the same 1 s cadence
+// as the stats log lines.
+static void publish_progress(const char *dir, const char *rel_path, uint64_t bytes, uint64_t total,
+                             double avg_kbps, bool final)
+{
+    if (!rel_path || !rel_path[0] || !ws_events_has_clients())
+    {
+        return;
+    }
+    char safe[MAX_PATH_LEN];
+    json_escape(safe, sizeof(safe), rel_path);
+    char msg[MAX_PATH_LEN + 160];
+    snprintf(msg, sizeof(msg),
+             "{\"type\":\"progress\",\"dir\":\"%s\",\"path\":\"%s\",\"bytes\":%llu,\"total\":%llu,"
+             "\"kbps\":%u,\"done\":%s}",
+             dir, safe, (unsigned long long)bytes, (unsigned long long)total, (unsigned)avg_kbps,
+             final ? "true" : "false");
+    ws_events_publish(msg);
+}
+
 static void upload_stats_log(upload_ctx_t *ctx, int64_t now_us, bool final)
 {
     uint64_t recv_bytes;
@@ -191,6 +292,36 @@ static void upload_stats_log(upload_ctx_t *ctx, int64_t now_us, bool final)
              max_write,
              recv_ms,
              write_ms);
+    publish_progress("upload", ctx->label, recv_bytes, ctx->total, avg_kbps, final);
+}
+
+// Writes one block as stored on the card; the hash and the G-code analyser
+// see exactly these bytes.
+static bool upload_write_block(void *arg, const uint8_t *data, size_t len)
+{
+    upload_ctx_t *ctx = (upload_ctx_t *)arg;
+    // One block per turn: listings get in between blocks.
+    sdcard_io_begin(SDCARD_IO_STREAM);
+    int64_t t0 = esp_timer_get_time();
+    TRACE_BEGIN(TRACE_FWRITE, len);
+    size_t written = fwrite(data, 1, len, ctx->fp);
+    TRACE_END(TRACE_FWRITE, written);
+    int64_t t1 = esp_timer_get_time();
+    sdcard_io_end();
+    if (written != len)
+    {
+        return false;
+    }
+    if (ctx->hash_started)
+    {
+        mbedtls_sha256_update(&ctx->sha, data, len);
+    }
+    if (ctx->gcode)
+    {
+        gcode_analyzer_feed(ctx->gcode, data, len);
+    }
+    upload_stats_add_write(ctx, (uint32_t)written, (uint64_t)(t1 - t0));
+    return true;
 }
 
 static void upload_writer_task(void *arg)
@@ -199,7 +330,9 @@ static void upload_writer_task(void *arg)
     while (true)
     {
         size_t item_size = 0;
+        TRACE_BEGIN(TRACE_RB_RECV, 0);
         uint8_t *item = (uint8_t *)xRingbufferReceive(ctx->rb, &item_size, pdMS_TO_TICKS(200));
+        TRACE_END(TRACE_RB_RECV, item_size);
         if (!item)
         {
             if (ctx->input_done)
@@ -208,23 +341,29 @@ static void upload_writer_task(void *arg)
             }
             continue;
         }
-        int64_t t0 = esp_timer_get_time();
-        size_t written = fwrite(item, 1, item_size, ctx->fp);
-        int64_t t1 = esp_timer_get_time();
+        bool ok = ctx->compactor ? gcode_compactor_feed(ctx->compactor, item, item_size)
+                                 : upload_write_block(ctx, item, item_size);
         vRingbufferReturnItem(ctx->rb, item);
-        if (written != item_size)
+        if (!ok)
         {
             ctx->result = ESP_FAIL;
             break;
         }
-        upload_stats_add_write(ctx, (uint32_t)written, (uint64_t)(t1 - t0));
     }
+    if (ctx->result == ESP_OK && ctx->compactor && !gcode_compactor_finish(ctx->compactor))
+    {
+        ctx->result = ESP_FAIL;
+    }
+    sdcard_io_begin(SDCARD_IO_STREAM);
     if (ctx->result == ESP_OK)
     {
+        TRACE_BEGIN(TRACE_FSYNC, 0);
         fflush(ctx->fp);
         fsync(fileno(ctx->fp));
+        TRACE_END(TRACE_FSYNC, 0);
     }
     fclose(ctx->fp);
+    sdcard_io_end();
     ctx->fp = NULL;
     xSemaphoreGive(ctx->done_sem);
     vTaskDelete(NULL);
@@ -236,7 +375,10 @@ static bool upload_ringbuf_send(upload_ctx_t *ctx, const uint8_t *data, size_t l
     {
         return true;
     }
-    if (xRingbufferSend(ctx->rb, data, len, portMAX_DELAY) != pdTRUE)
+    TRACE_BEGIN(TRACE_RB_SEND, len);
+    BaseType_t sent = xRingbufferSend(ctx->rb, data, len, portMAX_DELAY);
+    TRACE_END(TRACE_RB_SEND, len);
+    if (sent != pdTRUE)
     {
         ctx->result = ESP_FAIL;
         return false;
@@ -260,9 +402,37 @@ static bool upload_ctx_start(upload_ctx_t *ctx, FILE *fp, size_t *rb_size_out)
         ctx->done_sem = NULL;
         return false;
     }
+    // Hashing rides along in the writer (SHA peripheral on the S3), so the
+    // content hash costs no extra pass over the card.
+    if (ctx->hash)
+    {
+        mbedtls_sha256_init(&ctx->sha);
+        mbedtls_sha256_starts(&ctx->sha, 0);
+        ctx->hash_started = true;
+    }
+    // So is the G-code summary; without memory for it the file is simply
+    // left to the background analyser.
+    if (ctx->analyse)
+    {
+        ctx->gcode = gcode_analyzer_create();
+    }
+    // Compaction is best effort too: without memory the file is stored as sent.
+    if (ctx->compact)
+    {
+        ctx->compactor = gcode_compactor_create(upload_write_block, ctx);
+    }
     if (xTaskCreate(upload_writer_task, "upload_writer", UPLOAD_WRITER_STACK, ctx,
                     UPLOAD_WRITER_PRIO, NULL) != pdPASS)
     {
+        gcode_compactor_destroy(ctx->compactor);
+        ctx->compactor = NULL;
+        gcode_analyzer_destroy(ctx->gcode);
+        ctx->gcode = NULL;
+        if (ctx->hash_started)
+        {
+            mbedtls_sha256_free(&ctx->sha);
+            ctx->hash_started = false;
+        }
         vRingbufferDelete(ctx->rb);
         vSemaphoreDelete(ctx->done_sem);
         ctx->rb = NULL;
@@ -272,6 +442,70 @@ static bool upload_ctx_start(upload_ctx_t *ctx, FILE *fp, size_t *rb_size_out)
     return true;
 }
 
+static void upload_stats_account(upload_ctx_t *ctx)
+{
+    uint64_t wall_us = (uint64_t)(esp_timer_get_time() - ctx->start_us);
+    portENTER_CRITICAL(&s_xfer_stats_mux);
+    s_xfer_stats.uploads++;
+    if (ctx->result != ESP_OK)
+    {
+        s_xfer_stats.upload_write_errors++;
+    }
+    s_xfer_stats.upload_bytes += ctx->bytes_written;
+    s_xfer_stats.upload_recv_us += ctx->recv_time_us;
+    s_xfer_stats.upload_write_us += ctx->write_time_us;
+    s_xfer_stats.upload_wall_us += wall_us;
+    if (wall_us > 0)
+    {
+        s_xfer_stats.upload_last_kbps = (uint32_t)((double)ctx->bytes_written / 1024.0 / ((double)wall_us / 1e6));
+    }
+    portEXIT_CRITICAL(&s_xfer_stats_mux);
+}
+
+static void download_stats_account(uint64_t bytes, uint64_t read_us, uint64_t send_us, int64_t start_us, bool ok)
+{
+    uint64_t wall_us = (uint64_t)(esp_timer_get_time() - start_us);
+    portENTER_CRITICAL(&s_xfer_stats_mux);
+    s_xfer_stats.downloads++;
+    if (!ok)
+    {
+        s_xfer_stats.download_send_errors++;
+    }
+    s_xfer_stats.download_bytes += bytes;
+    s_xfer_stats.download_read_us += read_us;
+    s_xfer_stats.download_send_us += send_us;
+    s_xfer_stats.download_wall_us += wall_us;
+    if (wall_us > 0)
+    {
+        s_xfer_stats.download_last_kbps = (uint32_t)((double)bytes / 1024.0 / ((double)wall_us / 1e6));
+    }
+    portEXIT_CRITICAL(&s_xfer_stats_mux);
+}
+
+static void download_gzip_account(bool sidecar, uint64_t plain, uint64_t wire, int64_t deflate_us)
+{
+    portENTER_CRITICAL(&s_xfer_stats_mux);
+    if (sidecar)
+    {
+        s_xfer_stats.gzip_sidecar++;
+    }
+    else
+    {
+        s_xfer_stats.gzip_live++;
+    }
+    s_xfer_stats.gzip_plain_bytes += plain;
+    s_xfer_stats.gzip_wire_bytes += wire;
+    s_xfer_stats.gzip_deflate_us += deflate_us > 0 ? (uint64_t)deflate_us : 0;
+    portEXIT_CRITICAL(&s_xfer_stats_mux);
+}
+
+void web_fs_get_stats(web_fs_stats_t *out)
+{
+    portENTER_CRITICAL(&s_xfer_stats_mux);
+    *out = s_xfer_stats;
+    portEXIT_CRITICAL(&s_xfer_stats_mux);
+}
+
 static esp_err_t upload_ctx_finish(upload_ctx_t *ctx)
 {
     ctx->input_done = true;
@@ -280,12 +514,39 @@ static esp_err_t upload_ctx_finish(upload_ctx_t *ctx)
         xSemaphoreTake(ctx->done_sem, portMAX_DELAY);
         vSemaphoreDelete(ctx->done_sem);
         ctx->done_sem = NULL;
+        // Error paths call finish a second time; count the transfer once.
+        upload_stats_account(ctx);
     }
     if (ctx->rb)
     {
         vRingbufferDelete(ctx->rb);
         ctx->rb = NULL;
     }
+    if (ctx->hash_started)
+    {
+        mbedtls_sha256_finish(&ctx->sha, ctx->digest);
+        mbedtls_sha256_free(&ctx->sha);
+        ctx->hash_started = false;
+    }
+    if (ctx->compactor)
+    {
+        ctx->compact_in = gcode_compactor_consumed(ctx->compactor);
+        ctx->compact_out = gcode_compactor_produced(ctx->compactor);
+        gcode_compactor_destroy(ctx->compactor);
+        ctx->compactor = NULL;
+        if (ctx->result == ESP_OK)
+        {
+            ESP_LOGI(TAG, "upload %s: compacted %llu -> %llu bytes (%.1f%% saved)", ctx->label ? ctx->label : "",
+                     (unsigned long long)ctx->compact_in, (unsigned long long)ctx->compact_out,
+                     ctx->compact_in ? 100.0 * (double)(ctx->compact_in - ctx->compact_out) / (double)ctx->compact_in
+                                     : 0.0);
+        }
+    }
+    if (ctx->gcode && ctx->result != ESP_OK)
+    {
+        gcode_analyzer_destroy(ctx->gcode);
+        ctx->gcode = NULL;
+    }
     return ctx->result;
 }
 
@@ -296,6 +557,15 @@ static void send_json_error(httpd_req_t *req, const char *status, const char *js
     httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
 }
 
+// httpd_req_recv() with a trace span; all request bodies are read through it.
+static int req_recv(httpd_req_t *req, char *buf, size_t len)
+{
+    TRACE_BEGIN(TRACE_HTTPD_RECV, len);
+    int r = httpd_req_recv(req, buf, len);
+    TRACE_END(TRACE_HTTPD_RECV, r > 0 ? r : 0);
+    return r;
+}
+
 static char *find_seq(const char *buf, size_t len, const char *seq, size_t seq_len)
 {
     if (!buf || !seq || seq_len == 0 || len < seq_len)
@@ -357,7 +627,7 @@ static bool fileop_try_lock(httpd_req_t *req)
             return false;
         }
     }
-    if (xSemaphoreTake(s_fileop_mutex, 0) != pdTRUE)
+    if (!stripe_quiesce(STRIPE_QUIESCE_MS) || xSemaphoreTake(s_fileop_mutex, 0) != pdTRUE)
     {
         send_json_error(req, "423 Locked", "{\"error\":\"FILEOP_IN_PROGRESS\"}");
         return false;
@@ -365,8 +635,37 @@ static bool fileop_try_lock(httpd_req_t *req)
     return true;
 }
 
+// FATFS stdio buffer of the upload target. Only one is open at a time
+// (uploads hold the file-operation lock, stripe sessions are quiesced
+// first), so it is leased on first use and handed back by fileop_unlock(),
+// or by the stripe writer after fclose for a session that outlives its
+// request. It comes from the DMA pool: FATFS passes whole buffers straight
+// to the card driver, and the MSC sector cache takes the same memory while
+// USB is attached.
+static void upload_file_set_buffer(FILE *fp)
+{
+    if (!s_upload_file_buf)
+    {
+        s_upload_file_buf = xfer_buf_lease(XFER_BUF_DMA, UPLOAD_FILE_BUF_SIZE);
+    }
+    if (s_upload_file_buf)
+    {
+        setvbuf(fp, s_upload_file_buf, _IOFBF, UPLOAD_FILE_BUF_SIZE);
+    }
+}
+
+static void upload_file_release_buffer(void)
+{
+    xfer_buf_release(s_upload_file_buf);
+    s_upload_file_buf = NULL;
+}
+
 static void fileop_unlock(void)
 {
+    if (!s_stripe.active)
+    {
+        upload_file_release_buffer();
+    }
     if (s_fileop_mutex)
     {
         xSemaphoreGive(s_fileop_mutex);
@@ -375,6 +674,10 @@ static void fileop_unlock(void)
 
 bool web_fs_is_busy(void)
 {
+    if (s_stripe.active)
+    {
+        return true;
+    }
     if (!s_fileop_mutex)
     {
         return false;
@@ -387,6 +690,7 @@ bool web_fs_is_busy(void)
     return true;
 }
 
+// Decoding never lengthens the text, so dst may be src.
 static void url_decode(char *dst, size_t dst_len, const char *src)
 {
     size_t di = 0;
@@ -627,60 +931,48 @@ static bool build_suffix_path(const char *path, const char *suffix, char *out, s
     return true;
 }
 
+// Release with upload_free_buf().
 static char *download_alloc_buf(size_t *out_size)
 {
-    char *buf = heap_caps_malloc(DOWNLOAD_BUF_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    char *buf = (char *)upload_alloc_buf(DOWNLOAD_BUF_SIZE);
     if (buf)
     {
         *out_size = DOWNLOAD_BUF_SIZE;
         return buf;
     }
-    buf = heap_caps_malloc(DOWNLOAD_BUF_FALLBACK, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    if (buf)
-    {
-        *out_size = DOWNLOAD_BUF_FALLBACK;
-        return buf;
-    }
-    buf = heap_caps_malloc(DOWNLOAD_BUF_FALLBACK, MALLOC_CAP_8BIT);
-    if (buf)
-    {
-        *out_size = DOWNLOAD_BUF_FALLBACK;
-        return buf;
-    }
-    *out_size = 0;
-    return NULL;
+    buf = (char *)upload_alloc_buf(DOWNLOAD_BUF_FALLBACK);
+    *out_size = buf ? DOWNLOAD_BUF_FALLBACK : 0;
+    return buf;
+}
+
+// The query string inside req->uri, which the request (and its async copy)
+// already carries. The helpers below look keys up there directly instead of
+// each copying the whole query onto the stack first, and decode in place.
+static const char *req_query(httpd_req_t *req)
+{
+    const char *q = strchr(req->uri, '?');
+    return q ? q + 1 : NULL;
 }
 
 static bool get_query_path(httpd_req_t *req, char *out, size_t out_len)
 {
-    char query[MAX_QUERY_LEN] = {0};
-    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
-    {
-        strncpy(out, "/", out_len);
-        out[out_len - 1] = '\0';
-        return true;
-    }
+    const char *query = req_query(req);
     char raw[MAX_PATH_LEN] = {0};
-    if (httpd_query_key_value(query, "path", raw, sizeof(raw)) != ESP_OK)
+    if (!query || httpd_query_key_value(query, "path", raw, sizeof(raw)) != ESP_OK)
     {
         strncpy(out, "/", out_len);
         out[out_len - 1] = '\0';
         return true;
     }
-    char decoded[MAX_PATH_LEN];
-    url_decode(decoded, sizeof(decoded), raw);
-    return normalize_path(decoded, out, out_len);
+    url_decode(raw, sizeof(raw), raw);
+    return normalize_path(raw, out, out_len);
 }
 
 static bool get_query_flag(httpd_req_t *req, const char *key)
 {
-    char query[MAX_QUERY_LEN] = {0};
-    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
-    {
-        return false;
-    }
+    const char *query = req_query(req);
     char val[8] = {0};
-    if (httpd_query_key_value(query, key, val, sizeof(val)) != ESP_OK)
+    if (!query || httpd_query_key_value(query, key, val, sizeof(val)) != ESP_OK)
     {
         return false;
     }
@@ -693,48 +985,38 @@ static bool get_query_flag(httpd_req_t *req, const char *key)
 
 static bool get_query_value(httpd_req_t *req, const char *key, char *out, size_t out_len)
 {
-    char query[MAX_QUERY_LEN] = {0};
-    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
-    {
-        return false;
-    }
+    const char *query = req_query(req);
     char raw[MAX_NAME_LEN] = {0};
-    if (httpd_query_key_value(query, key, raw, sizeof(raw)) != ESP_OK)
+    if (!query || httpd_query_key_value(query, key, raw, sizeof(raw)) != ESP_OK)
     {
         return false;
     }
-    char decoded[MAX_NAME_LEN];
-    url_decode(decoded, sizeof(decoded), raw);
-    if (decoded[0] == '\0')
+    url_decode(raw, sizeof(raw), raw);
+    if (raw[0] == '\0')
     {
         return false;
     }
-    strncpy(out, decoded, out_len);
+    strncpy(out, raw, out_len);
     out[out_len - 1] = '\0';
     return true;
 }
 
 static bool get_query_u64(httpd_req_t *req, const char *key, uint64_t *out)
 {
-    char query[MAX_QUERY_LEN] = {0};
-    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
-    {
-        return false;
-    }
+    const char *query = req_query(req);
     char raw[32] = {0};
-    if (httpd_query_key_value(query, key, raw, sizeof(raw)) != ESP_OK)
+    if (!query || httpd_query_key_value(query, key, raw, sizeof(raw)) != ESP_OK)
     {
         return false;
     }
-    char decoded[32];
-    url_decode(decoded, sizeof(decoded), raw);
-    if (decoded[0] == '\0')
+    url_decode(raw, sizeof(raw), raw);
+    if (raw[0] == '\0')
     {
         return false;
     }
     char *end = NULL;
-    unsigned long long val = strtoull(decoded, &end, 10);
-    if (end == decoded || (end && *end != '\0'))
+    unsigned long long val = strtoull(raw, &end, 10);
+    if (end == raw || (end && *end != '\0'))
     {
         return false;
     }
@@ -759,6 +1041,88 @@ static void apply_mtime_if_needed(const char *path, uint64_t mtime_ms)
     }
 }
 
+static bool split_rel_path(const char *rel_path, char *dir, size_t dir_len, char *name, size_t name_len)
+{
+    const char *slash = strrchr(rel_path, '/');
+    if (!slash || slash[1] == '\0')
+    {
+        return false;
+    }
+    size_t len = (size_t)(slash - rel_path);
+    if (len == 0)
+    {
+        len = 1;
+    }
+    if (len + 1 > dir_len || strlen(slash + 1) + 1 > name_len)
+    {
+        return false;
+    }
+    memcpy(dir, rel_path, len);
+    dir[len] = '\0';
+    strcpy(name, slash + 1);
+    return true;
+}
+
+// Bumps the listing generation of the directory that holds rel_path.
+static void note_parent_changed(const char *rel_path)
+{
+    char dir[MAX_PATH_LEN];
+    char name[MAX_PATH_LEN];
+    if (split_rel_path(rel_path, dir, sizeof(dir), name, sizeof(name)))
+    {
+        dir_index_changed(dir);
+    }
+}
+
+// Journals a change made through the web API and bumps the listing
+// generation of the directories involved.
+static void note_change(fs_journal_op_t op, const char *rel_path, const char *rel_to, bool is_dir)
+{
+    fs_journal_record(op, rel_path, rel_to, is_dir);
+    if (!is_dir)
+    {
+        gz_cache_drop(rel_path);
+        if (rel_to)
+        {
+            gz_cache_drop(rel_to);
+        }
+    }
+    note_parent_changed(rel_path);
+    if (rel_to)
+    {
+        note_parent_changed(rel_to);
+    }
+}
+
+// Records the content hash of a freshly written file. Size and mtime are read
+// back after apply_mtime_if_needed so the entry matches what list reports.
+static void index_file_hash(const char *rel_dir, const char *name, const char *full_path, const char *hex)
+{
+    struct stat st;
+    if (stat(full_path, &st) != 0)
+    {
+        return;
+    }
+    hash_index_put(rel_dir, name, (uint64_t)st.st_size, (int64_t)st.st_mtime, hex);
+}
+
+// Stores the G-code summary and line index the writer collected, keyed the
+// same way, and releases the analyser.
+static void index_file_meta(const char *rel_file, const char *full_path, upload_ctx_t *ctx)
+{
+    struct stat st;
+    if (ctx->gcode && stat(full_path, &st) == 0)
+    {
+        gcode_meta_t m;
+        gcode_analyzer_finish(ctx->gcode, &m);
+        m.original_bytes = ctx->compact_in;
+        gcode_meta_store(rel_file, (uint64_t)st.st_size, (int64_t)st.st_mtime, &m);
+        gcode_lines_store(rel_file, (uint64_t)st.st_size, (int64_t)st.st_mtime, ctx->gcode);
+    }
+    gcode_analyzer_destroy(ctx->gcode);
+    ctx->gcode = NULL;
+}
+
 static bool read_body(httpd_req_t *req, char *buf, size_t buf_len)
 {
     int total = req->content_len;
@@ -769,7 +1133,7 @@ static bool read_body(httpd_req_t *req, char *buf, size_t buf_len)
     int received = 0;
     while (received < total)
     {
-        int r = httpd_req_recv(req, buf + received, total - received);
+        int r = req_recv(req, buf + received, total - received);
         if (r == HTTPD_SOCK_ERR_TIMEOUT)
         {
             continue;
@@ -843,116 +1207,406 @@ static bool json_get_string(const char *body, const char *key, char *out, size_t
     return true;
 }
 
-static void drain_body(httpd_req_t *req)
+// Collects small pieces of a chunked response and sends them CHUNK_SEND_BUF
+// at a time; the first send error sticks and makes every later call fail.
+// With `keep` set, everything sent is also copied there (PSRAM, up to
+// LIST_CACHE_MAX; the copy is dropped once it would grow past that).
+// With `io_held` set, the caller holds an interactive card grant that is
+// handed back around every send, so a slow client never blocks the card.
+typedef struct
 {
-    char buf[128];
-    int remaining = req->content_len;
-    while (remaining > 0)
+    httpd_req_t *req;
+    char *buf;
+    size_t len;
+    uint32_t count;
+    esp_err_t err;
+    char *keep;
+    size_t keep_len;
+    size_t keep_cap;
+    bool io_held;
+} chunk_buf_t;
+
+static void chunk_buf_keep(chunk_buf_t *out, const char *data, size_t len)
+{
+    if (!out->keep)
     {
-        int r = httpd_req_recv(req, buf, remaining > (int)sizeof(buf) ? (int)sizeof(buf) : remaining);
-        if (r == HTTPD_SOCK_ERR_TIMEOUT)
+        return;
+    }
+    if (out->keep_len + len > out->keep_cap)
+    {
+        size_t cap = out->keep_cap * 2;
+        if (cap < out->keep_len + len)
         {
-            continue;
+            cap = out->keep_len + len;
         }
-        if (r <= 0)
+        char *grown = cap <= LIST_CACHE_MAX ? heap_caps_realloc(out->keep, cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+                                            : NULL;
+        if (!grown)
         {
-            break;
+            heap_caps_free(out->keep);
+            out->keep = NULL;
+            return;
         }
-        remaining -= r;
+        out->keep = grown;
+        out->keep_cap = cap;
     }
+    memcpy(out->keep + out->keep_len, data, len);
+    out->keep_len += len;
 }
 
-static esp_err_t http_fs_list(httpd_req_t *req)
+static esp_err_t chunk_buf_send(chunk_buf_t *out, const char *data, size_t len)
 {
-    if (!fs_gate(req))
+    if (!out->io_held)
     {
-        return ESP_OK;
+        return httpd_resp_send_chunk(out->req, data, len);
     }
+    sdcard_io_end();
+    esp_err_t err = httpd_resp_send_chunk(out->req, data, len);
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    return err;
+}
 
-    char rel_path[MAX_PATH_LEN];
-    if (!get_query_path(req, rel_path, sizeof(rel_path)))
+static bool chunk_buf_flush(chunk_buf_t *out)
+{
+    if (out->len > 0 && out->err == ESP_OK)
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
-        return ESP_OK;
+        chunk_buf_keep(out, out->buf, out->len);
+        out->err = chunk_buf_send(out, out->buf, out->len);
     }
+    out->len = 0;
+    return out->err == ESP_OK;
+}
 
-    char full_path[MAX_PATH_LEN];
-    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+static bool chunk_buf_append(chunk_buf_t *out, const char *data, size_t len)
+{
+    if (out->len + len > CHUNK_SEND_BUF && !chunk_buf_flush(out))
     {
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
-        return ESP_OK;
+        return false;
     }
-
-    DIR *dir = opendir(full_path);
-    if (!dir)
+    if (len > CHUNK_SEND_BUF)
     {
-        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
-        return ESP_OK;
+        chunk_buf_keep(out, data, len);
+        out->err = chunk_buf_send(out, data, len);
+        return out->err == ESP_OK;
     }
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+    return true;
+}
 
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr_chunk(req, "{\"path\":\"");
-    httpd_resp_sendstr_chunk(req, rel_path);
-    httpd_resp_sendstr_chunk(req, "\",\"items\":[");
+// Sets the validator headers and answers 304 when the client already holds
+// this version. `etag` must stay valid until the response is sent.
+static bool list_not_modified(httpd_req_t *req, const char *etag)
+{
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    char inm[128];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) != ESP_OK || !strstr(inm, etag))
+    {
+        return false;
+    }
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return true;
+}
 
-    bool first = true;
-    struct dirent *ent = NULL;
-    while ((ent = readdir(dir)) != NULL)
+static void list_append_item(chunk_buf_t *out, const char *name, bool is_dir, uint64_t size, int64_t mtime)
+{
+    char safe_name[MAX_PATH_LEN];
+    char line[MAX_PATH_LEN + 96];
+    json_escape(safe_name, sizeof(safe_name), name);
+    const char *sep = out->count > 0 ? "," : "";
+    int n;
+    if (is_dir)
     {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
-        {
-            continue;
-        }
-        char item_rel[MAX_PATH_LEN];
-        if (!build_rel_child(rel_path, ent->d_name, item_rel, sizeof(item_rel)))
+        n = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"type\":\"dir\",\"mtime\":%lld}",
+                     sep, safe_name, (long long)mtime);
+    }
+    else
+    {
+        n = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"type\":\"file\",\"size\":%llu,\"mtime\":%lld}",
+                     sep, safe_name, (unsigned long long)size, (long long)mtime);
+    }
+    if (n <= 0 || (size_t)n >= sizeof(line))
+    {
+        return;
+    }
+    out->count++;
+    chunk_buf_append(out, line, (size_t)n);
+}
+
+// Paged form of /api/fs/list (any of limit, cursor, sort, order, glob given).
+// The first request builds a sorted snapshot of the directory in PSRAM; the
+// returned "next" cursor ("<snapshot>.<offset>") walks that snapshot, so later
+// pages cost no SD reads. An evicted snapshot answers 410 CURSOR_EXPIRED.
+static esp_err_t http_fs_list_page(httpd_req_t *req, const char *rel_path)
+{
+    char value[DIR_INDEX_GLOB_LEN] = {0};
+    const dir_index_t *index = NULL;
+    size_t offset = 0;
+    if (get_query_value(req, "cursor", value, sizeof(value)))
+    {
+        char *end = NULL;
+        unsigned long id = strtoul(value, &end, 10);
+        if (end && *end == '.')
         {
-            continue;
+            char *num = end + 1;
+            offset = strtoul(num, &end, 10);
+            if (end != num && *end == '\0')
+            {
+                index = dir_index_lookup((uint32_t)id, rel_path);
+            }
         }
-        char item_full[MAX_PATH_LEN];
-        if (!build_fs_path(item_rel, item_full, sizeof(item_full)))
+        if (!index)
         {
-            continue;
+            send_json_error(req, "410 Gone", "{\"error\":\"CURSOR_EXPIRED\"}");
+            return ESP_OK;
         }
-        struct stat st;
-        if (stat(item_full, &st) != 0)
+    }
+    else
+    {
+        dir_index_sort_t sort = DIR_INDEX_SORT_NAME;
+        if (get_query_value(req, "sort", value, sizeof(value)))
         {
-            continue;
+            if (strcmp(value, "mtime") == 0)
+            {
+                sort = DIR_INDEX_SORT_MTIME;
+            }
+            else if (strcmp(value, "size") == 0)
+            {
+                sort = DIR_INDEX_SORT_SIZE;
+            }
+            else if (strcmp(value, "name") != 0)
+            {
+                send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_SORT\"}");
+                return ESP_OK;
+            }
         }
-        if (!first)
+        bool desc = get_query_value(req, "order", value, sizeof(value)) && strcmp(value, "desc") == 0;
+        char glob[DIR_INDEX_GLOB_LEN] = {0};
+        get_query_value(req, "glob", glob, sizeof(glob));
+        esp_err_t err = dir_index_create(rel_path, sort, desc, glob, &index);
+        if (err == ESP_ERR_NO_MEM)
         {
-            httpd_resp_sendstr_chunk(req, ",");
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+            return ESP_OK;
         }
-        first = false;
-
-        char safe_name[MAX_NAME_LEN];
-        json_escape(safe_name, sizeof(safe_name), ent->d_name);
-        if (S_ISDIR(st.st_mode))
+        if (err == ESP_FAIL || err == ESP_ERR_INVALID_STATE)
         {
-            char line[200];
-            snprintf(line, sizeof(line), "{\"name\":\"%s\",\"type\":\"dir\",\"mtime\":%lld}",
-                     safe_name, (long long)st.st_mtime);
-            httpd_resp_sendstr_chunk(req, line);
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"READ_FAIL\"}");
+            return ESP_OK;
         }
-        else
+        if (err != ESP_OK)
         {
-            char line[220];
-            snprintf(line, sizeof(line), "{\"name\":\"%s\",\"type\":\"file\",\"size\":%ld,\"mtime\":%lld}",
-                     safe_name, (long)st.st_size, (long long)st.st_mtime);
-            httpd_resp_sendstr_chunk(req, line);
+            send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+            return ESP_OK;
         }
     }
-    closedir(dir);
-    httpd_resp_sendstr_chunk(req, "]}");
-    httpd_resp_sendstr_chunk(req, NULL);
-    return ESP_OK;
-}
 
-static bool extract_filename(const char *header, char *out, size_t out_len)
-{
-    const char *p = strstr(header, "filename=\"");
-    if (!p)
+    size_t total = dir_index_count(index);
+    uint64_t limit = 0;
+    if (!get_query_u64(req, "limit", &limit) || limit == 0)
     {
-        return false;
+        limit = total;
+    }
+    if (limit > LIST_PAGE_MAX)
+    {
+        limit = LIST_PAGE_MAX;
+    }
+    if (offset > total)
+    {
+        offset = total;
+    }
+    size_t end_pos = (total - offset) > limit ? offset + (size_t)limit : total;
+
+    // A page is fixed by its snapshot and bounds, so this tag stays valid for
+    // as long as the snapshot's stamp is current.
+    char etag[ETAG_LEN] = {0};
+    uint64_t stamp = dir_index_snapshot_stamp(index);
+    if (stamp != 0)
+    {
+        snprintf(etag, sizeof(etag), "\"%016llx-%u-%u-%u\"", (unsigned long long)stamp,
+                 (unsigned)dir_index_id(index), (unsigned)offset, (unsigned)(end_pos - offset));
+        if (list_not_modified(req, etag))
+        {
+            return ESP_OK;
+        }
+    }
+
+    chunk_buf_t out = {.req = req};
+    out.buf = (char *)upload_alloc_buf(CHUNK_SEND_BUF);
+    if (!out.buf)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        return ESP_OK;
+    }
+    httpd_resp_set_type(req, "application/json");
+    char safe_path[MAX_PATH_LEN];
+    json_escape(safe_path, sizeof(safe_path), rel_path);
+    char line[MAX_PATH_LEN + 96];
+    int n = snprintf(line, sizeof(line), "{\"path\":\"%s\",\"total\":%u,\"offset\":%u,\"items\":[",
+                     safe_path, (unsigned)total, (unsigned)offset);
+    chunk_buf_append(&out, line, (size_t)n);
+    dir_index_entry_t ent;
+    for (size_t pos = offset; pos < end_pos && out.err == ESP_OK; ++pos)
+    {
+        if (dir_index_get(index, pos, &ent))
+        {
+            list_append_item(&out, ent.name, ent.is_dir, ent.size, ent.mtime);
+        }
+    }
+    if (end_pos < total)
+    {
+        n = snprintf(line, sizeof(line), "],\"next\":\"%u.%u\"}", (unsigned)dir_index_id(index), (unsigned)end_pos);
+    }
+    else
+    {
+        n = snprintf(line, sizeof(line), "],\"next\":null}");
+    }
+    chunk_buf_append(&out, line, (size_t)n);
+    chunk_buf_flush(&out);
+    httpd_resp_send_chunk(req, NULL, 0);
+    upload_free_buf((uint8_t *)out.buf);
+    return ESP_OK;
+}
+
+static esp_err_t http_fs_list(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+
+    char rel_path[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_path, sizeof(rel_path)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        return ESP_OK;
+    }
+    const char *query = req_query(req);
+    char probe[2];
+    if (query)
+    {
+        static const char *const k_page_keys[] = {"limit", "cursor", "sort", "order", "glob"};
+        for (size_t i = 0; i < sizeof(k_page_keys) / sizeof(k_page_keys[0]); ++i)
+        {
+            esp_err_t found = httpd_query_key_value(query, k_page_keys[i], probe, sizeof(probe));
+            if (found == ESP_OK || found == ESP_ERR_HTTPD_RESULT_TRUNC)
+            {
+                return http_fs_list_page(req, rel_path);
+            }
+        }
+    }
+
+    // The stamp is read before the directory, so a copy taken while a write
+    // races with the scan is filed under the old stamp and never served.
+    bool cacheable = dir_index_cacheable(rel_path);
+    uint64_t stamp = dir_index_stamp(rel_path);
+    char etag[ETAG_LEN] = {0};
+    if (cacheable)
+    {
+        snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)stamp);
+        const char *cached = NULL;
+        size_t cached_len = 0;
+        if (dir_index_blob_get(rel_path, stamp, &cached, &cached_len))
+        {
+            if (!list_not_modified(req, etag))
+            {
+                httpd_resp_set_type(req, "application/json");
+                httpd_resp_send(req, cached, (ssize_t)cached_len);
+            }
+            return ESP_OK;
+        }
+    }
+
+    // One f_readdir pass yields name, size and timestamps together; a stat()
+    // per entry would re-scan the directory each time. The pass runs as
+    // interactive I/O, ahead of any transfer waiting for the card; the grant
+    // is dropped while a full buffer goes out (io_held), never across a send.
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    sdcard_dir_t *dir = sdcard_dir_open(rel_path);
+    if (!dir)
+    {
+        sdcard_io_end();
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        return ESP_OK;
+    }
+    if (cacheable)
+    {
+        // A 304 is a send too; the open directory does not need the grant.
+        sdcard_io_end();
+        if (list_not_modified(req, etag))
+        {
+            sdcard_dir_close(dir);
+            return ESP_OK;
+        }
+        sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    }
+    chunk_buf_t out = {.req = req, .io_held = true};
+    out.buf = (char *)upload_alloc_buf(CHUNK_SEND_BUF);
+    if (!out.buf)
+    {
+        sdcard_dir_close(dir);
+        sdcard_io_end();
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        return ESP_OK;
+    }
+    if (cacheable)
+    {
+        out.keep = heap_caps_malloc(CHUNK_SEND_BUF, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        out.keep_cap = out.keep ? CHUNK_SEND_BUF : 0;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    httpd_resp_set_type(req, "application/json");
+    char safe_path[MAX_PATH_LEN];
+    json_escape(safe_path, sizeof(safe_path), rel_path);
+    char line[MAX_PATH_LEN + 32];
+    int n = snprintf(line, sizeof(line), "{\"path\":\"%s\",\"items\":[", safe_path);
+    chunk_buf_append(&out, line, (size_t)n);
+
+    sdcard_dirent_t ent;
+    while (out.err == ESP_OK && sdcard_dir_read(dir, &ent))
+    {
+        list_append_item(&out, ent.name, ent.is_dir, ent.size, ent.mtime);
+    }
+    esp_err_t read_err = out.err == ESP_OK ? sdcard_dir_error(dir) : ESP_OK;
+    sdcard_dir_close(dir);
+    sdcard_io_end();
+    out.io_held = false;
+    if (read_err == ESP_OK)
+    {
+        chunk_buf_append(&out, "]}", 2);
+    }
+    else
+    {
+        // The 200 and the first items are already out; the trailer tells the
+        // client the list is incomplete, and nothing of it is cached.
+        static const char k_trailer[] = "],\"error\":\"READ_FAIL\"}";
+        chunk_buf_append(&out, k_trailer, sizeof(k_trailer) - 1);
+    }
+    chunk_buf_flush(&out);
+    httpd_resp_send_chunk(req, NULL, 0);
+    upload_free_buf((uint8_t *)out.buf);
+    if (out.keep && out.err == ESP_OK && read_err == ESP_OK)
+    {
+        dir_index_blob_put(rel_path, stamp, out.keep, out.keep_len);
+    }
+    else
+    {
+        heap_caps_free(out.keep);
+    }
+    ESP_LOGD(TAG, "list %s: entries=%u %lldms", rel_path, (unsigned)out.count,
+             (long long)((esp_timer_get_time() - start_us) / 1000));
+    return ESP_OK;
+}
+
+static bool extract_filename(const char *header, char *out, size_t out_len)
+{
+    const char *p = strstr(header, "filename=\"");
+    if (!p)
+    {
+        return false;
     }
     p += strlen("filename=\"");
     const char *end = strchr(p, '"');
@@ -974,12 +1628,12 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
 {
     if (!fs_gate(req))
     {
-        drain_body(req);
+        http_drain_body(req);
         return ESP_OK;
     }
     if (!fileop_try_lock(req))
     {
-        drain_body(req);
+        http_drain_body(req);
         return ESP_OK;
     }
 
@@ -988,15 +1642,21 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
     ctx.mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
     ctx.start_us = esp_timer_get_time();
     ctx.last_log_us = ctx.start_us;
+    ctx.hash = true;
     FILE *fp = NULL;
     bool ctx_started = false;
     bool upload_ok = false;
+    bool replaced = false;
+    char rel_file[MAX_PATH_LEN] = {0};
+    char full_path[MAX_PATH_LEN] = {0};
+    char tmp_path[MAX_PATH_LEN] = {0};
+    ctx.label = rel_file;
+    ctx.total = req->content_len;
 
-    bool recv_fallback = false;
-    bool work_fallback = false;
-    uint8_t *recv_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE, s_upload_recv_fallback, &recv_fallback);
-    uint8_t *work_buf = upload_alloc_buf(UPLOAD_WORK_SIZE, s_upload_work_fallback, &work_fallback);
-    if (!recv_buf || !work_buf)
+    uint8_t *recv_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
+    uint8_t *work_buf = upload_alloc_buf(UPLOAD_WORK_SIZE);
+    char *header_buf = (char *)upload_alloc_buf(UPLOAD_HEADER_SIZE);
+    if (!recv_buf || !work_buf || !header_buf)
     {
         send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
         goto cleanup;
@@ -1009,6 +1669,7 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
         goto cleanup;
     }
     bool overwrite = get_query_flag(req, "overwrite");
+    bool compact = get_query_flag(req, "compact");
     uint64_t mtime_ms = 0;
     get_query_u64(req, "mtime", &mtime_ms);
 
@@ -1045,16 +1706,13 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
         goto cleanup;
     }
 
-    char *header_buf = s_upload_header;
     int header_len = 0;
     bool header_done = false;
     char filename[MAX_NAME_LEN] = {0};
-    char full_path[MAX_PATH_LEN] = {0};
-    char tmp_path[MAX_PATH_LEN] = {0};
 
     char boundary_marker[80];
     size_t marker_len = 0;
-    char *tail = s_upload_tail;
+    char tail[UPLOAD_TAIL_SIZE];
     size_t tail_len = 0;
 
     int remaining = req->content_len;
@@ -1063,7 +1721,7 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
     {
         int to_read = remaining > (int)UPLOAD_RECV_BUF_SIZE ? (int)UPLOAD_RECV_BUF_SIZE : remaining;
         int64_t t0 = esp_timer_get_time();
-        r = httpd_req_recv(req, (char *)recv_buf, to_read);
+        r = req_recv(req, (char *)recv_buf, to_read);
         int64_t t1 = esp_timer_get_time();
         if (r == HTTPD_SOCK_ERR_TIMEOUT)
         {
@@ -1113,7 +1771,6 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
             strncpy(filename, clean_name, sizeof(filename));
             filename[sizeof(filename) - 1] = '\0';
 
-            char rel_file[MAX_PATH_LEN];
             if (!build_rel_child(rel_dir, filename, rel_file, sizeof(rel_file)))
             {
                 send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
@@ -1142,6 +1799,7 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
                     send_json_error(req, "500 Internal Server Error", "{\"error\":\"DELETE_FAIL\"}");
                     goto cleanup;
                 }
+                replaced = true;
             }
 
             if (!build_suffix_path(full_path, ".part", tmp_path, sizeof(tmp_path)))
@@ -1157,8 +1815,10 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
                 send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
                 goto cleanup;
             }
-            setvbuf(fp, s_upload_file_buf, _IOFBF, sizeof(s_upload_file_buf));
+            upload_file_set_buffer(fp);
 
+            ctx.analyse = gcode_meta_is_gcode(filename);
+            ctx.compact = ctx.analyse && compact;
             if (!upload_ctx_start(&ctx, fp, NULL))
             {
                 send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
@@ -1168,7 +1828,7 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
 
             snprintf(boundary_marker, sizeof(boundary_marker), "\r\n--%s", boundary);
             marker_len = strlen(boundary_marker);
-            if (marker_len + 1 > sizeof(s_upload_tail))
+            if (marker_len + 1 > sizeof(tail))
             {
                 send_json_error(req, "400 Bad Request", "{\"error\":\"BOUNDARY_TOO_LONG\"}");
                 goto cleanup;
@@ -1193,7 +1853,7 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
                 {
                     int to_read2 = remaining > (int)UPLOAD_RECV_BUF_SIZE ? (int)UPLOAD_RECV_BUF_SIZE : remaining;
                     int64_t rt0 = esp_timer_get_time();
-                    r = httpd_req_recv(req, (char *)recv_buf, to_read2);
+                    r = req_recv(req, (char *)recv_buf, to_read2);
                     int64_t rt1 = esp_timer_get_time();
                     if (r == HTTPD_SOCK_ERR_TIMEOUT)
                     {
@@ -1279,7 +1939,7 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
             {
                 int to_read3 = remaining > (int)UPLOAD_RECV_BUF_SIZE ? (int)UPLOAD_RECV_BUF_SIZE : remaining;
                 int64_t rt0 = esp_timer_get_time();
-                int d = httpd_req_recv(req, (char *)recv_buf, to_read3);
+                int d = req_recv(req, (char *)recv_buf, to_read3);
                 int64_t rt1 = esp_timer_get_time();
                 if (d == HTTPD_SOCK_ERR_TIMEOUT)
                 {
@@ -1309,9 +1969,23 @@ static esp_err_t http_fs_upload(httpd_req_t *req)
                 goto cleanup;
             }
             apply_mtime_if_needed(full_path, mtime_ms);
+            char hex[HASH_INDEX_HEX_LEN];
+            hash_index_to_hex(ctx.digest, hex);
+            index_file_hash(rel_dir, filename, full_path, hex);
+            index_file_meta(rel_file, full_path, &ctx);
 
             httpd_resp_set_type(req, "application/json");
-            httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+            if (ctx.compact_in > 0)
+            {
+                char json[96];
+                snprintf(json, sizeof(json), "{\"ok\":true,\"size\":%llu,\"original\":%llu}",
+                         (unsigned long long)ctx.compact_out, (unsigned long long)ctx.compact_in);
+                httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+            }
+            else
+            {
+                httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+            }
             upload_ok = true;
             goto cleanup;
         }
@@ -1333,26 +2007,190 @@ cleanup:
     {
         fclose(fp);
     }
+    gcode_analyzer_destroy(ctx.gcode);
     if (!upload_ok && tmp_path[0])
     {
         unlink(tmp_path);
     }
-    upload_free_buf(recv_buf, recv_fallback);
-    upload_free_buf(work_buf, work_fallback);
+    if (upload_ok)
+    {
+        note_change(replaced ? FS_JOURNAL_MODIFY : FS_JOURNAL_CREATE, rel_file, NULL, false);
+    }
+    else if (replaced)
+    {
+        // The old file was unlinked before the upload failed.
+        note_change(FS_JOURNAL_DELETE, rel_file, NULL, false);
+    }
+    else if (tmp_path[0])
+    {
+        // The .part came and went.
+        note_parent_changed(rel_file);
+    }
+    upload_free_buf(recv_buf);
+    upload_free_buf(work_buf);
+    upload_free_buf(header_buf);
     fileop_unlock();
     return result;
 }
 
+// Pulls the request body through a receive buffer for parsers that want
+// arbitrary-sized reads (delta ops, tar headers, gzip input).
+typedef struct
+{
+    httpd_req_t *req;
+    uint8_t *buf;
+    size_t cap;
+    size_t pos;
+    size_t len;
+    int remaining;
+} body_reader_t;
+
+static bool body_reader_fill(body_reader_t *r)
+{
+    if (r->pos < r->len)
+    {
+        return true;
+    }
+    while (r->remaining > 0)
+    {
+        int to_read = r->remaining > (int)r->cap ? (int)r->cap : r->remaining;
+        int n = req_recv(r->req, (char *)r->buf, to_read);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        r->remaining -= n;
+        r->pos = 0;
+        r->len = (size_t)n;
+        return true;
+    }
+    return false;
+}
+
+static bool body_reader_read(body_reader_t *r, uint8_t *dst, size_t n)
+{
+    while (n > 0)
+    {
+        if (!body_reader_fill(r))
+        {
+            return false;
+        }
+        size_t k = r->len - r->pos;
+        if (k > n)
+        {
+            k = n;
+        }
+        memcpy(dst, r->buf + r->pos, k);
+        r->pos += k;
+        dst += k;
+        n -= k;
+    }
+    return true;
+}
+
+static int body_reader_src(void *ctx, uint8_t *dst, size_t len)
+{
+    body_reader_t *r = (body_reader_t *)ctx;
+    if (!body_reader_fill(r))
+    {
+        return 0;
+    }
+    size_t k = r->len - r->pos;
+    if (k > len)
+    {
+        k = len;
+    }
+    memcpy(dst, r->buf + r->pos, k);
+    r->pos += k;
+    return (int)k;
+}
+
+static bool body_is_gzip(httpd_req_t *req)
+{
+    if (get_query_flag(req, "gz"))
+    {
+        return true;
+    }
+    char enc[32];
+    return httpd_req_get_hdr_value_str(req, "Content-Encoding", enc, sizeof(enc)) == ESP_OK && strstr(enc, "gzip");
+}
+
+// Compressed raw uploads: the receive loop feeds the inflater and the plain
+// bytes go to the writer task exactly as an uncompressed body would.
+typedef struct
+{
+    body_reader_t rd;
+    upload_ctx_t *ctx;
+} upload_gz_src_t;
+
+static int upload_gz_src(void *arg, uint8_t *dst, size_t len)
+{
+    upload_gz_src_t *src = (upload_gz_src_t *)arg;
+    if (src->rd.pos >= src->rd.len)
+    {
+        int64_t t0 = esp_timer_get_time();
+        if (!body_reader_fill(&src->rd))
+        {
+            return src->rd.remaining > 0 ? -1 : 0;
+        }
+        int64_t t1 = esp_timer_get_time();
+        upload_stats_add_recv(src->ctx, (uint32_t)src->rd.len, (uint64_t)(t1 - t0));
+        upload_stats_log(src->ctx, t1, false);
+    }
+    return body_reader_src(&src->rd, dst, len);
+}
+
+// Returns NULL once the whole body inflated cleanly, else the error code.
+static const char *upload_inflate_body(httpd_req_t *req, upload_ctx_t *ctx, uint8_t *recv_buf, uint64_t *plain_out)
+{
+    uint8_t *out = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
+    upload_gz_src_t src = {
+        .rd = {.req = req, .buf = recv_buf, .cap = UPLOAD_RECV_BUF_SIZE, .remaining = req->content_len},
+        .ctx = ctx,
+    };
+    gzip_reader_t *gz = out ? gzip_reader_create(upload_gz_src, &src) : NULL;
+    const char *err = gz ? NULL : "NO_MEM";
+    int n = 0;
+    while (!err && (n = gzip_reader_read(gz, out, UPLOAD_RECV_BUF_SIZE)) > 0)
+    {
+        *plain_out += (uint64_t)n;
+        if (!upload_ringbuf_send(ctx, out, (size_t)n))
+        {
+            err = "WRITE_FAIL";
+        }
+    }
+    if (!err && n < 0)
+    {
+        err = src.rd.remaining > 0 ? "RECV_FAIL" : "BAD_GZIP";
+    }
+    // One gzip member per request: anything after its trailer is rejected.
+    if (!err && gzip_reader_consumed(gz) != (uint64_t)req->content_len)
+    {
+        err = "BAD_GZIP";
+    }
+    gzip_reader_destroy(gz);
+    upload_free_buf(out);
+    return err;
+}
+
+// POST /api/fs/upload_raw?path=/dir&name=f[&overwrite=1][&mtime=ms][&gz=1][&compact=1]:
+// the body is the file itself; with gz=1 or Content-Encoding: gzip it is
+// inflated on the way to the card, with compact=1 G-code is compacted.
 static esp_err_t http_fs_upload_raw(httpd_req_t *req)
 {
     if (!fs_gate(req))
     {
-        drain_body(req);
+        http_drain_body(req);
         return ESP_OK;
     }
     if (!fileop_try_lock(req))
     {
-        drain_body(req);
+        http_drain_body(req);
         return ESP_OK;
     }
 
@@ -1361,12 +2199,17 @@ static esp_err_t http_fs_upload_raw(httpd_req_t *req)
     ctx.mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
     ctx.start_us = esp_timer_get_time();
     ctx.last_log_us = ctx.start_us;
+    ctx.hash = true;
     FILE *fp = NULL;
     bool ctx_started = false;
     bool upload_ok = false;
+    bool replaced = false;
+    char rel_file[MAX_PATH_LEN] = {0};
+    char tmp_path[MAX_PATH_LEN] = {0};
+    ctx.label = rel_file;
+    ctx.total = req->content_len;
 
-    bool recv_fallback = false;
-    uint8_t *recv_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE, s_upload_recv_fallback, &recv_fallback);
+    uint8_t *recv_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
     if (!recv_buf)
     {
         send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
@@ -1392,10 +2235,11 @@ static esp_err_t http_fs_upload_raw(httpd_req_t *req)
         goto cleanup;
     }
     bool overwrite = get_query_flag(req, "overwrite");
+    bool gz_body = body_is_gzip(req);
+    uint64_t plain_bytes = 0;
     uint64_t mtime_ms = 0;
     get_query_u64(req, "mtime", &mtime_ms);
 
-    char rel_file[MAX_PATH_LEN];
     if (!build_rel_child(rel_dir, clean_name, rel_file, sizeof(rel_file)))
     {
         send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
@@ -1425,9 +2269,9 @@ static esp_err_t http_fs_upload_raw(httpd_req_t *req)
             send_json_error(req, "500 Internal Server Error", "{\"error\":\"DELETE_FAIL\"}");
             goto cleanup;
         }
+        replaced = true;
     }
 
-    char tmp_path[MAX_PATH_LEN] = {0};
     if (!build_suffix_path(full_path, ".part", tmp_path, sizeof(tmp_path)))
     {
         send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
@@ -1448,7 +2292,9 @@ static esp_err_t http_fs_upload_raw(httpd_req_t *req)
         send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
         goto cleanup;
     }
-    setvbuf(fp, s_upload_file_buf, _IOFBF, sizeof(s_upload_file_buf));
+    upload_file_set_buffer(fp);
+    ctx.analyse = gcode_meta_is_gcode(clean_name);
+    ctx.compact = ctx.analyse && get_query_flag(req, "compact");
     if (!upload_ctx_start(&ctx, fp, NULL))
     {
         send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
@@ -1456,11 +2302,24 @@ static esp_err_t http_fs_upload_raw(httpd_req_t *req)
     }
     ctx_started = true;
 
+    if (gz_body)
+    {
+        const char *gz_err = upload_inflate_body(req, &ctx, recv_buf, &plain_bytes);
+        if (gz_err)
+        {
+            char json[48];
+            snprintf(json, sizeof(json), "{\"error\":\"%s\"}", gz_err);
+            bool server_side = strcmp(gz_err, "NO_MEM") == 0 || strcmp(gz_err, "WRITE_FAIL") == 0;
+            send_json_error(req, server_side ? "500 Internal Server Error" : "400 Bad Request", json);
+            goto cleanup;
+        }
+        remaining = 0;
+    }
     while (remaining > 0)
     {
         int to_read = remaining > (int)UPLOAD_RECV_BUF_SIZE ? (int)UPLOAD_RECV_BUF_SIZE : remaining;
         int64_t t0 = esp_timer_get_time();
-        int r = httpd_req_recv(req, (char *)recv_buf, to_read);
+        int r = req_recv(req, (char *)recv_buf, to_read);
         int64_t t1 = esp_timer_get_time();
         if (r == HTTPD_SOCK_ERR_TIMEOUT)
         {
@@ -1495,8 +2354,38 @@ static esp_err_t http_fs_upload_raw(httpd_req_t *req)
         goto cleanup;
     }
     apply_mtime_if_needed(full_path, mtime_ms);
+    char hex[HASH_INDEX_HEX_LEN];
+    hash_index_to_hex(ctx.digest, hex);
+    index_file_hash(rel_dir, clean_name, full_path, hex);
+    index_file_meta(rel_file, full_path, &ctx);
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+    if (gz_body || ctx.compact_in > 0)
+    {
+        if (gz_body)
+        {
+            ESP_LOGI(TAG, "upload_raw %s: gzip %d -> %llu bytes (%.1fx)", rel_file, req->content_len,
+                     (unsigned long long)plain_bytes, (double)plain_bytes / (double)req->content_len);
+        }
+        // size is what landed on the card; original is the plain body before
+        // compaction, compressed the body as sent.
+        char json[128];
+        int n = snprintf(json, sizeof(json), "{\"ok\":true,\"size\":%llu",
+                         (unsigned long long)(ctx.compact_in > 0 ? ctx.compact_out : plain_bytes));
+        if (ctx.compact_in > 0)
+        {
+            n += snprintf(json + n, sizeof(json) - n, ",\"original\":%llu", (unsigned long long)ctx.compact_in);
+        }
+        if (gz_body)
+        {
+            n += snprintf(json + n, sizeof(json) - n, ",\"compressed\":%d", req->content_len);
+        }
+        snprintf(json + n, sizeof(json) - n, "}");
+        httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    }
+    else
+    {
+        httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+    }
     upload_ok = true;
 
 cleanup:
@@ -1508,147 +2397,593 @@ cleanup:
     {
         fclose(fp);
     }
+    gcode_analyzer_destroy(ctx.gcode);
     if (!upload_ok && tmp_path[0])
     {
         unlink(tmp_path);
     }
-    upload_free_buf(recv_buf, recv_fallback);
+    if (upload_ok)
+    {
+        note_change(replaced ? FS_JOURNAL_MODIFY : FS_JOURNAL_CREATE, rel_file, NULL, false);
+    }
+    else if (replaced)
+    {
+        // The old file was unlinked before the upload failed.
+        note_change(FS_JOURNAL_DELETE, rel_file, NULL, false);
+    }
+    else if (tmp_path[0])
+    {
+        // The .part came and went.
+        note_parent_changed(rel_file);
+    }
+    upload_free_buf(recv_buf);
     fileop_unlock();
     return result;
 }
 
-static esp_err_t http_fs_download(httpd_req_t *req)
+static bool upload_recv_stream(httpd_req_t *req, upload_ctx_t *ctx, uint8_t *recv_buf, int remaining)
 {
-    if (!fs_gate(req))
+    while (remaining > 0)
     {
-        return ESP_OK;
+        int to_read = remaining > (int)UPLOAD_RECV_BUF_SIZE ? (int)UPLOAD_RECV_BUF_SIZE : remaining;
+        int64_t t0 = esp_timer_get_time();
+        int r = req_recv(req, (char *)recv_buf, to_read);
+        int64_t t1 = esp_timer_get_time();
+        if (r == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        if (r <= 0)
+        {
+            return false;
+        }
+        remaining -= r;
+        upload_stats_add_recv(ctx, (uint32_t)r, (uint64_t)(t1 - t0));
+        upload_stats_log(ctx, t1, false);
+        if (!upload_ringbuf_send(ctx, recv_buf, (size_t)r))
+        {
+            return false;
+        }
     }
-    if (!fileop_try_lock(req))
-    {
-        return ESP_OK;
+    return true;
+}
+
+static bool session_paths(const upload_session_t *s, char *full_path, size_t full_len, char *tmp_path, size_t tmp_len)
+{
+    return build_fs_path(s->rel_path, full_path, full_len) &&
+           build_suffix_path(full_path, ".part", tmp_path, tmp_len);
+}
+
+static void send_session_json(httpd_req_t *req, const upload_session_t *s, bool resumed)
+{
+    char line[160];
+    char safe_path[MAX_PATH_LEN];
+    json_escape(safe_path, sizeof(safe_path), s->rel_path);
+    httpd_resp_set_type(req, "application/json");
+    snprintf(line, sizeof(line), "{\"ok\":true,\"id\":\"%s\",\"size\":%llu,\"received\":%llu,\"complete\":%s,\"resumed\":%s,\"path\":\"",
+             s->id,
+             (unsigned long long)s->size,
+             (unsigned long long)upload_session_received(s),
+             upload_session_complete(s) ? "true" : "false",
+             resumed ? "true" : "false");
+    httpd_resp_sendstr_chunk(req, line);
+    httpd_resp_sendstr_chunk(req, safe_path);
+    httpd_resp_sendstr_chunk(req, "\",\"ranges\":[");
+    for (uint32_t i = 0; i < s->range_count; ++i)
+    {
+        snprintf(line, sizeof(line), "%s[%llu,%llu]", i ? "," : "",
+                 (unsigned long long)s->ranges[i].start,
+                 (unsigned long long)s->ranges[i].end);
+        httpd_resp_sendstr_chunk(req, line);
     }
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_sendstr_chunk(req, NULL);
+}
 
-    char rel_path[MAX_PATH_LEN];
-    if (!get_query_path(req, rel_path, sizeof(rel_path)))
+static bool body_get_session(httpd_req_t *req, upload_session_t *s)
+{
+    char body[MAX_BODY_LEN];
+    char id[UPLOAD_SESSION_ID_LEN + 4] = {0};
+    if (!read_body(req, body, sizeof(body)) || !json_get_string(body, "id", id, sizeof(id)))
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
-        goto cleanup;
+        send_json_error(req, "400 Bad Request", "{\"error\":\"ID_REQUIRED\"}");
+        return false;
     }
-    if (strcmp(rel_path, "/") == 0)
+    if (upload_session_load(id, s) != ESP_OK)
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
-        goto cleanup;
+        send_json_error(req, "404 Not Found", "{\"error\":\"NO_SESSION\"}");
+        return false;
     }
+    return true;
+}
 
-    char full_path[MAX_PATH_LEN];
-    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+static void stripe_worker_task(void *arg);
+
+static bool stripe_init(void)
+{
+    if (s_stripe_req_queue)
     {
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
-        goto cleanup;
+        return true;
     }
+    s_stripe.lock = xSemaphoreCreateMutex();
+    s_stripe.pool = xSemaphoreCreateCounting(STRIPE_POOL_BLOCKS, STRIPE_POOL_BLOCKS);
+    s_stripe.blocks = xQueueCreate(STRIPE_POOL_BLOCKS, sizeof(stripe_block_t *));
+    QueueHandle_t req_queue = xQueueCreate(STRIPE_MAX_STREAMS, sizeof(httpd_req_t *));
+    if (!s_stripe.lock || !s_stripe.pool || !s_stripe.blocks || !req_queue)
+    {
+        ESP_LOGE(TAG, "stripe init failed");
+        return false;
+    }
+    for (int i = 0; i < STRIPE_MAX_STREAMS; ++i)
+    {
+        s_stripe.rx_pos[i] = UINT64_MAX;
+        if (xTaskCreate(stripe_worker_task, "stripe_rx", STRIPE_WORKER_STACK, (void *)(intptr_t)i,
+                        STRIPE_WORKER_PRIO, NULL) != pdPASS)
+        {
+            ESP_LOGE(TAG, "stripe worker %d start failed", i);
+            return false;
+        }
+    }
+    s_stripe_req_queue = req_queue;
+    return true;
+}
 
-    struct stat st;
-    if (stat(full_path, &st) != 0)
+// Waits until no striped session holds the card. Only asks the writer to
+// close early when no stream is mid-request; otherwise it has to finish.
+static bool stripe_quiesce(uint32_t timeout_ms)
+{
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    while (s_stripe.active)
     {
-        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
-        goto cleanup;
+        xSemaphoreTake(s_stripe.lock, portMAX_DELAY);
+        if (s_stripe.inflight == 0)
+        {
+            s_stripe.close_requested = true;
+        }
+        xSemaphoreGive(s_stripe.lock);
+        if (esp_timer_get_time() >= deadline)
+        {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
     }
-    if (S_ISDIR(st.st_mode))
+    return true;
+}
+
+// Live view of a session: while the writer owns it, its in-memory ranges are
+// newer than the copy on the card.
+static esp_err_t stripe_session_lookup(const char *id, upload_session_t *out)
+{
+    if (s_stripe.active && s_stripe.lock)
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"IS_DIRECTORY\"}");
-        goto cleanup;
+        bool found = false;
+        xSemaphoreTake(s_stripe.lock, portMAX_DELAY);
+        if (s_stripe.active && strcmp(s_stripe.session.id, id) == 0)
+        {
+            *out = s_stripe.session;
+            found = true;
+        }
+        xSemaphoreGive(s_stripe.lock);
+        if (found)
+        {
+            return ESP_OK;
+        }
     }
+    return upload_session_load(id, out);
+}
 
-    ESP_LOGI(TAG, "download start: %s size=%lld", rel_path, (long long)st.st_size);
+static void stripe_save_session(stripe_ctx_t *st)
+{
+    upload_session_t copy;
+    sdcard_io_begin(SDCARD_IO_STREAM);
+    TRACE_BEGIN(TRACE_FSYNC, 0);
+    fflush(st->fp);
+    fsync(fileno(st->fp));
+    TRACE_END(TRACE_FSYNC, 0);
+    sdcard_io_end();
+    xSemaphoreTake(st->lock, portMAX_DELAY);
+    copy = st->session;
+    xSemaphoreGive(st->lock);
+    upload_session_save(&copy);
+}
 
-    char *size_hdr = heap_caps_malloc(32, MALLOC_CAP_8BIT);
-    if (!size_hdr)
+static void stripe_write_block(stripe_ctx_t *st, stripe_block_t *b)
+{
+    if (st->result == ESP_OK)
     {
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
-        goto cleanup;
+        sdcard_io_begin(SDCARD_IO_STREAM);
+        if (b->offset != st->file_pos)
+        {
+            st->seek_writes++;
+            if (fseek(st->fp, (long)b->offset, SEEK_SET) != 0)
+            {
+                st->result = ESP_FAIL;
+            }
+        }
+        if (st->result == ESP_OK)
+        {
+            TRACE_BEGIN(TRACE_FWRITE, b->len);
+            size_t written = fwrite(b->data, 1, b->len, st->fp);
+            TRACE_END(TRACE_FWRITE, written);
+            if (written != b->len)
+            {
+                st->result = ESP_FAIL;
+            }
+        }
+        sdcard_io_end();
+        if (st->result == ESP_OK)
+        {
+            st->file_pos = b->offset + b->len;
+            st->bytes_written += b->len;
+            xSemaphoreTake(st->lock, portMAX_DELAY);
+            if (upload_session_add_range(&st->session, b->offset, b->len) != ESP_OK)
+            {
+                st->result = ESP_ERR_NO_MEM;
+            }
+            xSemaphoreGive(st->lock);
+        }
     }
-    snprintf(size_hdr, 32, "%lld", (long long)st.st_size);
+    heap_caps_free(b);
+    xSemaphoreGive(st->pool);
+}
 
-    httpd_resp_set_hdr(req, "X-Content-Length", size_hdr);
-    httpd_resp_set_type(req, "application/octet-stream");
+static void stripe_pending_insert(stripe_ctx_t *st, stripe_block_t *b)
+{
+    stripe_block_t **pp = &st->pending;
+    while (*pp && (*pp)->offset < b->offset)
+    {
+        pp = &(*pp)->next;
+    }
+    b->next = *pp;
+    *pp = b;
+    st->pending_count++;
+}
 
-    FILE *fp = fopen(full_path, "rb");
-    if (!fp)
+// A pending block is written when it continues the file position, when no
+// active stream can still deliver anything in front of it, or when the pool
+// is running low and holding it back would stall the receivers.
+static void stripe_pending_drain(stripe_ctx_t *st, bool force)
+{
+    while (st->pending)
     {
-        heap_caps_free(size_hdr);
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
-        goto cleanup;
+        stripe_block_t *b = st->pending;
+        bool ready = force || b->offset == st->file_pos || st->pending_count >= STRIPE_HIGH_WATER;
+        if (!ready)
+        {
+            uint64_t min_rx = UINT64_MAX;
+            xSemaphoreTake(st->lock, portMAX_DELAY);
+            for (int i = 0; i < STRIPE_MAX_STREAMS; ++i)
+            {
+                if (st->rx_pos[i] < min_rx)
+                {
+                    min_rx = st->rx_pos[i];
+                }
+            }
+            xSemaphoreGive(st->lock);
+            ready = b->offset < min_rx;
+        }
+        if (!ready)
+        {
+            break;
+        }
+        st->pending = b->next;
+        st->pending_count--;
+        stripe_write_block(st, b);
     }
+}
 
-    size_t buf_size = 0;
-    char *buf = download_alloc_buf(&buf_size);
-    if (!buf)
+static void stripe_writer_task(void *arg)
+{
+    stripe_ctx_t *st = (stripe_ctx_t *)arg;
+    int64_t last_sync_us = esp_timer_get_time();
+    uint64_t synced_bytes = 0;
+    while (true)
     {
-        fclose(fp);
-        heap_caps_free(size_hdr);
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
-        goto cleanup;
+        stripe_block_t *b = NULL;
+        if (xQueueReceive(st->blocks, &b, pdMS_TO_TICKS(100)) == pdTRUE)
+        {
+            stripe_pending_insert(st, b);
+            while (xQueueReceive(st->blocks, &b, 0) == pdTRUE)
+            {
+                stripe_pending_insert(st, b);
+            }
+        }
+        stripe_pending_drain(st, st->inflight == 0);
+
+        int64_t now = esp_timer_get_time();
+        if (st->bytes_written != synced_bytes && (now - last_sync_us) >= STRIPE_SYNC_INTERVAL_US)
+        {
+            stripe_save_session(st);
+            synced_bytes = st->bytes_written;
+            last_sync_us = now;
+        }
+
+        bool done = false;
+        xSemaphoreTake(st->lock, portMAX_DELAY);
+        if (st->inflight == 0 && !st->pending && uxQueueMessagesWaiting(st->blocks) == 0 &&
+            (st->close_requested || (now - st->last_rx_us) >= STRIPE_IDLE_US))
+        {
+            st->closing = true;
+            done = true;
+        }
+        xSemaphoreGive(st->lock);
+        if (done)
+        {
+            break;
+        }
     }
-    ESP_LOGI(TAG, "download buffer=%u", (unsigned)buf_size);
 
-#if WEBFS_METRICS
-    int64_t start_us = esp_timer_get_time();
-    int64_t last_log = start_us;
-    uint64_t bytes_sent = 0;
-    uint32_t send_fail = 0;
-#endif
+    stripe_save_session(st);
+    fclose(st->fp);
+    st->fp = NULL;
+    upload_file_release_buffer();
 
-    size_t n = 0;
-    uint32_t chunk_count = 0;
-    while ((n = fread(buf, 1, buf_size, fp)) > 0)
+    double elapsed_s = (double)(st->last_rx_us - st->start_us) / 1e6;
+    double avg_kbps = elapsed_s > 0.0 ? (double)st->bytes_written / 1024.0 / elapsed_s : 0.0;
+    ESP_LOGI(TAG, "UPLOAD_STRIPE_DONE id=%s recv=%llu write=%llu avg=%.1f KB/s streams=%u seeks=%u result=%s",
+             st->session.id,
+             (unsigned long long)st->bytes_received,
+             (unsigned long long)st->bytes_written,
+             avg_kbps,
+             st->max_streams,
+             st->seek_writes,
+             esp_err_to_name(st->result));
+
+    xSemaphoreTake(st->lock, portMAX_DELAY);
+    st->active = false;
+    st->closing = false;
+    st->close_requested = false;
+    xSemaphoreGive(st->lock);
+    vTaskDelete(NULL);
+}
+
+static void stripe_set_rx_pos(int slot, uint64_t pos)
+{
+    xSemaphoreTake(s_stripe.lock, portMAX_DELAY);
+    s_stripe.rx_pos[slot] = pos;
+    xSemaphoreGive(s_stripe.lock);
+}
+
+static void stripe_receive(httpd_req_t *req, int slot)
+{
+    uint64_t offset = 0;
+    get_query_u64(req, "offset", &offset);
+    int remaining = req->content_len;
+    uint64_t queued = 0;
+    const char *error = NULL;
+
+    while (remaining > 0 && !error)
     {
-        esp_err_t send_err = httpd_resp_send_chunk(req, buf, n);
-        if (send_err != ESP_OK)
+        size_t want = remaining > STRIPE_BLOCK_SIZE ? STRIPE_BLOCK_SIZE : (size_t)remaining;
+        stripe_set_rx_pos(slot, offset);
+        if (xSemaphoreTake(s_stripe.pool, pdMS_TO_TICKS(STRIPE_POOL_WAIT_MS)) != pdTRUE)
         {
-            ESP_LOGW(TAG, "download send failed: %s", esp_err_to_name(send_err));
-#if WEBFS_DOWNLOAD_METRICS
-            send_fail++;
-#endif
-            fclose(fp);
-            heap_caps_free(buf);
-            heap_caps_free(size_hdr);
-            goto cleanup;
+            error = "WRITE_STALL";
+            break;
         }
-#if WEBFS_METRICS
-        bytes_sent += n;
-        int64_t now_us = esp_timer_get_time();
-        if (now_us - last_log >= 1000000)
+        stripe_block_t *b = heap_caps_malloc(sizeof(*b) + want, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!b)
         {
-            double elapsed_s = (double)(now_us - start_us) / 1e6;
-            double avg_kbps = elapsed_s > 0.0 ? (double)bytes_sent / 1024.0 / elapsed_s : 0.0;
-            ESP_LOGI(TAG, "download stats: bytes=%llu avg=%.1f KB/s fail=%u",
-                     (unsigned long long)bytes_sent, avg_kbps, (unsigned)send_fail);
-            last_log = now_us;
+            b = heap_caps_malloc(sizeof(*b) + want, MALLOC_CAP_8BIT);
+        }
+        if (!b)
+        {
+            xSemaphoreGive(s_stripe.pool);
+            error = "NO_MEM";
+            break;
+        }
+        size_t got = 0;
+        while (got < want)
+        {
+            int r = req_recv(req, (char *)b->data + got, want - got);
+            if (r == HTTPD_SOCK_ERR_TIMEOUT)
+            {
+                vTaskDelay(pdMS_TO_TICKS(10));
+                continue;
+            }
+            if (r <= 0)
+            {
+                error = "RECV_FAIL";
+                break;
+            }
+            got += (size_t)r;
+        }
+        if (got == 0)
+        {
+            heap_caps_free(b);
+            xSemaphoreGive(s_stripe.pool);
+            break;
+        }
+        // Whatever arrived is real data; the writer records it as a range.
+        b->next = NULL;
+        b->offset = offset;
+        b->len = got;
+        xQueueSend(s_stripe.blocks, &b, portMAX_DELAY);
+        offset += got;
+        remaining -= (int)got;
+        queued += got;
+        if (!error && s_stripe.result != ESP_OK)
+        {
+            error = s_stripe.result == ESP_ERR_NO_MEM ? "TOO_FRAGMENTED" : "WRITE_FAIL";
         }
-#endif
-        chunk_count++;
     }
-    fclose(fp);
-    heap_caps_free(buf);
-    heap_caps_free(size_hdr);
-    httpd_resp_send_chunk(req, NULL, 0);
-    fileop_unlock();
-    return ESP_OK;
 
-cleanup:
+    xSemaphoreTake(s_stripe.lock, portMAX_DELAY);
+    s_stripe.rx_pos[slot] = UINT64_MAX;
+    s_stripe.bytes_received += queued;
+    s_stripe.last_rx_us = esp_timer_get_time();
+    s_stripe.inflight--;
+    xSemaphoreGive(s_stripe.lock);
+
+    if (error)
+    {
+        char json[64];
+        snprintf(json, sizeof(json), "{\"error\":\"%s\"}", error);
+        send_json_error(req, strcmp(error, "RECV_FAIL") == 0 ? "400 Bad Request" : "500 Internal Server Error", json);
+        return;
+    }
+    char json[96];
+    snprintf(json, sizeof(json), "{\"ok\":true,\"id\":\"%s\",\"queued\":%llu}",
+             s_stripe.session.id, (unsigned long long)queued);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+static void stripe_worker_task(void *arg)
+{
+    int slot = (int)(intptr_t)arg;
+    while (true)
+    {
+        httpd_req_t *req = NULL;
+        if (xQueueReceive(s_stripe_req_queue, &req, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+        stripe_receive(req, slot);
+        httpd_req_async_handler_complete(req);
+    }
+}
+
+// Joins the running striped writer for this session or starts a new one.
+// Runs on the httpd task, so two attaches never race; a quiesce from a
+// worker-pool handler sets close_requested under the lock, which makes a
+// concurrent join fail with 423 instead of reopening a closing writer.
+static bool stripe_attach(httpd_req_t *req, const upload_session_t *s)
+{
+    xSemaphoreTake(s_stripe.lock, portMAX_DELAY);
+    if (s_stripe.active && !s_stripe.closing && !s_stripe.close_requested &&
+        strcmp(s_stripe.session.id, s->id) == 0)
+    {
+        s_stripe.inflight++;
+        if ((uint32_t)s_stripe.inflight > s_stripe.max_streams)
+        {
+            s_stripe.max_streams = (uint32_t)s_stripe.inflight;
+        }
+        xSemaphoreGive(s_stripe.lock);
+        return true;
+    }
+    bool other = s_stripe.active && strcmp(s_stripe.session.id, s->id) != 0;
+    xSemaphoreGive(s_stripe.lock);
+    if (other || !stripe_quiesce(STRIPE_QUIESCE_MS))
+    {
+        send_json_error(req, "423 Locked", "{\"error\":\"FILEOP_IN_PROGRESS\"}");
+        return false;
+    }
+    if (!fileop_try_lock(req))
+    {
+        return false;
+    }
+
+    char full_path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    upload_session_t session = *s;
+    FILE *fp = NULL;
+    if (session_paths(&session, full_path, sizeof(full_path), tmp_path, sizeof(tmp_path)))
+    {
+        fp = fopen(tmp_path, "r+b");
+        if (!fp)
+        {
+            upload_session_reset_ranges(&session);
+            fp = fopen(tmp_path, "wb");
+        }
+    }
+    if (!fp)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
+        fileop_unlock();
+        return false;
+    }
+    upload_file_set_buffer(fp);
+
+    s_stripe.session = session;
+    s_stripe.fp = fp;
+    s_stripe.result = ESP_OK;
+    s_stripe.pending = NULL;
+    s_stripe.pending_count = 0;
+    s_stripe.file_pos = 0;
+    s_stripe.bytes_received = 0;
+    s_stripe.bytes_written = 0;
+    s_stripe.seek_writes = 0;
+    s_stripe.max_streams = 1;
+    s_stripe.start_us = esp_timer_get_time();
+    s_stripe.last_rx_us = s_stripe.start_us;
+    s_stripe.closing = false;
+    s_stripe.close_requested = false;
+    s_stripe.inflight = 1;
+    s_stripe.active = true;
+    if (xTaskCreate(stripe_writer_task, "stripe_writer", UPLOAD_WRITER_STACK, &s_stripe,
+                    UPLOAD_WRITER_PRIO, NULL) != pdPASS)
+    {
+        s_stripe.active = false;
+        s_stripe.inflight = 0;
+        fclose(fp);
+        s_stripe.fp = NULL;
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        fileop_unlock();
+        return false;
+    }
     fileop_unlock();
+    return true;
+}
+
+static void stripe_detach(void)
+{
+    xSemaphoreTake(s_stripe.lock, portMAX_DELAY);
+    s_stripe.inflight--;
+    s_stripe.last_rx_us = esp_timer_get_time();
+    xSemaphoreGive(s_stripe.lock);
+}
+
+static esp_err_t stripe_chunk_begin(httpd_req_t *req, const upload_session_t *s)
+{
+    if (!stripe_init())
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    if (uxQueueSpacesAvailable(s_stripe_req_queue) == 0)
+    {
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        send_json_error(req, "503 Service Unavailable", "{\"error\":\"TOO_MANY_STREAMS\"}");
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    if (!stripe_attach(req, s))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    httpd_req_t *async_req = NULL;
+    if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK)
+    {
+        stripe_detach();
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    if (xQueueSend(s_stripe_req_queue, &async_req, 0) != pdTRUE)
+    {
+        stripe_detach();
+        httpd_resp_set_hdr(async_req, "Retry-After", "1");
+        send_json_error(async_req, "503 Service Unavailable", "{\"error\":\"TOO_MANY_STREAMS\"}");
+        http_drain_body(async_req);
+        httpd_req_async_handler_complete(async_req);
+    }
     return ESP_OK;
 }
 
-static esp_err_t http_fs_mkdir(httpd_req_t *req)
+static esp_err_t http_fs_session_create(httpd_req_t *req)
 {
     if (!fs_gate(req))
     {
+        http_drain_body(req);
         return ESP_OK;
     }
     if (!fileop_try_lock(req))
     {
-        drain_body(req);
+        http_drain_body(req);
         return ESP_OK;
     }
 
@@ -1662,6 +2997,8 @@ static esp_err_t http_fs_mkdir(httpd_req_t *req)
 
     char path_raw[MAX_PATH_LEN] = "/";
     char name_raw[MAX_NAME_LEN] = {0};
+    char num[32] = {0};
+    char sha256[UPLOAD_SESSION_HASH_LEN + 2] = {0};
     json_get_string(body, "path", path_raw, sizeof(path_raw));
     if (!json_get_string(body, "name", name_raw, sizeof(name_raw)))
     {
@@ -1669,239 +3006,3135 @@ static esp_err_t http_fs_mkdir(httpd_req_t *req)
         fileop_unlock();
         return ESP_OK;
     }
+    if (!json_get_string(body, "size", num, sizeof(num)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"SIZE_REQUIRED\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    uint64_t size = strtoull(num, NULL, 10);
+    uint64_t mtime_ms = 0;
+    if (json_get_string(body, "mtime", num, sizeof(num)))
+    {
+        mtime_ms = strtoull(num, NULL, 10);
+    }
+    bool overwrite = false;
+    if (json_get_string(body, "overwrite", num, sizeof(num)))
+    {
+        overwrite = (strcmp(num, "1") == 0 || strcmp(num, "true") == 0);
+    }
+    json_get_string(body, "sha256", sha256, sizeof(sha256));
+    uint8_t streams = 1;
+    if (json_get_string(body, "streams", num, sizeof(num)))
+    {
+        long n = strtol(num, NULL, 10);
+        streams = (uint8_t)(n < 1 ? 1 : (n > STRIPE_MAX_STREAMS ? STRIPE_MAX_STREAMS : n));
+    }
+    if (size == 0 || size > (uint64_t)LONG_MAX)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_SIZE\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
 
     char rel_dir[MAX_PATH_LEN];
-    if (!normalize_path(path_raw, rel_dir, sizeof(rel_dir)))
+    char name[MAX_NAME_LEN];
+    char rel_file[MAX_PATH_LEN];
+    if (!normalize_path(path_raw, rel_dir, sizeof(rel_dir)) || !sanitize_name(name_raw, name, sizeof(name)))
     {
         send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
         fileop_unlock();
         return ESP_OK;
     }
-
-    char name[MAX_NAME_LEN];
-    if (!sanitize_name(name_raw, name, sizeof(name)))
+    if (!build_rel_child(rel_dir, name, rel_file, sizeof(rel_file)))
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_NAME\"}");
+        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
         fileop_unlock();
         return ESP_OK;
     }
-
-    char rel_path[MAX_PATH_LEN];
-    if (!build_rel_child(rel_dir, name, rel_path, sizeof(rel_path)))
+
+    upload_session_t s;
+    bool resumed = false;
+    esp_err_t err = upload_session_open(rel_file, size, sha256, mtime_ms, overwrite, &s, &resumed);
+    if (err != ESP_OK)
+    {
+        if (err == ESP_ERR_INVALID_STATE)
+        {
+            send_json_error(req, "409 Conflict", "{\"error\":\"SESSION_CONFLICT\"}");
+        }
+        else if (err == ESP_ERR_INVALID_ARG)
+        {
+            send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_HASH\"}");
+        }
+        else
+        {
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"SESSION_FAIL\"}");
+        }
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char full_path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    if (!session_paths(&s, full_path, sizeof(full_path), tmp_path, sizeof(tmp_path)))
+    {
+        upload_session_remove(s.id);
+        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    struct stat st;
+    if (stat(full_path, &st) == 0)
+    {
+        if (S_ISDIR(st.st_mode) || !overwrite)
+        {
+            upload_session_remove(s.id);
+            send_json_error(req, "409 Conflict",
+                            S_ISDIR(st.st_mode) ? "{\"error\":\"IS_DIRECTORY\"}" : "{\"error\":\"FILE_EXISTS\"}");
+            fileop_unlock();
+            return ESP_OK;
+        }
+    }
+
+    // The .part file is the only copy of the received data; if it is gone or
+    // shorter than what the session claims, start over from zero.
+    bool part_ok = resumed && stat(tmp_path, &st) == 0 &&
+                   (s.range_count == 0 || (uint64_t)st.st_size >= s.ranges[s.range_count - 1].end);
+    if (!part_ok)
+    {
+        unlink(tmp_path);
+        FILE *fp = fopen(tmp_path, "wb");
+        if (!fp)
+        {
+            upload_session_remove(s.id);
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
+            fileop_unlock();
+            return ESP_OK;
+        }
+        fclose(fp);
+        if (s.range_count > 0)
+        {
+            upload_session_reset_ranges(&s);
+        }
+        resumed = false;
+    }
+    // Striped chunks land out of order; allocating the whole cluster chain up
+    // front keeps the writer's seeks from extending the file piecemeal.
+    s.streams = streams;
+    if (streams > 1 && (stat(tmp_path, &st) != 0 || (uint64_t)st.st_size < s.size))
+    {
+        FILE *fp = fopen(tmp_path, "r+b");
+        bool prealloc_ok = fp && fseek(fp, (long)(s.size - 1), SEEK_SET) == 0 && fputc(0, fp) != EOF;
+        if (fp)
+        {
+            prealloc_ok = (fclose(fp) == 0) && prealloc_ok;
+        }
+        if (!prealloc_ok)
+        {
+            upload_session_remove(s.id);
+            unlink(tmp_path);
+            send_json_error(req, "507 Insufficient Storage", "{\"error\":\"PREALLOC_FAIL\"}");
+            fileop_unlock();
+            return ESP_OK;
+        }
+    }
+    upload_session_save(&s);
+    note_parent_changed(s.rel_path);
+
+    ESP_LOGI(TAG, "session %s %s: %s size=%llu received=%llu", s.id, resumed ? "resumed" : "created",
+             s.rel_path, (unsigned long long)s.size, (unsigned long long)upload_session_received(&s));
+    send_session_json(req, &s, resumed);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+static esp_err_t http_fs_session_status(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    char id[UPLOAD_SESSION_ID_LEN + 4];
+    if (!get_query_value(req, "id", id, sizeof(id)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"ID_REQUIRED\"}");
+        return ESP_OK;
+    }
+    upload_session_t s;
+    if (stripe_session_lookup(id, &s) != ESP_OK)
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NO_SESSION\"}");
+        return ESP_OK;
+    }
+    send_session_json(req, &s, false);
+    return ESP_OK;
+}
+
+static esp_err_t http_fs_session_chunk(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    char id[UPLOAD_SESSION_ID_LEN + 4];
+    uint64_t offset = 0;
+    if (!get_query_value(req, "id", id, sizeof(id)) || !get_query_u64(req, "offset", &offset))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"ID_OFFSET_REQUIRED\"}");
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    upload_session_t s;
+    if (stripe_session_lookup(id, &s) != ESP_OK)
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NO_SESSION\"}");
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    int remaining = req->content_len;
+    if (remaining <= 0)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"NO_BODY\"}");
+        return ESP_OK;
+    }
+    if (offset + (uint64_t)remaining > s.size)
+    {
+        send_json_error(req, "416 Range Not Satisfiable", "{\"error\":\"BAD_RANGE\"}");
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    if (s.streams > 1)
+    {
+        return stripe_chunk_begin(req, &s);
+    }
+    if (!fileop_try_lock(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    esp_err_t result = ESP_OK;
+    upload_ctx_t ctx = {0};
+    ctx.mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    ctx.start_us = esp_timer_get_time();
+    ctx.last_log_us = ctx.start_us;
+    FILE *fp = NULL;
+    bool ctx_started = false;
+    bool recv_ok = false;
+
+    uint8_t *recv_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
+    if (!recv_buf)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+
+    char full_path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    if (!session_paths(&s, full_path, sizeof(full_path), tmp_path, sizeof(tmp_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        goto cleanup;
+    }
+    fp = fopen(tmp_path, "r+b");
+    if (!fp)
+    {
+        // .part vanished (e.g. a plain upload of the same name cleaned it up).
+        upload_session_reset_ranges(&s);
+        fp = fopen(tmp_path, "wb");
+    }
+    if (!fp)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
+        goto cleanup;
+    }
+    // setvbuf is only valid before any other operation on the stream.
+    upload_file_set_buffer(fp);
+    if (fseek(fp, (long)offset, SEEK_SET) != 0)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"SEEK_FAIL\"}");
+        goto cleanup;
+    }
+    if (!upload_ctx_start(&ctx, fp, NULL))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+    ctx_started = true;
+    fp = NULL;
+
+    recv_ok = upload_recv_stream(req, &ctx, recv_buf, remaining);
+    result = upload_ctx_finish(&ctx);
+    ctx_started = false;
+    upload_stats_log(&ctx, esp_timer_get_time(), true);
+
+    // Whatever reached the card is durable (the writer fsyncs), so record it
+    // even if the connection dropped part-way through the chunk.
+    if (ctx.bytes_written > 0)
+    {
+        if (upload_session_add_range(&s, offset, ctx.bytes_written) != ESP_OK)
+        {
+            send_json_error(req, "409 Conflict", "{\"error\":\"TOO_FRAGMENTED\"}");
+            goto cleanup;
+        }
+        upload_session_save(&s);
+    }
+    if (result != ESP_OK)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"WRITE_FAIL\"}");
+        goto cleanup;
+    }
+    if (!recv_ok)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"RECV_FAIL\"}");
+        goto cleanup;
+    }
+    send_session_json(req, &s, false);
+
+cleanup:
+    if (ctx_started)
+    {
+        upload_ctx_finish(&ctx);
+    }
+    else if (fp)
+    {
+        fclose(fp);
+    }
+    upload_free_buf(recv_buf);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+static esp_err_t http_fs_session_commit(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    upload_session_t s;
+    if (!body_get_session(req, &s))
+    {
+        fileop_unlock();
+        return ESP_OK;
+    }
+    if (!upload_session_complete(&s))
+    {
+        send_json_error(req, "409 Conflict", "{\"error\":\"INCOMPLETE\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    char full_path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    if (!session_paths(&s, full_path, sizeof(full_path), tmp_path, sizeof(tmp_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    esp_err_t err = upload_session_verify(&s, tmp_path);
+    if (err != ESP_OK)
+    {
+        if (err == ESP_ERR_INVALID_CRC)
+        {
+            // Corrupt data cannot be repaired chunk by chunk; force a restart.
+            upload_session_reset_ranges(&s);
+            upload_session_save(&s);
+            send_json_error(req, "409 Conflict", "{\"error\":\"HASH_MISMATCH\"}");
+        }
+        else
+        {
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"VERIFY_FAIL\"}");
+        }
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    struct stat st;
+    bool replaced = false;
+    if (stat(full_path, &st) == 0)
+    {
+        if (S_ISDIR(st.st_mode))
+        {
+            send_json_error(req, "409 Conflict", "{\"error\":\"IS_DIRECTORY\"}");
+            fileop_unlock();
+            return ESP_OK;
+        }
+        if (!s.overwrite)
+        {
+            send_json_error(req, "409 Conflict", "{\"error\":\"FILE_EXISTS\"}");
+            fileop_unlock();
+            return ESP_OK;
+        }
+        if (unlink(full_path) != 0)
+        {
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"DELETE_FAIL\"}");
+            fileop_unlock();
+            return ESP_OK;
+        }
+        replaced = true;
+    }
+    if (rename(tmp_path, full_path) != 0)
+    {
+        if (replaced)
+        {
+            note_change(FS_JOURNAL_DELETE, s.rel_path, NULL, false);
+        }
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"RENAME_FAIL\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    apply_mtime_if_needed(full_path, s.mtime_ms);
+    note_change(replaced ? FS_JOURNAL_MODIFY : FS_JOURNAL_CREATE, s.rel_path, NULL, false);
+    char dir_path[MAX_PATH_LEN];
+    char name[MAX_PATH_LEN];
+    if (s.sha256[0] && split_rel_path(s.rel_path, dir_path, sizeof(dir_path), name, sizeof(name)))
+    {
+        index_file_hash(dir_path, name, full_path, s.sha256);
+    }
+    upload_session_remove(s.id);
+    // Chunks may have arrived out of order, so the summary is built afterwards.
+    gcode_meta_schedule(s.rel_path);
+    ESP_LOGI(TAG, "session %s committed: %s", s.id, s.rel_path);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+static esp_err_t http_fs_session_abort(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    upload_session_t s;
+    if (!body_get_session(req, &s))
+    {
+        fileop_unlock();
+        return ESP_OK;
+    }
+    char full_path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    if (session_paths(&s, full_path, sizeof(full_path), tmp_path, sizeof(tmp_path)))
+    {
+        unlink(tmp_path);
+        note_parent_changed(s.rel_path);
+    }
+    upload_session_remove(s.id);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+// Compressed downloads: the deflater pushes its output here, which sends it
+// and tees it into the sidecar being built.
+typedef struct
+{
+    httpd_req_t *req;
+    FILE *sidecar;
+    bool sidecar_failed;
+    esp_err_t send_err;
+    uint64_t wire_bytes;
+    int64_t sink_us;
+} download_gz_ctx_t;
+
+static bool download_gz_sink(void *arg, const uint8_t *data, size_t len)
+{
+    download_gz_ctx_t *ctx = (download_gz_ctx_t *)arg;
+    int64_t t0 = esp_timer_get_time();
+    if (ctx->sidecar && !ctx->sidecar_failed)
+    {
+        sdcard_io_begin(SDCARD_IO_STREAM);
+        ctx->sidecar_failed = fwrite(data, 1, len, ctx->sidecar) != len;
+        sdcard_io_end();
+    }
+    ctx->send_err = httpd_resp_send_chunk(ctx->req, (const char *)data, len);
+    ctx->sink_us += esp_timer_get_time() - t0;
+    if (ctx->send_err != ESP_OK)
+    {
+        return false;
+    }
+    ctx->wire_bytes += len;
+    return true;
+}
+
+static esp_err_t http_fs_download(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        return ESP_OK;
+    }
+
+    char rel_path[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_path, sizeof(rel_path)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        goto cleanup;
+    }
+    if (strcmp(rel_path, "/") == 0)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        goto cleanup;
+    }
+
+    char full_path[MAX_PATH_LEN];
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        goto cleanup;
+    }
+
+    struct stat st;
+    if (stat(full_path, &st) != 0)
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        goto cleanup;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"IS_DIRECTORY\"}");
+        goto cleanup;
+    }
+
+    ESP_LOGI(TAG, "download start: %s size=%lld", rel_path, (long long)st.st_size);
+
+    char *size_hdr = heap_caps_malloc(32, MALLOC_CAP_8BIT);
+    if (!size_hdr)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+    snprintf(size_hdr, 32, "%lld", (long long)st.st_size);
+
+    // Text files go out gzip-encoded when the client takes it: from a current
+    // sidecar if there is one, otherwise deflated on the fly while a new
+    // sidecar is teed to the card. X-Content-Length stays the plain size,
+    // which is what the browser counts after decoding.
+    bool gz_wanted = gz_cache_compressible(rel_path, (uint64_t)st.st_size);
+    bool gz_encode = false;
+    char enc_hdr[128];
+    if (gz_wanted)
+    {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        gz_encode = httpd_req_get_hdr_value_str(req, "Accept-Encoding", enc_hdr, sizeof(enc_hdr)) == ESP_OK &&
+                    strstr(enc_hdr, "gzip");
+    }
+
+    httpd_resp_set_hdr(req, "X-Content-Length", size_hdr);
+    httpd_resp_set_type(req, "application/octet-stream");
+
+    uint64_t gz_cached_size = 0;
+    FILE *fp = gz_encode ? gz_cache_open(rel_path, (uint64_t)st.st_size, (int64_t)st.st_mtime, &gz_cached_size) : NULL;
+    bool gz_cached = fp != NULL;
+    if (!fp)
+    {
+        fp = fopen(full_path, "rb");
+    }
+    if (!fp)
+    {
+        heap_caps_free(size_hdr);
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
+        goto cleanup;
+    }
+
+    size_t buf_size = 0;
+    char *buf = download_alloc_buf(&buf_size);
+    if (!buf)
+    {
+        fclose(fp);
+        heap_caps_free(size_hdr);
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+    ESP_LOGI(TAG, "download buffer=%u", (unsigned)buf_size);
+
+    download_gz_ctx_t gz_ctx = {.req = req};
+    gzip_writer_t *gz = NULL;
+    if (gz_encode && !gz_cached)
+    {
+        uint8_t extra[GZ_CACHE_EXTRA_MAX];
+        size_t extra_len = gz_cache_extra(rel_path, (uint64_t)st.st_size, (int64_t)st.st_mtime, extra, sizeof(extra));
+        gz = gzip_writer_create(download_gz_sink, &gz_ctx, extra_len > 0 ? extra : NULL, extra_len);
+        if (gz)
+        {
+            gz_ctx.sidecar = extra_len > 0 ? gz_cache_create(rel_path, (uint64_t)st.st_size) : NULL;
+            httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        }
+        else
+        {
+            ESP_LOGW(TAG, "download %s: no memory for deflater, sending identity", rel_path);
+            gz_encode = false;
+        }
+    }
+    else if (gz_cached)
+    {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+
+#if WEBFS_METRICS
+    int64_t start_us = esp_timer_get_time();
+    int64_t last_log = start_us;
+    uint64_t bytes_sent = 0;
+    uint32_t send_fail = 0;
+#endif
+
+    size_t n = 0;
+    bool sent_ok = true;
+    int64_t deflate_us = 0;
+    uint64_t read_us = 0;
+    uint64_t send_us = 0;
+    uint32_t chunk_count = 0;
+    uint64_t progress_bytes = 0;
+    uint64_t progress_total = gz_cached ? gz_cached_size : (uint64_t)st.st_size;
+    int64_t progress_start = esp_timer_get_time();
+    int64_t progress_last = progress_start;
+    for (;;)
+    {
+        int64_t rt0 = esp_timer_get_time();
+        sdcard_io_begin(SDCARD_IO_STREAM);
+        n = fread(buf, 1, buf_size, fp);
+        sdcard_io_end();
+        int64_t rt1 = esp_timer_get_time();
+        read_us += (uint64_t)(rt1 - rt0);
+        if (n == 0)
+        {
+            break;
+        }
+        esp_err_t send_err = ESP_OK;
+        if (gz)
+        {
+            bool ok = gzip_writer_write(gz, (const uint8_t *)buf, n);
+            deflate_us += esp_timer_get_time() - rt1;
+            send_err = ok ? ESP_OK : gz_ctx.send_err != ESP_OK ? gz_ctx.send_err : ESP_FAIL;
+        }
+        else
+        {
+            send_err = httpd_resp_send_chunk(req, buf, n);
+            gz_ctx.wire_bytes += n;
+        }
+        send_us += (uint64_t)(esp_timer_get_time() - rt1);
+        if (send_err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "download send failed: %s", esp_err_to_name(send_err));
+#if WEBFS_DOWNLOAD_METRICS
+            send_fail++;
+#endif
+            sent_ok = false;
+            break;
+        }
+#if WEBFS_METRICS
+        bytes_sent += n;
+        int64_t now_us = esp_timer_get_time();
+        if (now_us - last_log >= 1000000)
+        {
+            double elapsed_s = (double)(now_us - start_us) / 1e6;
+            double avg_kbps = elapsed_s > 0.0 ? (double)bytes_sent / 1024.0 / elapsed_s : 0.0;
+            ESP_LOGI(TAG, "download stats: bytes=%llu wire=%llu avg=%.1f KB/s fail=%u",
+                     (unsigned long long)bytes_sent, (unsigned long long)gz_ctx.wire_bytes, avg_kbps,
+                     (unsigned)send_fail);
+            last_log = now_us;
+        }
+#endif
+        chunk_count++;
+        progress_bytes += n;
+        int64_t progress_now = esp_timer_get_time();
+        if (progress_now - progress_last >= UPLOAD_LOG_INTERVAL_US)
+        {
+            double kbps = (double)progress_bytes / 1024.0 / ((double)(progress_now - progress_start) / 1e6);
+            publish_progress("download", rel_path, progress_bytes, progress_total, kbps, false);
+            progress_last = progress_now;
+        }
+    }
+    if (gz && sent_ok)
+    {
+        int64_t t0 = esp_timer_get_time();
+        sent_ok = gzip_writer_finish(gz);
+        deflate_us += esp_timer_get_time() - t0;
+    }
+    fclose(fp);
+    upload_free_buf(buf);
+    heap_caps_free(size_hdr);
+    bool gz_teed = gz_ctx.sidecar != NULL;
+    if (gz)
+    {
+        gz_cache_commit(rel_path, gz_ctx.sidecar, sent_ok && !gz_ctx.sidecar_failed);
+        gzip_writer_destroy(gz);
+        // Socket time spent inside the sink is not compression work.
+        deflate_us -= gz_ctx.sink_us;
+    }
+    download_stats_account(progress_bytes, read_us, send_us, progress_start, sent_ok);
+    if (!sent_ok)
+    {
+        goto cleanup;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    int64_t progress_us = esp_timer_get_time() - progress_start;
+    publish_progress("download", rel_path, progress_bytes, progress_total,
+                     progress_us > 0 ? (double)progress_bytes / 1024.0 / ((double)progress_us / 1e6) : 0.0, true);
+    if (gz_encode)
+    {
+        download_gzip_account(gz_cached, (uint64_t)st.st_size, gz_ctx.wire_bytes, deflate_us);
+        ESP_LOGI(TAG, "download %s: gzip %s plain=%lld wire=%llu ratio=%.2f deflate=%lld ms (%.0f%% of %lld ms)",
+                 rel_path, gz_cached ? "sidecar" : gz_teed ? "live+sidecar" : "live", (long long)st.st_size,
+                 (unsigned long long)gz_ctx.wire_bytes,
+                 gz_ctx.wire_bytes > 0 ? (double)st.st_size / (double)gz_ctx.wire_bytes : 0.0,
+                 (long long)(deflate_us / 1000), progress_us > 0 ? 100.0 * (double)deflate_us / (double)progress_us : 0.0,
+                 (long long)(progress_us / 1000));
+    }
+    fileop_unlock();
+    return ESP_OK;
+
+cleanup:
+    fileop_unlock();
+    return ESP_OK;
+}
+
+// Gate and lock for web_fs_stream_*: fs_gate() and fileop_try_lock() with
+// the error returned instead of sent.
+static int stream_lock(const char **err)
+{
+    if (msc_get_state() == MSC_STATE_USB_ATTACHED)
+    {
+        *err = "BUSY";
+        return 423;
+    }
+    if (!sdcard_is_mounted())
+    {
+        *err = "NOT_MOUNTED";
+        return 409;
+    }
+    if (!s_fileop_mutex)
+    {
+        s_fileop_mutex = xSemaphoreCreateMutex();
+        if (!s_fileop_mutex)
+        {
+            *err = "NO_MEM";
+            return 500;
+        }
+    }
+    if (!stripe_quiesce(STRIPE_QUIESCE_MS) || xSemaphoreTake(s_fileop_mutex, 0) != pdTRUE)
+    {
+        *err = "FILEOP_IN_PROGRESS";
+        return 423;
+    }
+    return 200;
+}
+
+int web_fs_stream_put(const char *path, uint64_t size, bool overwrite, uint64_t mtime_ms,
+                      const web_fs_stream_t *io, uint8_t digest[32], const char **err)
+{
+    int status = stream_lock(err);
+    if (status != 200)
+    {
+        return status;
+    }
+
+    upload_ctx_t ctx = {0};
+    ctx.mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    ctx.start_us = esp_timer_get_time();
+    ctx.last_log_us = ctx.start_us;
+    ctx.hash = true;
+    FILE *fp = NULL;
+    bool ctx_started = false;
+    bool finished = false;
+    bool replaced = false;
+    char rel_file[MAX_PATH_LEN] = {0};
+    char tmp_path[MAX_PATH_LEN] = {0};
+    ctx.label = rel_file;
+    ctx.total = size;
+
+    uint8_t *recv_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
+    char rel_dir[MAX_PATH_LEN];
+    char name[MAX_PATH_LEN];
+    char clean_name[MAX_NAME_LEN];
+    char full_path[MAX_PATH_LEN];
+    struct stat st;
+    if (!recv_buf)
+    {
+        *err = "NO_MEM";
+        status = 500;
+        goto cleanup;
+    }
+    if (!normalize_path(path, rel_file, sizeof(rel_file)) ||
+        !split_rel_path(rel_file, rel_dir, sizeof(rel_dir), name, sizeof(name)) ||
+        !sanitize_name(name, clean_name, sizeof(clean_name)))
+    {
+        rel_file[0] = '\0';
+        *err = "BAD_PATH";
+        status = 400;
+        goto cleanup;
+    }
+    if (!build_fs_path(rel_file, full_path, sizeof(full_path)))
+    {
+        *err = "PATH_FAIL";
+        status = 500;
+        goto cleanup;
+    }
+    if (stat(full_path, &st) == 0)
+    {
+        if (S_ISDIR(st.st_mode))
+        {
+            *err = "IS_DIRECTORY";
+            status = 409;
+            goto cleanup;
+        }
+        if (!overwrite)
+        {
+            *err = "FILE_EXISTS";
+            status = 409;
+            goto cleanup;
+        }
+        if (unlink(full_path) != 0)
+        {
+            *err = "DELETE_FAIL";
+            status = 500;
+            goto cleanup;
+        }
+        replaced = true;
+    }
+    if (!build_suffix_path(full_path, ".part", tmp_path, sizeof(tmp_path)))
+    {
+        *err = "PATH_TOO_LONG";
+        status = 400;
+        goto cleanup;
+    }
+    unlink(tmp_path);
+    fp = fopen(tmp_path, "wb");
+    if (!fp)
+    {
+        *err = "OPEN_FAIL";
+        status = 500;
+        goto cleanup;
+    }
+    upload_file_set_buffer(fp);
+    ctx.analyse = gcode_meta_is_gcode(clean_name);
+    if (!upload_ctx_start(&ctx, fp, NULL))
+    {
+        *err = "NO_MEM";
+        status = 500;
+        goto cleanup;
+    }
+    ctx_started = true;
+    if (!io->begin(io->ctx, size))
+    {
+        *err = "SEND_FAIL";
+        status = 400;
+        goto cleanup;
+    }
+
+    uint64_t remaining = size;
+    while (remaining > 0)
+    {
+        size_t to_read = remaining > UPLOAD_RECV_BUF_SIZE ? UPLOAD_RECV_BUF_SIZE : (size_t)remaining;
+        int64_t t0 = esp_timer_get_time();
+        int r = io->recv(io->ctx, recv_buf, to_read);
+        int64_t t1 = esp_timer_get_time();
+        if (r <= 0)
+        {
+            *err = "RECV_FAIL";
+            status = 400;
+            goto cleanup;
+        }
+        remaining -= (uint64_t)r;
+        upload_stats_add_recv(&ctx, (uint32_t)r, (uint64_t)(t1 - t0));
+        upload_stats_log(&ctx, t1, false);
+        if (!upload_ringbuf_send(&ctx, recv_buf, (size_t)r))
+        {
+            *err = "WRITE_FAIL";
+            status = 500;
+            goto cleanup;
+        }
+    }
+
+    finished = true;
+    esp_err_t result = upload_ctx_finish(&ctx);
+    upload_stats_log(&ctx, esp_timer_get_time(), true);
+    if (result != ESP_OK)
+    {
+        *err = "WRITE_FAIL";
+        status = 500;
+        goto cleanup;
+    }
+    if (rename(tmp_path, full_path) != 0)
+    {
+        *err = "RENAME_FAIL";
+        status = 500;
+        goto cleanup;
+    }
+    tmp_path[0] = '\0';
+    apply_mtime_if_needed(full_path, mtime_ms);
+    char hex[HASH_INDEX_HEX_LEN];
+    hash_index_to_hex(ctx.digest, hex);
+    index_file_hash(rel_dir, clean_name, full_path, hex);
+    index_file_meta(rel_file, full_path, &ctx);
+    memcpy(digest, ctx.digest, sizeof(ctx.digest));
+    status = 200;
+
+cleanup:
+    if (ctx_started && !finished)
+    {
+        upload_ctx_finish(&ctx);
+    }
+    else if (!ctx_started && fp)
+    {
+        fclose(fp);
+    }
+    gcode_analyzer_destroy(ctx.gcode);
+    if (tmp_path[0])
+    {
+        unlink(tmp_path);
+    }
+    if (status == 200)
+    {
+        note_change(replaced ? FS_JOURNAL_MODIFY : FS_JOURNAL_CREATE, rel_file, NULL, false);
+    }
+    else if (replaced)
+    {
+        note_change(FS_JOURNAL_DELETE, rel_file, NULL, false);
+    }
+    else if (tmp_path[0])
+    {
+        note_parent_changed(rel_file);
+    }
+    upload_free_buf(recv_buf);
+    fileop_unlock();
+    return status;
+}
+
+int web_fs_stream_get(const char *path, const web_fs_stream_t *io, uint64_t *sent, const char **err)
+{
+    *sent = 0;
+    int status = stream_lock(err);
+    if (status != 200)
+    {
+        return status;
+    }
+    char rel_path[MAX_PATH_LEN];
+    char full_path[MAX_PATH_LEN];
+    struct stat st;
+    FILE *fp = NULL;
+    size_t buf_size = 0;
+    char *buf = NULL;
+    int64_t start_us = 0;
+    uint64_t read_us = 0;
+    uint64_t send_us = 0;
+    if (!normalize_path(path, rel_path, sizeof(rel_path)) || strcmp(rel_path, "/") == 0)
+    {
+        *err = "BAD_PATH";
+        status = 400;
+        goto cleanup;
+    }
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    {
+        *err = "PATH_FAIL";
+        status = 500;
+        goto cleanup;
+    }
+    if (stat(full_path, &st) != 0)
+    {
+        *err = "NOT_FOUND";
+        status = 404;
+        goto cleanup;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        *err = "IS_DIRECTORY";
+        status = 400;
+        goto cleanup;
+    }
+    fp = fopen(full_path, "rb");
+    if (!fp)
+    {
+        *err = "OPEN_FAIL";
+        status = 500;
+        goto cleanup;
+    }
+    buf = download_alloc_buf(&buf_size);
+    if (!buf)
+    {
+        *err = "NO_MEM";
+        status = 500;
+        goto cleanup;
+    }
+    if (!io->begin(io->ctx, (uint64_t)st.st_size))
+    {
+        *err = "SEND_FAIL";
+        status = 400;
+        goto cleanup;
+    }
+
+    // The size was announced up front: a file that changes underneath is cut
+    // or fails rather than desynchronising the stream.
+    uint64_t remaining = (uint64_t)st.st_size;
+    start_us = esp_timer_get_time();
+    int64_t last_us = start_us;
+    while (remaining > 0)
+    {
+        size_t want = remaining > buf_size ? buf_size : (size_t)remaining;
+        int64_t rt0 = esp_timer_get_time();
+        sdcard_io_begin(SDCARD_IO_STREAM);
+        size_t n = fread(buf, 1, want, fp);
+        sdcard_io_end();
+        int64_t rt1 = esp_timer_get_time();
+        read_us += (uint64_t)(rt1 - rt0);
+        if (n == 0)
+        {
+            *err = "READ_FAIL";
+            status = 500;
+            goto cleanup;
+        }
+        bool sent_ok = io->send(io->ctx, (const uint8_t *)buf, n);
+        send_us += (uint64_t)(esp_timer_get_time() - rt1);
+        if (!sent_ok)
+        {
+            *err = "SEND_FAIL";
+            status = 400;
+            goto cleanup;
+        }
+        remaining -= n;
+        *sent += n;
+        int64_t now_us = esp_timer_get_time();
+        if (now_us - last_us >= UPLOAD_LOG_INTERVAL_US)
+        {
+            publish_progress("download", rel_path, *sent, (uint64_t)st.st_size,
+                             (double)*sent / 1024.0 / ((double)(now_us - start_us) / 1e6), false);
+            last_us = now_us;
+        }
+    }
+    int64_t dur_us = esp_timer_get_time() - start_us;
+    double kbps = dur_us > 0 ? (double)*sent / 1024.0 / ((double)dur_us / 1e6) : 0.0;
+    publish_progress("download", rel_path, *sent, (uint64_t)st.st_size, kbps, true);
+    ESP_LOGI(TAG, "stream get %s: %llu bytes in %lld ms (%.1f KB/s)", rel_path, (unsigned long long)*sent,
+             (long long)(dur_us / 1000), kbps);
+    status = 200;
+
+cleanup:
+    if (start_us != 0)
+    {
+        download_stats_account(*sent, read_us, send_us, start_us, status == 200);
+    }
+    if (fp)
+    {
+        fclose(fp);
+    }
+    upload_free_buf(buf);
+    fileop_unlock();
+    return status;
+}
+
+// Directory archives are produced by a reader task that walks the tree and
+// pushes headers and file data into a ring buffer; the httpd task only
+// drains it to the socket, so card reads overlap the Wi-Fi sends the same
+// way the upload writer does in the other direction.
+typedef struct
+{
+    RingbufHandle_t rb;
+    SemaphoreHandle_t done_sem;
+    volatile bool abort;
+    volatile bool done;
+    esp_err_t result;
+    zip_writer_t *zip;
+    char rel_root[MAX_PATH_LEN];
+    char root_full[MAX_PATH_LEN];
+    char prefix[MAX_NAME_LEN];
+    uint8_t *buf;
+    size_t buf_size;
+    uint64_t offset;
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t skipped;
+} archive_ctx_t;
+
+static const uint8_t k_zero_block[TAR_BLOCK_SIZE] = {0};
+
+static bool archive_emit(archive_ctx_t *ac, const void *data, size_t len)
+{
+    while (!ac->abort)
+    {
+        TRACE_BEGIN(TRACE_RB_SEND, len);
+        BaseType_t sent = xRingbufferSend(ac->rb, data, len, pdMS_TO_TICKS(ARCHIVE_SEND_WAIT_MS));
+        TRACE_END(TRACE_RB_SEND, len);
+        if (sent == pdTRUE)
+        {
+            ac->offset += len;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool archive_add(const fs_manifest_entry_t *entry, void *arg)
+{
+    archive_ctx_t *ac = (archive_ctx_t *)arg;
+    char name[TAR_PATH_LEN];
+    int n = ac->prefix[0] ? snprintf(name, sizeof(name), "%s/%s", ac->prefix, entry->path)
+                          : snprintf(name, sizeof(name), "%s", entry->path);
+    if (n <= 0 || (size_t)n >= sizeof(name))
+    {
+        ac->skipped++;
+        return !ac->abort;
+    }
+    FILE *fp = NULL;
+    if (!entry->is_dir)
+    {
+        char full_path[MAX_PATH_LEN + TAR_PATH_LEN];
+        snprintf(full_path, sizeof(full_path), "%s/%s", ac->root_full, entry->path);
+        fp = fopen(full_path, "rb");
+        if (!fp)
+        {
+            ac->skipped++;
+            return !ac->abort;
+        }
+    }
+
+    uint8_t header[TAR_HEADER_MAX];
+    size_t header_len = ac->zip ? zip_writer_begin(ac->zip, header, name, entry->is_dir, entry->size, entry->mtime,
+                                                   ac->offset)
+                                : tar_write_header(header, name, entry->size, entry->mtime, entry->is_dir);
+    if (header_len == 0)
+    {
+        if (fp)
+        {
+            fclose(fp);
+        }
+        ac->skipped++;
+        return !ac->abort;
+    }
+    if (!archive_emit(ac, header, header_len))
+    {
+        if (fp)
+        {
+            fclose(fp);
+        }
+        return false;
+    }
+    if (entry->is_dir)
+    {
+        ac->dirs++;
+        return true;
+    }
+
+    uint64_t remaining = entry->size;
+    uint32_t crc = 0;
+    bool ok = true;
+    while (remaining > 0 && ok)
+    {
+        size_t want = remaining > ac->buf_size ? ac->buf_size : (size_t)remaining;
+        sdcard_io_begin(SDCARD_IO_STREAM);
+        size_t got = fread(ac->buf, 1, want, fp);
+        sdcard_io_end();
+        if (got < want)
+        {
+            // The header already promised entry->size bytes.
+            memset(ac->buf + got, 0, want - got);
+            ac->result = ESP_ERR_INVALID_SIZE;
+            ESP_LOGW(TAG, "archive: short read on %s", name);
+        }
+        if (ac->zip)
+        {
+            crc = esp_rom_crc32_le(crc, ac->buf, (uint32_t)want);
+        }
+        ok = archive_emit(ac, ac->buf, want);
+        remaining -= want;
+    }
+    fclose(fp);
+    if (!ok)
+    {
+        return false;
+    }
+    if (ac->zip)
+    {
+        size_t len = zip_writer_end(ac->zip, header, crc);
+        ok = archive_emit(ac, header, len);
+    }
+    else
+    {
+        uint64_t pad = tar_padding(entry->size);
+        ok = pad == 0 || archive_emit(ac, k_zero_block, (size_t)pad);
+    }
+    ac->files++;
+    return ok && ac->result == ESP_OK;
+}
+
+static void archive_reader_task(void *arg)
+{
+    archive_ctx_t *ac = (archive_ctx_t *)arg;
+    esp_err_t err = fs_manifest_walk(ac->rel_root, false, archive_add, ac);
+    if (err == ESP_OK && ac->zip)
+    {
+        uint64_t cd_offset = ac->offset;
+        uint8_t record[ZIP_CENTRAL_MAX];
+        uint32_t count = zip_writer_count(ac->zip);
+        for (uint32_t i = 0; i < count && err == ESP_OK; ++i)
+        {
+            size_t len = zip_writer_central(ac->zip, i, record);
+            if (!archive_emit(ac, record, len))
+            {
+                err = ESP_FAIL;
+            }
+        }
+        size_t len = zip_writer_finish(ac->zip, record, cd_offset, ac->offset - cd_offset);
+        if (err == ESP_OK && !archive_emit(ac, record, len))
+        {
+            err = ESP_FAIL;
+        }
+    }
+    else if (err == ESP_OK)
+    {
+        if (!archive_emit(ac, k_zero_block, TAR_BLOCK_SIZE) || !archive_emit(ac, k_zero_block, TAR_BLOCK_SIZE))
+        {
+            err = ESP_FAIL;
+        }
+    }
+    if (ac->result == ESP_OK)
+    {
+        ac->result = err;
+    }
+    ac->done = true;
+    xSemaphoreGive(ac->done_sem);
+    vTaskDelete(NULL);
+}
+
+// GET /api/fs/archive?path=/dir[&format=tar|zip]: the whole subtree as one
+// tar (default) or stored zip, streamed straight from the card. Nothing is
+// staged; a zip only keeps its central directory records in PSRAM.
+static esp_err_t http_fs_archive(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        return ESP_OK;
+    }
+    esp_err_t ret = ESP_OK;
+    archive_ctx_t *ac = heap_caps_calloc(1, sizeof(*ac), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!ac)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+    if (!get_query_path(req, ac->rel_root, sizeof(ac->rel_root)) ||
+        !build_fs_path(ac->rel_root, ac->root_full, sizeof(ac->root_full)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        goto cleanup;
+    }
+    struct stat st;
+    if (stat(ac->root_full, &st) != 0)
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        goto cleanup;
+    }
+    if (!S_ISDIR(st.st_mode))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"NOT_A_DIRECTORY\"}");
+        goto cleanup;
+    }
+    char format[8] = "tar";
+    get_query_value(req, "format", format, sizeof(format));
+    bool zip = strcmp(format, "zip") == 0;
+    if (!zip && strcmp(format, "tar") != 0)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_FORMAT\"}");
+        goto cleanup;
+    }
+
+    const char *base = strrchr(ac->rel_root, '/');
+    snprintf(ac->prefix, sizeof(ac->prefix), "%s", (base && base[1]) ? base + 1 : "");
+    ac->result = ESP_OK;
+    ac->buf = (uint8_t *)download_alloc_buf(&ac->buf_size);
+    ac->rb = upload_ringbuf_create(NULL);
+    ac->done_sem = xSemaphoreCreateBinary();
+    ac->zip = zip ? zip_writer_create() : NULL;
+    if (!ac->buf || !ac->rb || !ac->done_sem || (zip && !ac->zip))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+
+    char disposition[MAX_NAME_LEN + 48];
+    snprintf(disposition, sizeof(disposition), "attachment; filename=\"%s.%s\"",
+             ac->prefix[0] ? ac->prefix : "sdcard", zip ? "zip" : "tar");
+    httpd_resp_set_type(req, zip ? "application/zip" : "application/x-tar");
+    httpd_resp_set_hdr(req, "Content-Disposition", disposition);
+
+    int64_t start_us = esp_timer_get_time();
+    if (xTaskCreate(archive_reader_task, "archive_reader", ARCHIVE_READER_STACK, ac, ARCHIVE_READER_PRIO, NULL) !=
+        pdPASS)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+    uint64_t sent = 0;
+    while (true)
+    {
+        size_t len = 0;
+        TRACE_BEGIN(TRACE_RB_RECV, 0);
+        uint8_t *item = (uint8_t *)xRingbufferReceiveUpTo(ac->rb, &len, pdMS_TO_TICKS(ARCHIVE_SEND_WAIT_MS),
+                                                           DOWNLOAD_BUF_SIZE);
+        TRACE_END(TRACE_RB_RECV, len);
+        if (!item)
+        {
+            if (!ac->done)
+            {
+                continue;
+            }
+            // The reader may have queued its last bytes just before finishing.
+            item = (uint8_t *)xRingbufferReceiveUpTo(ac->rb, &len, 0, DOWNLOAD_BUF_SIZE);
+            if (!item)
+            {
+                break;
+            }
+        }
+        esp_err_t send_err = httpd_resp_send_chunk(req, (const char *)item, len);
+        vRingbufferReturnItem(ac->rb, item);
+        if (send_err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "archive send failed: %s", esp_err_to_name(send_err));
+            ac->abort = true;
+            break;
+        }
+        sent += len;
+    }
+    xSemaphoreTake(ac->done_sem, portMAX_DELAY);
+
+    int64_t dur_us = esp_timer_get_time() - start_us;
+    ESP_LOGI(TAG, "archive %s (%s): files=%u dirs=%u skipped=%u bytes=%llu %.1f KB/s result=%s", ac->rel_root,
+             format, (unsigned)ac->files, (unsigned)ac->dirs, (unsigned)ac->skipped, (unsigned long long)sent,
+             dur_us > 0 ? (double)sent / 1024.0 / ((double)dur_us / 1e6) : 0.0,
+             ac->abort ? "ABORTED" : esp_err_to_name(ac->result));
+    if (!ac->abort && ac->result == ESP_OK)
+    {
+        httpd_resp_send_chunk(req, NULL, 0);
+    }
+    else
+    {
+        // Leave the chunked body unterminated so the client sees a broken
+        // transfer instead of a silently short archive.
+        ret = ESP_FAIL;
+    }
+
+cleanup:
+    if (ac)
+    {
+        if (ac->rb)
+        {
+            vRingbufferDelete(ac->rb);
+        }
+        if (ac->done_sem)
+        {
+            vSemaphoreDelete(ac->done_sem);
+        }
+        zip_writer_destroy(ac->zip);
+        upload_free_buf(ac->buf);
+        heap_caps_free(ac);
+    }
+    fileop_unlock();
+    return ret;
+}
+
+static esp_err_t http_fs_mkdir(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    char body[MAX_BODY_LEN];
+    if (!read_body(req, body, sizeof(body)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_BODY\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char path_raw[MAX_PATH_LEN] = "/";
+    char name_raw[MAX_NAME_LEN] = {0};
+    json_get_string(body, "path", path_raw, sizeof(path_raw));
+    if (!json_get_string(body, "name", name_raw, sizeof(name_raw)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"NAME_REQUIRED\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char rel_dir[MAX_PATH_LEN];
+    if (!normalize_path(path_raw, rel_dir, sizeof(rel_dir)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char name[MAX_NAME_LEN];
+    if (!sanitize_name(name_raw, name, sizeof(name)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_NAME\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char rel_path[MAX_PATH_LEN];
+    if (!build_rel_child(rel_dir, name, rel_path, sizeof(rel_path)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char full_path[MAX_PATH_LEN];
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    int rc = mkdir(full_path, 0775) == 0 ? 0 : errno;
+    sdcard_io_end();
+    if (rc != 0)
+    {
+        if (rc == EEXIST)
+        {
+            send_json_error(req, "409 Conflict", "{\"error\":\"FILE_EXISTS\"}");
+        }
+        else
+        {
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"MKDIR_FAIL\"}");
+        }
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    note_change(FS_JOURNAL_CREATE, rel_path, NULL, true);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+static esp_err_t http_fs_delete(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    char body[MAX_BODY_LEN];
+    if (!read_body(req, body, sizeof(body)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_BODY\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char path_raw[MAX_PATH_LEN] = {0};
+    if (!json_get_string(body, "path", path_raw, sizeof(path_raw)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_REQUIRED\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char rel_path[MAX_PATH_LEN];
+    if (!normalize_path(path_raw, rel_path, sizeof(rel_path)) || strcmp(rel_path, "/") == 0)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char full_path[MAX_PATH_LEN];
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    struct stat st;
+    if (stat(full_path, &st) != 0)
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"IS_DIRECTORY\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    int rc = unlink(full_path);
+    sdcard_io_end();
+    if (rc != 0)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"DELETE_FAIL\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    char dir_path[MAX_PATH_LEN];
+    char name[MAX_PATH_LEN];
+    if (split_rel_path(rel_path, dir_path, sizeof(dir_path), name, sizeof(name)))
+    {
+        hash_index_remove(dir_path, name);
+    }
+    note_change(FS_JOURNAL_DELETE, rel_path, NULL, false);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+static esp_err_t http_fs_rename(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    char body[MAX_BODY_LEN];
+    if (!read_body(req, body, sizeof(body)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_BODY\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char path_raw[MAX_PATH_LEN] = {0};
+    char new_raw[MAX_NAME_LEN] = {0};
+    if (!json_get_string(body, "path", path_raw, sizeof(path_raw)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_REQUIRED\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    if (!json_get_string(body, "new_name", new_raw, sizeof(new_raw)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"NEW_NAME_REQUIRED\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char rel_old[MAX_PATH_LEN];
+    if (!normalize_path(path_raw, rel_old, sizeof(rel_old)) || strcmp(rel_old, "/") == 0)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char new_name[MAX_NAME_LEN];
+    if (!sanitize_name(new_raw, new_name, sizeof(new_name)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_NAME\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char dir_path[MAX_PATH_LEN];
+    char old_name[MAX_PATH_LEN];
+    if (!split_rel_path(rel_old, dir_path, sizeof(dir_path), old_name, sizeof(old_name)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char rel_new[MAX_PATH_LEN];
+    if (!build_rel_child(dir_path, new_name, rel_new, sizeof(rel_new)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    char full_old[MAX_PATH_LEN];
+    char full_new[MAX_PATH_LEN];
+    if (!build_fs_path(rel_old, full_old, sizeof(full_old)) ||
+        !build_fs_path(rel_new, full_new, sizeof(full_new)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    struct stat st;
+    if (stat(full_old, &st) != 0)
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    bool is_dir = S_ISDIR(st.st_mode);
+    if (stat(full_new, &st) == 0)
+    {
+        send_json_error(req, "409 Conflict", "{\"error\":\"FILE_EXISTS\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    int rc = rename(full_old, full_new);
+    sdcard_io_end();
+    if (rc != 0)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"RENAME_FAIL\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    if (is_dir)
+    {
+        // Indexes are keyed by directory path; the renamed one just gets
+        // rebuilt lazily under its new name. Listings below the old path
+        // cannot be found one by one, so all of them go.
+        hash_index_drop_dir(rel_old);
+        dir_index_invalidate_all();
+    }
+    else
+    {
+        hash_index_rename(dir_path, old_name, new_name);
+    }
+    note_change(FS_JOURNAL_RENAME, rel_old, rel_new, is_dir);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+// GET /api/fs/signature?path=/dir/file[&block=N]: block signatures of an
+// existing file for delta uploads (format in delta_sync.h).
+static esp_err_t http_fs_signature(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    char rel_path[MAX_PATH_LEN];
+    char full_path[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_path, sizeof(rel_path)) || strcmp(rel_path, "/") == 0)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        return ESP_OK;
+    }
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        return ESP_OK;
+    }
+    uint64_t requested = 0;
+    get_query_u64(req, "block", &requested);
+    if (!fileop_try_lock(req))
+    {
+        return ESP_OK;
+    }
+
+    struct stat st;
+    if (stat(full_path, &st) != 0 || S_ISDIR(st.st_mode))
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    uint32_t block = delta_block_size(size, requested > DELTA_BLOCK_MAX ? DELTA_BLOCK_MAX : (uint32_t)requested);
+    uint32_t count = (uint32_t)((size + block - 1) / block);
+
+    FILE *fp = fopen(full_path, "rb");
+    if (!fp)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+    uint8_t *buf = upload_alloc_buf(DELTA_BLOCK_MAX);
+    if (!buf)
+    {
+        fclose(fp);
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        fileop_unlock();
+        return ESP_OK;
+    }
+
+    uint8_t header[DELTA_SIG_HEADER_LEN];
+    delta_put_u32(header, DELTA_SIG_MAGIC);
+    delta_put_u32(header + 4, block);
+    delta_put_u64(header + 8, size);
+    delta_put_u32(header + 16, count);
+    delta_put_u32(header + 20, DELTA_STRONG_LEN);
+    delta_put_u64(header + 24, (uint64_t)(int64_t)st.st_mtime);
+    httpd_resp_set_type(req, "application/octet-stream");
+    esp_err_t err = httpd_resp_send_chunk(req, (const char *)header, sizeof(header));
+
+    uint8_t out[DELTA_SIG_ENTRY_LEN * 64];
+    size_t out_len = 0;
+    for (uint32_t i = 0; i < count && err == ESP_OK; ++i)
+    {
+        sdcard_io_begin(SDCARD_IO_STREAM);
+        size_t n = fread(buf, 1, block, fp);
+        sdcard_io_end();
+        if (n == 0)
+        {
+            // Short stream; the client checks the entry count from the header.
+            break;
+        }
+        delta_put_u32(out + out_len, delta_weak_checksum(buf, n));
+        delta_strong_hash(buf, n, out + out_len + 4);
+        out_len += DELTA_SIG_ENTRY_LEN;
+        if (out_len == sizeof(out) || i + 1 == count)
+        {
+            err = httpd_resp_send_chunk(req, (const char *)out, out_len);
+            out_len = 0;
+        }
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    fclose(fp);
+    upload_free_buf(buf);
+    ESP_LOGI(TAG, "signature %s: size=%llu block=%u count=%u", rel_path, (unsigned long long)size,
+             (unsigned)block, (unsigned)count);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+// POST /api/fs/delta?path=/dir/file[&mtime=ms][&sha256=hex]: rebuilds the
+// file from its current version plus the client's copy/literal ops. The
+// result goes through the normal writer pipeline into .part and replaces the
+// old file only once the stream ended cleanly (and the hash matched).
+static esp_err_t http_fs_delta(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    upload_ctx_t ctx = {0};
+    ctx.mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    ctx.start_us = esp_timer_get_time();
+    ctx.last_log_us = ctx.start_us;
+    ctx.hash = true;
+    FILE *fp = NULL;
+    FILE *base = NULL;
+    bool ctx_started = false;
+    bool upload_ok = false;
+    bool keep_part = false;
+    char tmp_path[MAX_PATH_LEN] = {0};
+    uint64_t copied = 0;
+    uint64_t literal = 0;
+    uint32_t ops = 0;
+
+    uint8_t *recv_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
+    uint8_t *copy_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
+    if (!recv_buf || !copy_buf)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+
+    char rel_path[MAX_PATH_LEN];
+    char dir_path[MAX_PATH_LEN];
+    char name[MAX_PATH_LEN];
+    char full_path[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_path, sizeof(rel_path)) ||
+        !split_rel_path(rel_path, dir_path, sizeof(dir_path), name, sizeof(name)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        goto cleanup;
+    }
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)) ||
+        !build_suffix_path(full_path, ".part", tmp_path, sizeof(tmp_path)))
+    {
+        tmp_path[0] = '\0';
+        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
+        goto cleanup;
+    }
+    struct stat st;
+    if (stat(full_path, &st) != 0 || S_ISDIR(st.st_mode))
+    {
+        tmp_path[0] = '\0';
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        goto cleanup;
+    }
+    uint64_t mtime_ms = 0;
+    get_query_u64(req, "mtime", &mtime_ms);
+    char want[HASH_INDEX_HEX_LEN + 2] = {0};
+    get_query_value(req, "sha256", want, sizeof(want));
+    ctx.label = rel_path;
+    ctx.total = req->content_len;
+
+    body_reader_t rd = {
+        .req = req,
+        .buf = recv_buf,
+        .cap = UPLOAD_RECV_BUF_SIZE,
+        .remaining = req->content_len,
+    };
+    uint8_t header[DELTA_BODY_HEADER_LEN];
+    if (!body_reader_read(&rd, header, sizeof(header)) || delta_get_u32(header) != DELTA_BODY_MAGIC)
+    {
+        tmp_path[0] = '\0';
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_DELTA\"}");
+        goto cleanup;
+    }
+    uint32_t block = delta_get_u32(header + 4);
+    uint64_t base_size = delta_get_u64(header + 8);
+    int64_t base_mtime = (int64_t)delta_get_u64(header + 16);
+    if (block < DELTA_BLOCK_MIN || block > DELTA_BLOCK_MAX)
+    {
+        tmp_path[0] = '\0';
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_DELTA\"}");
+        goto cleanup;
+    }
+    if (base_size > (uint64_t)LONG_MAX)
+    {
+        // Copy ops fseek() into the base, and stdio positions are a long.
+        tmp_path[0] = '\0';
+        send_json_error(req, "413 Payload Too Large", "{\"error\":\"FILE_TOO_LARGE\"}");
+        goto cleanup;
+    }
+    if (base_size != (uint64_t)st.st_size || base_mtime != (int64_t)st.st_mtime)
+    {
+        // The signature the client matched against is no longer current:
+        // a same-size rewrite is caught by the mtime.
+        tmp_path[0] = '\0';
+        send_json_error(req, "409 Conflict", "{\"error\":\"BASE_CHANGED\"}");
+        goto cleanup;
+    }
+
+    base = fopen(full_path, "rb");
+    unlink(tmp_path);
+    fp = base ? fopen(tmp_path, "wb") : NULL;
+    if (!fp)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"OPEN_FAIL\"}");
+        goto cleanup;
+    }
+    upload_file_set_buffer(fp);
+    ctx.analyse = gcode_meta_is_gcode(rel_path);
+    if (!upload_ctx_start(&ctx, fp, NULL))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+    ctx_started = true;
+    fp = NULL;
+
+    bool ended = false;
+    while (!ended)
+    {
+        uint8_t op = 0;
+        uint8_t args[8];
+        if (!body_reader_read(&rd, &op, 1))
+        {
+            send_json_error(req, "400 Bad Request", "{\"error\":\"RECV_FAIL\"}");
+            goto cleanup;
+        }
+        ops++;
+        if (op == DELTA_OP_COPY)
+        {
+            if (!body_reader_read(&rd, args, 8))
+            {
+                send_json_error(req, "400 Bad Request", "{\"error\":\"RECV_FAIL\"}");
+                goto cleanup;
+            }
+            uint64_t start = (uint64_t)delta_get_u32(args) * block;
+            uint64_t len = (uint64_t)delta_get_u32(args + 4) * block;
+            if (len == 0 || start >= base_size)
+            {
+                send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_COPY\"}");
+                goto cleanup;
+            }
+            if (start + len > base_size)
+            {
+                len = base_size - start;
+            }
+            if (fseek(base, (long)start, SEEK_SET) != 0)
+            {
+                send_json_error(req, "500 Internal Server Error", "{\"error\":\"READ_FAIL\"}");
+                goto cleanup;
+            }
+            while (len > 0)
+            {
+                size_t k = len > UPLOAD_RECV_BUF_SIZE ? UPLOAD_RECV_BUF_SIZE : (size_t)len;
+                sdcard_io_begin(SDCARD_IO_STREAM);
+                size_t got = fread(copy_buf, 1, k, base);
+                sdcard_io_end();
+                if (got != k)
+                {
+                    send_json_error(req, "500 Internal Server Error", "{\"error\":\"READ_FAIL\"}");
+                    goto cleanup;
+                }
+                if (!upload_ringbuf_send(&ctx, copy_buf, k))
+                {
+                    send_json_error(req, "500 Internal Server Error", "{\"error\":\"WRITE_FAIL\"}");
+                    goto cleanup;
+                }
+                len -= k;
+                copied += k;
+            }
+        }
+        else if (op == DELTA_OP_LITERAL)
+        {
+            if (!body_reader_read(&rd, args, 4))
+            {
+                send_json_error(req, "400 Bad Request", "{\"error\":\"RECV_FAIL\"}");
+                goto cleanup;
+            }
+            uint32_t len = delta_get_u32(args);
+            while (len > 0)
+            {
+                if (!body_reader_fill(&rd))
+                {
+                    send_json_error(req, "400 Bad Request", "{\"error\":\"RECV_FAIL\"}");
+                    goto cleanup;
+                }
+                size_t k = rd.len - rd.pos;
+                if (k > len)
+                {
+                    k = len;
+                }
+                if (!upload_ringbuf_send(&ctx, rd.buf + rd.pos, k))
+                {
+                    send_json_error(req, "500 Internal Server Error", "{\"error\":\"WRITE_FAIL\"}");
+                    goto cleanup;
+                }
+                rd.pos += k;
+                len -= (uint32_t)k;
+                literal += k;
+            }
+        }
+        else if (op == DELTA_OP_END)
+        {
+            ended = true;
+        }
+        else
+        {
+            send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_OP\"}");
+            goto cleanup;
+        }
+    }
+    if (rd.remaining > 0 || rd.pos < rd.len)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"TRAILING_DATA\"}");
+        goto cleanup;
+    }
+
+    esp_err_t result = upload_ctx_finish(&ctx);
+    ctx_started = false;
+    upload_stats_log(&ctx, esp_timer_get_time(), true);
+    fclose(base);
+    base = NULL;
+    if (result != ESP_OK)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"WRITE_FAIL\"}");
+        goto cleanup;
+    }
+    char hex[HASH_INDEX_HEX_LEN];
+    hash_index_to_hex(ctx.digest, hex);
+    if (want[0] && strcasecmp(want, hex) != 0)
+    {
+        ESP_LOGW(TAG, "delta %s hash mismatch: got %s", rel_path, hex);
+        send_json_error(req, "409 Conflict", "{\"error\":\"HASH_MISMATCH\"}");
+        goto cleanup;
+    }
+    // FAT cannot rename over an existing file, so the old version steps
+    // aside under a .part name first and is put back if the new one cannot
+    // take its place; the rebuilt .part is kept either way, so a failure
+    // never loses both.
+    char old_path[MAX_PATH_LEN];
+    if (!build_suffix_path(full_path, ".old.part", old_path, sizeof(old_path)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
+        goto cleanup;
+    }
+    unlink(old_path);
+    if (rename(full_path, old_path) != 0)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"RENAME_FAIL\"}");
+        goto cleanup;
+    }
+    if (rename(tmp_path, full_path) != 0)
+    {
+        if (rename(old_path, full_path) != 0)
+        {
+            ESP_LOGE(TAG, "delta %s: old version left as %s", rel_path, old_path);
+        }
+        ESP_LOGE(TAG, "delta %s: rebuilt file left as %s", rel_path, tmp_path);
+        keep_part = true;
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"RENAME_FAIL\"}");
+        goto cleanup;
+    }
+    unlink(old_path);
+    apply_mtime_if_needed(full_path, mtime_ms);
+    index_file_hash(dir_path, name, full_path, hex);
+    index_file_meta(rel_path, full_path, &ctx);
+    upload_ok = true;
+
+    ESP_LOGI(TAG, "delta %s: size=%llu copied=%llu literal=%llu ops=%u", rel_path,
+             (unsigned long long)(copied + literal), (unsigned long long)copied,
+             (unsigned long long)literal, (unsigned)ops);
+    char json[160];
+    snprintf(json, sizeof(json), "{\"ok\":true,\"size\":%llu,\"copied\":%llu,\"literal\":%llu,\"ops\":%u}",
+             (unsigned long long)(copied + literal), (unsigned long long)copied,
+             (unsigned long long)literal, (unsigned)ops);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+
+cleanup:
+    if (ctx_started)
+    {
+        upload_ctx_finish(&ctx);
+    }
+    else if (fp)
+    {
+        fclose(fp);
+    }
+    gcode_analyzer_destroy(ctx.gcode);
+    if (base)
+    {
+        fclose(base);
+    }
+    if (!upload_ok && tmp_path[0] && !keep_part)
+    {
+        unlink(tmp_path);
+    }
+    if (upload_ok)
+    {
+        note_change(FS_JOURNAL_MODIFY, rel_path, NULL, false);
+    }
+    else if (tmp_path[0])
+    {
+        // The .part came and went.
+        dir_index_changed(dir_path);
+    }
+    upload_free_buf(recv_buf);
+    upload_free_buf(copy_buf);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+#define TAR_HASH_BATCH 32
+
+// Byte source for archive uploads: the request body, optionally through gzip.
+typedef struct
+{
+    body_reader_t rd;
+    gzip_reader_t *gz;
+} archive_src_t;
+
+static int archive_read_some(archive_src_t *src, uint8_t *dst, size_t len)
+{
+    if (src->gz)
+    {
+        return gzip_reader_read(src->gz, dst, len);
+    }
+    return body_reader_src(&src->rd, dst, len);
+}
+
+static bool archive_read(archive_src_t *src, uint8_t *dst, size_t len)
+{
+    while (len > 0)
+    {
+        int n = archive_read_some(src, dst, len);
+        if (n <= 0)
+        {
+            return false;
+        }
+        dst += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool archive_skip(archive_src_t *src, uint8_t *buf, size_t cap, uint64_t len)
+{
+    while (len > 0)
+    {
+        size_t k = len > cap ? cap : (size_t)len;
+        if (!archive_read(src, buf, k))
+        {
+            return false;
+        }
+        len -= k;
+    }
+    return true;
+}
+
+typedef struct
+{
+    archive_src_t src;
+    uint8_t *buf;
+    bool overwrite;
+    tar_entry_t entry;
+    tar_entry_t ext;
+    char made_dir[MAX_PATH_LEN];
+    char batch_dir[MAX_PATH_LEN];
+    char batch_names[TAR_HASH_BATCH][MAX_NAME_LEN];
+    hash_index_item_t batch[TAR_HASH_BATCH];
+    size_t batch_count;
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t skipped;
+    uint64_t bytes;
+    const char *status;
+    const char *error;
+} tar_upload_t;
+
+static bool tar_fail(tar_upload_t *tu, const char *status, const char *error)
+{
+    tu->status = status;
+    tu->error = error;
+    return false;
+}
+
+static void tar_flush_hashes(tar_upload_t *tu)
+{
+    hash_index_put_batch(tu->batch_dir, tu->batch, tu->batch_count);
+    tu->batch_count = 0;
+}
+
+// Hash index updates are collected per directory: one index rewrite per
+// batch instead of one per file.
+static void tar_queue_hash(tar_upload_t *tu, const char *rel_dir, const char *name, const char *full_path,
+                           const uint8_t digest[32])
+{
+    struct stat st;
+    if (strlen(name) >= MAX_NAME_LEN || stat(full_path, &st) != 0)
+    {
+        return;
+    }
+    if (tu->batch_count > 0 && (tu->batch_count == TAR_HASH_BATCH || strcmp(tu->batch_dir, rel_dir) != 0))
+    {
+        tar_flush_hashes(tu);
+    }
+    strcpy(tu->batch_dir, rel_dir);
+    hash_index_item_t *item = &tu->batch[tu->batch_count];
+    strcpy(tu->batch_names[tu->batch_count], name);
+    item->name = tu->batch_names[tu->batch_count];
+    item->size = (uint64_t)st.st_size;
+    item->mtime = (int64_t)st.st_mtime;
+    hash_index_to_hex(digest, item->hex);
+    tu->batch_count++;
+}
+
+// mkdir -p for rel_dir; remembers the last directory so runs of files in
+// one folder cost a single strcmp.
+static bool tar_make_dirs(tar_upload_t *tu, const char *rel_dir)
+{
+    if (strcmp(rel_dir, "/") == 0 || strcmp(rel_dir, tu->made_dir) == 0)
+    {
+        return true;
+    }
+    char partial[MAX_PATH_LEN];
+    char full_path[MAX_PATH_LEN];
+    size_t len = strlen(rel_dir);
+    for (size_t i = 1; i <= len; ++i)
+    {
+        if (rel_dir[i] != '/' && rel_dir[i] != '\0')
+        {
+            continue;
+        }
+        memcpy(partial, rel_dir, i);
+        partial[i] = '\0';
+        if (!build_fs_path(partial, full_path, sizeof(full_path)))
+        {
+            return false;
+        }
+        if (mkdir(full_path, 0775) == 0)
+        {
+            tu->dirs++;
+            note_change(FS_JOURNAL_CREATE, partial, NULL, true);
+        }
+        else if (errno != EEXIST)
+        {
+            return false;
+        }
+    }
+    struct stat st;
+    if (stat(full_path, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        return false;
+    }
+    strcpy(tu->made_dir, rel_dir);
+    return true;
+}
+
+static bool tar_write_file(tar_upload_t *tu, const char *rel_file)
+{
+    char dir_path[MAX_PATH_LEN];
+    char name[MAX_PATH_LEN];
+    char full_path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    if (!split_rel_path(rel_file, dir_path, sizeof(dir_path), name, sizeof(name)) ||
+        !build_fs_path(rel_file, full_path, sizeof(full_path)) ||
+        !build_suffix_path(full_path, ".part", tmp_path, sizeof(tmp_path)))
+    {
+        return tar_fail(tu, "400 Bad Request", "PATH_TOO_LONG");
+    }
+    if (!tar_make_dirs(tu, dir_path))
+    {
+        return tar_fail(tu, "500 Internal Server Error", "MKDIR_FAIL");
+    }
+    struct stat st;
+    bool exists = stat(full_path, &st) == 0;
+    if (exists && S_ISDIR(st.st_mode))
+    {
+        return tar_fail(tu, "409 Conflict", "IS_DIRECTORY");
+    }
+    if (exists && !tu->overwrite)
+    {
+        return tar_fail(tu, "409 Conflict", "FILE_EXISTS");
+    }
+
+    upload_ctx_t ctx = {0};
+    ctx.mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    ctx.start_us = esp_timer_get_time();
+    ctx.last_log_us = ctx.start_us;
+    ctx.hash = true;
+    ctx.analyse = gcode_meta_is_gcode(name);
+    unlink(tmp_path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp)
+    {
+        return tar_fail(tu, "500 Internal Server Error", "OPEN_FAIL");
+    }
+    upload_file_set_buffer(fp);
+    if (!upload_ctx_start(&ctx, fp, NULL))
+    {
+        fclose(fp);
+        unlink(tmp_path);
+        return tar_fail(tu, "500 Internal Server Error", "NO_MEM");
+    }
+
+    uint64_t remaining = tu->entry.size;
+    bool ok = true;
+    while (remaining > 0 && ok)
+    {
+        size_t want = remaining > UPLOAD_RECV_BUF_SIZE ? UPLOAD_RECV_BUF_SIZE : (size_t)remaining;
+        int64_t t0 = esp_timer_get_time();
+        int n = archive_read_some(&tu->src, tu->buf, want);
+        if (n <= 0)
+        {
+            ok = tar_fail(tu, "400 Bad Request", tu->src.gz ? "BAD_GZIP" : "RECV_FAIL");
+            break;
+        }
+        upload_stats_add_recv(&ctx, (uint32_t)n, (uint64_t)(esp_timer_get_time() - t0));
+        if (!upload_ringbuf_send(&ctx, tu->buf, (size_t)n))
+        {
+            ok = tar_fail(tu, "500 Internal Server Error", "WRITE_FAIL");
+        }
+        remaining -= (uint64_t)n;
+    }
+    if (upload_ctx_finish(&ctx) != ESP_OK && ok)
+    {
+        ok = tar_fail(tu, "500 Internal Server Error", "WRITE_FAIL");
+    }
+    if (ok && exists && unlink(full_path) != 0)
+    {
+        ok = tar_fail(tu, "500 Internal Server Error", "DELETE_FAIL");
+    }
+    if (ok && rename(tmp_path, full_path) != 0)
+    {
+        ok = tar_fail(tu, "500 Internal Server Error", "RENAME_FAIL");
+    }
+    if (!ok)
+    {
+        gcode_analyzer_destroy(ctx.gcode);
+        unlink(tmp_path);
+        dir_index_changed(dir_path);
+        return false;
+    }
+    note_change(exists ? FS_JOURNAL_MODIFY : FS_JOURNAL_CREATE, rel_file, NULL, false);
+    apply_mtime_if_needed(full_path, tu->entry.mtime > 0 ? (uint64_t)tu->entry.mtime * 1000ULL : 0);
+    tar_queue_hash(tu, dir_path, name, full_path, ctx.digest);
+    index_file_meta(rel_file, full_path, &ctx);
+    tu->files++;
+    tu->bytes += tu->entry.size;
+    return true;
+}
+
+// Reads the data of a GNU long-name or pax header into tu->ext, which then
+// overrides the fields of the following entry.
+static bool tar_read_ext(tar_upload_t *tu)
+{
+    uint64_t size = tu->entry.size;
+    uint64_t padded = size + tar_padding(size);
+    if (size >= UPLOAD_RECV_BUF_SIZE)
+    {
+        tu->ext.truncated = true;
+        return archive_skip(&tu->src, tu->buf, UPLOAD_RECV_BUF_SIZE, padded);
+    }
+    if (!archive_read(&tu->src, tu->buf, (size_t)padded))
+    {
+        return false;
+    }
+    if (tu->entry.type == TAR_ENTRY_PAX)
+    {
+        tar_apply_pax((const char *)tu->buf, (size_t)size, &tu->ext);
+    }
+    else
+    {
+        size_t len = strnlen((const char *)tu->buf, (size_t)size);
+        tu->ext.truncated = len >= sizeof(tu->ext.path);
+        if (!tu->ext.truncated)
+        {
+            memcpy(tu->ext.path, tu->buf, len);
+            tu->ext.path[len] = '\0';
+        }
+    }
+    return true;
+}
+
+static bool tar_extract(tar_upload_t *tu, const char *rel_root)
+{
+    tu->ext.path[0] = '\0';
+    tu->ext.mtime = -1;
+    while (true)
+    {
+        uint8_t *block = tu->buf;
+        int n = archive_read_some(&tu->src, block, TAR_BLOCK_SIZE);
+        if (n == 0)
+        {
+            // Producers that omit the end-of-archive blocks.
+            return true;
+        }
+        if (n < 0 || (n < TAR_BLOCK_SIZE && !archive_read(&tu->src, block + n, TAR_BLOCK_SIZE - (size_t)n)))
+        {
+            return tar_fail(tu, "400 Bad Request", tu->src.gz ? "BAD_GZIP" : "RECV_FAIL");
+        }
+        tar_entry_type_t type = tar_parse_header(block, &tu->entry);
+        if (type == TAR_ENTRY_END)
+        {
+            return true;
+        }
+        if (type == TAR_ENTRY_BAD)
+        {
+            return tar_fail(tu, "400 Bad Request", "BAD_ARCHIVE");
+        }
+        if (type == TAR_ENTRY_LONGNAME || type == TAR_ENTRY_PAX)
+        {
+            if (!tar_read_ext(tu))
+            {
+                return tar_fail(tu, "400 Bad Request", "RECV_FAIL");
+            }
+            continue;
+        }
+        if (tu->ext.path[0])
+        {
+            strcpy(tu->entry.path, tu->ext.path);
+        }
+        if (tu->ext.mtime >= 0)
+        {
+            tu->entry.mtime = tu->ext.mtime;
+        }
+        bool truncated = tu->entry.truncated || tu->ext.truncated;
+        tu->ext.path[0] = '\0';
+        tu->ext.mtime = -1;
+        tu->ext.truncated = false;
+
+        char joined[MAX_PATH_LEN];
+        char rel[MAX_PATH_LEN] = {0};
+        bool path_ok = build_rel_child(rel_root, tu->entry.path, joined, sizeof(joined)) &&
+                       normalize_path(joined, rel, sizeof(rel));
+        bool internal = strncmp(rel, "/.wimill", 8) == 0 && (rel[8] == '/' || rel[8] == '\0');
+        if (type == TAR_ENTRY_OTHER || truncated || !path_ok || internal || strcmp(rel, "/") == 0)
+        {
+            tu->skipped++;
+            uint64_t data = type == TAR_ENTRY_DIR ? 0 : tu->entry.size;
+            if (!archive_skip(&tu->src, tu->buf, UPLOAD_RECV_BUF_SIZE, data + tar_padding(data)))
+            {
+                return tar_fail(tu, "400 Bad Request", "RECV_FAIL");
+            }
+            continue;
+        }
+        if (type == TAR_ENTRY_DIR)
+        {
+            if (!tar_make_dirs(tu, rel))
+            {
+                return tar_fail(tu, "500 Internal Server Error", "MKDIR_FAIL");
+            }
+            continue;
+        }
+        if (!tar_write_file(tu, rel))
+        {
+            strcpy(tu->entry.path, rel);
+            return false;
+        }
+        if (!archive_skip(&tu->src, tu->buf, UPLOAD_RECV_BUF_SIZE, tar_padding(tu->entry.size)))
+        {
+            return tar_fail(tu, "400 Bad Request", "RECV_FAIL");
+        }
+    }
+}
+
+// POST /api/fs/upload_tar?path=/dir[&overwrite=1]: unpacks a tar stream
+// (gzip is detected by its magic) below path in one request. Every file
+// goes through the writer pipeline into .part and is renamed into place
+// once complete, so a broken transfer leaves only whole files behind.
+static esp_err_t http_fs_upload_tar(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+    if (!fileop_try_lock(req))
+    {
+        http_drain_body(req);
+        return ESP_OK;
+    }
+
+    uint8_t *recv_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
+    uint8_t *work_buf = upload_alloc_buf(UPLOAD_RECV_BUF_SIZE);
+    tar_upload_t *tu = heap_caps_calloc(1, sizeof(*tu), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!recv_buf || !work_buf || !tu)
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
+    }
+
+    char rel_root[MAX_PATH_LEN];
+    char full_root[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_root, sizeof(rel_root)) || !build_fs_path(rel_root, full_root, sizeof(full_root)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        goto cleanup;
+    }
+    struct stat st;
+    if (stat(full_root, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        goto cleanup;
+    }
+    if (req->content_len <= 0)
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"NO_BODY\"}");
+        goto cleanup;
+    }
+
+    tu->buf = work_buf;
+    tu->overwrite = get_query_flag(req, "overwrite");
+    tu->src.rd = (body_reader_t){
+        .req = req,
+        .buf = recv_buf,
+        .cap = UPLOAD_RECV_BUF_SIZE,
+        .remaining = req->content_len,
+    };
+    if (body_reader_fill(&tu->src.rd) && tu->src.rd.len >= 2 && recv_buf[0] == 0x1f && recv_buf[1] == 0x8b)
+    {
+        tu->src.gz = gzip_reader_create(body_reader_src, &tu->src.rd);
+        if (!tu->src.gz)
+        {
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+            goto cleanup;
+        }
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    fs_journal_batch_begin();
+    bool ok = tar_extract(tu, rel_root);
+    fs_journal_batch_end();
+    // Consume the record padding after the end blocks; for gzip this also
+    // verifies the trailer CRC.
+    while (ok && archive_read_some(&tu->src, work_buf, UPLOAD_RECV_BUF_SIZE) > 0)
+    {
+    }
+    if (ok && tu->src.gz && gzip_reader_read(tu->src.gz, work_buf, 1) < 0)
+    {
+        ok = tar_fail(tu, "400 Bad Request", "BAD_GZIP");
+    }
+    tar_flush_hashes(tu);
+
+    int64_t dur_ms = (esp_timer_get_time() - start_us) / 1000;
+    ESP_LOGI(TAG, "upload_tar %s: files=%u dirs=%u skipped=%u bytes=%llu gzip=%d %lldms%s%s", rel_root,
+             (unsigned)tu->files, (unsigned)tu->dirs, (unsigned)tu->skipped, (unsigned long long)tu->bytes,
+             tu->src.gz != NULL, (long long)dur_ms, ok ? "" : " error=", ok ? "" : tu->error);
+    char json[MAX_PATH_LEN + 160];
+    if (!ok)
+    {
+        char safe_path[MAX_PATH_LEN];
+        json_escape(safe_path, sizeof(safe_path), tu->entry.path);
+        snprintf(json, sizeof(json), "{\"error\":\"%s\",\"entry\":\"%s\",\"files\":%u}", tu->error, safe_path,
+                 (unsigned)tu->files);
+        send_json_error(req, tu->status, json);
+        goto cleanup;
+    }
+    snprintf(json, sizeof(json), "{\"ok\":true,\"files\":%u,\"dirs\":%u,\"skipped\":%u,\"bytes\":%llu}",
+             (unsigned)tu->files, (unsigned)tu->dirs, (unsigned)tu->skipped, (unsigned long long)tu->bytes);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+
+cleanup:
+    if (tu)
+    {
+        gzip_reader_destroy(tu->src.gz);
+        heap_caps_free(tu);
+    }
+    upload_free_buf(recv_buf);
+    upload_free_buf(work_buf);
+    fileop_unlock();
+    return ESP_OK;
+}
+
+// GET/HEAD /api/fs/hash?path=/dir/file[&sha256=hex]: pre-upload check so a
+// client can skip sending a file the card already holds. HEAD answers 200 on
+// match (or when no hash is given) and 412 on mismatch; the hash is returned
+// as the ETag either way. Misses are hashed once and cached in the index.
+static esp_err_t http_fs_hash(httpd_req_t *req)
+{
+    bool head = (req->method == HTTP_HEAD);
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    char rel_path[MAX_PATH_LEN];
+    char dir_path[MAX_PATH_LEN];
+    char name[MAX_PATH_LEN];
+    char full_path[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_path, sizeof(rel_path)) ||
+        !split_rel_path(rel_path, dir_path, sizeof(dir_path), name, sizeof(name)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        return ESP_OK;
+    }
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        return ESP_OK;
+    }
+    struct stat st;
+    if (stat(full_path, &st) != 0 || S_ISDIR(st.st_mode))
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        return ESP_OK;
+    }
+    char want[HASH_INDEX_HEX_LEN + 2] = {0};
+    get_query_value(req, "sha256", want, sizeof(want));
+
+    char hex[HASH_INDEX_HEX_LEN];
+    bool cached = hash_index_lookup(dir_path, name, (uint64_t)st.st_size, (int64_t)st.st_mtime, hex) == ESP_OK;
+    if (!cached)
+    {
+        if (!fileop_try_lock(req))
+        {
+            return ESP_OK;
+        }
+        esp_err_t err = hash_index_file_sha256(full_path, 0, hex);
+        if (err == ESP_OK)
+        {
+            hash_index_put(dir_path, name, (uint64_t)st.st_size, (int64_t)st.st_mtime, hex);
+        }
+        fileop_unlock();
+        if (err != ESP_OK)
+        {
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"HASH_FAIL\"}");
+            return ESP_OK;
+        }
+    }
+    bool match = want[0] && strcasecmp(want, hex) == 0;
+
+    char etag[HASH_INDEX_HEX_LEN + 2];
+    snprintf(etag, sizeof(etag), "\"%s\"", hex);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    if (head)
+    {
+        if (want[0] && !match)
+        {
+            httpd_resp_set_status(req, "412 Precondition Failed");
+        }
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+    char json[224];
+    snprintf(json, sizeof(json), "{\"ok\":true,\"size\":%llu,\"mtime\":%lld,\"sha256\":\"%s\",\"cached\":%s%s}",
+             (unsigned long long)st.st_size,
+             (long long)st.st_mtime,
+             hex,
+             cached ? "true" : "false",
+             want[0] ? (match ? ",\"match\":true" : ",\"match\":false") : "");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+// GET /api/fs/meta?path=/job.nc: G-code summary (lines, bounds, feeds,
+// tools, estimated time). Served from the sidecar when it is current,
+// otherwise the file is analysed now and the sidecar written.
+static esp_err_t http_fs_meta(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    char rel_path[MAX_PATH_LEN];
+    char full_path[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_path, sizeof(rel_path)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        return ESP_OK;
+    }
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        return ESP_OK;
+    }
+    struct stat st;
+    if (stat(full_path, &st) != 0 || S_ISDIR(st.st_mode))
+    {
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
+        return ESP_OK;
+    }
+    if (!gcode_meta_is_gcode(rel_path))
+    {
+        send_json_error(req, "415 Unsupported Media Type", "{\"error\":\"NOT_GCODE\"}");
+        return ESP_OK;
+    }
+
+    char meta[GCODE_META_JSON_LEN];
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    bool cached = gcode_meta_load_json(rel_path, (uint64_t)st.st_size, (int64_t)st.st_mtime, meta,
+                                       sizeof(meta)) == ESP_OK;
+    sdcard_io_end();
+    if (!cached)
+    {
+        if (!fileop_try_lock(req))
+        {
+            return ESP_OK;
+        }
+        gcode_meta_t m;
+        int64_t t0 = esp_timer_get_time();
+        esp_err_t err = gcode_meta_analyze_file(rel_path, SDCARD_IO_STREAM, &m);
+        fileop_unlock();
+        if (err != ESP_OK || gcode_meta_to_json(&m, meta, sizeof(meta)) < 0)
+        {
+            send_json_error(req, "500 Internal Server Error", "{\"error\":\"ANALYSE_FAIL\"}");
+            return ESP_OK;
+        }
+        ESP_LOGI(TAG, "meta %s: analysed %lld bytes in %lld ms", rel_path, (long long)st.st_size,
+                 (long long)((esp_timer_get_time() - t0) / 1000));
+    }
+    char json[GCODE_META_JSON_LEN + 96];
+    snprintf(json, sizeof(json), "{\"ok\":true,\"size\":%llu,\"mtime\":%lld,\"cached\":%s,\"meta\":%s}",
+             (unsigned long long)st.st_size, (long long)st.st_mtime, cached ? "true" : "false", meta);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+// GET /api/fs/lines?path=/job.nc&from=N&count=M: M lines from line N
+// (1-based) as text/plain. G-code files jump to the nearest indexed line
+// (the index is built first if it is missing or stale), so only up to
+// GCODE_LINES_STRIDE - 1 lines are skipped; other files are read from the
+// start.
+static esp_err_t http_fs_lines(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
+        return ESP_OK;
+    }
+    char rel_path[MAX_PATH_LEN];
+    char full_path[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_path, sizeof(rel_path)))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        return ESP_OK;
+    }
+    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    {
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
+        return ESP_OK;
+    }
+    struct stat st;
+    if (stat(full_path, &st) != 0 || S_ISDIR(st.st_mode))
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
-        fileop_unlock();
+        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
         return ESP_OK;
     }
-
-    char full_path[MAX_PATH_LEN];
-    if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
+    uint64_t from = 1;
+    uint64_t count = LINES_DEFAULT_COUNT;
+    get_query_u64(req, "from", &from);
+    get_query_u64(req, "count", &count);
+    if (from < 1 || from > UINT32_MAX || count == 0)
     {
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
-        fileop_unlock();
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_RANGE\"}");
         return ESP_OK;
     }
+    if (count > LINES_MAX_COUNT)
+    {
+        count = LINES_MAX_COUNT;
+    }
+    uint32_t first = (uint32_t)(from - 1);
 
-    if (mkdir(full_path, 0775) != 0)
+    int64_t t0 = esp_timer_get_time();
+    gcode_lines_pos_t pos = {0};
+    bool indexed = false;
+    if (gcode_meta_is_gcode(rel_path))
     {
-        if (errno == EEXIST)
+        sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+        esp_err_t err = gcode_lines_seek(rel_path, (uint64_t)st.st_size, (int64_t)st.st_mtime, first, &pos);
+        sdcard_io_end();
+        if (err != ESP_OK)
         {
-            send_json_error(req, "409 Conflict", "{\"error\":\"FILE_EXISTS\"}");
+            if (!fileop_try_lock(req))
+            {
+                return ESP_OK;
+            }
+            err = gcode_meta_analyze_file(rel_path, SDCARD_IO_STREAM, NULL);
+            fileop_unlock();
+            if (err == ESP_OK)
+            {
+                sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+                err = gcode_lines_seek(rel_path, (uint64_t)st.st_size, (int64_t)st.st_mtime, first, &pos);
+                sdcard_io_end();
+            }
         }
-        else
+        indexed = err == ESP_OK;
+        if (!indexed)
         {
-            send_json_error(req, "500 Internal Server Error", "{\"error\":\"MKDIR_FAIL\"}");
+            memset(&pos, 0, sizeof(pos));
         }
-        fileop_unlock();
-        return ESP_OK;
     }
 
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
-    fileop_unlock();
-    return ESP_OK;
-}
-
-static esp_err_t http_fs_delete(httpd_req_t *req)
-{
-    if (!fs_gate(req))
+    // stdio positions are a 32-bit long here; the index can point further
+    // into a FAT file than fseek() reaches.
+    if (pos.offset > (uint64_t)LONG_MAX)
     {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"OFFSET_TOO_LARGE\"}");
         return ESP_OK;
     }
-    if (!fileop_try_lock(req))
+    char *buf = heap_caps_malloc(LINES_BUF_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+    FILE *fp = fopen(full_path, "rb");
+    bool seek_ok = fp && fseek(fp, (long)pos.offset, SEEK_SET) == 0;
+    sdcard_io_end();
+    if (!buf || !seek_ok)
     {
-        drain_body(req);
+        const char *json = buf ? "{\"error\":\"OPEN_FAIL\"}" : "{\"error\":\"NO_MEM\"}";
+        if (fp)
+        {
+            fclose(fp);
+        }
+        heap_caps_free(buf);
+        send_json_error(req, "500 Internal Server Error", json);
         return ESP_OK;
     }
 
-    char body[MAX_BODY_LEN];
-    if (!read_body(req, body, sizeof(body)))
+    char hdr[3][16];
+    snprintf(hdr[0], sizeof(hdr[0]), "%lu", (unsigned long)from);
+    httpd_resp_set_hdr(req, "X-First-Line", hdr[0]);
+    if (indexed)
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_BODY\"}");
-        fileop_unlock();
-        return ESP_OK;
+        snprintf(hdr[1], sizeof(hdr[1]), "%lu", (unsigned long)pos.total_lines);
+        httpd_resp_set_hdr(req, "X-Total-Lines", hdr[1]);
     }
+    snprintf(hdr[2], sizeof(hdr[2]), "%lu", (unsigned long)(first - pos.line));
+    httpd_resp_set_hdr(req, "X-Lines-Skipped", hdr[2]);
+    httpd_resp_set_type(req, "text/plain");
 
-    char path_raw[MAX_PATH_LEN] = {0};
-    if (!json_get_string(body, "path", path_raw, sizeof(path_raw)))
+    uint32_t line = pos.line;
+    // Saturates: from near UINT32_MAX must not wrap end below first.
+    uint32_t end = count > UINT32_MAX - first ? UINT32_MAX : first + (uint32_t)count;
+    bool sent_ok = true;
+    while (sent_ok && line < end)
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_REQUIRED\"}");
-        fileop_unlock();
-        return ESP_OK;
+        sdcard_io_begin(SDCARD_IO_INTERACTIVE);
+        size_t n = fread(buf, 1, LINES_BUF_SIZE, fp);
+        sdcard_io_end();
+        if (n == 0)
+        {
+            break;
+        }
+        // Sends the part of this buffer that lies inside [first, end).
+        size_t out_start = line >= first ? 0 : n;
+        size_t out_end = n;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (buf[i] != '\n')
+            {
+                continue;
+            }
+            line++;
+            if (line == first)
+            {
+                out_start = i + 1;
+            }
+            if (line == end)
+            {
+                out_end = i + 1;
+                break;
+            }
+        }
+        if (out_start < out_end)
+        {
+            sent_ok = httpd_resp_send_chunk(req, buf + out_start, out_end - out_start) == ESP_OK;
+        }
+    }
+    fclose(fp);
+    heap_caps_free(buf);
+    if (sent_ok)
+    {
+        httpd_resp_send_chunk(req, NULL, 0);
     }
+    ESP_LOGI(TAG, "lines %s from=%lu count=%lu: %s, skipped %lu, %lld us", rel_path, (unsigned long)from,
+             (unsigned long)count, indexed ? "indexed" : "linear", (unsigned long)(first - pos.line),
+             (long long)(esp_timer_get_time() - t0));
+    return ESP_OK;
+}
 
-    char rel_path[MAX_PATH_LEN];
-    if (!normalize_path(path_raw, rel_path, sizeof(rel_path)) || strcmp(rel_path, "/") == 0)
+static bool manifest_emit(const fs_manifest_entry_t *entry, void *ctx)
+{
+    chunk_buf_t *ms = (chunk_buf_t *)ctx;
+    char line[FS_MANIFEST_LINE_LEN];
+    int n = fs_manifest_format(entry, line, sizeof(line));
+    if (n <= 0 || (size_t)n >= sizeof(line))
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
-        fileop_unlock();
-        return ESP_OK;
+        return true;
     }
+    ms->count++;
+    return chunk_buf_append(ms, line, (size_t)n);
+}
 
+// Resolves ?path= to a directory for the manifest/plan endpoints; replies
+// with the error itself when it returns false.
+static bool manifest_root(httpd_req_t *req, char *rel_path, size_t rel_len)
+{
     char full_path[MAX_PATH_LEN];
+    if (!get_query_path(req, rel_path, rel_len))
+    {
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
+        return false;
+    }
     if (!build_fs_path(rel_path, full_path, sizeof(full_path)))
     {
         send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
-        fileop_unlock();
-        return ESP_OK;
+        return false;
     }
-
     struct stat st;
-    if (stat(full_path, &st) != 0)
+    if (stat(full_path, &st) != 0 || !S_ISDIR(st.st_mode))
     {
         send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
-        fileop_unlock();
+        return false;
+    }
+    return true;
+}
+
+// GET /api/fs/manifest?path=/dir[&hash=1]: recursive listing as TSV (format
+// in fs_manifest.h). hash=1 adds cached SHA-256 values; nothing is hashed
+// here, so the walk stays cheap even on a full card.
+static esp_err_t http_fs_manifest(httpd_req_t *req)
+{
+    if (!fs_gate(req))
+    {
         return ESP_OK;
     }
-    if (S_ISDIR(st.st_mode))
+    char rel_path[MAX_PATH_LEN];
+    if (!manifest_root(req, rel_path, sizeof(rel_path)))
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"IS_DIRECTORY\"}");
-        fileop_unlock();
         return ESP_OK;
     }
-
-    if (unlink(full_path) != 0)
+    bool with_hash = get_query_flag(req, "hash");
+    chunk_buf_t ms = {.req = req};
+    ms.buf = (char *)upload_alloc_buf(CHUNK_SEND_BUF);
+    if (!ms.buf)
     {
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"DELETE_FAIL\"}");
-        fileop_unlock();
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
         return ESP_OK;
     }
 
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
-    fileop_unlock();
+    int64_t start_us = esp_timer_get_time();
+    httpd_resp_set_type(req, "text/tab-separated-values");
+    esp_err_t err = fs_manifest_walk(rel_path, with_hash, manifest_emit, &ms);
+    chunk_buf_flush(&ms);
+    httpd_resp_send_chunk(req, NULL, 0);
+    upload_free_buf((uint8_t *)ms.buf);
+    ESP_LOGI(TAG, "manifest %s: entries=%u hash=%d err=%s %lldms", rel_path, (unsigned)ms.count, with_hash,
+             esp_err_to_name(err), (long long)((esp_timer_get_time() - start_us) / 1000));
     return ESP_OK;
 }
 
-static esp_err_t http_fs_rename(httpd_req_t *req)
+static const char *const k_plan_keys[] = {"mkdirs", "renames", "uploads", "deletes"};
+
+typedef struct
 {
-    if (!fs_gate(req))
+    chunk_buf_t out;
+    int op;
+    bool first;
+} plan_stream_t;
+
+static bool plan_open_until(plan_stream_t *ps, int op)
+{
+    while (ps->op < op)
     {
-        return ESP_OK;
+        if (ps->op >= 0 && !chunk_buf_append(&ps->out, "],", 2))
+        {
+            return false;
+        }
+        ps->op++;
+        char key[24];
+        int n = snprintf(key, sizeof(key), "\"%s\":[", k_plan_keys[ps->op]);
+        if (!chunk_buf_append(&ps->out, key, (size_t)n))
+        {
+            return false;
+        }
+        ps->first = true;
     }
-    if (!fileop_try_lock(req))
+    return true;
+}
+
+static bool plan_emit(fs_plan_op_t op, const char *path, const char *to, void *ctx)
+{
+    plan_stream_t *ps = (plan_stream_t *)ctx;
+    if (!plan_open_until(ps, (int)op))
     {
-        drain_body(req);
-        return ESP_OK;
+        return false;
     }
-
-    char body[MAX_BODY_LEN];
-    if (!read_body(req, body, sizeof(body)))
+    char safe_path[FS_MANIFEST_PATH_LEN];
+    char safe_to[FS_MANIFEST_PATH_LEN];
+    char item[2 * FS_MANIFEST_PATH_LEN + 16];
+    json_escape(safe_path, sizeof(safe_path), path);
+    int n;
+    if (op == FS_PLAN_RENAME)
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_BODY\"}");
-        fileop_unlock();
-        return ESP_OK;
+        json_escape(safe_to, sizeof(safe_to), to);
+        n = snprintf(item, sizeof(item), "%s[\"%s\",\"%s\"]", ps->first ? "" : ",", safe_path, safe_to);
+    }
+    else
+    {
+        n = snprintf(item, sizeof(item), "%s\"%s\"", ps->first ? "" : ",", safe_path);
     }
+    ps->first = false;
+    ps->out.count++;
+    return chunk_buf_append(&ps->out, item, (size_t)n);
+}
 
-    char path_raw[MAX_PATH_LEN] = {0};
-    char new_raw[MAX_NAME_LEN] = {0};
-    if (!json_get_string(body, "path", path_raw, sizeof(path_raw)))
+// POST /api/fs/plan?path=/dir[&delete=1] with a client manifest as the body:
+// answers which mkdir/rename/upload/delete calls bring the card in line, so
+// a batch sync needs one round trip instead of a listing per directory.
+static esp_err_t http_fs_plan(httpd_req_t *req)
+{
+    if (!fs_gate(req))
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_REQUIRED\"}");
-        fileop_unlock();
+        http_drain_body(req);
         return ESP_OK;
     }
-    if (!json_get_string(body, "new_name", new_raw, sizeof(new_raw)))
+    char rel_path[MAX_PATH_LEN];
+    if (!manifest_root(req, rel_path, sizeof(rel_path)))
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"NEW_NAME_REQUIRED\"}");
-        fileop_unlock();
+        http_drain_body(req);
         return ESP_OK;
     }
-
-    char rel_old[MAX_PATH_LEN];
-    if (!normalize_path(path_raw, rel_old, sizeof(rel_old)) || strcmp(rel_old, "/") == 0)
+    if (req->content_len <= 0)
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_PATH\"}");
-        fileop_unlock();
+        send_json_error(req, "400 Bad Request", "{\"error\":\"EMPTY_BODY\"}");
+        http_drain_body(req);
         return ESP_OK;
     }
-
-    char new_name[MAX_NAME_LEN];
-    if (!sanitize_name(new_raw, new_name, sizeof(new_name)))
+    if (req->content_len > PLAN_MAX_BODY)
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"BAD_NAME\"}");
-        fileop_unlock();
+        send_json_error(req, "413 Payload Too Large", "{\"error\":\"MANIFEST_TOO_LARGE\"}");
+        http_drain_body(req);
         return ESP_OK;
     }
+    bool mirror = get_query_flag(req, "delete");
 
-    char dir_path[MAX_PATH_LEN];
-    strncpy(dir_path, rel_old, sizeof(dir_path));
-    dir_path[sizeof(dir_path) - 1] = '\0';
-    char *slash = strrchr(dir_path, '/');
-    if (!slash || slash == dir_path)
+    char *body = (char *)upload_alloc_buf(req->content_len + 1);
+    plan_stream_t ps = {.out = {.req = req}, .op = -1};
+    ps.out.buf = (char *)upload_alloc_buf(CHUNK_SEND_BUF);
+    if (!body || !ps.out.buf)
     {
-        strncpy(dir_path, "/", sizeof(dir_path));
-    }
-    else
-    {
-        *slash = '\0';
+        upload_free_buf((uint8_t *)body);
+        upload_free_buf((uint8_t *)ps.out.buf);
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        http_drain_body(req);
+        return ESP_OK;
     }
-
-    char rel_new[MAX_PATH_LEN];
-    if (!build_rel_child(dir_path, new_name, rel_new, sizeof(rel_new)))
+    if (!read_body(req, body, req->content_len + 1))
     {
-        send_json_error(req, "400 Bad Request", "{\"error\":\"PATH_TOO_LONG\"}");
-        fileop_unlock();
+        upload_free_buf((uint8_t *)body);
+        upload_free_buf((uint8_t *)ps.out.buf);
+        send_json_error(req, "400 Bad Request", "{\"error\":\"BODY_READ_FAIL\"}");
         return ESP_OK;
     }
 
-    char full_old[MAX_PATH_LEN];
-    char full_new[MAX_PATH_LEN];
-    if (!build_fs_path(rel_old, full_old, sizeof(full_old)) ||
-        !build_fs_path(rel_new, full_new, sizeof(full_new)))
+    int64_t start_us = esp_timer_get_time();
+    httpd_resp_set_type(req, "application/json");
+    chunk_buf_append(&ps.out, "{", 1);
+    fs_plan_stats_t stats;
+    esp_err_t err = fs_manifest_plan(rel_path, body, (size_t)req->content_len, mirror, plan_emit, &ps, &stats);
+    char tail[96];
+    int n = snprintf(tail, sizeof(tail), "],\"unchanged\":%u,\"ok\":%s}", (unsigned)stats.unchanged,
+                     err == ESP_OK ? "true" : "false");
+    if (plan_open_until(&ps, FS_PLAN_DELETE))
     {
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"PATH_FAIL\"}");
-        fileop_unlock();
-        return ESP_OK;
+        chunk_buf_append(&ps.out, tail, (size_t)n);
     }
+    chunk_buf_flush(&ps.out);
+    httpd_resp_send_chunk(req, NULL, 0);
+    upload_free_buf((uint8_t *)body);
+    upload_free_buf((uint8_t *)ps.out.buf);
+    ESP_LOGI(TAG, "plan %s: ops=%u mirror=%d err=%s %lldms", rel_path, (unsigned)ps.out.count, mirror,
+             esp_err_to_name(err), (long long)((esp_timer_get_time() - start_us) / 1000));
+    return ESP_OK;
+}
 
-    struct stat st;
-    if (stat(full_old, &st) != 0)
+// GET /api/fs/changes?since=N[&epoch=E]: journal events after sequence
+// number N, oldest first. "reset" means the client's position is lost (new
+// epoch, events already dropped from the ring, or no since at all) and it
+// has to re-list what it shows; "next" is the since for the following poll.
+static esp_err_t http_fs_changes(httpd_req_t *req)
+{
+    if (!fs_gate(req))
     {
-        send_json_error(req, "404 Not Found", "{\"error\":\"NOT_FOUND\"}");
-        fileop_unlock();
         return ESP_OK;
     }
-    if (stat(full_new, &st) == 0)
+    uint64_t since = 0;
+    uint64_t epoch = 0;
+    bool have_since = get_query_u64(req, "since", &since);
+    bool have_epoch = get_query_u64(req, "epoch", &epoch);
+    fs_journal_state_t js = {0};
+    fs_journal_state(&js);
+    if (js.epoch == 0)
     {
-        send_json_error(req, "409 Conflict", "{\"error\":\"FILE_EXISTS\"}");
-        fileop_unlock();
+        send_json_error(req, "503 Service Unavailable", "{\"error\":\"JOURNAL_UNAVAILABLE\"}");
         return ESP_OK;
     }
+    bool reset = !have_since || (have_epoch && epoch != js.epoch) || since > js.seq || since + 1 < js.oldest;
+    uint32_t next = reset ? js.seq : (uint32_t)since;
 
-    if (rename(full_old, full_new) != 0)
+    chunk_buf_t out = {.req = req};
+    out.buf = (char *)upload_alloc_buf(CHUNK_SEND_BUF);
+    fs_journal_event_t *ev = heap_caps_malloc(sizeof(*ev), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    char *safe = malloc(2 * FS_JOURNAL_PATH_LEN);
+    char *safe_to = malloc(2 * FS_JOURNAL_PATH_LEN);
+    char *line = malloc(4 * FS_JOURNAL_PATH_LEN + 96);
+    if (!out.buf || !ev || !safe || !safe_to || !line)
     {
-        send_json_error(req, "500 Internal Server Error", "{\"error\":\"RENAME_FAIL\"}");
-        fileop_unlock();
-        return ESP_OK;
+        send_json_error(req, "500 Internal Server Error", "{\"error\":\"NO_MEM\"}");
+        goto cleanup;
     }
 
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, "{\"ok\":true}", HTTPD_RESP_USE_STRLEN);
-    fileop_unlock();
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    int n = snprintf(line, 4 * FS_JOURNAL_PATH_LEN + 96, "{\"epoch\":%lu,\"seq\":%lu,\"reset\":%s,\"events\":[",
+                     (unsigned long)js.epoch, (unsigned long)js.seq, reset ? "true" : "false");
+    chunk_buf_append(&out, line, (size_t)n);
+    while (next < js.seq && out.count < CHANGES_PAGE_MAX && fs_journal_get(next + 1, ev))
+    {
+        json_escape(safe, 2 * FS_JOURNAL_PATH_LEN, ev->path);
+        n = snprintf(line, 4 * FS_JOURNAL_PATH_LEN + 96, "%s{\"seq\":%lu,\"op\":\"%s\",\"dir\":%s,\"path\":\"%s\"",
+                     out.count ? "," : "", (unsigned long)ev->seq, fs_journal_op_name(ev->op),
+                     ev->is_dir ? "true" : "false", safe);
+        chunk_buf_append(&out, line, (size_t)n);
+        if (ev->op == FS_JOURNAL_RENAME)
+        {
+            json_escape(safe_to, 2 * FS_JOURNAL_PATH_LEN, ev->to);
+            n = snprintf(line, 4 * FS_JOURNAL_PATH_LEN + 96, ",\"to\":\"%s\"", safe_to);
+            chunk_buf_append(&out, line, (size_t)n);
+        }
+        chunk_buf_append(&out, "}", 1);
+        out.count++;
+        next++;
+    }
+    n = snprintf(line, 4 * FS_JOURNAL_PATH_LEN + 96, "],\"next\":%lu,\"more\":%s}", (unsigned long)next,
+                 next < js.seq ? "true" : "false");
+    chunk_buf_append(&out, line, (size_t)n);
+    chunk_buf_flush(&out);
+    httpd_resp_send_chunk(req, NULL, 0);
+
+cleanup:
+    upload_free_buf((uint8_t *)out.buf);
+    heap_caps_free(ev);
+    free(safe);
+    free(safe_to);
+    free(line);
     return ESP_OK;
 }
 
+// Forwards journal events to WebSocket clients; ev == NULL is a new epoch.
+static void journal_to_ws(uint32_t epoch, const fs_journal_event_t *ev)
+{
+    if (!ws_events_has_clients())
+    {
+        return;
+    }
+    char *msg = malloc(4 * FS_JOURNAL_PATH_LEN + 128);
+    char *safe = malloc(FS_JOURNAL_PATH_LEN);
+    char *safe_to = malloc(FS_JOURNAL_PATH_LEN);
+    if (msg && safe && safe_to)
+    {
+        if (!ev)
+        {
+            snprintf(msg, 4 * FS_JOURNAL_PATH_LEN + 128, "{\"type\":\"change\",\"epoch\":%lu,\"reset\":true}",
+                     (unsigned long)epoch);
+        }
+        else
+        {
+            json_escape(safe, FS_JOURNAL_PATH_LEN, ev->path);
+            json_escape(safe_to, FS_JOURNAL_PATH_LEN, ev->to);
+            snprintf(msg, 4 * FS_JOURNAL_PATH_LEN + 128,
+                     "{\"type\":\"change\",\"epoch\":%lu,\"seq\":%lu,\"op\":\"%s\",\"dir\":%s,\"path\":\"%s\""
+                     "%s%s%s}",
+                     (unsigned long)epoch, (unsigned long)ev->seq, fs_journal_op_name(ev->op),
+                     ev->is_dir ? "true" : "false", safe, ev->to[0] ? ",\"to\":\"" : "", safe_to,
+                     ev->to[0] ? "\"" : "");
+        }
+        ws_events_publish(msg);
+    }
+    free(msg);
+    free(safe);
+    free(safe_to);
+}
+
 static esp_err_t http_usb_detach(httpd_req_t *req)
 {
     if (web_fs_is_busy())
@@ -1938,6 +6171,21 @@ static esp_err_t http_usb_attach(httpd_req_t *req)
     return ESP_OK;
 }
 
+// Handlers that can hold a connection for seconds to minutes run on the
+// worker pool; everything else stays on the httpd task.
+static const http_work_t k_work_upload = {http_fs_upload, HTTP_WORK_BULK};
+static const http_work_t k_work_upload_raw = {http_fs_upload_raw, HTTP_WORK_BULK};
+static const http_work_t k_work_upload_tar = {http_fs_upload_tar, HTTP_WORK_BULK};
+static const http_work_t k_work_download = {http_fs_download, HTTP_WORK_BULK};
+static const http_work_t k_work_archive = {http_fs_archive, HTTP_WORK_BULK};
+static const http_work_t k_work_delta = {http_fs_delta, HTTP_WORK_BULK};
+static const http_work_t k_work_signature = {http_fs_signature, HTTP_WORK_SCAN};
+static const http_work_t k_work_hash = {http_fs_hash, HTTP_WORK_SCAN};
+static const http_work_t k_work_meta = {http_fs_meta, HTTP_WORK_SCAN};
+static const http_work_t k_work_lines = {http_fs_lines, HTTP_WORK_SCAN};
+static const http_work_t k_work_manifest = {http_fs_manifest, HTTP_WORK_SCAN};
+static const http_work_t k_work_plan = {http_fs_plan, HTTP_WORK_SCAN};
+
 esp_err_t web_fs_register_handlers(httpd_handle_t server)
 {
     if (!server)
@@ -1954,20 +6202,32 @@ esp_err_t web_fs_register_handlers(httpd_handle_t server)
     httpd_uri_t upload = {
         .uri = "/api/fs/upload",
         .method = HTTP_POST,
-        .handler = http_fs_upload,
-        .user_ctx = NULL,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_upload,
     };
     httpd_uri_t upload_raw = {
         .uri = "/api/fs/upload_raw",
         .method = HTTP_POST,
-        .handler = http_fs_upload_raw,
-        .user_ctx = NULL,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_upload_raw,
+    };
+    httpd_uri_t upload_tar = {
+        .uri = "/api/fs/upload_tar",
+        .method = HTTP_POST,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_upload_tar,
     };
     httpd_uri_t download = {
         .uri = "/api/fs/download",
         .method = HTTP_GET,
-        .handler = http_fs_download,
-        .user_ctx = NULL,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_download,
+    };
+    httpd_uri_t archive = {
+        .uri = "/api/fs/archive",
+        .method = HTTP_GET,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_archive,
     };
     httpd_uri_t mkdir_req = {
         .uri = "/api/fs/mkdir",
@@ -1987,6 +6247,90 @@ esp_err_t web_fs_register_handlers(httpd_handle_t server)
         .handler = http_fs_rename,
         .user_ctx = NULL,
     };
+    httpd_uri_t session_create = {
+        .uri = "/api/fs/session",
+        .method = HTTP_POST,
+        .handler = http_fs_session_create,
+        .user_ctx = NULL,
+    };
+    httpd_uri_t session_status = {
+        .uri = "/api/fs/session",
+        .method = HTTP_GET,
+        .handler = http_fs_session_status,
+        .user_ctx = NULL,
+    };
+    httpd_uri_t session_chunk = {
+        .uri = "/api/fs/session/chunk",
+        .method = HTTP_PUT,
+        .handler = http_fs_session_chunk,
+        .user_ctx = NULL,
+    };
+    httpd_uri_t session_commit = {
+        .uri = "/api/fs/session/commit",
+        .method = HTTP_POST,
+        .handler = http_fs_session_commit,
+        .user_ctx = NULL,
+    };
+    httpd_uri_t session_abort = {
+        .uri = "/api/fs/session/abort",
+        .method = HTTP_POST,
+        .handler = http_fs_session_abort,
+        .user_ctx = NULL,
+    };
+    httpd_uri_t signature = {
+        .uri = "/api/fs/signature",
+        .method = HTTP_GET,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_signature,
+    };
+    httpd_uri_t delta = {
+        .uri = "/api/fs/delta",
+        .method = HTTP_POST,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_delta,
+    };
+    httpd_uri_t hash_get = {
+        .uri = "/api/fs/hash",
+        .method = HTTP_GET,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_hash,
+    };
+    httpd_uri_t hash_head = {
+        .uri = "/api/fs/hash",
+        .method = HTTP_HEAD,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_hash,
+    };
+    httpd_uri_t meta = {
+        .uri = "/api/fs/meta",
+        .method = HTTP_GET,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_meta,
+    };
+    httpd_uri_t lines = {
+        .uri = "/api/fs/lines",
+        .method = HTTP_GET,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_lines,
+    };
+    httpd_uri_t manifest = {
+        .uri = "/api/fs/manifest",
+        .method = HTTP_GET,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_manifest,
+    };
+    httpd_uri_t plan = {
+        .uri = "/api/fs/plan",
+        .method = HTTP_POST,
+        .handler = http_workers_dispatch,
+        .user_ctx = (void *)&k_work_plan,
+    };
+    httpd_uri_t changes = {
+        .uri = "/api/fs/changes",
+        .method = HTTP_GET,
+        .handler = http_fs_changes,
+        .user_ctx = NULL,
+    };
     httpd_uri_t usb_detach = {
         .uri = "/api/usb/detach",
         .method = HTTP_POST,
@@ -2003,11 +6347,28 @@ esp_err_t web_fs_register_handlers(httpd_handle_t server)
     httpd_register_uri_handler(server, &list);
     httpd_register_uri_handler(server, &upload);
     httpd_register_uri_handler(server, &upload_raw);
+    httpd_register_uri_handler(server, &upload_tar);
     httpd_register_uri_handler(server, &download);
+    httpd_register_uri_handler(server, &archive);
     httpd_register_uri_handler(server, &mkdir_req);
     httpd_register_uri_handler(server, &del_req);
     httpd_register_uri_handler(server, &rename_req);
+    httpd_register_uri_handler(server, &session_create);
+    httpd_register_uri_handler(server, &session_status);
+    httpd_register_uri_handler(server, &session_chunk);
+    httpd_register_uri_handler(server, &session_commit);
+    httpd_register_uri_handler(server, &session_abort);
+    httpd_register_uri_handler(server, &signature);
+    httpd_register_uri_handler(server, &delta);
+    httpd_register_uri_handler(server, &hash_get);
+    httpd_register_uri_handler(server, &hash_head);
+    httpd_register_uri_handler(server, &meta);
+    httpd_register_uri_handler(server, &lines);
+    httpd_register_uri_handler(server, &manifest);
+    httpd_register_uri_handler(server, &plan);
+    httpd_register_uri_handler(server, &changes);
     httpd_register_uri_handler(server, &usb_detach);
     httpd_register_uri_handler(server, &usb_attach);
+    fs_journal_set_listener(journal_to_ws);
     return ESP_OK;
 }
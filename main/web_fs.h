@@ -1,9 +1,63 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "esp_err.h"
 #include "esp_http_server.h"
 
 esp_err_t web_fs_register_handlers(httpd_handle_t server);
 bool web_fs_is_busy(void);
+
+// Whole-file transfers for callers without an HTTP request (the raw-TCP bulk
+// server), through the same upload writer and download reader as the HTTP
+// handlers and under the same gate and file-operation lock.
+typedef struct
+{
+    // Returns bytes received (> 0), or <= 0 on error / closed connection.
+    int (*recv)(void *ctx, uint8_t *buf, size_t len);
+    bool (*send)(void *ctx, const uint8_t *data, size_t len);
+    // Called once the transfer is accepted, before any payload moves: size is
+    // the payload that follows (put: expected from the peer, get: the file).
+    bool (*begin)(void *ctx, uint64_t size);
+    void *ctx;
+} web_fs_stream_t;
+
+// Both return an HTTP-style status (200 on success) and set *err to the API
+// error code ("FILE_EXISTS", "NOT_FOUND", ...) otherwise. If the error comes
+// after begin, the payload was cut short and the connection is out of sync.
+int web_fs_stream_put(const char *path, uint64_t size, bool overwrite, uint64_t mtime_ms,
+                      const web_fs_stream_t *io, uint8_t digest[32], const char **err);
+int web_fs_stream_get(const char *path, const web_fs_stream_t *io, uint64_t *sent, const char **err);
+
+// Transfer totals since boot, over all HTTP and bulk-server transfers. Stage
+// times are summed per transfer: upload recv = socket reads on the request
+// side, write = the writer task's card writes (hash/analyse included);
+// download read = card reads, send = socket sends (deflate included).
+typedef struct
+{
+    uint32_t uploads;
+    uint32_t upload_write_errors;
+    uint64_t upload_bytes;
+    uint64_t upload_recv_us;
+    uint64_t upload_write_us;
+    uint64_t upload_wall_us;
+    uint32_t upload_last_kbps;
+    uint32_t downloads;
+    uint32_t download_send_errors;
+    uint64_t download_bytes;
+    uint64_t download_read_us;
+    uint64_t download_send_us;
+    uint64_t download_wall_us;
+    uint32_t download_last_kbps;
+    // Gzip-encoded downloads: plain / wire bytes is the compression ratio;
+    // deflate time excludes the socket sends inside the deflater's sink.
+    uint32_t gzip_sidecar;
+    uint32_t gzip_live;
+    uint64_t gzip_plain_bytes;
+    uint64_t gzip_wire_bytes;
+    uint64_t gzip_deflate_us;
+} web_fs_stats_t;
+
+void web_fs_get_stats(web_fs_stats_t *out);
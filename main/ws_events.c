@@ -0,0 +1,129 @@
+#include "ws_events.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "WS"
+#define WS_RX_MAX 128
+
+// The client table is only modified on the httpd task (handshakes, failed
+// sends); other tasks just read the count and hand their messages over.
+static httpd_handle_t s_server = NULL;
+static TaskHandle_t s_httpd_task = NULL;
+static int s_fds[WS_EVENTS_MAX_CLIENTS];
+static volatile int s_count = 0;
+
+static void drop_client(int slot)
+{
+    ESP_LOGI(TAG, "client fd=%d gone", s_fds[slot]);
+    s_fds[slot] = s_fds[s_count - 1];
+    s_count--;
+}
+
+static bool add_client(int fd)
+{
+    for (int i = 0; i < s_count; ++i) {
+        if (s_fds[i] == fd) {
+            return true;
+        }
+    }
+    if (s_count >= WS_EVENTS_MAX_CLIENTS) {
+        return false;
+    }
+    s_fds[s_count++] = fd;
+    return true;
+}
+
+static void send_all(const char *json)
+{
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)json,
+        .len = strlen(json),
+    };
+    for (int i = s_count - 1; i >= 0; --i) {
+        // A closed socket's fd may already belong to a plain HTTP client.
+        if (httpd_ws_get_fd_info(s_server, s_fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET ||
+            httpd_ws_send_frame_async(s_server, s_fds[i], &frame) != ESP_OK) {
+            drop_client(i);
+        }
+    }
+}
+
+static void send_work(void *arg)
+{
+    send_all((const char *)arg);
+    free(arg);
+}
+
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_GET) {
+        // Handshake: from here on the connection belongs to the WS layer.
+        s_httpd_task = xTaskGetCurrentTaskHandle();
+        int fd = httpd_req_to_sockfd(req);
+        if (!add_client(fd)) {
+            ESP_LOGW(TAG, "client fd=%d refused, %d connected", fd, s_count);
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "client fd=%d connected (%d)", fd, s_count);
+        return ESP_OK;
+    }
+    httpd_ws_frame_t frame = {0};
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK || frame.len == 0) {
+        return err;
+    }
+    if (frame.len > WS_RX_MAX) {
+        return ESP_FAIL;
+    }
+    uint8_t buf[WS_RX_MAX];
+    frame.payload = buf;
+    return httpd_ws_recv_frame(req, &frame, frame.len);
+}
+
+esp_err_t ws_events_register(httpd_handle_t server)
+{
+    if (!server) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_server = server;
+    s_httpd_task = NULL;
+    s_count = 0;
+    httpd_uri_t ws = {
+        .uri = "/ws",
+        .method = HTTP_GET,
+        .handler = ws_handler,
+        .user_ctx = NULL,
+        .is_websocket = true,
+    };
+    return httpd_register_uri_handler(server, &ws);
+}
+
+bool ws_events_has_clients(void)
+{
+    return s_count > 0;
+}
+
+void ws_events_publish(const char *json)
+{
+    if (!json || s_count == 0 || !s_server) {
+        return;
+    }
+    if (xTaskGetCurrentTaskHandle() == s_httpd_task) {
+        send_all(json);
+        return;
+    }
+    char *copy = strdup(json);
+    if (!copy) {
+        return;
+    }
+    if (httpd_queue_work(s_server, send_work, copy) != ESP_OK) {
+        free(copy);
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Push channel for the web UI: /ws is a WebSocket that only carries
+// server-to-client JSON text frames (transfer progress, USB mode, Wi-Fi
+// signal, file changes). Messages sent by clients are read and dropped.
+
+#define WS_EVENTS_MAX_CLIENTS 3
+
+// Registers /ws on `server`; call again after the server was restarted.
+esp_err_t ws_events_register(httpd_handle_t server);
+// Cheap check so publishers can skip formatting when nobody listens.
+bool ws_events_has_clients(void);
+// Sends `json` to every connected client. Safe from any task: on the httpd
+// task the frame goes out directly, elsewhere it is queued to that task.
+void ws_events_publish(const char *json);
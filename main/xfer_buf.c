@@ -0,0 +1,159 @@
+#include "xfer_buf.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+#define TAG "XFER_BUF"
+#define XFER_SLOT_SIZE 4096
+#define XFER_MAX_SLOTS 64 // one bit per slot in a uint64_t
+
+#ifndef XFER_PSRAM_ARENA_SIZE
+#define XFER_PSRAM_ARENA_SIZE (256 * 1024)
+#endif
+#ifndef XFER_DMA_POOL_SIZE
+#define XFER_DMA_POOL_SIZE (64 * 1024)
+#endif
+
+typedef struct {
+    const char *name;
+    uint32_t caps;
+    size_t want;
+    uint8_t *base;
+    uint32_t slots;
+    uint64_t used;                // bit per slot
+    uint8_t run[XFER_MAX_SLOTS];  // lease length in slots, at its first slot
+    xfer_buf_stats_t stats;
+} xfer_pool_t;
+
+static xfer_pool_t s_pools[XFER_BUF_POOL_COUNT] = {
+    [XFER_BUF_PSRAM] = {.name = "psram", .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, .want = XFER_PSRAM_ARENA_SIZE},
+    [XFER_BUF_DMA] = {.name = "dma", .caps = MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+                      .want = XFER_DMA_POOL_SIZE},
+};
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t xfer_buf_init(void)
+{
+    esp_err_t ret = ESP_OK;
+    for (int i = 0; i < XFER_BUF_POOL_COUNT; ++i) {
+        xfer_pool_t *p = &s_pools[i];
+        if (p->base) {
+            continue;
+        }
+        size_t slots = p->want / XFER_SLOT_SIZE;
+        if (slots > XFER_MAX_SLOTS) {
+            slots = XFER_MAX_SLOTS;
+        }
+        p->base = heap_caps_malloc(slots * XFER_SLOT_SIZE, p->caps);
+        if (!p->base) {
+            ESP_LOGW(TAG, "%s pool: no memory for %u KB, leases go to the heap", p->name,
+                     (unsigned)(slots * XFER_SLOT_SIZE / 1024));
+            ret = ESP_ERR_NO_MEM;
+            continue;
+        }
+        p->slots = (uint32_t)slots;
+        p->stats.size = (uint32_t)(slots * XFER_SLOT_SIZE);
+        ESP_LOGI(TAG, "%s pool: %u KB", p->name, (unsigned)(p->stats.size / 1024));
+    }
+    return ret;
+}
+
+// First run of `count` free slots, -1 if there is none. Called locked.
+static int find_run_locked(const xfer_pool_t *p, uint32_t count)
+{
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < p->slots; ++i) {
+        if (p->used & (1ULL << i)) {
+            len = 0;
+            continue;
+        }
+        if (++len == count) {
+            return (int)(i + 1 - count);
+        }
+    }
+    return -1;
+}
+
+void *xfer_buf_lease(xfer_buf_pool_t pool, size_t size)
+{
+    if (pool >= XFER_BUF_POOL_COUNT || size == 0) {
+        return NULL;
+    }
+    xfer_pool_t *p = &s_pools[pool];
+    uint32_t count = (uint32_t)((size + XFER_SLOT_SIZE - 1) / XFER_SLOT_SIZE);
+    void *buf = NULL;
+    portENTER_CRITICAL(&s_mux);
+    int first = p->base && count <= p->slots ? find_run_locked(p, count) : -1;
+    if (first >= 0) {
+        uint64_t mask = (count == 64 ? ~0ULL : ((1ULL << count) - 1)) << first;
+        p->used |= mask;
+        p->run[first] = (uint8_t)count;
+        p->stats.leases++;
+        p->stats.in_use += count * XFER_SLOT_SIZE;
+        if (p->stats.in_use > p->stats.peak) {
+            p->stats.peak = p->stats.in_use;
+        }
+        buf = p->base + (size_t)first * XFER_SLOT_SIZE;
+    }
+    portEXIT_CRITICAL(&s_mux);
+    if (buf) {
+        return buf;
+    }
+
+    buf = heap_caps_malloc(size, p->caps);
+    if (!buf && pool == XFER_BUF_PSRAM) {
+        buf = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    portENTER_CRITICAL(&s_mux);
+    if (buf) {
+        p->stats.fallbacks++;
+    } else {
+        p->stats.failures++;
+    }
+    portEXIT_CRITICAL(&s_mux);
+    return buf;
+}
+
+void xfer_buf_release(void *buf)
+{
+    if (!buf) {
+        return;
+    }
+    uint8_t *ptr = (uint8_t *)buf;
+    for (int i = 0; i < XFER_BUF_POOL_COUNT; ++i) {
+        xfer_pool_t *p = &s_pools[i];
+        if (!p->base || ptr < p->base || ptr >= p->base + (size_t)p->slots * XFER_SLOT_SIZE) {
+            continue;
+        }
+        uint32_t first = (uint32_t)((ptr - p->base) / XFER_SLOT_SIZE);
+        portENTER_CRITICAL(&s_mux);
+        uint32_t count = p->run[first];
+        uint64_t mask = (count == 64 ? ~0ULL : ((1ULL << count) - 1)) << first;
+        p->used &= ~mask;
+        p->run[first] = 0;
+        p->stats.in_use -= count * XFER_SLOT_SIZE;
+        portEXIT_CRITICAL(&s_mux);
+        return;
+    }
+    heap_caps_free(buf);
+}
+
+void xfer_buf_get_stats(xfer_buf_pool_t pool, xfer_buf_stats_t *out)
+{
+    if (pool >= XFER_BUF_POOL_COUNT) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    portENTER_CRITICAL(&s_mux);
+    *out = s_pools[pool].stats;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+const char *xfer_buf_pool_name(xfer_buf_pool_t pool)
+{
+    return pool < XFER_BUF_POOL_COUNT ? s_pools[pool].name : "unknown";
+}
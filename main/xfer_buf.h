@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Shared transfer buffers. Two pools are carved once at boot, before the card
+// is mounted, so they never fragment:
+//  - XFER_BUF_PSRAM: the large arena in PSRAM for network-side buffers
+//    (receive, parse, download chunks, archive staging);
+//  - XFER_BUF_DMA: a small internal DMA-capable pool for buffers the card
+//    driver reads or writes directly (FATFS stdio buffer of an upload, the
+//    MSC sector cache, sdtest/sdbench). USB and web uploads never run at the
+//    same time, so the MSC cache and the upload buffer take turns in it.
+// Leases are whole 4 KB slots. When a pool is exhausted, or the request is
+// larger than the pool, the lease falls back to the heap with the same
+// capabilities (PSRAM leases finally to internal RAM), so callers only see
+// NULL when memory is really gone.
+
+typedef enum {
+    XFER_BUF_PSRAM,
+    XFER_BUF_DMA,
+    XFER_BUF_POOL_COUNT,
+} xfer_buf_pool_t;
+
+typedef struct {
+    uint32_t size;        // pool bytes, 0 when it could not be allocated
+    uint32_t in_use;      // bytes leased from the pool right now
+    uint32_t peak;        // highest in_use since boot
+    uint32_t leases;      // served from the pool
+    uint32_t fallbacks;   // served from the heap instead
+    uint32_t failures;    // NULL returned
+} xfer_buf_stats_t;
+
+esp_err_t xfer_buf_init(void);
+void *xfer_buf_lease(xfer_buf_pool_t pool, size_t size);
+// Takes pool and heap buffers alike; NULL is ignored.
+void xfer_buf_release(void *buf);
+void xfer_buf_get_stats(xfer_buf_pool_t pool, xfer_buf_stats_t *out);
+const char *xfer_buf_pool_name(xfer_buf_pool_t pool);
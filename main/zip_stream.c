@@ -0,0 +1,231 @@
+#include "zip_stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_heap_caps.h"
+
+#define ZIP_SIG_LOCAL 0x04034b50u
+#define ZIP_SIG_DESCRIPTOR 0x08074b50u
+#define ZIP_SIG_CENTRAL 0x02014b50u
+#define ZIP_SIG_END 0x06054b50u
+#define ZIP_SIG_END64 0x06064b50u
+#define ZIP_SIG_LOCATOR64 0x07064b50u
+#define ZIP_FLAG_DESCRIPTOR 0x0008
+#define ZIP_FLAG_UTF8 0x0800
+#define ZIP_VERSION 20
+#define ZIP_VERSION64 45
+#define ZIP_NAME_MAX 255
+#define ZIP_GROW 64
+
+typedef struct {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t crc;
+    uint32_t name_off;
+    uint16_t name_len;
+    uint16_t dos_time;
+    uint16_t dos_date;
+    bool is_dir;
+} zip_entry_t;
+
+struct zip_writer {
+    zip_entry_t *entries;
+    uint32_t count;
+    uint32_t cap;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+};
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+    p = put16(p, (uint16_t)v);
+    return put16(p, (uint16_t)(v >> 16));
+}
+
+static uint8_t *put64(uint8_t *p, uint64_t v)
+{
+    p = put32(p, (uint32_t)v);
+    return put32(p, (uint32_t)(v >> 32));
+}
+
+static void *grow(void *ptr, size_t size)
+{
+    void *p = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p ? p : realloc(ptr, size);
+}
+
+static void dos_datetime(int64_t mtime, uint16_t *dos_time, uint16_t *dos_date)
+{
+    time_t t = (time_t)mtime;
+    struct tm tm;
+    if (mtime <= 0 || !gmtime_r(&t, &tm) || tm.tm_year < 80) {
+        // 1980-01-01 00:00, the earliest DOS date.
+        *dos_time = 0;
+        *dos_date = (1 << 5) | 1;
+        return;
+    }
+    *dos_time = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+    *dos_date = (uint16_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+}
+
+zip_writer_t *zip_writer_create(void)
+{
+    return calloc(1, sizeof(zip_writer_t));
+}
+
+void zip_writer_destroy(zip_writer_t *zw)
+{
+    if (!zw) {
+        return;
+    }
+    free(zw->entries);
+    free(zw->names);
+    free(zw);
+}
+
+uint32_t zip_writer_count(const zip_writer_t *zw)
+{
+    return zw->count;
+}
+
+size_t zip_writer_begin(zip_writer_t *zw, uint8_t *out, const char *name, bool is_dir, uint64_t size,
+                        int64_t mtime, uint64_t offset)
+{
+    size_t len = strlen(name) + (is_dir ? 1 : 0);
+    if (len == 0 || len > ZIP_NAME_MAX || size > UINT32_MAX) {
+        return 0;
+    }
+    if (zw->count == zw->cap) {
+        zip_entry_t *e = grow(zw->entries, (zw->cap + ZIP_GROW) * sizeof(zip_entry_t));
+        if (!e) {
+            return 0;
+        }
+        zw->entries = e;
+        zw->cap += ZIP_GROW;
+    }
+    if (zw->names_len + len > zw->names_cap) {
+        size_t cap = zw->names_cap ? zw->names_cap * 2 : 4096;
+        while (cap < zw->names_len + len) {
+            cap *= 2;
+        }
+        char *n = grow(zw->names, cap);
+        if (!n) {
+            return 0;
+        }
+        zw->names = n;
+        zw->names_cap = cap;
+    }
+    zip_entry_t *e = &zw->entries[zw->count++];
+    memset(e, 0, sizeof(*e));
+    e->offset = offset;
+    e->size = is_dir ? 0 : (uint32_t)size;
+    e->is_dir = is_dir;
+    e->name_off = (uint32_t)zw->names_len;
+    e->name_len = (uint16_t)len;
+    memcpy(zw->names + zw->names_len, name, len);
+    if (is_dir) {
+        zw->names[zw->names_len + len - 1] = '/';
+    }
+    zw->names_len += len;
+    dos_datetime(mtime, &e->dos_time, &e->dos_date);
+
+    uint8_t *p = put32(out, ZIP_SIG_LOCAL);
+    p = put16(p, ZIP_VERSION);
+    p = put16(p, ZIP_FLAG_UTF8 | (is_dir ? 0 : ZIP_FLAG_DESCRIPTOR));
+    p = put16(p, 0);
+    p = put16(p, e->dos_time);
+    p = put16(p, e->dos_date);
+    p = put32(p, 0);
+    // Sizes are known up front (stored method), which helps streaming
+    // readers; the CRC follows in the data descriptor.
+    p = put32(p, e->size);
+    p = put32(p, e->size);
+    p = put16(p, e->name_len);
+    p = put16(p, 0);
+    memcpy(p, zw->names + e->name_off, len);
+    return (size_t)(p - out) + len;
+}
+
+size_t zip_writer_end(zip_writer_t *zw, uint8_t *out, uint32_t crc)
+{
+    zip_entry_t *e = &zw->entries[zw->count - 1];
+    e->crc = crc;
+    uint8_t *p = put32(out, ZIP_SIG_DESCRIPTOR);
+    p = put32(p, crc);
+    p = put32(p, e->size);
+    p = put32(p, e->size);
+    return (size_t)(p - out);
+}
+
+size_t zip_writer_central(const zip_writer_t *zw, uint32_t index, uint8_t *out)
+{
+    const zip_entry_t *e = &zw->entries[index];
+    bool offset64 = e->offset >= UINT32_MAX;
+    uint8_t *p = put32(out, ZIP_SIG_CENTRAL);
+    p = put16(p, offset64 ? ZIP_VERSION64 : ZIP_VERSION);
+    p = put16(p, offset64 ? ZIP_VERSION64 : ZIP_VERSION);
+    p = put16(p, ZIP_FLAG_UTF8 | (e->is_dir ? 0 : ZIP_FLAG_DESCRIPTOR));
+    p = put16(p, 0);
+    p = put16(p, e->dos_time);
+    p = put16(p, e->dos_date);
+    p = put32(p, e->crc);
+    p = put32(p, e->size);
+    p = put32(p, e->size);
+    p = put16(p, e->name_len);
+    p = put16(p, offset64 ? 12 : 0);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put32(p, e->is_dir ? 0x10 : 0);
+    p = put32(p, offset64 ? UINT32_MAX : (uint32_t)e->offset);
+    memcpy(p, zw->names + e->name_off, e->name_len);
+    p += e->name_len;
+    if (offset64) {
+        p = put16(p, 0x0001);
+        p = put16(p, 8);
+        p = put64(p, e->offset);
+    }
+    return (size_t)(p - out);
+}
+
+size_t zip_writer_finish(const zip_writer_t *zw, uint8_t *out, uint64_t cd_offset, uint64_t cd_size)
+{
+    uint8_t *p = out;
+    bool need64 = zw->count >= UINT16_MAX || cd_offset >= UINT32_MAX || cd_size >= UINT32_MAX;
+    if (need64) {
+        uint64_t end64_offset = cd_offset + cd_size;
+        p = put32(p, ZIP_SIG_END64);
+        p = put64(p, 44);
+        p = put16(p, ZIP_VERSION64);
+        p = put16(p, ZIP_VERSION64);
+        p = put32(p, 0);
+        p = put32(p, 0);
+        p = put64(p, zw->count);
+        p = put64(p, zw->count);
+        p = put64(p, cd_size);
+        p = put64(p, cd_offset);
+        p = put32(p, ZIP_SIG_LOCATOR64);
+        p = put32(p, 0);
+        p = put64(p, end64_offset);
+        p = put32(p, 1);
+    }
+    p = put32(p, ZIP_SIG_END);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, need64 ? UINT16_MAX : (uint16_t)zw->count);
+    p = put16(p, need64 ? UINT16_MAX : (uint16_t)zw->count);
+    p = put32(p, need64 ? UINT32_MAX : (uint32_t)cd_size);
+    p = put32(p, need64 ? UINT32_MAX : (uint32_t)cd_offset);
+    p = put16(p, 0);
+    return (size_t)(p - out);
+}
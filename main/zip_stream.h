@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming writer for stored (uncompressed) zip archives. Entry data is
+// written by the caller between zip_writer_begin() and zip_writer_end();
+// the CRC goes into a trailing data descriptor, so nothing has to be read
+// twice. Only the central directory records (a few dozen bytes per entry)
+// are kept until the end. Zip64 records are added once offsets or the
+// entry count outgrow the classic format.
+
+#define ZIP_LOCAL_HEADER_MAX (30 + 256)
+#define ZIP_DESCRIPTOR_LEN 16
+#define ZIP_CENTRAL_MAX (46 + 256 + 12)
+#define ZIP_END_MAX (56 + 20 + 22)
+
+typedef struct zip_writer zip_writer_t;
+
+zip_writer_t *zip_writer_create(void);
+void zip_writer_destroy(zip_writer_t *zw);
+
+// Local header for an entry starting at archive offset `offset`; returns
+// its length, 0 on a too long name or when out of memory.
+size_t zip_writer_begin(zip_writer_t *zw, uint8_t *out, const char *name, bool is_dir, uint64_t size,
+                        int64_t mtime, uint64_t offset);
+// Data descriptor closing the current file entry.
+size_t zip_writer_end(zip_writer_t *zw, uint8_t *out, uint32_t crc);
+
+uint32_t zip_writer_count(const zip_writer_t *zw);
+// Central directory record for entry `index` (0 .. count-1).
+size_t zip_writer_central(const zip_writer_t *zw, uint32_t index, uint8_t *out);
+// End of central directory (with zip64 records when needed).
+size_t zip_writer_finish(const zip_writer_t *zw, uint8_t *out, uint64_t cd_offset, uint64_t cd_size);
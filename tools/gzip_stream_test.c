@@ -0,0 +1,261 @@
+/*
+ * Host test for main/gzip_stream.c: round-trips `gzip -c` output of many
+ * sizes through gzip_reader (fed in several chunk sizes, so the trailer
+ * lands at every offset of the input buffer), checks that corrupt or
+ * truncated streams fail, and that gzip_writer output passes `gzip -dc`.
+ *
+ * Needs gzip in PATH and miniz.c of miniz 1.15, the release in the ROM
+ * (see tools/host/rom/miniz.h):
+ *
+ *   cc -O2 -Itools/host -Imain -I$MINIZ -o gzip_stream_test \
+ *      tools/gzip_stream_test.c main/gzip_stream.c $MINIZ/miniz.c
+ *   ./gzip_stream_test
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gzip_stream.h"
+
+static int s_failed;
+static int s_passed;
+
+#define CHECK(cond, ...)                                                                                           \
+    do {                                                                                                           \
+        if (cond) {                                                                                                \
+            s_passed++;                                                                                            \
+        } else {                                                                                                   \
+            s_failed++;                                                                                            \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);                                                   \
+            fprintf(stderr, __VA_ARGS__);                                                                          \
+            fputc('\n', stderr);                                                                                   \
+        }                                                                                                          \
+    } while (0)
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    size_t chunk;
+} mem_src_t;
+
+static int mem_src(void *ctx, uint8_t *dst, size_t len)
+{
+    mem_src_t *m = ctx;
+    size_t n = m->len - m->pos;
+    if (n > len) {
+        n = len;
+    }
+    if (n > m->chunk) {
+        n = m->chunk;
+    }
+    memcpy(dst, m->data + m->pos, n);
+    m->pos += n;
+    return (int)n;
+}
+
+typedef enum {
+    DATA_GCODE,
+    DATA_RANDOM,
+    DATA_ZEROS,
+} data_kind_t;
+
+static uint8_t *make_data(data_kind_t kind, size_t len, uint32_t seed)
+{
+    uint8_t *buf = malloc(len ? len : 1);
+    uint32_t x = seed * 2654435761u + 1;
+    size_t pos = 0;
+    while (pos < len) {
+        x = x * 1103515245u + 12345u;
+        if (kind == DATA_RANDOM) {
+            buf[pos++] = (uint8_t)(x >> 16);
+        } else if (kind == DATA_ZEROS) {
+            buf[pos++] = 0;
+        } else {
+            char line[64];
+            int n = snprintf(line, sizeof(line), "G1 X%u.%03u Y%u.%03u F%u\n", (x >> 8) % 300, x % 1000,
+                             (x >> 12) % 200, (x >> 4) % 1000, 600 + (x >> 20) % 4 * 300);
+            for (int i = 0; i < n && pos < len; ++i) {
+                buf[pos++] = (uint8_t)line[i];
+            }
+        }
+    }
+    return buf;
+}
+
+// Runs data through the system gzip; returns the compressed stream.
+static uint8_t *system_gzip(const uint8_t *data, size_t len, const char *level, size_t *out_len)
+{
+    char path[] = "/tmp/gzip_stream_test.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, data, len) != (ssize_t)len) {
+        perror("tmp file");
+        exit(2);
+    }
+    close(fd);
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "gzip -c %s %s", level, path);
+    FILE *p = popen(cmd, "r");
+    if (!p) {
+        perror("gzip");
+        exit(2);
+    }
+    size_t cap = len + len / 8 + 1024;
+    uint8_t *gz = malloc(cap);
+    size_t n = 0;
+    size_t got;
+    while ((got = fread(gz + n, 1, cap - n, p)) > 0) {
+        n += got;
+        if (n == cap) {
+            cap *= 2;
+            gz = realloc(gz, cap);
+        }
+    }
+    pclose(p);
+    unlink(path);
+    *out_len = n;
+    return gz;
+}
+
+// Decodes the whole stream; returns the last gzip_reader_read() result
+// (0 when the trailer checked out) and the output in *out.
+static int decode(const uint8_t *gz, size_t gz_len, size_t chunk, uint8_t **out, size_t *out_len,
+                  uint64_t *consumed)
+{
+    mem_src_t src = {.data = gz, .len = gz_len, .chunk = chunk};
+    gzip_reader_t *r = gzip_reader_create(mem_src, &src);
+    size_t cap = 64 * 1024;
+    size_t n = 0;
+    uint8_t *buf = malloc(cap);
+    int ret;
+    while (true) {
+        if (cap - n < 4096) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+        ret = gzip_reader_read(r, buf + n, 4096);
+        if (ret <= 0) {
+            break;
+        }
+        n += (size_t)ret;
+    }
+    *consumed = gzip_reader_consumed(r);
+    gzip_reader_destroy(r);
+    *out = buf;
+    *out_len = n;
+    return ret;
+}
+
+static void test_reader(data_kind_t kind, size_t len, const char *level)
+{
+    static const size_t chunks[] = {1, 3, 509, 4096, SIZE_MAX};
+    uint8_t *data = make_data(kind, len, (uint32_t)len);
+    size_t gz_len = 0;
+    uint8_t *gz = system_gzip(data, len, level, &gz_len);
+
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+        // Byte-at-a-time is slow on the big inputs and adds nothing there.
+        if (chunks[c] == 1 && len > 70000) {
+            continue;
+        }
+        uint8_t *out = NULL;
+        size_t out_len = 0;
+        uint64_t consumed = 0;
+        int ret = decode(gz, gz_len, chunks[c], &out, &out_len, &consumed);
+        CHECK(ret == 0, "kind %d len %zu %s chunk %zu: read returned %d", kind, len, level, chunks[c], ret);
+        CHECK(out_len == len && memcmp(out, data, len) == 0, "kind %d len %zu %s chunk %zu: output differs",
+              kind, len, level, chunks[c]);
+        CHECK(consumed == gz_len, "kind %d len %zu %s chunk %zu: consumed %llu of %zu", kind, len, level,
+              chunks[c], (unsigned long long)consumed, gz_len);
+        free(out);
+    }
+
+    // A flipped CRC bit and a missing last byte must both be rejected.
+    uint8_t *out = NULL;
+    size_t out_len = 0;
+    uint64_t consumed = 0;
+    gz[gz_len - 8] ^= 0x01;
+    CHECK(decode(gz, gz_len, 4096, &out, &out_len, &consumed) < 0, "kind %d len %zu: bad CRC accepted", kind, len);
+    free(out);
+    gz[gz_len - 8] ^= 0x01;
+    CHECK(decode(gz, gz_len - 1, 4096, &out, &out_len, &consumed) < 0, "kind %d len %zu: truncation accepted",
+          kind, len);
+    free(out);
+
+    free(gz);
+    free(data);
+}
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+} mem_sink_t;
+
+static bool mem_sink(void *ctx, const uint8_t *data, size_t len)
+{
+    mem_sink_t *m = ctx;
+    if (m->len + len > m->cap) {
+        m->cap = (m->len + len) * 2;
+        m->buf = realloc(m->buf, m->cap);
+    }
+    memcpy(m->buf + m->len, data, len);
+    m->len += len;
+    return true;
+}
+
+static void test_writer(data_kind_t kind, size_t len)
+{
+    uint8_t *data = make_data(kind, len, (uint32_t)len + 7);
+    mem_sink_t sink = {0};
+    gzip_writer_t *w = gzip_writer_create(mem_sink, &sink, NULL, 0);
+    bool ok = w != NULL;
+    for (size_t pos = 0; ok && pos < len; pos += 3000) {
+        ok = gzip_writer_write(w, data + pos, len - pos < 3000 ? len - pos : 3000);
+    }
+    ok = ok && gzip_writer_finish(w);
+    gzip_writer_destroy(w);
+    CHECK(ok, "writer kind %d len %zu failed", kind, len);
+
+    char path[] = "/tmp/gzip_stream_test.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, sink.buf, sink.len) != (ssize_t)sink.len) {
+        perror("tmp file");
+        exit(2);
+    }
+    close(fd);
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "gzip -dc < %s", path);
+    FILE *p = popen(cmd, "r");
+    uint8_t *out = malloc(len + 1);
+    size_t n = fread(out, 1, len + 1, p);
+    int status = pclose(p);
+    unlink(path);
+    CHECK(status == 0 && n == len && memcmp(out, data, len) == 0, "writer kind %d len %zu: gzip -dc mismatch", kind,
+          len);
+    free(out);
+    free(sink.buf);
+    free(data);
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {0,    1,    2,     3,     17,     1000,   4095,      4096,
+                                   4097, 8191, 32768, 65537, 300000, 999983, 1u << 21};
+    static const char *levels[] = {"-1", "-6", "-9"};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+            test_reader(DATA_GCODE, sizes[i], levels[l]);
+        }
+        test_reader(DATA_RANDOM, sizes[i], "-6");
+        test_reader(DATA_ZEROS, sizes[i], "-6");
+        test_writer(DATA_GCODE, sizes[i]);
+        test_writer(DATA_RANDOM, sizes[i]);
+    }
+    printf("%d passed, %d failed\n", s_passed, s_failed);
+    return s_failed ? 1 : 0;
+}
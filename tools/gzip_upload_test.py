@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Uploads real `gzip -c` bodies to upload_raw and checks what lands on the card.
+
+For each size the file is compressed with the system gzip and sent once
+with ?gz=1 and once with Content-Encoding: gzip; the reply must report the
+plain and compressed sizes, and a plain download must return the original
+bytes. A body with a corrupted CRC must be answered 400 BAD_GZIP and leave
+no file behind.
+
+    python3 tools/gzip_upload_test.py --host wimill.local
+"""
+
+import argparse
+import http.client
+import json
+import os
+import subprocess
+import sys
+import urllib.parse
+
+SIZES = [1, 1000, 4095, 4096, 65537, 1048576, 8 * 1048576]
+
+
+def gcode(size, seed):
+    lines = []
+    n = 0
+    x = seed
+    while n < size:
+        x = (x * 1103515245 + 12345) & 0xFFFFFFFF
+        line = "G1 X%d.%03d Y%d.%03d F%d\n" % ((x >> 8) % 300, x % 1000, (x >> 12) % 200, (x >> 4) % 1000,
+                                              600 + (x >> 20) % 4 * 300)
+        lines.append(line)
+        n += len(line)
+    return "".join(lines).encode()[:size]
+
+
+def gzip_c(data):
+    return subprocess.run(["gzip", "-c"], input=data, stdout=subprocess.PIPE, check=True).stdout
+
+
+def upload(host, port, path, body, via_header):
+    folder, name = path.rsplit("/", 1)
+    params = {"path": folder or "/", "name": name, "overwrite": "1"}
+    headers = {"Content-Type": "application/octet-stream"}
+    if via_header:
+        headers["Content-Encoding"] = "gzip"
+    else:
+        params["gz"] = "1"
+    conn = http.client.HTTPConnection(host, port, timeout=120)
+    conn.request("POST", "/api/fs/upload_raw?" + urllib.parse.urlencode(params), body=body, headers=headers)
+    resp = conn.getresponse()
+    status, reply = resp.status, resp.read()
+    conn.close()
+    return status, reply
+
+
+def download(host, port, path):
+    conn = http.client.HTTPConnection(host, port, timeout=120)
+    conn.request("GET", "/api/fs/download?" + urllib.parse.urlencode({"path": path}))
+    resp = conn.getresponse()
+    status, body = resp.status, resp.read()
+    conn.close()
+    return status, body
+
+
+def delete(host, port, path):
+    conn = http.client.HTTPConnection(host, port, timeout=15)
+    conn.request("POST", "/api/fs/delete", body=json.dumps({"path": path}),
+                 headers={"Content-Type": "application/json"})
+    conn.getresponse().read()
+    conn.close()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--host", default="wimill.local")
+    ap.add_argument("--port", type=int, default=80)
+    ap.add_argument("--path", default="/gztest.nc")
+    args = ap.parse_args()
+
+    failures = 0
+
+    def check(ok, what):
+        nonlocal failures
+        print("%-4s %s" % ("ok" if ok else "FAIL", what))
+        if not ok:
+            failures += 1
+
+    cases = [(size, gcode(size, size)) for size in SIZES] + [(65536, os.urandom(65536))]
+    for size, data in cases:
+        body = gzip_c(data)
+        for via_header in (False, True):
+            what = "%d B -> %d B gz via %s" % (size, len(body), "header" if via_header else "gz=1")
+            status, reply = upload(args.host, args.port, args.path, body, via_header)
+            if status != 200:
+                check(False, "%s: upload %d %s" % (what, status, reply[:200]))
+                continue
+            info = json.loads(reply)
+            check(info.get("size") == size and info.get("compressed") == len(body),
+                  "%s: reply %s" % (what, info))
+            status, got = download(args.host, args.port, args.path)
+            check(status == 200 and got == data, "%s: download %d, %d B" % (what, status, len(got)))
+
+    data = gcode(100000, 7)
+    body = bytearray(gzip_c(data))
+    body[-8] ^= 0x01
+    delete(args.host, args.port, args.path)
+    status, reply = upload(args.host, args.port, args.path, bytes(body), False)
+    check(status == 400 and b"BAD_GZIP" in reply, "bad CRC: %d %s" % (status, reply[:200]))
+    status, _ = download(args.host, args.port, args.path)
+    check(status == 404, "bad CRC leaves no file: download %d" % status)
+
+    delete(args.host, args.port, args.path)
+    print("%d failure(s)" % failures)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,12 @@
+/* Host shim for the tools/ host tests: heap_caps_* on top of malloc. */
+#pragma once
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT 0
+#define MALLOC_CAP_SPIRAM 0
+#define MALLOC_CAP_INTERNAL 0
+#define MALLOC_CAP_DMA 0
+
+#define heap_caps_malloc(size, caps) malloc(size)
+#define heap_caps_calloc(n, size, caps) calloc((n), (size))
+#define heap_caps_free(p) free(p)
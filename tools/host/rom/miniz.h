@@ -0,0 +1,8 @@
+/* Host shim for the tools/ host tests: the ROM holds miniz 1.15, so build against
+ * the same release's single-file miniz.c (github.com/richgel999/miniz,
+ * tag v115_r4). On a 64-bit host its bit buffer is 64-bit, which only makes
+ * the inflater's look-ahead longer than on the chip. */
+#pragma once
+#define MINIZ_HEADER_FILE_ONLY
+#include "miniz.c"
+#undef MINIZ_HEADER_FILE_ONLY
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Packs main/ui/index.html into the gzip blob the firmware serves at /.
+
+Minification is deliberately simple and safe for this page:
+- whole-line comment blocks (/* ... */ in CSS/JS, <!-- ... --> in markup)
+  are dropped;
+- lines are stripped;
+- lines are joined without a separator at tag boundaries and with a
+  newline elsewhere, so JS never depends on the join for statement ends.
+
+The gzip header carries no name or timestamp, so the output (and the ETag
+the firmware derives from it) only changes when the page does.
+
+    python3 tools/pack_ui.py main/ui/index.html build/index.html.gz
+"""
+
+import gzip
+import sys
+
+
+def minify(text):
+    out = []
+    closing = None
+    for raw in text.splitlines():
+        line = raw.strip()
+        if closing:
+            if line.endswith(closing):
+                closing = None
+            continue
+        if line.startswith("/*") or line.startswith("<!--"):
+            end = "*/" if line.startswith("/*") else "-->"
+            if not line.endswith(end):
+                closing = end
+            continue
+        if not line:
+            continue
+        if out and not (out[-1].endswith(">") or line.startswith("<")):
+            out.append("\n")
+        out.append(line)
+    return "".join(out)
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip().splitlines()[-1].strip(), file=sys.stderr)
+        return 2
+    with open(sys.argv[1], encoding="utf-8") as f:
+        html = minify(f.read()).encode("utf-8")
+    blob = gzip.compress(html, compresslevel=9, mtime=0)
+    with open(sys.argv[2], "wb") as f:
+        f.write(blob)
+    print("ui: %d bytes -> %d gzip" % (len(html), len(blob)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Measures /api/status latency while the device is busy with a bulk transfer.
+
+Phases: idle baseline, a raw upload of --size MB, a download of the same
+file. During each phase the status endpoint is polled every --interval
+seconds over one keep-alive connection and p50/p90/p99/max are reported.
+
+    python3 tools/status_loadtest.py --host wimill.local --size 50
+"""
+
+import argparse
+import http.client
+import json
+import os
+import sys
+import threading
+import time
+import urllib.parse
+
+CHUNK = 64 * 1024
+
+
+def percentile(sorted_ms, p):
+    if not sorted_ms:
+        return float("nan")
+    k = max(0, min(len(sorted_ms) - 1, int(round(p / 100.0 * len(sorted_ms) + 0.5)) - 1))
+    return sorted_ms[k]
+
+
+class StatusPoller:
+    def __init__(self, host, port, interval):
+        self.host = host
+        self.port = port
+        self.interval = interval
+        self.conn = None
+
+    def _get(self):
+        if self.conn is None:
+            self.conn = http.client.HTTPConnection(self.host, self.port, timeout=15)
+        self.conn.request("GET", "/api/status")
+        resp = self.conn.getresponse()
+        body = resp.read()
+        if resp.status != 200:
+            raise RuntimeError("status %d" % resp.status)
+        json.loads(body)
+
+    def run(self, stop):
+        """Polls until stop() is true; returns (latencies_ms, errors)."""
+        lat = []
+        errors = 0
+        while not stop():
+            t0 = time.perf_counter()
+            try:
+                self._get()
+                lat.append((time.perf_counter() - t0) * 1000.0)
+            except Exception:
+                errors += 1
+                if self.conn is not None:
+                    self.conn.close()
+                self.conn = None
+            left = self.interval - (time.perf_counter() - t0)
+            if left > 0:
+                time.sleep(left)
+        return lat, errors
+
+
+class Transfer(threading.Thread):
+    def __init__(self, host, port, kind, path, size):
+        super().__init__(daemon=True)
+        self.host = host
+        self.port = port
+        self.kind = kind
+        self.path = path
+        self.size = size
+        self.bytes = 0
+        self.seconds = 0.0
+        self.error = None
+
+    def _upload(self, conn):
+        folder, name = self.path.rsplit("/", 1)
+        query = urllib.parse.urlencode({"path": folder or "/", "name": name, "overwrite": "1"})
+        conn.putrequest("POST", "/api/fs/upload_raw?" + query)
+        conn.putheader("Content-Type", "application/octet-stream")
+        conn.putheader("Content-Length", str(self.size))
+        conn.endheaders()
+        block = os.urandom(CHUNK)
+        remaining = self.size
+        while remaining > 0:
+            n = min(CHUNK, remaining)
+            conn.send(block[:n])
+            remaining -= n
+            self.bytes += n
+        resp = conn.getresponse()
+        body = resp.read()
+        if resp.status != 200:
+            raise RuntimeError("upload: %d %s" % (resp.status, body[:200]))
+
+    def _download(self, conn):
+        conn.request("GET", "/api/fs/download?" + urllib.parse.urlencode({"path": self.path}))
+        resp = conn.getresponse()
+        if resp.status != 200:
+            raise RuntimeError("download: %d %s" % (resp.status, resp.read()[:200]))
+        while True:
+            data = resp.read(CHUNK)
+            if not data:
+                break
+            self.bytes += len(data)
+
+    def run(self):
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=60)
+        t0 = time.perf_counter()
+        try:
+            if self.kind == "upload":
+                self._upload(conn)
+            else:
+                self._download(conn)
+        except Exception as e:  # reported by the caller
+            self.error = e
+        finally:
+            self.seconds = time.perf_counter() - t0
+            conn.close()
+
+
+def report(name, lat, errors, transfer=None):
+    lat.sort()
+    line = "%-9s n=%-5d err=%-3d p50=%7.1f p90=%7.1f p99=%7.1f max=%7.1f ms" % (
+        name, len(lat), errors, percentile(lat, 50), percentile(lat, 90), percentile(lat, 99),
+        lat[-1] if lat else float("nan"))
+    if transfer is not None:
+        mbps = transfer.bytes / 1048576.0 / transfer.seconds if transfer.seconds > 0 else 0.0
+        line += "  %s %.1f MB in %.1f s (%.2f MB/s)" % (
+            transfer.kind, transfer.bytes / 1048576.0, transfer.seconds, mbps)
+        if transfer.error:
+            line += "  FAILED: %s" % transfer.error
+    print(line)
+    return percentile(lat, 99)
+
+
+def delete(host, port, path):
+    conn = http.client.HTTPConnection(host, port, timeout=15)
+    conn.request("POST", "/api/fs/delete", body=json.dumps({"path": path}),
+                 headers={"Content-Type": "application/json"})
+    conn.getresponse().read()
+    conn.close()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--host", default="wimill.local")
+    ap.add_argument("--port", type=int, default=80)
+    ap.add_argument("--size", type=int, default=50, help="transfer size in MB (default 50)")
+    ap.add_argument("--interval", type=float, default=0.1, help="status poll interval in s")
+    ap.add_argument("--idle", type=float, default=5.0, help="baseline duration in s")
+    ap.add_argument("--path", default="/loadtest.bin")
+    ap.add_argument("--keep", action="store_true", help="keep the test file on the card")
+    ap.add_argument("--max-p99", type=float, help="exit 1 if a loaded phase exceeds this p99 (ms)")
+    args = ap.parse_args()
+
+    poller = StatusPoller(args.host, args.port, args.interval)
+    t_end = time.perf_counter() + args.idle
+    lat, err = poller.run(lambda: time.perf_counter() >= t_end)
+    report("idle", lat, err)
+
+    worst = 0.0
+    failed = False
+    for kind in ("upload", "download"):
+        tr = Transfer(args.host, args.port, kind, args.path, args.size * 1048576)
+        tr.start()
+        lat, err = poller.run(lambda: not tr.is_alive())
+        tr.join()
+        worst = max(worst, report(kind, lat, err, tr))
+        failed = failed or tr.error is not None
+        if tr.error:
+            break
+
+    if not args.keep:
+        delete(args.host, args.port, args.path)
+    if failed:
+        return 2
+    if args.max_p99 is not None and worst > args.max_p99:
+        print("p99 %.1f ms exceeds %.1f ms" % (worst, args.max_p99))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,436 @@
+/*
+ * Reference client for the E-WiMill raw-TCP bulk server (main/bulk_server.c).
+ *
+ *   cc -O2 -o wimill_bulk tools/wimill_bulk.c
+ *
+ *   wimill_bulk put   HOST[:PORT] LOCAL /dir/name [-f]   upload (-f: overwrite)
+ *   wimill_bulk get   HOST[:PORT] /dir/name LOCAL        download
+ *   wimill_bulk bench HOST[:PORT] [MB] [HTTP_PORT]       bulk vs upload_raw
+ *
+ * PORT defaults to 8081 (web port + 1, TXT "bulk" on the _http._tcp mDNS
+ * service). bench uploads the same MB of data (default 32) once over the
+ * bulk port and once with POST /api/fs/upload_raw on HTTP_PORT (default
+ * PORT - 1), downloads it back over the bulk port and deletes the file.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BULK_MAGIC 0x31424D57u
+#define BULK_OP_PUT 1
+#define BULK_OP_GET 2
+#define BULK_FLAG_OVERWRITE 0x01
+#define BULK_REQ_LEN 24
+#define BULK_RESP_LEN 48
+#define DEFAULT_PORT 8081
+#define IO_CHUNK (256 * 1024)
+#define BENCH_PATH "/.wimill_bench.bin"
+
+typedef struct {
+    unsigned status;
+    uint64_t size;
+    uint8_t sha[32];
+    char err[64];
+} bulk_resp_t;
+
+static void put_le(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+    for (int i = n - 1; i >= 0; --i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int dial(const char *host, int port)
+{
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res = NULL;
+    int rc = getaddrinfo(host, service, &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(rc));
+        return -1;
+    }
+    int sock = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+        int buf = 1 << 20;
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0) {
+        fprintf(stderr, "%s:%d: %s\n", host, port, strerror(errno));
+    }
+    return sock;
+}
+
+static int send_all(int sock, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int recv_all(int sock, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int send_request(int sock, int op, int flags, const char *path, uint64_t size, uint64_t mtime_ms)
+{
+    size_t path_len = strlen(path);
+    if (path_len == 0 || path_len > 255) {
+        fprintf(stderr, "bad remote path\n");
+        return -1;
+    }
+    uint8_t hdr[BULK_REQ_LEN];
+    put_le(hdr, BULK_MAGIC, 4);
+    hdr[4] = (uint8_t)op;
+    hdr[5] = (uint8_t)flags;
+    put_le(hdr + 6, path_len, 2);
+    put_le(hdr + 8, size, 8);
+    put_le(hdr + 16, mtime_ms, 8);
+    return send_all(sock, hdr, sizeof(hdr)) == 0 && send_all(sock, path, path_len) == 0 ? 0 : -1;
+}
+
+static int read_response(int sock, bulk_resp_t *r)
+{
+    uint8_t hdr[BULK_RESP_LEN];
+    if (recv_all(sock, hdr, sizeof(hdr)) != 0 || get_le(hdr, 4) != BULK_MAGIC) {
+        fprintf(stderr, "connection lost\n");
+        return -1;
+    }
+    r->status = (unsigned)get_le(hdr + 4, 2);
+    size_t err_len = (size_t)get_le(hdr + 6, 2);
+    r->size = get_le(hdr + 8, 8);
+    memcpy(r->sha, hdr + 16, 32);
+    r->err[0] = '\0';
+    while (err_len > 0) {
+        char tmp[64];
+        size_t n = err_len < sizeof(tmp) ? err_len : sizeof(tmp);
+        if (recv_all(sock, tmp, n) != 0) {
+            return -1;
+        }
+        if (r->err[0] == '\0') {
+            size_t k = n < sizeof(r->err) - 1 ? n : sizeof(r->err) - 1;
+            memcpy(r->err, tmp, k);
+            r->err[k] = '\0';
+        }
+        err_len -= n;
+    }
+    return 0;
+}
+
+// Payload from a file, or `size` bytes of generated data when fp is NULL.
+static int bulk_put(int sock, const char *remote, FILE *fp, uint64_t size, uint64_t mtime_ms, int overwrite,
+                    uint8_t sha[32])
+{
+    bulk_resp_t r;
+    if (send_request(sock, BULK_OP_PUT, overwrite ? BULK_FLAG_OVERWRITE : 0, remote, size, mtime_ms) != 0 ||
+        read_response(sock, &r) != 0) {
+        return -1;
+    }
+    if (r.status != 100) {
+        fprintf(stderr, "put %s: %u %s\n", remote, r.status, r.err);
+        return -1;
+    }
+    uint8_t *buf = malloc(IO_CHUNK);
+    if (!buf) {
+        return -1;
+    }
+    for (size_t i = 0; i < IO_CHUNK; ++i) {
+        buf[i] = (uint8_t)(i * 2654435761u >> 13);
+    }
+    uint64_t left = size;
+    int rc = 0;
+    while (left > 0 && rc == 0) {
+        size_t n = left < IO_CHUNK ? (size_t)left : IO_CHUNK;
+        if (fp && fread(buf, 1, n, fp) != n) {
+            fprintf(stderr, "short read\n");
+            rc = -1;
+            break;
+        }
+        rc = send_all(sock, buf, n);
+        left -= n;
+    }
+    free(buf);
+    if (rc != 0 || read_response(sock, &r) != 0) {
+        return -1;
+    }
+    if (r.status != 200) {
+        fprintf(stderr, "put %s: %u %s\n", remote, r.status, r.err);
+        return -1;
+    }
+    memcpy(sha, r.sha, 32);
+    return 0;
+}
+
+// Writes to fp, or discards the data when fp is NULL.
+static int bulk_get(int sock, const char *remote, FILE *fp, uint64_t *size)
+{
+    bulk_resp_t r;
+    if (send_request(sock, BULK_OP_GET, 0, remote, 0, 0) != 0 || read_response(sock, &r) != 0) {
+        return -1;
+    }
+    if (r.status != 200) {
+        fprintf(stderr, "get %s: %u %s\n", remote, r.status, r.err);
+        return -1;
+    }
+    uint8_t *buf = malloc(IO_CHUNK);
+    if (!buf) {
+        return -1;
+    }
+    uint64_t left = r.size;
+    int rc = 0;
+    while (left > 0) {
+        ssize_t n = recv(sock, buf, left < IO_CHUNK ? (size_t)left : IO_CHUNK, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || (fp && fwrite(buf, 1, (size_t)n, fp) != (size_t)n)) {
+            fprintf(stderr, "get %s: transfer cut short\n", remote);
+            rc = -1;
+            break;
+        }
+        left -= (uint64_t)n;
+    }
+    free(buf);
+    *size = r.size - left;
+    return rc;
+}
+
+// POST /api/fs/upload_raw with the same generated payload, for comparison.
+static int http_upload_raw(const char *host, int port, const char *remote, uint64_t size)
+{
+    const char *slash = strrchr(remote, '/');
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%.*s", slash == remote ? 1 : (int)(slash - remote), remote);
+    int sock = dial(host, port);
+    if (sock < 0) {
+        return -1;
+    }
+    char hdr[512];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "POST /api/fs/upload_raw?path=%s&name=%s&overwrite=1 HTTP/1.1\r\n"
+                     "Host: %s\r\nContent-Type: application/octet-stream\r\n"
+                     "Content-Length: %llu\r\nConnection: close\r\n\r\n",
+                     dir, slash + 1, host, (unsigned long long)size);
+    uint8_t *buf = malloc(IO_CHUNK);
+    int rc = buf && send_all(sock, hdr, (size_t)n) == 0 ? 0 : -1;
+    if (buf) {
+        for (size_t i = 0; i < IO_CHUNK; ++i) {
+            buf[i] = (uint8_t)(i * 2654435761u >> 13);
+        }
+    }
+    for (uint64_t left = size; rc == 0 && left > 0;) {
+        size_t k = left < IO_CHUNK ? (size_t)left : IO_CHUNK;
+        rc = send_all(sock, buf, k);
+        left -= k;
+    }
+    char resp[256] = {0};
+    if (rc == 0 && recv(sock, resp, sizeof(resp) - 1, 0) > 0 && strncmp(resp + 9, "200", 3) != 0) {
+        fprintf(stderr, "upload_raw: %.*s\n", (int)strcspn(resp, "\r\n"), resp);
+        rc = -1;
+    }
+    free(buf);
+    close(sock);
+    return rc;
+}
+
+static void http_delete(const char *host, int port, const char *remote)
+{
+    int sock = dial(host, port);
+    if (sock < 0) {
+        return;
+    }
+    char body[300];
+    int body_len = snprintf(body, sizeof(body), "{\"path\":\"%s\"}", remote);
+    char req[512];
+    int n = snprintf(req, sizeof(req),
+                     "POST /api/fs/delete HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                     "Content-Length: %d\r\nConnection: close\r\n\r\n%s",
+                     host, body_len, body);
+    char resp[128];
+    if (send_all(sock, req, (size_t)n) == 0) {
+        (void)!recv(sock, resp, sizeof(resp), 0);
+    }
+    close(sock);
+}
+
+static void print_sha(const uint8_t sha[32])
+{
+    for (int i = 0; i < 32; ++i) {
+        printf("%02x", sha[i]);
+    }
+}
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: wimill_bulk put HOST[:PORT] LOCAL /dir/name [-f]\n"
+                    "       wimill_bulk get HOST[:PORT] /dir/name LOCAL\n"
+                    "       wimill_bulk bench HOST[:PORT] [MB] [HTTP_PORT]\n");
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        return usage();
+    }
+    char host[256];
+    snprintf(host, sizeof(host), "%s", argv[2]);
+    int port = DEFAULT_PORT;
+    char *colon = strrchr(host, ':');
+    if (colon && !strchr(colon + 1, ']')) {
+        *colon = '\0';
+        port = atoi(colon + 1);
+    }
+
+    if (strcmp(argv[1], "put") == 0 && argc >= 5) {
+        FILE *fp = fopen(argv[3], "rb");
+        struct stat st;
+        if (!fp || fstat(fileno(fp), &st) != 0) {
+            perror(argv[3]);
+            return 1;
+        }
+        int sock = dial(host, port);
+        if (sock < 0) {
+            return 1;
+        }
+        uint8_t sha[32];
+        double t0 = now_s();
+        int rc = bulk_put(sock, argv[4], fp, (uint64_t)st.st_size, (uint64_t)st.st_mtime * 1000ULL,
+                          argc >= 6 && strcmp(argv[5], "-f") == 0, sha);
+        double dt = now_s() - t0;
+        close(sock);
+        fclose(fp);
+        if (rc != 0) {
+            return 1;
+        }
+        printf("%s: %lld bytes in %.2f s (%.2f MB/s) sha256 ", argv[4], (long long)st.st_size, dt,
+               (double)st.st_size / dt / 1e6);
+        print_sha(sha);
+        printf("\n");
+        return 0;
+    }
+    if (strcmp(argv[1], "get") == 0 && argc >= 5) {
+        FILE *fp = fopen(argv[4], "wb");
+        if (!fp) {
+            perror(argv[4]);
+            return 1;
+        }
+        int sock = dial(host, port);
+        if (sock < 0) {
+            return 1;
+        }
+        uint64_t size = 0;
+        double t0 = now_s();
+        int rc = bulk_get(sock, argv[3], fp, &size);
+        double dt = now_s() - t0;
+        close(sock);
+        if (fclose(fp) != 0 || rc != 0) {
+            return 1;
+        }
+        printf("%s: %llu bytes in %.2f s (%.2f MB/s)\n", argv[3], (unsigned long long)size, dt,
+               (double)size / dt / 1e6);
+        return 0;
+    }
+    if (strcmp(argv[1], "bench") == 0) {
+        uint64_t size = (uint64_t)(argc >= 4 ? atoi(argv[3]) : 32) * 1024 * 1024;
+        int http_port = argc >= 5 ? atoi(argv[4]) : port - 1;
+        if (size == 0) {
+            return usage();
+        }
+        double t0 = now_s();
+        if (http_upload_raw(host, http_port, BENCH_PATH, size) != 0) {
+            return 1;
+        }
+        double http_s = now_s() - t0;
+
+        int sock = dial(host, port);
+        if (sock < 0) {
+            return 1;
+        }
+        uint8_t sha[32];
+        t0 = now_s();
+        int rc = bulk_put(sock, BENCH_PATH, NULL, size, 0, 1, sha);
+        double put_s = now_s() - t0;
+        uint64_t got = 0;
+        t0 = now_s();
+        rc = rc == 0 ? bulk_get(sock, BENCH_PATH, NULL, &got) : rc;
+        double get_s = now_s() - t0;
+        close(sock);
+        http_delete(host, http_port, BENCH_PATH);
+        if (rc != 0) {
+            return 1;
+        }
+        double mb = (double)size / 1e6;
+        printf("%.1f MB\n", mb);
+        printf("  http upload_raw  %6.2f s  %6.2f MB/s\n", http_s, mb / http_s);
+        printf("  bulk put         %6.2f s  %6.2f MB/s  (%+.0f%%)\n", put_s, mb / put_s,
+               100.0 * (http_s / put_s - 1.0));
+        printf("  bulk get         %6.2f s  %6.2f MB/s\n", get_s, (double)got / 1e6 / get_s);
+        return 0;
+    }
+    return usage();
+}